@@ -0,0 +1,86 @@
+#define _GNU_SOURCE // for MAP_ANONYMOUS, MAP_NORESERVE
+
+#include "arena.h"
+
+#include "assert.h"
+#include "types.h"
+#include "util.h"
+
+#include <errno.h>
+#include <sys/mman.h>
+
+
+#define ARENA_ALIGN 64
+
+
+void
+arena_create(MemoryArena *arena, size_t reserve)
+{
+    size_t reserved = alignull_up2(reserve, ARENA_COMMIT_SIZE);
+    char *base = mmap(nullptr, reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (MAP_FAILED == base)
+    {
+        errno_exit("arena_create:mmap");
+    }
+
+    arena->base = base;
+    arena->reserved = reserved;
+    arena->committed = 0;
+    arena->used = 0;
+    arena->peak = 0;
+}
+
+
+void *
+arena_push(MemoryArena *arena, size_t size)
+{
+    size_t start = alignull_up2(arena->used, ARENA_ALIGN);
+    if ((start > arena->reserved) || (size > arena->reserved - start))
+    {
+        errno = ENOMEM;
+        errno_exit("arena_push");
+    }
+
+    size_t end = start + size;
+    if (end > arena->committed)
+    {
+        size_t committed = minull(alignull_up2(end, ARENA_COMMIT_SIZE), arena->reserved);
+        if (mprotect(arena->base + arena->committed, committed - arena->committed, PROT_READ | PROT_WRITE) == -1)
+        {
+            errno_exit("arena_push:mprotect");
+        }
+        arena->committed = committed;
+    }
+
+    arena->used = end;
+    if (end > arena->peak)
+    {
+        arena->peak = end;
+    }
+
+    void *result = arena->base + start;
+    return result;
+}
+
+
+void
+arena_pop_to(MemoryArena *arena, size_t mark)
+{
+    ASSERT(mark <= arena->used);
+    arena->used = mark;
+}
+
+
+void
+arena_reset(MemoryArena *arena)
+{
+    arena->used = 0;
+}
+
+
+void
+arena_destroy(MemoryArena *arena)
+{
+    munmap(arena->base, arena->reserved);
+    *arena = (MemoryArena){ 0 };
+}
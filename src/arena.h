@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+
+
+// Address space is committed this much at a time as an arena grows into it
+#define ARENA_COMMIT_SIZE (64 * 1024)
+
+
+// Address space reserved up front and handed out front to back. It's committed
+// a piece at a time the first time it's used and stays committed when the arena
+// is reset, so memory that is used over and over, like the screen's grid or
+// whatever a frame needs while it's drawn, costs nothing after the first time.
+// Nothing is freed on its own: the whole arena is reset at once, or back to
+// where it was when its used size was looked at.
+typedef struct MemoryArena
+{
+    char *base;
+    size_t reserved;
+    size_t committed;
+    size_t used;
+
+    // The most that was ever in use at once
+    size_t peak;
+} MemoryArena;
+
+
+void arena_create(MemoryArena *arena, size_t reserve);
+
+// Aligned to a cache line. Not zeroed.
+void *arena_push(MemoryArena *arena, size_t size);
+
+// Drops everything pushed since the arena's used size was mark
+void arena_pop_to(MemoryArena *arena, size_t mark);
+
+void arena_reset(MemoryArena *arena);
+
+// Gives back the address space along with everything committed in it
+void arena_destroy(MemoryArena *arena);
@@ -0,0 +1,774 @@
+#define _GNU_SOURCE
+
+#include "data_buffer.h"
+#include "headless.h"
+#include "io_ring.h"
+#include "parser.h"
+#include "pty.h"
+#include "pty_reader.h"
+#include "scan.h"
+#include "screen.h"
+#include "scrollback.h"
+#include "streams.h"
+#include "types.h"
+#include "utf8.h"
+#include "util.h"
+#include "xlib.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h> // getrusage
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <termios.h> // cfmakeraw, tcgetattr, tcsetattr
+#include <unistd.h>
+
+
+#define DEFAULT_MEGABYTES 64
+
+// The size of the window nullrefterm opens by default
+#define BENCH_COLS 80
+#define BENCH_ROWS 25
+
+// How many random pages of scrollback to look at after each stream
+#define BENCH_PAGE_VIEWS 10000
+
+// How many times to resize the screen after each stream
+#define BENCH_RESIZES 1000
+
+
+typedef struct BenchOptions
+{
+    // Draw to a real window instead of only counting
+    XlibConnection *x_connection;
+
+    // Without a window, rasterize into memory the way the MIT-SHM renderer
+    // does instead of only counting
+    HeadlessRenderer *headless;
+
+    // Read the pty on a separate thread the way nullrefterm -t does
+    int reader_thread;
+
+    // Drain a non-blocking pty on every edge-triggered wakeup the way
+    // nullrefterm does without -t, instead of one blocking read a frame
+    int edge_triggered;
+
+    // Read the pty through an io_uring the way nullrefterm -u does, with one
+    // read in flight that's queued and waited for in a single system call
+    IoRing *ring;
+    char *registered_base;
+
+    // Extra time each frame takes, to see how a slow renderer holds up the
+    // writer
+    unsigned frame_delay_us;
+} BenchOptions;
+
+
+typedef struct BenchResult
+{
+    size_t bytes;
+    size_t reads;
+    size_t frames;
+    size_t cells_drawn;
+
+    // On the reading side, not counting the reader thread's own
+    size_t wakeups;
+    size_t syscalls;
+
+    size_t requests;
+
+    uint64_t total_ns;
+    uint64_t read_ns;
+    uint64_t parse_ns;
+    uint64_t draw_ns;
+
+    size_t scrollback_lines;
+    uint64_t page_view_ns;
+    uint64_t resize_ns;
+} BenchResult;
+
+
+// Walks the damaged cells exactly the way draw_buffer does, but only counts the
+// characters it would have drawn and the requests it would have made instead of
+// talking to the X server
+static size_t
+null_draw(TerminalScreen *screen, size_t *requests)
+{
+    // Drawing the cursor
+    size_t request_count = 1;
+    size_t cells_drawn = 0;
+    for (unsigned y = 0; y < screen->rows; ++y)
+    {
+        ScreenDamage *damage = screen->damage + y;
+        if (damage->first >= damage->end)
+        {
+            continue;
+        }
+
+        // Clearing the span
+        ++request_count;
+
+        ScreenCell *row = screen_row(screen, y);
+        for (unsigned x = damage->first; x < damage->end; )
+        {
+            unsigned count = CAST(unsigned, screen_run_length(row + x, damage->end - x));
+
+            ScreenAttribute *attribute = screen->attributes + row[x].attribute;
+            uint32_t foreground, background;
+            screen_resolve_colors(attribute, &foreground, &background);
+            if (background != DEFAULT_BACKGROUND_RGB)
+            {
+                ++request_count;
+            }
+
+            size_t glyphs = 0;
+            for (unsigned i = 0; i < count; ++i)
+            {
+                if (row[x + i].codepoint != ' ')
+                {
+                    ++glyphs;
+                }
+            }
+            if (glyphs && (foreground != background))
+            {
+                ++request_count;
+            }
+            if (attribute->style & STYLE_UNDERLINE)
+            {
+                ++request_count;
+            }
+            if (attribute->style & STYLE_STRIKETHROUGH)
+            {
+                ++request_count;
+            }
+
+            cells_drawn += glyphs;
+            x += count;
+        }
+    }
+    screen_clear_damage(screen);
+
+    *requests += request_count;
+    return cells_drawn;
+}
+
+
+// Jumps to random places in the scrollback and reads a screenful of it, the
+// way draw_buffer does when the view is scrolled back. Returns the time taken.
+static uint64_t
+view_random_pages(TerminalScreen *screen, size_t *checksum)
+{
+    size_t line_count = scrollback_line_count(screen->scrollback);
+    uint32_t random = 12345;
+
+    uint64_t start = now_ns();
+    for (unsigned i = 0; i < BENCH_PAGE_VIEWS; ++i)
+    {
+        random = random * 1103515245 + 12345;
+        screen_view_line(screen, line_count ? (random >> 8) % line_count : 0);
+        screen_scroll_view_up(screen, screen->rows);
+        for (unsigned y = 0; y < screen->rows; ++y)
+        {
+            unsigned count;
+            ScreenAttribute *attributes;
+            ScreenCell *row = screen_view_row(screen, y, &count, &attributes);
+            for (unsigned x = 0; x < count; ++x)
+            {
+                *checksum += row[x].codepoint + attributes[row[x].attribute].style;
+            }
+        }
+        screen_clear_damage(screen);
+    }
+    uint64_t result = now_ns() - start;
+
+    screen_view_bottom(screen);
+    return result;
+}
+
+
+// Drags the window back and forth between two sizes. Returns the time taken.
+static uint64_t
+resize_repeatedly(TerminalScreen *screen)
+{
+    uint64_t start = now_ns();
+    for (unsigned i = 0; i < BENCH_RESIZES; ++i)
+    {
+        if (i & 1)
+        {
+            screen_resize(screen, BENCH_COLS, BENCH_ROWS);
+        }
+        else
+        {
+            screen_resize(screen, BENCH_COLS + 1 + i % 40, BENCH_ROWS + 1 + i % 10);
+        }
+    }
+    uint64_t result = now_ns() - start;
+
+    return result;
+}
+
+
+// Draws into a framebuffer in memory, which costs what the MIT-SHM renderer
+// costs short of the one request a frame it would send
+static size_t
+raster_draw(HeadlessRenderer *headless, TerminalScreen *screen, size_t *requests)
+{
+    GlyphAtlas *atlas = &headless->atlas;
+    size_t first_lookup = atlas->hits + atlas->misses;
+
+    RasterRect moved;
+    raster_scroll(&headless->framebuffer, atlas, screen, &headless->cursor, 0, &moved);
+
+    RasterRect changed;
+    raster_draw_buffer(&headless->framebuffer, atlas, screen, &headless->cursor, &changed);
+    if (changed.width || moved.width)
+    {
+        ++*requests;
+    }
+
+    size_t result = atlas->hits + atlas->misses - first_lookup;
+    return result;
+}
+
+
+// Draws to a real window, counting the requests that were actually sent
+static void
+x_draw(XlibConnection *x_connection, TerminalScreen *screen, size_t *requests)
+{
+    // Frames are dropped while the server is still copying the last one, the
+    // same as in the terminal
+    XEvent event;
+    while ((x_connection->renderer == XLIB_RENDER_SHM)
+        && XCheckTypedEvent(x_connection->display, x_connection->shm_completion, &event))
+    {
+        xlib_shm_completed(x_connection, screen, &event);
+    }
+
+    unsigned long first_request = NextRequest(x_connection->display);
+    draw_buffer(x_connection, screen);
+    *requests += NextRequest(x_connection->display) - first_request;
+    XFlush(x_connection->display);
+}
+
+
+// The buffer is registered again whenever it grew into a new ring
+static void
+ring_register(BenchOptions *options, RawDataBuffer *data)
+{
+    if (options->registered_base != data->base)
+    {
+        struct iovec iovec = { .iov_base = data->base, .iov_len = 2 * data->size };
+        io_ring_register_buffers(options->ring, &iovec, 1);
+        options->registered_base = data->base;
+    }
+}
+
+
+static int
+ring_read(BenchOptions *options, int pty_fd, RawDataBuffer *data, BenchResult *result)
+{
+    IoRing *ring = options->ring;
+    ring_register(options, data);
+
+    size_t space;
+    char *write = data_buffer_reserve(data, &space);
+    io_ring_read(ring, pty_fd, write, CAST(unsigned, minull(space, TYPE_MAX(unsigned))),
+        ring->buffers_registered ? 0 : -1, 0);
+
+    struct io_uring_cqe *cqe;
+    do
+    {
+        io_ring_enter(ring, 1);
+        ++result->syscalls;
+        ++result->wakeups;
+    } while (!(cqe = io_ring_cqe(ring)));
+
+    int bytes_read = cqe->res;
+    io_ring_seen(ring);
+    if (bytes_read > 0)
+    {
+        ++result->reads;
+        data_buffer_commit(data, CAST(size_t, bytes_read));
+        data_buffer_filled(data);
+    }
+
+    return bytes_read;
+}
+
+
+// Writes the stream into the child side of a raw pty from a separate process
+// while this process reads it back with the same read/parse/draw sequence the
+// terminal uses for every pty read
+static BenchResult
+bench_stream(
+    const char *stream, size_t size,
+    RawDataBuffer *data, Parser *parser, TerminalScreen *screen, BenchOptions *options)
+{
+    char pty_name[PATH_MAX];
+    int pty_fd = pty_open(pty_name, sizeof(pty_name));
+
+    // Open the child side here rather than in the writer so it is guaranteed
+    // to be open before the first read
+    int child_fd = open(pty_name, O_RDWR | O_NOCTTY);
+    if (child_fd == -1)
+    {
+        errno_exit("bench_stream: open");
+    }
+
+    struct termios attributes;
+    if (tcgetattr(child_fd, &attributes) == -1)
+    {
+        errno_exit("bench_stream: tcgetattr");
+    }
+    cfmakeraw(&attributes);
+    if (tcsetattr(child_fd, TCSANOW, &attributes) == -1)
+    {
+        errno_exit("bench_stream: tcsetattr");
+    }
+
+    struct winsize winsize = { .ws_row = BENCH_ROWS, .ws_col = BENCH_COLS };
+    if (ioctl(child_fd, TIOCSWINSZ, &winsize) == -1)
+    {
+        errno_exit("bench_stream: ioctl TIOCSWINSZ");
+    }
+
+    pid_t writer = fork();
+    if (writer == -1)
+    {
+        errno_exit("bench_stream: fork");
+    }
+    if (writer == 0)
+    {
+        close(pty_fd);
+        size_t written = 0;
+        while (written < size)
+        {
+            ssize_t result = write(child_fd, stream + written, size - written);
+            if (result < 0)
+            {
+                errno_exit("bench_stream: write");
+            }
+            written += CAST(size_t, result);
+        }
+        _exit(EXIT_SUCCESS);
+    }
+    close(child_fd);
+
+    data_buffer_reset(data);
+    parser_create(parser);
+    Scrollback *scrollback = screen->scrollback;
+    screen_create(screen, BENCH_COLS, BENCH_ROWS, nullptr);
+    scrollback_clear(scrollback);
+    screen->scrollback = scrollback;
+
+    PtyReader reader;
+    if (options->reader_thread)
+    {
+        pty_reader_start(&reader, pty_fd, data);
+    }
+
+    if (options->headless)
+    {
+        framebuffer_clear(&options->headless->framebuffer);
+        options->headless->cursor = (DrawnCursor){ 0 };
+    }
+
+    int epoll_fd = -1;
+    if (options->edge_triggered || options->ring)
+    {
+        int flags = fcntl(pty_fd, F_GETFL);
+        if ((flags == -1) || (fcntl(pty_fd, F_SETFL, flags | O_NONBLOCK) == -1))
+        {
+            errno_exit("bench_stream: fcntl");
+        }
+
+    }
+    if (options->edge_triggered)
+    {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        struct epoll_event event = { .events = EPOLLIN | EPOLLET, .data = {.fd = pty_fd} };
+        if ((epoll_fd == -1) || (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pty_fd, &event) == -1))
+        {
+            errno_exit("bench_stream: epoll");
+        }
+    }
+
+    BenchResult result = { 0 };
+
+    uint64_t start = now_ns();
+    int drained = 1;
+    while (data->consumed < size)
+    {
+        uint64_t read_start = now_ns();
+        if (options->reader_thread)
+        {
+            ++result.wakeups;
+            ++result.reads;
+            if (!pty_reader_wait(&reader) && (data->written == data->consumed))
+            {
+                break;
+            }
+        }
+        else if (options->edge_triggered)
+        {
+            // A pty that wasn't drained is read again right away, which is
+            // what waiting after asking epoll about it again comes down to
+            if (drained)
+            {
+                struct epoll_event event;
+                ++result.syscalls;
+                if (epoll_wait(epoll_fd, &event, 1, -1) == -1)
+                {
+                    errno_exit("bench_stream: epoll_wait");
+                }
+                ++result.wakeups;
+            }
+
+            PtyDrain drain = pty_drain(pty_fd, data);
+            result.reads += drain.reads;
+            result.syscalls += drain.syscalls;
+            drained = drain.drained;
+            if (drain.closed && !drain.bytes)
+            {
+                break;
+            }
+        }
+        else if (options->ring)
+        {
+            if (ring_read(options, pty_fd, data, &result) <= 0)
+            {
+                break;
+            }
+        }
+        else
+        {
+            ++result.wakeups;
+            ++result.reads;
+            ++result.syscalls;
+            if (pty_read(pty_fd, data) <= 0)
+            {
+                break;
+            }
+        }
+        uint64_t parse_start = now_ns();
+
+        parser_process(parser, screen, data);
+        parser->reply_size = 0;
+        if (options->reader_thread)
+        {
+            pty_reader_consumed(&reader);
+        }
+        uint64_t draw_start = now_ns();
+
+        if (options->x_connection)
+        {
+            x_draw(options->x_connection, screen, &result.requests);
+        }
+        else if (options->headless)
+        {
+            result.cells_drawn += raster_draw(options->headless, screen, &result.requests);
+        }
+        else
+        {
+            result.cells_drawn += null_draw(screen, &result.requests);
+        }
+        if (options->frame_delay_us)
+        {
+            usleep(options->frame_delay_us);
+        }
+        uint64_t draw_end = now_ns();
+
+        ++result.frames;
+        result.read_ns += parse_start - read_start;
+        result.parse_ns += draw_start - parse_start;
+        result.draw_ns += draw_end - draw_start;
+    }
+    result.total_ns = now_ns() - start;
+    result.bytes = data->consumed;
+
+    size_t checksum = 0;
+    result.scrollback_lines = scrollback_line_count(scrollback);
+    result.page_view_ns = view_random_pages(screen, &checksum) / BENCH_PAGE_VIEWS;
+    result.resize_ns = resize_repeatedly(screen) / BENCH_RESIZES;
+    result.cells_drawn += checksum & 1;
+
+    if (options->x_connection)
+    {
+        XSync(options->x_connection->display, False);
+    }
+    waitpid(writer, nullptr, 0);
+    if (options->reader_thread)
+    {
+        // The writer closed the child side, so the reader sees end of file
+        pty_reader_join(&reader);
+    }
+    close(pty_fd);
+    if (epoll_fd != -1)
+    {
+        close(epoll_fd);
+    }
+    screen_destroy(screen);
+
+    return result;
+}
+
+
+static void
+print_header(void)
+{
+    printf("%-16s %8s %9s %9s %9s %9s %9s %9s %9s %9s %10s %9s %9s %9s\n",
+        "stream", "MB", "MB/s", "read ns/B", "parse", "draw", "B/read", "sys/MB", "wake/MB", "req/frame",
+        "sb lines", "page ns", "resize ns", "peak RSS");
+}
+
+
+static void
+print_result(const char *name, BenchResult *result)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    double bytes = CAST(double, result->bytes);
+    double megabytes = bytes / (1024 * 1024);
+    double reads = result->reads ? CAST(double, result->reads) : 1;
+    double frames = result->frames ? CAST(double, result->frames) : 1;
+    printf("%-16s %8.1f %9.1f %9.3f %9.3f %9.3f %9.0f %9.0f %9.1f %9.1f %10zu %9.0f %9.0f %7.1fMB\n",
+        name,
+        megabytes,
+        megabytes / (CAST(double, result->total_ns) / 1e9),
+        CAST(double, result->read_ns) / bytes,
+        CAST(double, result->parse_ns) / bytes,
+        CAST(double, result->draw_ns) / bytes,
+        bytes / reads,
+        CAST(double, result->syscalls) / megabytes,
+        CAST(double, result->wakeups) / megabytes,
+        CAST(double, result->requests) / frames,
+        result->scrollback_lines,
+        CAST(double, result->page_view_ns),
+        CAST(double, result->resize_ns),
+        CAST(double, usage.ru_maxrss) / 1024);
+
+    if (result->bytes == 0)
+    {
+        printf("%-16s no data was read\n", name);
+    }
+}
+
+
+static char *
+map_file(const char *path, size_t *size)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        errno_exit(path);
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) == -1)
+    {
+        errno_exit(path);
+    }
+
+    char *result = nullptr;
+    *size = CAST(size_t, info.st_size);
+    if (*size)
+    {
+        result = mmap(nullptr, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (result == MAP_FAILED)
+        {
+            errno_exit(path);
+        }
+    }
+    close(fd);
+
+    return result;
+}
+
+
+static _Noreturn void
+usage(const char *program)
+{
+    fprintf(stderr, "usage: %s [-x] [-R xft|shm] [-t | -e | -u] [-d microseconds] [-s megabytes] [-m megabytes] [-f recorded-output]... [stream]...\n", program);
+    fprintf(stderr, "  -x  draw to an X window instead of only counting what would be drawn\n");
+    fprintf(stderr, "  -R  the renderer to draw with; shm without -x rasterizes into memory\n");
+    fprintf(stderr, "  -t  read the pty on a separate thread\n");
+    fprintf(stderr, "  -e  drain a non-blocking pty on every edge-triggered wakeup\n");
+    fprintf(stderr, "  -u  read the pty through an io_uring\n");
+    fprintf(stderr, "  -d  make every frame take this much longer\n");
+    fprintf(stderr, "  -s  scrollback memory (default %u)\n", SCROLLBACK_DEFAULT_MEGABYTES);
+    fprintf(stderr, "streams:");
+    for (StreamKind kind = 0; kind < STREAM_KIND_COUNT; ++kind)
+    {
+        fprintf(stderr, " %s", stream_names[kind]);
+    }
+    fputs("\n", stderr);
+    exit(EXIT_FAILURE);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    scan_init(SCAN_CONTROL_LEVEL);
+    utf8_init(SCAN_LEVEL_COUNT - 1);
+    raster_init(SCAN_LEVEL_COUNT - 1);
+    parser_init();
+
+    size_t megabytes = DEFAULT_MEGABYTES;
+    size_t scrollback_megabytes = SCROLLBACK_DEFAULT_MEGABYTES;
+    int selected[STREAM_KIND_COUNT] = { 0 };
+    int any_selected = 0;
+
+    const char *files[64];
+    size_t file_count = 0;
+
+    int use_x = 0;
+    XlibRenderer renderer = XLIB_RENDER_XFT;
+    BenchOptions options = { 0 };
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "-x"))
+        {
+            use_x = 1;
+        }
+        else if (!strcmp(argv[i], "-R") && (i + 1 < argc))
+        {
+            ++i;
+            if (!strcmp(argv[i], "xft"))
+            {
+                renderer = XLIB_RENDER_XFT;
+            }
+            else if (!strcmp(argv[i], "shm"))
+            {
+                renderer = XLIB_RENDER_SHM;
+            }
+            else
+            {
+                usage(argv[0]);
+            }
+        }
+        else if (!strcmp(argv[i], "-t"))
+        {
+            options.reader_thread = 1;
+        }
+        else if (!strcmp(argv[i], "-e"))
+        {
+            options.edge_triggered = 1;
+        }
+        else if (!strcmp(argv[i], "-u"))
+        {
+            static IoRing ring;
+            if (!io_ring_create(&ring, IO_RING_ENTRIES))
+            {
+                errno_exit("io_uring");
+            }
+            options.ring = &ring;
+        }
+        else if (!strcmp(argv[i], "-d") && (i + 1 < argc))
+        {
+            options.frame_delay_us = CAST(unsigned, strtoul(argv[++i], nullptr, 10));
+        }
+        else if (!strcmp(argv[i], "-s") && (i + 1 < argc))
+        {
+            scrollback_megabytes = strtoul(argv[++i], nullptr, 10);
+            if (!scrollback_megabytes)
+            {
+                usage(argv[0]);
+            }
+        }
+        else if (!strcmp(argv[i], "-m") && (i + 1 < argc))
+        {
+            megabytes = strtoul(argv[++i], nullptr, 10);
+            if (!megabytes)
+            {
+                usage(argv[0]);
+            }
+        }
+        else if (!strcmp(argv[i], "-f") && (i + 1 < argc) && (file_count < ARRAY_COUNT(files)))
+        {
+            files[file_count++] = argv[++i];
+            any_selected = 1;
+        }
+        else
+        {
+            StreamKind kind = 0;
+            while ((kind < STREAM_KIND_COUNT) && strcmp(argv[i], stream_names[kind]))
+            {
+                ++kind;
+            }
+            if (kind == STREAM_KIND_COUNT)
+            {
+                usage(argv[0]);
+            }
+            selected[kind] = any_selected = 1;
+        }
+    }
+
+    RawDataBuffer data;
+    data_buffer_create(&data, options.reader_thread ? PTY_READER_BUFFER_SIZE : DEFAULT_DATA_BUFFER_SIZE);
+    if (options.edge_triggered || options.ring)
+    {
+        data.max_size = DATA_BUFFER_GROW_LIMIT;
+    }
+
+    static Parser parser;
+    static TerminalScreen screen;
+    static Scrollback scrollback;
+    scrollback_create(&scrollback, scrollback_megabytes * 1024 * 1024);
+    screen.scrollback = &scrollback;
+
+    static XlibConnection x_storage;
+    static HeadlessRenderer headless;
+    if (use_x)
+    {
+        XlibConnection *x_connection = options.x_connection = &x_storage;
+        xlib_window_create(x_connection, renderer);
+        xlib_resize(x_connection, BENCH_COLS * x_connection->cell_width, BENCH_ROWS * x_connection->cell_height);
+        XSync(x_connection->display, False);
+    }
+    else if (renderer == XLIB_RENDER_SHM)
+    {
+        headless_create(&headless, "mono", BENCH_COLS, BENCH_ROWS);
+        options.headless = &headless;
+    }
+
+    print_header();
+
+    size_t size = megabytes * 1024 * 1024;
+    char *stream = malloc(size);
+    if (!stream)
+    {
+        errno_exit("malloc");
+    }
+    for (StreamKind kind = 0; kind < STREAM_KIND_COUNT; ++kind)
+    {
+        if (selected[kind] || !any_selected)
+        {
+            stream_generate(kind, stream, size);
+            BenchResult result = bench_stream(stream, size, &data, &parser, &screen, &options);
+            print_result(stream_names[kind], &result);
+        }
+    }
+    free(stream);
+
+    for (size_t i = 0; i < file_count; ++i)
+    {
+        size_t file_size;
+        char *file = map_file(files[i], &file_size);
+        BenchResult result = bench_stream(file, file_size, &data, &parser, &screen, &options);
+        print_result(files[i], &result);
+        if (file)
+        {
+            munmap(file, file_size);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
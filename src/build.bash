@@ -1,23 +1,54 @@
 #!/usr/bin/env bash
 
 # Set application-specific stuff here
-EXE_NAME=nullrefterm
-EXE_SOURCES=(main.c)
-EXE_LIBS=(x11 xft)
+TARGET=${1:-nullrefterm}
+case $TARGET in
+    nullrefterm)
+        EXE_NAME=nullrefterm
+        EXE_SOURCES=(main.c arena.c data_buffer.c frame_clock.c glyph_cache.c headless.c io_ring.c latency.c parser.c pty.c pty_reader.c pty_writer.c raster.c render_thread.c scan.c screen.c scrollback.c session.c shared_heap.c stats.c utf8.c util.c xlib.c)
+        EXE_LIBS=(x11 xft xext fontconfig freetype2)
+        ;;
+    bench)
+        EXE_NAME=bench
+        EXE_SOURCES=(bench.c arena.c data_buffer.c glyph_cache.c headless.c io_ring.c parser.c pty.c pty_reader.c raster.c scan.c screen.c scrollback.c shared_heap.c stats.c streams.c utf8.c util.c xlib.c)
+        EXE_LIBS=(x11 xft xext fontconfig freetype2)
+        BUILD_TYPE=release
+        ;;
+    scan_bench)
+        EXE_NAME=scan_bench
+        EXE_SOURCES=(scan_bench.c scan.c streams.c utf8.c)
+        EXE_LIBS=()
+        BUILD_TYPE=release
+        ;;
+    screen_test)
+        EXE_NAME=screen_test
+        EXE_SOURCES=(screen_test.c arena.c scan.c screen.c scrollback.c shared_heap.c utf8.c util.c)
+        EXE_LIBS=()
+        ;;
+    *)
+        echo "Unknown target: ${TARGET}"
+        exit 1
+        ;;
+esac
 
 # Things that could also be modified but are probably fine
 BUILD_DIR=../build/
 CC=clang
 C_VERSION=c17
 COMPILER_FLAGS+="-g "
-#COMPILER_FLAGS+="-O3 "
-COMPILER_FLAGS+="-DDEBUG "
+if [ "$BUILD_TYPE" == "release" ]
+then
+    COMPILER_FLAGS+="-O3 "
+else
+    COMPILER_FLAGS+="-DDEBUG "
+fi
 COMPILER_FLAGS+="-Wall -Wextra -Wpedantic "
 COMPILER_FLAGS+="-Wcast-qual "
 COMPILER_FLAGS+="-Wconversion "
 COMPILER_FLAGS+="-Wshadow "
 COMPILER_FLAGS+="-Wunused "
 COMPILER_FLAGS+="-Werror=vla "
+COMPILER_FLAGS+="-pthread "
 COMPILER_FLAGS+="-Wl,-z,defs "
 
 
@@ -38,13 +69,33 @@ pushd $BUILD_DIR > /dev/null
 START=$(date +"%s.%N")
 
 
+# The width table is generated once per build directory, or again when its
+# generator changes
+if [ ! -e width_table.h ] || [ "${SOURCE_DIR}width_gen.c" -nt width_table.h ]
+then
+    echo "Generating width_table.h..."
+    $CC -O2 ${SOURCE_DIR}width_gen.c -o width_gen -std=$C_VERSION || exit 1
+    ./width_gen > width_table.h.tmp && mv width_table.h.tmp width_table.h || exit 1
+fi
+
+
+# So is the terminfo entry the shell is started with, if there's a tic to
+# compile it with. Without one, programs see whatever else TERM names.
+if [ "$TARGET" == "nullrefterm" ] && command -v tic > /dev/null \
+    && { [ ! -e terminfo ] || [ "${SOURCE_DIR}nullrefterm.ti" -nt terminfo ]; }
+then
+    echo "Compiling terminfo..."
+    tic -x -o terminfo ${SOURCE_DIR}nullrefterm.ti && touch terminfo || exit 1
+fi
+
+
 echo "Building ${EXE_NAME}..."
 SOURCES=""
 for SOURCE in ${EXE_SOURCES[@]}
 do
     SOURCES+="${SOURCE_DIR}${SOURCE} "
 done
-$CC $COMPILER_FLAGS $SOURCES -o $EXE_NAME -std=$C_VERSION
+$CC $COMPILER_FLAGS -I. $SOURCES -o $EXE_NAME -std=$C_VERSION
 RESULT=$?
 
 
@@ -0,0 +1,218 @@
+#define _GNU_SOURCE // for memfd_create, MFD_HUGETLB, MADV_HUGEPAGE
+
+#include "data_buffer.h"
+
+#include "assert.h"
+#include "types.h"
+#include "util.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h> // memfd_create
+#include <unistd.h> // ftruncate
+
+
+// Maps a file of size bytes three times in a row. Huge pages have to be mapped
+// at a multiple of their size, and if there are none to be had nullptr is
+// returned.
+static char *
+map_ring(size_t size, int huge)
+{
+    int fd = memfd_create("data buffer", MFD_CLOEXEC | (huge ? MFD_HUGETLB : 0));
+    if (fd == -1)
+    {
+        if (huge)
+        {
+            return nullptr;
+        }
+        errno_exit("data_buffer_create: memfd_create");
+    }
+
+    ASSERT(size < TYPE_MAX(off_t));
+    if (ftruncate(fd, CAST(off_t, size)) == -1)
+    {
+        errno_exit("data_buffer_create: ftruncate");
+    }
+
+    size_t align = huge ? DATA_BUFFER_HUGE_PAGE_SIZE : CAST(size_t, sysconf(_SC_PAGESIZE));
+    size_t reserved = 3 * size + align;
+    char *reservation = mmap(nullptr, reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == reservation)
+    {
+        errno_exit("data_buffer_create: mmap");
+    }
+    char *start = CAST(char *, alignull_up2(CAST(uintptr_t, reservation), align));
+
+    // Huge pages are set aside when they're mapped, which is where asking for
+    // more than there are fails
+    int prot = PROT_READ | PROT_WRITE;
+    int flags = MAP_SHARED | MAP_FIXED;
+    for (size_t i = 0; i < 3; ++i)
+    {
+        if (mmap(start + i * size, size, prot, flags, fd, 0) == MAP_FAILED)
+        {
+            if (huge)
+            {
+                munmap(reservation, reserved);
+                close(fd);
+                return nullptr;
+            }
+            errno_exit("data_buffer_create: map buffer");
+        }
+    }
+    close(fd);
+
+    munmap(reservation, CAST(size_t, start - reservation));
+    munmap(start + 3 * size, CAST(size_t, reservation + reserved - (start + 3 * size)));
+
+    return start;
+}
+
+
+void
+data_buffer_create(RawDataBuffer *buffer, size_t size)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    size_t aligned_size = alignull_up2(size, CAST(size_t, page_size));
+    if ((aligned_size < size) || (aligned_size > EXPR_MAX(aligned_size) / 4))
+    {
+        errno = EOVERFLOW;
+        errno_exit("data_buffer_create: buffer size");
+    }
+
+    // Big rings are backed by huge pages if any were set aside, and otherwise
+    // by transparent ones if the kernel does that for shared memory, which
+    // saves a TLB miss every few KB of a burst of output
+    char *start = nullptr;
+    int huge = 0;
+    if (aligned_size >= DATA_BUFFER_HUGE_PAGE_SIZE)
+    {
+        size_t huge_size = alignull_up2(aligned_size, DATA_BUFFER_HUGE_PAGE_SIZE);
+        start = map_ring(huge_size, 1);
+        if (start)
+        {
+            aligned_size = huge_size;
+            huge = 1;
+        }
+    }
+    if (!start)
+    {
+        start = map_ring(aligned_size, 0);
+        if (aligned_size >= DATA_BUFFER_HUGE_PAGE_SIZE)
+        {
+            madvise(start, 3 * aligned_size, MADV_HUGEPAGE);
+        }
+    }
+
+    buffer->size = aligned_size;
+    buffer->max_size = aligned_size;
+    buffer->huge = huge;
+    buffer->filled_reads = 0;
+    buffer->base = start;
+    data_buffer_reset(buffer);
+}
+
+
+void
+data_buffer_grow(RawDataBuffer *buffer, size_t size)
+{
+    size_t written = atomic_load_explicit(&buffer->written, memory_order_relaxed);
+    size_t consumed = atomic_load_explicit(&buffer->consumed, memory_order_relaxed);
+    size_t max_size = buffer->max_size;
+
+    RawDataBuffer grown;
+    data_buffer_create(&grown, size);
+    ASSERT(grown.size >= buffer->size);
+
+    // Positions are running totals, so whatever wasn't read yet goes where the
+    // same totals fall in the bigger ring, and it stays contiguous there
+    memcpy(grown.base + consumed % grown.size, buffer->base + consumed % buffer->size, written - consumed);
+    munmap(buffer->base, 3 * buffer->size);
+
+    buffer->size = grown.size;
+    buffer->max_size = (grown.size > max_size) ? grown.size : max_size;
+    buffer->huge = grown.huge;
+    buffer->filled_reads = 0;
+    buffer->base = grown.base;
+}
+
+
+void
+data_buffer_filled(RawDataBuffer *buffer)
+{
+    if (buffer->size >= buffer->max_size)
+    {
+        return;
+    }
+
+    // Mostly full after a read means output arrives faster than it's taken
+    size_t written = atomic_load_explicit(&buffer->written, memory_order_relaxed);
+    size_t consumed = atomic_load_explicit(&buffer->consumed, memory_order_relaxed);
+    if (written - consumed < buffer->size - buffer->size / 4)
+    {
+        buffer->filled_reads = 0;
+    }
+    else if (++buffer->filled_reads >= DATA_BUFFER_GROW_AFTER)
+    {
+        data_buffer_grow(buffer, minull(2 * buffer->size, buffer->max_size));
+    }
+}
+
+
+void
+data_buffer_reset(RawDataBuffer *buffer)
+{
+    atomic_store_explicit(&buffer->written, 0, memory_order_relaxed);
+    atomic_store_explicit(&buffer->consumed, 0, memory_order_relaxed);
+}
+
+
+char *
+data_buffer_reserve(RawDataBuffer *buffer, size_t *space)
+{
+    size_t written = atomic_load_explicit(&buffer->written, memory_order_relaxed);
+
+    // Pairs with the release in data_buffer_consume so the consumer is done
+    // with the bytes before they are overwritten
+    size_t consumed = atomic_load_explicit(&buffer->consumed, memory_order_acquire);
+    ASSERT(written - consumed <= buffer->size);
+
+    *space = buffer->size - (written - consumed);
+    char *result = buffer->base + written % buffer->size;
+    return result;
+}
+
+
+void
+data_buffer_commit(RawDataBuffer *buffer, size_t count)
+{
+    size_t written = atomic_load_explicit(&buffer->written, memory_order_relaxed);
+    atomic_store_explicit(&buffer->written, written + count, memory_order_release);
+}
+
+
+char *
+data_buffer_peek(RawDataBuffer *buffer, size_t *count)
+{
+    size_t consumed = atomic_load_explicit(&buffer->consumed, memory_order_relaxed);
+
+    // Pairs with the release in data_buffer_commit so the bytes are visible
+    size_t written = atomic_load_explicit(&buffer->written, memory_order_acquire);
+    ASSERT(written - consumed <= buffer->size);
+
+    // Starting in the first mapping, everything up to a whole buffer's worth
+    // is contiguous
+    *count = written - consumed;
+    char *result = buffer->base + consumed % buffer->size;
+    return result;
+}
+
+
+void
+data_buffer_consume(RawDataBuffer *buffer, size_t count)
+{
+    size_t consumed = atomic_load_explicit(&buffer->consumed, memory_order_relaxed);
+    atomic_store_explicit(&buffer->consumed, consumed + count, memory_order_release);
+}
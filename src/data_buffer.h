@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+
+// The size the terminal asks for when creating its data buffer. It is rounded
+// up to a multiple of the page size.
+#define DEFAULT_DATA_BUFFER_SIZE 4000
+
+// How big the terminal lets its data buffer grow when output keeps filling it
+#define DATA_BUFFER_GROW_LIMIT (16 * 1024 * 1024)
+
+// How many reads in a row have to leave the buffer mostly full before it grows
+#define DATA_BUFFER_GROW_AFTER 4
+
+// Buffers at least this big are backed by huge pages when there are any
+#define DATA_BUFFER_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+
+// A ring of bytes mapped several times in a row, so whatever is in it can be
+// accessed as one contiguous block even when it wraps around the end.
+//
+// Positions are running totals rather than pointers. Only the producer stores
+// written and only the consumer stores consumed, which lets a reader thread
+// fill the ring while another thread parses it without any locks.
+typedef struct RawDataBuffer
+{
+    size_t size;
+    char *base;
+
+    // The producer may grow the buffer up to this by calling
+    // data_buffer_filled after each read. Only a buffer that's produced and
+    // consumed on the same thread can grow, so it's the same as size
+    // otherwise.
+    size_t max_size;
+    unsigned filled_reads;
+
+    // Set if backed by huge pages that were set aside for them
+    int huge;
+
+    _Atomic size_t written;
+    _Atomic size_t consumed;
+} RawDataBuffer;
+
+
+void data_buffer_create(RawDataBuffer *buffer, size_t size);
+
+void data_buffer_reset(RawDataBuffer *buffer);
+
+// Moves the buffer to a bigger ring, keeping whatever wasn't consumed yet
+void data_buffer_grow(RawDataBuffer *buffer, size_t size);
+
+// Grows the buffer towards max_size if reads keep leaving it mostly full
+void data_buffer_filled(RawDataBuffer *buffer);
+
+// Producer side: returns where to write and sets space to how much fits, then
+// publishes the bytes that were written
+char *data_buffer_reserve(RawDataBuffer *buffer, size_t *space);
+void data_buffer_commit(RawDataBuffer *buffer, size_t count);
+
+// Consumer side: returns the bytes waiting to be processed and sets count to
+// how many there are, then releases the ones that were processed
+char *data_buffer_peek(RawDataBuffer *buffer, size_t *count);
+void data_buffer_consume(RawDataBuffer *buffer, size_t count);
@@ -0,0 +1,106 @@
+#define _GNU_SOURCE // for CLOCK_MONOTONIC
+
+#include "frame_clock.h"
+
+#include "assert.h"
+#include "types.h"
+#include "util.h"
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+
+void
+frame_clock_create(FrameClock *clock, unsigned rate)
+{
+    ASSERT(rate);
+
+    clock->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (clock->fd == -1)
+    {
+        errno_exit("frame_clock_create:timerfd_create");
+    }
+
+    clock->interval_ns = 1000000000 / rate;
+    clock->last_frame_ns = 0;
+    clock->pending = 0;
+    clock->held = 0;
+}
+
+
+static void
+arm(FrameClock *clock, uint64_t due)
+{
+    struct itimerspec timer = {
+        .it_value = {
+            .tv_sec = CAST(time_t, due / 1000000000),
+            .tv_nsec = CAST(long, due % 1000000000),
+        },
+    };
+    if (timerfd_settime(clock->fd, TFD_TIMER_ABSTIME, &timer, nullptr) == -1)
+    {
+        errno_exit("frame_clock:timerfd_settime");
+    }
+    clock->pending = 1;
+}
+
+
+int
+frame_clock_request(FrameClock *clock)
+{
+    if (clock->pending && !clock->held)
+    {
+        return 0;
+    }
+    clock->held = 0;
+
+    uint64_t due = clock->last_frame_ns + clock->interval_ns;
+    if (now_ns() >= due)
+    {
+        return 1;
+    }
+    arm(clock, due);
+
+    return 0;
+}
+
+
+void
+frame_clock_hold(FrameClock *clock, uint64_t until_ns)
+{
+    if (!clock->held)
+    {
+        arm(clock, until_ns);
+        clock->held = 1;
+    }
+}
+
+
+int
+frame_clock_expired(FrameClock *clock)
+{
+    uint64_t expirations;
+    ssize_t result = read(clock->fd, &expirations, sizeof(expirations));
+
+    // The timer may have been disarmed since it was polled
+    int due = (result == sizeof(expirations)) && clock->pending;
+    if (due)
+    {
+        clock->pending = 0;
+        clock->held = 0;
+    }
+    return due;
+}
+
+
+void
+frame_clock_drew(FrameClock *clock)
+{
+    clock->last_frame_ns = now_ns();
+    if (clock->pending)
+    {
+        struct itimerspec disarm = { 0 };
+        timerfd_settime(clock->fd, 0, &disarm, nullptr);
+        clock->pending = 0;
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+
+
+#define DEFAULT_FRAME_RATE 60
+
+
+// Decides when to draw. Input that arrives after the terminal has been idle for
+// a frame is drawn right away; input that keeps arriving is drawn at most once
+// per frame when the timer fires.
+typedef struct FrameClock
+{
+    // A timerfd that becomes readable when the next frame is due
+    int fd;
+
+    uint64_t interval_ns;
+    uint64_t last_frame_ns;
+
+    // Set when the screen changed but drawing it was put off to the timer
+    int pending;
+
+    // Set when the timer was armed by frame_clock_hold rather than for the
+    // next frame
+    int held;
+} FrameClock;
+
+
+void frame_clock_create(FrameClock *clock, unsigned rate);
+
+// Called when the screen changed. Returns whether to draw now; otherwise the
+// timer is armed for the next frame.
+int frame_clock_request(FrameClock *clock);
+
+// Puts off drawing until until_ns at the latest, whatever the frame rate. The
+// next frame_clock_request goes back to the frame rate.
+void frame_clock_hold(FrameClock *clock, uint64_t until_ns);
+
+// Called when the timer fd is readable. Returns whether a frame is due.
+int frame_clock_expired(FrameClock *clock);
+
+void frame_clock_drew(FrameClock *clock);
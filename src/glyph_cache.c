@@ -0,0 +1,164 @@
+#include "glyph_cache.h"
+
+#include "assert.h"
+#include "types.h"
+#include "util.h"
+
+#include <stdlib.h>
+
+
+static XftFont *
+open_face(Display *display, int screen, const char *family, GlyphFace face)
+{
+    XftFont *result = XftFontOpen(
+        display, screen,
+        XFT_FAMILY, XftTypeString, family,
+        XFT_WEIGHT, XftTypeInteger, (face & GLYPH_BOLD) ? XFT_WEIGHT_BOLD : XFT_WEIGHT_MEDIUM,
+        XFT_SLANT, XftTypeInteger, (face & GLYPH_ITALIC) ? XFT_SLANT_ITALIC : XFT_SLANT_ROMAN,
+        nullptr);
+
+    return result;
+}
+
+
+// Asks fontconfig for the font closest to the given one that has the codepoint
+static XftFont *
+find_fallback(GlyphCache *cache, XftFont *font, uint32_t codepoint)
+{
+    XftFont *result = nullptr;
+
+    FcPattern *pattern = FcPatternDuplicate(font->pattern);
+    FcCharSet *charset = FcCharSetCreate();
+    if (pattern && charset)
+    {
+        FcCharSetAddChar(charset, codepoint);
+        FcPatternDel(pattern, FC_CHARSET);
+        FcPatternAddCharSet(pattern, FC_CHARSET, charset);
+        FcPatternAddBool(pattern, FC_SCALABLE, FcTrue);
+
+        FcResult match_result;
+        FcPattern *match = XftFontMatch(cache->display, cache->screen, pattern, &match_result);
+        if (match)
+        {
+            // The font takes ownership of the pattern
+            result = XftFontOpenPattern(cache->display, match);
+            if (!result)
+            {
+                FcPatternDestroy(match);
+            }
+            else if (!XftCharExists(cache->display, result, codepoint))
+            {
+                XftFontClose(cache->display, result);
+                result = nullptr;
+            }
+        }
+    }
+
+    if (charset)
+    {
+        FcCharSetDestroy(charset);
+    }
+    if (pattern)
+    {
+        FcPatternDestroy(pattern);
+    }
+
+    return result;
+}
+
+
+static void
+resolve_glyph(GlyphCache *cache, uint32_t codepoint, GlyphFace face, CachedGlyph *entry)
+{
+    XftFont *font = cache->faces[face];
+    if (!XftCharExists(cache->display, font, codepoint))
+    {
+        XftFont *fallback = nullptr;
+        for (unsigned i = 0; i < cache->fallback_count; ++i)
+        {
+            if (XftCharExists(cache->display, cache->fallbacks[i], codepoint))
+            {
+                fallback = cache->fallbacks[i];
+                break;
+            }
+        }
+
+        if (!fallback && (cache->fallback_count < ARRAY_COUNT(cache->fallbacks)))
+        {
+            fallback = find_fallback(cache, font, codepoint);
+            if (fallback)
+            {
+                cache->fallbacks[cache->fallback_count++] = fallback;
+            }
+        }
+
+        // Otherwise fall through and draw whatever the font has for missing
+        // characters
+        if (fallback)
+        {
+            font = fallback;
+        }
+    }
+
+    entry->key = (codepoint << 2) | face;
+    entry->font = font;
+    entry->glyph = XftCharIndex(cache->display, font, codepoint);
+}
+
+
+void
+glyph_cache_create(GlyphCache *cache, Display *display, int screen, const char *family)
+{
+    cache->display = display;
+    cache->screen = screen;
+
+    for (GlyphFace face = 0; face < GLYPH_FACE_COUNT; ++face)
+    {
+        cache->faces[face] = open_face(display, screen, family, face);
+        if (!cache->faces[face])
+        {
+            // Still draw something if the family has no bold or italic variant
+            if (face == GLYPH_REGULAR)
+            {
+                error_exit("glyph_cache_create:XftFontOpen");
+            }
+            cache->faces[face] = cache->faces[GLYPH_REGULAR];
+        }
+    }
+
+    cache->fallback_count = 0;
+    cache->hits = cache->misses = 0;
+
+    cache->entries = calloc(GLYPH_CACHE_SIZE, sizeof(*cache->entries));
+    if (!cache->entries)
+    {
+        errno_exit("glyph_cache_create:calloc");
+    }
+}
+
+
+CachedGlyph *
+glyph_cache_lookup(GlyphCache *cache, uint32_t codepoint, GlyphFace face)
+{
+    ASSERT(face < GLYPH_FACE_COUNT);
+    _Static_assert((GLYPH_CACHE_SIZE & (GLYPH_CACHE_SIZE - 1)) == 0, "Cache size must be a power of 2");
+
+    uint32_t key = (codepoint << 2) | face;
+
+    // Fibonacci hashing so runs of neighbouring codepoints spread out
+    uint32_t slot = (key * 2654435769u) >> 20;
+    _Static_assert(GLYPH_CACHE_SIZE == (1 << (32 - 20)), "Hash shift doesn't match the cache size");
+
+    CachedGlyph *result = cache->entries + slot;
+    if (result->font && (result->key == key))
+    {
+        ++cache->hits;
+    }
+    else
+    {
+        ++cache->misses;
+        resolve_glyph(cache, codepoint, face, result);
+    }
+
+    return result;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "screen.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <X11/Xlib.h>
+#include <X11/Xft/Xft.h>
+
+
+// Must be a power of 2
+#define GLYPH_CACHE_SIZE 4096
+
+#define GLYPH_CACHE_MAX_FALLBACKS 16
+
+
+typedef struct CachedGlyph
+{
+    // (codepoint << 2) | face. Only meaningful if font is set.
+    uint32_t key;
+    XftFont *font;
+    FT_UInt glyph;
+} CachedGlyph;
+
+
+// Maps codepoints to the font and glyph index they are drawn with so drawing
+// doesn't have to ask Xft or fontconfig anything for characters it has seen
+typedef struct GlyphCache
+{
+    Display *display;
+    int screen;
+
+    XftFont *faces[GLYPH_FACE_COUNT];
+
+    // Fonts found for characters the faces don't have, shared by every face
+    unsigned fallback_count;
+    XftFont *fallbacks[GLYPH_CACHE_MAX_FALLBACKS];
+
+    size_t hits;
+    size_t misses;
+
+    CachedGlyph *entries;
+} GlyphCache;
+
+
+void glyph_cache_create(GlyphCache *cache, Display *display, int screen, const char *family);
+
+CachedGlyph *glyph_cache_lookup(GlyphCache *cache, uint32_t codepoint, GlyphFace face);
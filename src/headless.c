@@ -0,0 +1,98 @@
+#include "headless.h"
+
+#include "types.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+void
+headless_create(HeadlessRenderer *renderer, const char *family, unsigned cols, unsigned rows)
+{
+    GlyphAtlas *atlas = &renderer->atlas;
+    glyph_atlas_create(atlas, family, 0);
+
+    Framebuffer *framebuffer = &renderer->framebuffer;
+    framebuffer->width = cols * atlas->cell_width;
+    framebuffer->height = rows * atlas->cell_height;
+    framebuffer->stride = framebuffer->width;
+    framebuffer->pixels = malloc(framebuffer->stride * framebuffer->height * sizeof(*framebuffer->pixels));
+    if (!framebuffer->pixels)
+    {
+        errno_exit("headless_create:malloc");
+    }
+    framebuffer_clear(framebuffer);
+
+    renderer->cursor = (DrawnCursor){ 0 };
+    renderer->overlay = nullptr;
+    renderer->overlay_cols = 0;
+    renderer->frames = 0;
+    renderer->draw_ns = 0;
+}
+
+
+void
+headless_draw(HeadlessRenderer *renderer, TerminalScreen *screen)
+{
+    uint64_t start = now_ns();
+
+    RasterRect moved;
+    raster_scroll(&renderer->framebuffer, &renderer->atlas, screen, &renderer->cursor, renderer->overlay_cols, &moved);
+
+    size_t overlay_length = renderer->overlay ? strlen(renderer->overlay) : 0;
+    unsigned overlay_col = screen_damage_overlay(screen, &renderer->overlay_cols, overlay_length);
+
+    RasterRect changed;
+    raster_draw_buffer(&renderer->framebuffer, &renderer->atlas, screen, &renderer->cursor, &changed);
+    if (renderer->overlay_cols)
+    {
+        raster_draw_text(&renderer->framebuffer, &renderer->atlas, overlay_col, 0,
+            renderer->overlay, renderer->overlay_cols, &changed);
+    }
+    raster_add_rect(&changed, moved.x, moved.y, moved.width, moved.height);
+
+    renderer->draw_ns += now_ns() - start;
+    ++renderer->frames;
+}
+
+
+int
+headless_write_ppm(HeadlessRenderer *renderer, const char *path)
+{
+    FILE *file = fopen(path, "wb");
+    if (!file)
+    {
+        return 0;
+    }
+
+    Framebuffer *framebuffer = &renderer->framebuffer;
+    fprintf(file, "P6\n%u %u\n255\n", framebuffer->width, framebuffer->height);
+
+    byte *row = malloc(framebuffer->width * 3);
+    if (!row)
+    {
+        errno_exit("headless_write_ppm:malloc");
+    }
+    for (unsigned y = 0; y < framebuffer->height; ++y)
+    {
+        uint32_t *pixels = framebuffer->pixels + y * framebuffer->stride;
+        for (unsigned x = 0; x < framebuffer->width; ++x)
+        {
+            row[3 * x + 0] = CAST(byte, pixels[x] >> 16);
+            row[3 * x + 1] = CAST(byte, pixels[x] >> 8);
+            row[3 * x + 2] = CAST(byte, pixels[x]);
+        }
+        fwrite(row, 3, framebuffer->width, file);
+    }
+    free(row);
+
+    int result = !ferror(file);
+    if (fclose(file))
+    {
+        result = 0;
+    }
+
+    return result;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "raster.h"
+#include "screen.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+// Draws the screen into a framebuffer in memory with the same glyph atlas and
+// rasterizer as the MIT-SHM renderer, so drawing can be tested and timed
+// without an X server
+typedef struct HeadlessRenderer
+{
+    Framebuffer framebuffer;
+    GlyphAtlas atlas;
+    DrawnCursor cursor;
+
+    // Drawn over the top right corner if set
+    const char *overlay;
+    unsigned overlay_cols;
+
+    size_t frames;
+    uint64_t draw_ns;
+} HeadlessRenderer;
+
+
+// Sized to fit cols by rows cells of the font
+void headless_create(HeadlessRenderer *renderer, const char *family, unsigned cols, unsigned rows);
+
+void headless_draw(HeadlessRenderer *renderer, TerminalScreen *screen);
+
+// Writes the framebuffer as a binary PPM. Returns 0 if the file couldn't be
+// written.
+int headless_write_ppm(HeadlessRenderer *renderer, const char *path);
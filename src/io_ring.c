@@ -0,0 +1,244 @@
+#define _GNU_SOURCE // for syscall, MAP_POPULATE
+
+#include "io_ring.h"
+
+#include "types.h"
+#include "util.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+// There's no libc wrapper for any of these
+static int
+ring_setup(unsigned entries, struct io_uring_params *params)
+{
+    int result = CAST(int, syscall(__NR_io_uring_setup, entries, params));
+    return result;
+}
+
+
+static int
+ring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    int result = CAST(int, syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+    return result;
+}
+
+
+static int
+ring_register(int fd, unsigned opcode, const void *arg, unsigned count)
+{
+    int result = CAST(int, syscall(__NR_io_uring_register, fd, opcode, arg, count));
+    return result;
+}
+
+
+int
+io_ring_create(IoRing *ring, unsigned entries)
+{
+    memset(ring, 0, sizeof(*ring));
+
+    // Completions are only ever looked at by this thread after it waited for
+    // them, so the kernel needn't interrupt it to post them any earlier
+    struct io_uring_params params = {
+        .flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN,
+    };
+    int fd = ring_setup(entries, &params);
+    if ((fd == -1) && (errno == EINVAL))
+    {
+        // Older kernels don't know those flags
+        memset(&params, 0, sizeof(params));
+        fd = ring_setup(entries, &params);
+    }
+    if (fd == -1)
+    {
+        return 0;
+    }
+
+    // Reads are only waited on with a poll rather than on a kernel thread from
+    // 5.7 on, and polls can complete more than once from 5.13 on, which has no
+    // feature bit of its own but came with resource tags. Both rings share one
+    // mapping on all of those.
+    unsigned needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_FAST_POLL | IORING_FEAT_RSRC_TAGS;
+    if ((params.features & needed) != needed)
+    {
+        close(fd);
+        errno = ENOSYS;
+        return 0;
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    size_t rings_size = (sq_size > cq_size) ? sq_size : cq_size;
+    char *rings = mmap(nullptr, rings_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+        IORING_OFF_SQ_RING);
+    if (MAP_FAILED == rings)
+    {
+        errno_exit("io_ring_create: mmap rings");
+    }
+    struct io_uring_sqe *sqes = mmap(nullptr, params.sq_entries * sizeof(*sqes), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (MAP_FAILED == sqes)
+    {
+        errno_exit("io_ring_create: mmap entries");
+    }
+
+    ring->fd = fd;
+
+    ring->sq_entries = params.sq_entries;
+    ring->sq_mask = *CAST(unsigned *, CAST(void *, rings + params.sq_off.ring_mask));
+    ring->sq_head = CAST(_Atomic unsigned *, CAST(void *, rings + params.sq_off.head));
+    ring->sq_tail = CAST(_Atomic unsigned *, CAST(void *, rings + params.sq_off.tail));
+    ring->sq_array = CAST(unsigned *, CAST(void *, rings + params.sq_off.array));
+    ring->sqes = sqes;
+    ring->sq_local_tail = atomic_load_explicit(ring->sq_tail, memory_order_relaxed);
+
+    ring->cq_mask = *CAST(unsigned *, CAST(void *, rings + params.cq_off.ring_mask));
+    ring->cq_head = CAST(_Atomic unsigned *, CAST(void *, rings + params.cq_off.head));
+    ring->cq_tail = CAST(_Atomic unsigned *, CAST(void *, rings + params.cq_off.tail));
+    ring->cqes = CAST(struct io_uring_cqe *, CAST(void *, rings + params.cq_off.cqes));
+
+    // Entries are always queued in order, so each slot of the array just
+    // points at the entry of the same index
+    for (unsigned i = 0; i < ring->sq_entries; ++i)
+    {
+        ring->sq_array[i] = i;
+    }
+
+    return 1;
+}
+
+
+void
+io_ring_enter(IoRing *ring, unsigned wait_count)
+{
+    atomic_store_explicit(ring->sq_tail, ring->sq_local_tail, memory_order_release);
+
+    unsigned flags = wait_count ? IORING_ENTER_GETEVENTS : 0;
+    for (;;)
+    {
+        ++ring->enters;
+        int result = ring_enter(ring->fd, ring->to_submit, wait_count, flags);
+        if (result >= 0)
+        {
+            // Anything that wasn't taken is submitted with the next call
+            ring->to_submit -= CAST(unsigned, result);
+            break;
+        }
+
+        // EAGAIN and EBUSY mean completions have to be looked at before more
+        // can be taken, which the caller does next
+        if ((errno != EINTR) && (errno != EAGAIN) && (errno != EBUSY))
+        {
+            errno_exit("io_ring_enter");
+        }
+        if (errno != EINTR)
+        {
+            break;
+        }
+    }
+}
+
+
+struct io_uring_cqe *
+io_ring_cqe(IoRing *ring)
+{
+    struct io_uring_cqe *result = nullptr;
+
+    unsigned head = atomic_load_explicit(ring->cq_head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(ring->cq_tail, memory_order_acquire);
+    if (head != tail)
+    {
+        result = ring->cqes + (head & ring->cq_mask);
+    }
+
+    return result;
+}
+
+
+void
+io_ring_seen(IoRing *ring)
+{
+    unsigned head = atomic_load_explicit(ring->cq_head, memory_order_relaxed);
+    atomic_store_explicit(ring->cq_head, head + 1, memory_order_release);
+}
+
+
+int
+io_ring_register_buffers(IoRing *ring, const struct iovec *iovecs, unsigned count)
+{
+    if (ring->buffers_registered)
+    {
+        if (ring_register(ring->fd, IORING_UNREGISTER_BUFFERS, nullptr, 0) == -1)
+        {
+            errno_exit("io_ring_register_buffers: unregister");
+        }
+        ring->buffers_registered = 0;
+    }
+
+    // Registered pages are locked in memory, which RLIMIT_MEMLOCK may not
+    // leave room for
+    ring->buffers_registered = (ring_register(ring->fd, IORING_REGISTER_BUFFERS, iovecs, count) == 0);
+
+    int result = ring->buffers_registered;
+    return result;
+}
+
+
+static struct io_uring_sqe *
+queue_entry(IoRing *ring)
+{
+    // Only happens if more was queued than ever is in flight at once, in
+    // which case what's there is sent off first
+    unsigned head = atomic_load_explicit(ring->sq_head, memory_order_acquire);
+    if (ring->sq_local_tail - head == ring->sq_entries)
+    {
+        io_ring_enter(ring, 0);
+        head = atomic_load_explicit(ring->sq_head, memory_order_acquire);
+        if (ring->sq_local_tail - head == ring->sq_entries)
+        {
+            error_exit("io_ring: submission queue full");
+        }
+    }
+
+    struct io_uring_sqe *result = ring->sqes + (ring->sq_local_tail & ring->sq_mask);
+    memset(result, 0, sizeof(*result));
+    ++ring->sq_local_tail;
+    ++ring->to_submit;
+
+    return result;
+}
+
+
+void
+io_ring_read(IoRing *ring, int fd, void *buffer, unsigned size, int buffer_index, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = queue_entry(ring);
+    sqe->opcode = (buffer_index >= 0) ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = CAST(uint64_t, CAST(uintptr_t, buffer));
+    sqe->len = size;
+    // At the current position, which is all a pty has
+    sqe->off = TYPE_MAX(uint64_t);
+    if (buffer_index >= 0)
+    {
+        sqe->buf_index = CAST(uint16_t, buffer_index);
+    }
+    sqe->user_data = user_data;
+}
+
+
+void
+io_ring_poll(IoRing *ring, int fd, unsigned events, int multishot, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = queue_entry(ring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->len = multishot ? IORING_POLL_ADD_MULTI : 0;
+    sqe->user_data = user_data;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h> // struct iovec
+
+
+// Enough for everything the terminal keeps in flight at once: a read and a
+// poll for writability on the pty and a poll on each of its other fds
+#define IO_RING_ENTRIES 16
+
+
+// An io_uring set up and driven through the raw system calls. Requests are
+// queued with the io_ring_* calls below and only go to the kernel with the next
+// io_ring_enter, which also waits for completions, so a loop that queues its
+// next requests while handling the last completions costs one system call per
+// wakeup.
+//
+// Only ever used from the thread that created it.
+typedef struct IoRing
+{
+    int fd;
+
+    // Submission queue. The kernel moves the head as it takes entries, we move
+    // the tail as we add them.
+    unsigned sq_entries;
+    unsigned sq_mask;
+    _Atomic unsigned *sq_head;
+    _Atomic unsigned *sq_tail;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+
+    // Queued since the last io_ring_enter
+    unsigned sq_local_tail;
+    unsigned to_submit;
+
+    // Completion queue, the other way around
+    unsigned cq_mask;
+    _Atomic unsigned *cq_head;
+    _Atomic unsigned *cq_tail;
+    struct io_uring_cqe *cqes;
+
+    // Set while buffers are registered, which can then be read into and
+    // written from without the kernel looking up their pages every time
+    int buffers_registered;
+
+    // How many times io_ring_enter was called
+    size_t enters;
+} IoRing;
+
+
+// Returns 0 with errno set if the kernel doesn't have io_uring or won't let us
+// use it
+int io_ring_create(IoRing *ring, unsigned entries);
+
+// Submits whatever was queued and waits until at least wait_count completions
+// are there to be looked at
+void io_ring_enter(IoRing *ring, unsigned wait_count);
+
+// Returns the oldest completion not looked at yet, or nullptr. It stays valid
+// until io_ring_seen is called.
+struct io_uring_cqe *io_ring_cqe(IoRing *ring);
+void io_ring_seen(IoRing *ring);
+
+// Replaces the registered buffers, whose indices are their places in iovecs.
+// Returns 0 if the kernel refused them, in which case none are registered.
+int io_ring_register_buffers(IoRing *ring, const struct iovec *iovecs, unsigned count);
+
+// Reads the file at its current position. buffer_index is the registered
+// buffer the data goes into, or -1 if it's in none. A read of a non-blocking
+// file waits for data like any other, though some kernels may complete it with
+// -EAGAIN instead.
+void io_ring_read(IoRing *ring, int fd, void *buffer, unsigned size, int buffer_index, uint64_t user_data);
+
+// Completes once the fd is ready for events. If multishot is set it completes
+// every time it becomes ready instead, until a completion comes without
+// IORING_CQE_F_MORE set, after which it has to be queued again.
+void io_ring_poll(IoRing *ring, int fd, unsigned events, int multishot, uint64_t user_data);
@@ -0,0 +1,221 @@
+#define _GNU_SOURCE // for CLOCK_MONOTONIC, cfmakeraw
+
+#include "latency.h"
+
+#include "assert.h"
+#include "types.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <sys/timerfd.h>
+#include <termios.h> // struct termios, TCSANOW, cfmakeraw, tcgetattr, tcsetattr
+#include <unistd.h>
+
+
+static void
+arm_timer(LatencyProbe *probe, unsigned milliseconds)
+{
+    struct itimerspec timer = {
+        .it_value = {
+            .tv_sec = milliseconds / 1000,
+            .tv_nsec = CAST(long, milliseconds % 1000) * 1000000,
+        },
+    };
+    if (timerfd_settime(probe->fd, 0, &timer, nullptr) == -1)
+    {
+        errno_exit("latency:timerfd_settime");
+    }
+}
+
+
+void
+latency_create(LatencyProbe *probe, size_t key_count)
+{
+    ASSERT(key_count);
+
+    probe->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (probe->fd == -1)
+    {
+        errno_exit("latency_create:timerfd_create");
+    }
+
+    probe->state = LATENCY_IDLE;
+    probe->key_count = key_count;
+    probe->keys_sent = 0;
+    probe->written = 0;
+    probe->key_end = 0;
+    probe->key_ns = 0;
+    probe->echo_ns = 0;
+
+    probe->sample_count = 0;
+    probe->echo_samples = malloc(2 * key_count * sizeof(*probe->echo_samples));
+    if (!probe->echo_samples)
+    {
+        errno_exit("latency_create:malloc");
+    }
+    probe->frame_samples = probe->echo_samples + key_count;
+
+    arm_timer(probe, LATENCY_START_DELAY_MS);
+}
+
+
+int
+latency_key_due(LatencyProbe *probe)
+{
+    uint64_t expirations;
+    ssize_t result = read(probe->fd, &expirations, sizeof(expirations));
+
+    int due = (result == sizeof(expirations)) && (probe->state == LATENCY_IDLE)
+        && (probe->keys_sent < probe->key_count);
+    if (due)
+    {
+        probe->state = LATENCY_SENT;
+        ++probe->keys_sent;
+    }
+    return due;
+}
+
+
+char
+latency_next_key(LatencyProbe *probe)
+{
+    char result = CAST(char, 'a' + probe->keys_sent % 26);
+    return result;
+}
+
+
+void
+latency_key_written(LatencyProbe *probe, size_t bytes)
+{
+    probe->written += bytes;
+
+    // Keys typed in the meantime only move the offsets along
+    if ((probe->state == LATENCY_SENT) && bytes)
+    {
+        probe->key_ns = now_ns();
+        probe->key_end = probe->written;
+        probe->state = LATENCY_WRITTEN;
+    }
+}
+
+
+void
+latency_read(LatencyProbe *probe, size_t read_total)
+{
+    if ((probe->state == LATENCY_WRITTEN) && (read_total >= probe->key_end))
+    {
+        probe->echo_ns = now_ns();
+        probe->state = LATENCY_ECHOED;
+    }
+}
+
+
+void
+latency_drawn(LatencyProbe *probe, int presented)
+{
+    if (probe->state == LATENCY_ECHOED)
+    {
+        probe->state = LATENCY_DRAWN;
+        if (presented)
+        {
+            latency_presented(probe);
+        }
+    }
+}
+
+
+void
+latency_presented(LatencyProbe *probe)
+{
+    if (probe->state != LATENCY_DRAWN)
+    {
+        return;
+    }
+
+    uint64_t frame_ns = now_ns();
+    probe->echo_samples[probe->sample_count] = probe->echo_ns - probe->key_ns;
+    probe->frame_samples[probe->sample_count] = frame_ns - probe->key_ns;
+    ++probe->sample_count;
+
+    probe->state = LATENCY_IDLE;
+    if (probe->keys_sent < probe->key_count)
+    {
+        arm_timer(probe, LATENCY_KEY_INTERVAL_MS);
+    }
+}
+
+
+int
+latency_done(LatencyProbe *probe)
+{
+    int result = (probe->sample_count == probe->key_count);
+    return result;
+}
+
+
+static int
+compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *CAST(const uint64_t *, a);
+    uint64_t y = *CAST(const uint64_t *, b);
+    int result = (x > y) - (x < y);
+    return result;
+}
+
+
+// Sorts the samples and prints their percentiles in microseconds
+static void
+report_series(FILE *file, const char *name, uint64_t *samples, size_t count)
+{
+    qsort(samples, count, sizeof(*samples), compare_u64);
+    fprintf(file, "  %-13s %9.1f %9.1f %9.1f\n", name,
+        CAST(double, samples[(count - 1) * 50 / 100]) / 1e3,
+        CAST(double, samples[(count - 1) * 99 / 100]) / 1e3,
+        CAST(double, samples[count - 1]) / 1e3);
+}
+
+
+void
+latency_report(LatencyProbe *probe, FILE *file)
+{
+    if (!probe->sample_count)
+    {
+        fprintf(file, "No keys made it to the screen\n");
+        return;
+    }
+
+    fprintf(file, "Latency of %zu keys in microseconds\n", probe->sample_count);
+    fprintf(file, "  %-13s %9s %9s %9s\n", "", "p50", "p99", "max");
+    report_series(file, "key to echo", probe->echo_samples, probe->sample_count);
+    report_series(file, "key to frame", probe->frame_samples, probe->sample_count);
+}
+
+
+void
+latency_echo(void)
+{
+    struct termios termios;
+    if (tcgetattr(STDIN_FILENO, &termios) == -1)
+    {
+        errno_exit("latency_echo:tcgetattr");
+    }
+    cfmakeraw(&termios);
+    if (tcsetattr(STDIN_FILENO, TCSANOW, &termios) == -1)
+    {
+        errno_exit("latency_echo:tcsetattr");
+    }
+
+    char buffer[256];
+    for (;;)
+    {
+        ssize_t count = read(STDIN_FILENO, buffer, sizeof(buffer));
+        if (count <= 0)
+        {
+            exit(EXIT_SUCCESS);
+        }
+        if (write(STDOUT_FILENO, buffer, CAST(size_t, count)) != count)
+        {
+            exit(EXIT_FAILURE);
+        }
+    }
+}
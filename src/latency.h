@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+
+// How long to wait after a key shows up before sending the next one, so each
+// key arrives at an idle terminal the way typing does
+#define LATENCY_KEY_INTERVAL_MS 20
+
+// Time for the echo child to switch its terminal to raw mode before the first
+// key, so the pty doesn't echo it as well
+#define LATENCY_START_DELAY_MS 200
+
+
+typedef enum LatencyState
+{
+    // Waiting for the timer to send the next key
+    LATENCY_IDLE,
+
+    // The key was sent but hasn't been written to the pty yet
+    LATENCY_SENT,
+
+    // Written, waiting for the echo to be read back
+    LATENCY_WRITTEN,
+
+    // Read back, waiting for a frame that shows it
+    LATENCY_ECHOED,
+
+    // Drawn, waiting for the server to say the frame is on screen
+    LATENCY_DRAWN,
+} LatencyState;
+
+
+// Measures how long a key takes from being handled to being on screen. One key
+// is in flight at a time. The child echoes whatever it reads byte for byte, so
+// a key has come back once as many bytes have been read from the pty as had
+// been written to it up to and including the key.
+typedef struct LatencyProbe
+{
+    // A timerfd that becomes readable when the next key is due
+    int fd;
+
+    LatencyState state;
+
+    size_t key_count;
+    size_t keys_sent;
+
+    // Running total of bytes written to the pty, and where the key in flight
+    // ends in it
+    size_t written;
+    size_t key_end;
+
+    uint64_t key_ns;
+    uint64_t echo_ns;
+
+    // Nanoseconds from each key to its echo being read and to its frame
+    size_t sample_count;
+    uint64_t *echo_samples;
+    uint64_t *frame_samples;
+} LatencyProbe;
+
+
+void latency_create(LatencyProbe *probe, size_t key_count);
+
+// Called when the timer fd is readable. Returns whether to send a key now.
+int latency_key_due(LatencyProbe *probe);
+
+// The key to send next
+char latency_next_key(LatencyProbe *probe);
+
+// Called whenever bytes for a key were written to the pty
+void latency_key_written(LatencyProbe *probe, size_t bytes);
+
+// Called with the running total of bytes read from the pty
+void latency_read(LatencyProbe *probe, size_t read_total);
+
+// Called after a frame was drawn. If it will only be on screen later, presented
+// is 0 and latency_presented has to be called once it is.
+void latency_drawn(LatencyProbe *probe, int presented);
+
+void latency_presented(LatencyProbe *probe);
+
+int latency_done(LatencyProbe *probe);
+
+// Writes the median, 99th percentile and maximum of both latencies
+void latency_report(LatencyProbe *probe, FILE *file);
+
+// Runs in the child instead of a shell: puts the terminal in raw mode and
+// writes back everything it reads until the pty is closed
+_Noreturn void latency_echo(void);
@@ -1,876 +1,1383 @@
-#define _GNU_SOURCE // for memfd_create
+#define _GNU_SOURCE // for memfd_create, memrchr
 
+#include "arena.h"
 #include "assert.h"
+#include "data_buffer.h"
+#include "frame_clock.h"
+#include "headless.h"
+#include "io_ring.h"
+#include "latency.h"
+#include "parser.h"
+#include "pty.h"
+#include "pty_reader.h"
+#include "pty_writer.h"
+#include "raster.h"
+#include "render_thread.h"
+#include "scan.h"
+#include "scrollback.h"
+#include "screen.h"
+#include "session.h"
+#include "stats.h"
 #include "types.h"
+#include "utf8.h"
+#include "util.h"
+#include "xlib.h"
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/epoll.h>
 #include <sys/ioctl.h> // struct winsize, TIOCSWINSZ, ioctl,
 #include <sys/mman.h> // memfd_create
 #include <sys/select.h> // fd_set, FD_ZERO, FD_SET, FD_ISSET, select
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <termios.h> // struct termios, TCSANOW, tcgetattr, tcsetattr
 #include <unistd.h> // ftruncate
 
-#include <X11/Xlib.h>
-#include <X11/Xutil.h>
-#include <X11/Xft/Xft.h>
-
 
 #define DEFAULT_SHELL "/bin/sh"
 
+// For everything that lives as long as the terminal
+#define TERMINAL_ARENA_RESERVE (16 * 1024 * 1024)
+
+// How long an application can hold off drawing with a synchronized update
+// before whatever it has drawn so far is shown anyway
+#define SYNCHRONIZED_TIMEOUT_NS (150 * 1000000ull)
+
 #define UNUSED(name) __attribute__((__unused__)) name ## __UNUSED
 
 
-typedef struct RawDataBuffer
+typedef struct TerminalOptions
 {
-    size_t size;
-    size_t bytes_read;
+    unsigned frame_rate;
 
-    char *base;
-    char *wrap;
+    // Read the pty on a thread of its own
+    int reader_thread;
 
-    char *read;
-    char *write;
-} RawDataBuffer;
+    // Read the pty and wait for everything else through an io_uring instead
+    // of epoll, if the kernel lets us
+    int io_ring;
 
+    // Draw on a thread of its own, from copies of the screen
+    int render_thread;
 
-#define LINE_BUFFER_COUNT 80
+    size_t scrollback_megabytes;
 
-typedef struct TerminalLine
-{
-    size_t first_byte;
-    size_t one_past_last_byte;
-} TerminalLine;
+    // How big the buffer the pty is read into starts out, or 0 for the default
+    size_t buffer_kilobytes;
 
+    XlibRenderer renderer;
 
-typedef struct TerminalLineBuffer
-{
-    RawDataBuffer *data;
-    size_t total_line_count;
+    // Draw into memory at this many cells instead of opening a window
+    int headless;
+    unsigned headless_cols;
+    unsigned headless_rows;
+
+    // Where to write the headless frame, which is after dump_offset bytes of
+    // output if that isn't 0 and on exit otherwise
+    const char *dump_path;
+    size_t dump_offset;
 
-    size_t current_line;
-    TerminalLine lines[LINE_BUFFER_COUNT];
-} TerminalLineBuffer;
+    // Draw the recent stats over the top right corner
+    int stats_overlay;
+
+    // Send this many keys to a child that echoes them instead of running the
+    // shell, and report how long they took to show up
+    size_t latency_keys;
+
+    // Show the screen of the session by this name, which keeps running when
+    // the window is closed. It's started first unless attach_only is set.
+    const char *session_name;
+    int attach_only;
+
+    // Run instead of the shell
+    char **command;
+} TerminalOptions;
 
 
 typedef struct Terminal
 {
-    TerminalLineBuffer *buffer;
-    size_t current_line;
+    MemoryArena *memory;
+    RawDataBuffer *data;
+    Parser *parser;
+    TerminalScreen *screen;
 
-    unsigned cols;
-    unsigned rows;
+    // Exactly one of these is set
+    XlibConnection *x_connection;
+    HeadlessRenderer *headless;
 
-    unsigned cursor_x;
-    unsigned cursor_y;
-} Terminal;
+    // Everything sent to the child goes through here
+    PtyWriter *writer;
 
+    // Rewritten before every frame if the stats are shown
+    char *overlay;
 
+    LatencyProbe *probe;
 
-static size_t
-copy_string(char *dst, const char *src, size_t len)
-{
-    size_t count = 0;
+    // Set if the screen belongs to a session, in which case it's locked while
+    // it's looked at and the writer sends to the session
+    SessionView *view;
 
-    for (; src[count] && (count < len); ++count)
-    {
-        dst[count] = src[count];
-    }
-    if (count < len)
-    {
-        dst[count] = 0;
-    }
+    int pty_fd;
+    FrameClock *frame_clock;
 
-    return count;
-}
+    // Set if the pty is read on a thread of its own
+    PtyReader *reader;
 
+    // Readable when SIGUSR1 came in, or -1
+    int signal_fd;
 
-static int
-is_printable(char c)
-{
-    int result = (c >= 32) && (c <= 126);
-    return result;
-}
+    // Set once the headless frame was written
+    int dumped;
 
+    // Set if frames are drawn on a thread of their own, which from then on is
+    // the only one that touches the renderer
+    RenderThread *render;
 
-#if 0
-static unsigned
-minu(unsigned a, unsigned b)
-{
-    unsigned result = a < b ? a : b;
-    return result;
-}
-#endif
+    // The first frame published with the probe's key in it, or 0
+    uint64_t probe_frame;
 
+    // When the application started the synchronized update it's in the middle
+    // of, or 0, and how many times the screen changed but wasn't drawn because
+    // of one
+    uint64_t synchronized_since;
+    size_t frames_held;
+} Terminal;
 
-static unsigned long long
-minull(unsigned long long a, unsigned long long b)
-{
-    unsigned long long result = a < b ? a : b;
-    return result;
-}
 
 
 #if 0
 static int
-power_of_2s(long long v)
+is_printable(char c)
 {
-    int result = (v > 0) && (0 == (v & (v - 1)));
-
+    int result = (c >= 32) && (c <= 126);
     return result;
 }
 #endif
 
 
+// Shift with Page Up/Down and Home/End move the view through the scrollback.
+// Returns whether the key was one of those.
 static int
-power_of_2u(unsigned long long v)
+scroll_view(TerminalScreen *screen, KeySym keysym)
 {
-    int result = v && (0 == (v & (v - 1)));
+    switch (keysym)
+    {
+        case XK_Prior:
+        {
+            screen_scroll_view_up(screen, screen->rows);
+        } break;
 
-    return result;
+        case XK_Next:
+        {
+            screen_scroll_view_down(screen, screen->rows);
+        } break;
+
+        case XK_Home:
+        {
+            screen_view_line(screen, 0);
+        } break;
+
+        case XK_End:
+        {
+            screen_view_bottom(screen);
+        } break;
+
+        default:
+        {
+            return 0;
+        } break;
+    }
+
+    return 1;
 }
 
 
-static unsigned
-alignu_down(unsigned value, unsigned align)
+// Returns whether the screen needs to be drawn
+static int
+xlib_process_key_press(XKeyEvent *event, PtyWriter *writer, TerminalScreen *screen, LatencyProbe *probe)
 {
-    unsigned result = value / align * align;
+    char buf[32];
+    KeySym keysym;
+    int bytes = XLookupString(event, buf, sizeof(buf), &keysym, 0);
+    if ((event->state & ShiftMask) && scroll_view(screen, keysym))
+    {
+        return 1;
+    }
+    if ((event->state & ShiftMask) && (keysym == XK_Insert))
+    {
+        xlib_request_paste(event->display, event->window, XA_PRIMARY);
+        return 0;
+    }
+#if 0
+    printf("KeySym: %lu (%s) -> %d bytes: ", keysym, XKeysymToString(keysym), bytes);
+    for (int i = 0; i < bytes; ++i)
+    {
+        if (i)
+        {
+            printf(", ");
+        }
+        char c = buf[i];
+        if (is_printable(c))
+        {
+            printf("%d (%c)", c, c);
+        }
+        else
+        {
+            printf("%d", c);
+        }
+    }
+    fputs("\n", stdout);
+#endif
+
+    // Typing jumps back to the bottom
+    int result = 0;
+    if (bytes && screen->scrolled_back)
+    {
+        screen_view_bottom(screen);
+        result = 1;
+    }
+    if (pty_write(writer, buf, CAST(size_t, bytes)) && probe)
+    {
+        latency_key_written(probe, CAST(size_t, bytes));
+    }
 
     return result;
 }
 
 
-static unsigned long long
-alignull_up2(unsigned long long value, unsigned long long align)
+// Reads the selection into a paste after SelectionNotify, or the next piece of
+// a large one after PropertyNotify
+static void
+xlib_process_paste(XlibConnection *x_connection, Terminal *terminal)
 {
-    ASSERT(power_of_2u(align));
+    Atom type;
+    int format;
+    unsigned long count;
+    unsigned long remaining;
+    unsigned char *data = nullptr;
+    if (XGetWindowProperty(x_connection->display, x_connection->window, NULLREF_PASTE, 0, LONG_MAX / 4, True,
+            AnyPropertyType, &type, &format, &count, &remaining, &data) != Success)
+    {
+        return;
+    }
 
-    unsigned long long mask = align - 1;
+    PtyWriter *writer = terminal->writer;
+    if (type == INCR)
+    {
+        // Deleting the property asked for the first piece
+        pty_paste_begin(writer, terminal->screen->bracketed_paste);
+        x_connection->paste_incremental = 1;
+    }
+    else if (format == 8)
+    {
+        if (!x_connection->paste_incremental)
+        {
+            pty_paste_begin(writer, terminal->screen->bracketed_paste);
+        }
+        pty_paste_append(writer, CAST(char *, data), count);
 
-    unsigned long long result = (value + (mask - 1)) & ~mask;
+        // An empty piece ends an incremental paste
+        if (!x_connection->paste_incremental || !count)
+        {
+            x_connection->paste_incremental = 0;
+            pty_paste_end(writer);
+        }
+    }
 
-    return result;
+    if (data)
+    {
+        XFree(data);
+    }
 }
 
 
-static _Noreturn void
-error_exit(const char *message)
+static void
+terminal_lock(Terminal *terminal)
 {
-    fputs(message, stderr);
-    exit(EXIT_FAILURE);
+    if (terminal->view)
+    {
+        session_lock(terminal->view->shared);
+    }
 }
 
 
-#if 0
-static _Noreturn void
-errorf_exit(const char *format, ...)
+static void
+terminal_unlock(Terminal *terminal)
 {
-    va_list args;
-    va_start(args, format);
-    vfprintf(stderr, format, args);
-    va_end(args);
-    exit(EXIT_FAILURE);
+    if (terminal->view)
+    {
+        session_unlock(terminal->view->shared);
+    }
 }
-#endif
 
 
-static _Noreturn void
-errno_exit(const char *msg)
+static void
+terminal_resize(Terminal *terminal, XlibConnection *x_connection, int pty_fd)
 {
-    perror(msg);
-    exit(EXIT_FAILURE);
+    unsigned cols = x_connection->width / x_connection->cell_width;
+    unsigned rows = x_connection->height / x_connection->cell_height;
+    if (terminal->view)
+    {
+        // The session resizes the screen and the pty, and says when it's done
+        if (cols && rows)
+        {
+            session_request_resize(terminal->view, cols, rows);
+        }
+        return;
+    }
+
+    TerminalScreen *screen = terminal->screen;
+    screen_resize(screen, cols, rows);
+
+    struct winsize terminal_size = {
+        .ws_row = CAST(unsigned short, screen->rows),
+        .ws_col = CAST(unsigned short, screen->cols),
+    };
+
+    if (ioctl(pty_fd, TIOCSWINSZ, &terminal_size) == -1)
+        errno_exit("terminal_resize: ioctl");
 }
 
 
-static ssize_t
-pty_read(int pty_fd, RawDataBuffer *buffer)
+// Tells the probe about a frame that was drawn. Xft requests are on screen once
+// the server has answered a round trip after them, but a shared image only once
+// the server says it is done with it.
+static void
+terminal_probe_drawn(Terminal *terminal)
 {
-    size_t used = CAST(size_t, buffer->write - buffer->read);
-
-    size_t avail = buffer->size - used;
+    LatencyProbe *probe = terminal->probe;
+    XlibConnection *x_connection = terminal->x_connection;
+    if (probe->state != LATENCY_ECHOED)
+    {
+        return;
+    }
 
-    ssize_t bytes_read = read(pty_fd, buffer->write, minull(avail, EXPR_MAX(bytes_read)));
-    if (bytes_read < 0)
+    if (!x_connection)
     {
-        perror("pty_read");
+        latency_drawn(probe, 1);
     }
-    else
+    else if (x_connection->renderer == XLIB_RENDER_SHM)
     {
-#if 0
-        printf("Read %ld bytes\n", bytes_read);
-        for (ssize_t i = 0; i < bytes_read; ++i)
+        if (x_connection->put_pending && !x_connection->draw_deferred)
         {
-            if (i)
-            {
-                printf(", ");
-            }
-            char c = buffer->write[i];
-            if (isprint(c))
-            {
-                printf("'%c'", c);
-            }
-            else
-            {
-                printf("<%d>", c);
-            }
+            latency_drawn(probe, 0);
         }
-        fputs("\n", stdout);
-#endif
-        buffer->bytes_read += CAST(size_t, bytes_read);
-        buffer->write += bytes_read;
-        if (buffer->write >= buffer->wrap)
+    }
+    else
+    {
+        XSync(x_connection->display, False);
+        latency_drawn(probe, 1);
+    }
+}
+
+
+static void
+terminal_draw(Terminal *terminal)
+{
+    RenderThread *render = terminal->render;
+    if (render)
+    {
+        XlibConnection *x_connection = terminal->x_connection;
+        unsigned width = x_connection ? x_connection->width : 0;
+        unsigned height = x_connection ? x_connection->height : 0;
+        render_thread_publish(render, terminal->screen, width, height);
+        STATS_COUNT(frames_published);
+
+        LatencyProbe *probe = terminal->probe;
+        if (probe && (probe->state == LATENCY_ECHOED) && !terminal->probe_frame)
         {
-            buffer->read -= buffer->size;
-            buffer->write -= buffer->size;
+            terminal->probe_frame = render->published;
         }
+        return;
+    }
+
+#ifdef STATS_ENABLED
+    if (terminal->overlay)
+    {
+        stats_format_overlay(terminal->overlay, STATS_OVERLAY_SIZE);
+    }
+#endif
+
+    STATS_START(draw_start);
+    terminal_lock(terminal);
+    if (terminal->x_connection)
+    {
+        draw_buffer(terminal->x_connection, terminal->screen);
+    }
+    else
+    {
+        headless_draw(terminal->headless, terminal->screen);
+    }
+    terminal_unlock(terminal);
+    STATS_STOP(STATS_DRAW_NS, draw_start);
+    STATS_COUNT(frames_drawn);
+
+    if (terminal->probe)
+    {
+        terminal_probe_drawn(terminal);
     }
-    return bytes_read;
 }
 
 
+// Whether the application is in the middle of a synchronized update, in which
+// case the frame clock is held until it times out
 static int
-pty_open(char *name, size_t len)
+terminal_held(Terminal *terminal)
 {
-    int pty_fd = posix_openpt(O_RDWR | O_NOCTTY);
-    if (pty_fd == -1)
+    if (!terminal->screen->synchronized)
     {
-        errno_exit("pty_open:posix_openpt");
+        terminal->synchronized_since = 0;
+        return 0;
     }
 
-    if(grantpt(pty_fd) == -1)
+    uint64_t now = now_ns();
+    if (!terminal->synchronized_since)
     {
-        errno_exit("pty_open:grantpt");
+        terminal->synchronized_since = now;
     }
+    uint64_t until = terminal->synchronized_since + SYNCHRONIZED_TIMEOUT_NS;
 
-    if (unlockpt(pty_fd) == -1)
+    int result = now < until;
+    if (result)
     {
-        errno_exit("pty_open:unlockpt");
+        frame_clock_hold(terminal->frame_clock, until);
     }
+    return result;
+}
+
 
-    char *pty_name = ptsname(pty_fd);
-    if (!pty_name)
+// Called when the screen changed
+static void
+terminal_changed(Terminal *terminal)
+{
+    if (terminal_held(terminal))
+    {
+        ++terminal->frames_held;
+        STATS_COUNT(frames_held);
+    }
+    else if (frame_clock_request(terminal->frame_clock))
+    {
+        terminal_draw(terminal);
+        frame_clock_drew(terminal->frame_clock);
+    }
+    else
     {
-        errno_exit("pty_open:ptsname");
+        STATS_COUNT(frames_skipped);
     }
+}
+
 
-    size_t copied = copy_string(name, pty_name, len);
-    if (copied == len)
+static void
+terminal_frame_due(Terminal *terminal)
+{
+    if (frame_clock_expired(terminal->frame_clock) && !terminal_held(terminal))
     {
-        errno = EOVERFLOW;
-        errno_exit("pty_open:copy_string");
+        terminal_draw(terminal);
+        frame_clock_drew(terminal->frame_clock);
     }
+}
+
 
-    return pty_fd;
+// Bytes actually backed by memory or disk, which for a sparse file is only
+// what was written to it
+static size_t
+file_allocated(int fd)
+{
+    struct stat status;
+    size_t result = (fstat(fd, &status) == 0) ? CAST(size_t, status.st_blocks) * 512 : 0;
+    return result;
 }
 
 
-static pid_t
-pty_spawn(int *fd, struct winsize *winsize)
+// Everything the terminal has committed, as opposed to only reserved
+static void
+terminal_report_memory(Terminal *terminal, FILE *file)
 {
-    pid_t pid = -1;
+    TerminalScreen *screen = terminal->screen;
+    Scrollback *scrollback = screen->scrollback;
+    MemoryArena *grids = screen->grid_arenas;
+
+    // The CPU renderers draw into a framebuffer with glyphs from an atlas, and
+    // Xft only keeps an index of the glyphs the server has. A render thread
+    // has a connection of its own and draws from three copies of the screen.
+    XlibConnection *x_connection = terminal->render ? &terminal->render->x_connection : terminal->x_connection;
+    Framebuffer *pixels = nullptr;
+    GlyphAtlas *atlas = nullptr;
+    size_t scratch = 0;
+    size_t glyphs = 0;
+    if (terminal->headless)
+    {
+        pixels = &terminal->headless->framebuffer;
+        atlas = &terminal->headless->atlas;
+    }
+    else if (x_connection->renderer == XLIB_RENDER_SHM)
+    {
+        pixels = &x_connection->framebuffer;
+        atlas = &x_connection->atlas;
+    }
+    else
+    {
+        scratch = x_connection->scratch.committed;
+        glyphs = GLYPH_CACHE_SIZE * sizeof(CachedGlyph);
+    }
+    size_t framebuffer = pixels ? pixels->stride * pixels->height * sizeof(*pixels->pixels) : 0;
+    if (atlas)
+    {
+        glyphs = GLYPH_ATLAS_SIZE * (sizeof(AtlasEntry) + atlas->slot_size);
+    }
+
+    size_t state = terminal->memory->committed;
+    size_t grid = grids[0].committed + grids[1].committed;
+    if (terminal->render)
+    {
+        RenderFrame *frames = terminal->render->frames;
+        for (unsigned i = 0; i < ARRAY_COUNT(terminal->render->frames); ++i)
+        {
+            grid += frames[i].screen.grid_arenas[0].committed + frames[i].screen.grid_arenas[1].committed;
+        }
+    }
+    size_t ring = terminal->data->size;
+    size_t queue = terminal->writer->queue.size;
+    size_t history = file_allocated(scrollback->cells_fd) + file_allocated(scrollback->lines_fd);
+
+    size_t kb = 1024;
+    fprintf(file, "memory %zu KB: state %zu KB, grids %zu KB (%zu KB in use at most), frame scratch %zu KB, "
+        "framebuffer %zu KB, glyphs %zu KB, output ring %zu KB%s, input queue %zu KB, scrollback %zu KB%s\n",
+        (state + grid + scratch + framebuffer + glyphs + ring + queue + history) / kb,
+        state / kb, grid / kb, (grids[0].peak + grids[1].peak) / kb, scratch / kb,
+        framebuffer / kb, glyphs / kb, ring / kb, terminal->data->huge ? " in huge pages" : "", queue / kb,
+        history / kb, scrollback->spilled ? " on disk" : "");
+}
+
 
-    size_t pty_name_len = PATH_MAX;
-    char *pty_name = malloc(pty_name_len);
-    if (!pty_name)
+static void
+terminal_dump(Terminal *terminal, const char *path)
+{
+    terminal_draw(terminal);
+    if (terminal->render)
     {
-        errno_exit("pty_spawn:malloc");
+        render_thread_flush(terminal->render);
     }
+    if (!headless_write_ppm(terminal->headless, path))
+    {
+        errno_exit(path);
+    }
+    printf("Wrote %s after %zu bytes\n", path, CAST(size_t, terminal->data->consumed));
+}
+
+
+static int
+xlib_process_events(XlibConnection *x_connection, int pty_fd, Terminal *terminal)
+{
+    int running = 1;
 
-    int parent_fd = pty_open(pty_name, pty_name_len);
-    if (parent_fd >= 0)
+    int event_count = XPending(x_connection->display);
+    while (event_count)
     {
-        pid = fork();
-        switch (pid)
+        for (int i = 0; i < event_count; ++i)
         {
-            // fork failed
-            case -1:
+            XEvent event;
+            XNextEvent(x_connection->display, &event);
+            switch (event.type)
             {
-                errno_exit("pty_spawn:fork");
-            } break;
+                case ConfigureNotify:
+                {
+                    if ((event.xconfigure.width != x_connection->width)
+                        || (event.xconfigure.height != x_connection->height))
+                    {
+                        xlib_resize(x_connection,
+                            CAST(unsigned, event.xconfigure.width), CAST(unsigned, event.xconfigure.height));
+                        terminal_resize(terminal, x_connection, pty_fd);
+                    }
+                } break;
 
-            // we're the child process
-            case 0:
-            {
-                if (setsid() == -1)
+                case Expose:
                 {
-                    errno_exit("pty_spawn:setsid");
-                }
+                    XExposeEvent *expose = &event.xexpose;
+                    terminal_lock(terminal);
+                    xlib_damage_rect(x_connection, terminal->screen,
+                        expose->x, expose->y, expose->width, expose->height);
+                    terminal_unlock(terminal);
+
+                    // The last event of a batch of exposures. Like any other
+                    // damage it waits out a synchronized update.
+                    if (!expose->count)
+                    {
+                        terminal_changed(terminal);
+                    }
+                } break;
 
-                close(parent_fd);
-                int child_fd = open(pty_name, O_RDWR);
-                if (child_fd == -1)
+                case GraphicsExpose:
+                case NoExpose:
                 {
-                    errno_exit("pty_spawn:open");
-                }
+                    terminal_lock(terminal);
+                    int damaged = xlib_copy_exposed(x_connection, terminal->screen, &event);
+                    terminal_unlock(terminal);
+                    if (damaged)
+                    {
+                        terminal_changed(terminal);
+                    }
+                } break;
 
-                if (winsize)
+                case KeyPress:
                 {
-                    if (ioctl(child_fd, TIOCSWINSZ, winsize) == -1)
+                    terminal_lock(terminal);
+                    int changed = xlib_process_key_press(&event.xkey, terminal->writer, terminal->screen,
+                        terminal->probe);
+                    terminal_unlock(terminal);
+                    if (changed)
                     {
-                        errno_exit("pty_spawn:ioctl TIOCSWINSZ");
+                        terminal_changed(terminal);
                     }
-                }
+                } break;
 
-                if (dup2(child_fd, STDIN_FILENO) != STDIN_FILENO)
+                case ButtonPress:
                 {
-                    errno_exit("pty_spawn:dup2 stdin");
-                }
-                if (dup2(child_fd, STDOUT_FILENO) != STDOUT_FILENO)
+                    if (event.xbutton.button == Button2)
+                    {
+                        xlib_request_paste(x_connection->display, x_connection->window, XA_PRIMARY);
+                    }
+                } break;
+
+                case SelectionNotify:
                 {
-                    errno_exit("pty_spawn:dup2 stdout");
-                }
-                if (dup2(child_fd, STDERR_FILENO) != STDERR_FILENO)
+                    if (event.xselection.property == NULLREF_PASTE)
+                    {
+                        xlib_process_paste(x_connection, terminal);
+                    }
+                } break;
+
+                case PropertyNotify:
                 {
-                    errno_exit("pty_spawn:dup2 stderr");
-                }
+                    if (x_connection->paste_incremental
+                        && (event.xproperty.atom == NULLREF_PASTE) && (event.xproperty.state == PropertyNewValue))
+                    {
+                        xlib_process_paste(x_connection, terminal);
+                    }
+                } break;
 
-                if (child_fd > STDERR_FILENO)
+                case ClientMessage:
                 {
-                    close(child_fd);
-                }
-            } break;
+                    if ((event.xclient.message_type == WM_PROTOCOLS)
+                        && (CAST(Atom, event.xclient.data.l[0]) == WM_DELETE_WINDOW))
+                    {
+                        running = 0;
+                    }
+                } break;
 
-            // we're the parent process. pid = the process id of the child
-            default:
-            {
-                *fd = parent_fd;
-            } break;
+                default:
+                {
+                    terminal_lock(terminal);
+                    int completed = xlib_shm_completed(x_connection, terminal->screen, &event);
+                    terminal_unlock(terminal);
+                    if (completed && terminal->probe)
+                    {
+                        // This may also have drawn a frame that was waiting
+                        latency_presented(terminal->probe);
+                        terminal_probe_drawn(terminal);
+                    }
+                } break;
+            }
         }
+        event_count = XPending(x_connection->display);
     }
 
-    free(pty_name);
-    return pid;
+    return running;
 }
 
 
-typedef struct XlibConnection
+// Handles output that was just read from the pty: parses it, sends whatever
+// replies it asked for and draws it if a frame is due
+static void
+terminal_output(Terminal *terminal, TerminalOptions *options)
 {
-    Display *display;
-    Window window;
-    int fd;
+    RawDataBuffer *data_buffer = terminal->data;
+    Parser *parser = terminal->parser;
+    TerminalScreen *screen = terminal->screen;
 
-    XftDraw *draw;
-    XftFont *font;
-    XftColor color;
-
-    unsigned short width;
-    unsigned short height;
-
-    unsigned short cursor_x;
-    unsigned short cursor_y;
-} XlibConnection;
+    if (terminal->probe)
+    {
+        latency_read(terminal->probe, data_buffer->written);
+    }
 
+    if (options->dump_path && options->dump_offset && !terminal->dumped)
+    {
+        parser_process_until(parser, screen, data_buffer, options->dump_offset);
+        if (data_buffer->consumed == options->dump_offset)
+        {
+            terminal_dump(terminal, options->dump_path);
+            terminal->dumped = 1;
+        }
+    }
+    STATS_START(parse_start);
+    parser_process(parser, screen, data_buffer);
+    STATS_STOP(STATS_PARSE_NS, parse_start);
+    if (terminal->reader)
+    {
+        pty_reader_consumed(terminal->reader);
+    }
 
-static Atom WM_PROTOCOLS;
-static Atom WM_DELETE_WINDOW;
+    if (parser->reply_size)
+    {
+        pty_write(terminal->writer, parser->reply, parser->reply_size);
+        parser->reply_size = 0;
+    }
+    if (parser->title_changed)
+    {
+        if (terminal->x_connection)
+        {
+            xlib_set_title(terminal->x_connection->display, terminal->x_connection->window, parser->title);
+        }
+        parser->title_changed = 0;
+    }
+    terminal_changed(terminal);
+}
 
 
+// Called when the probe's timer fires
 static void
-xlib_process_key_press(XKeyEvent *event, int pty_fd)
+terminal_probe_key(Terminal *terminal)
 {
-    char buf[32];
-    KeySym keysym;
-    int bytes = XLookupString(event, buf, sizeof(buf), &keysym, 0);
-#if 0
-    printf("KeySym: %lu (%s) -> %d bytes: ", keysym, XKeysymToString(keysym), bytes);
-    for (int i = 0; i < bytes; ++i)
+    LatencyProbe *probe = terminal->probe;
+    if (latency_key_due(probe))
     {
-        if (i)
+        char key = latency_next_key(probe);
+        if (terminal->x_connection)
         {
-            printf(", ");
-        }
-        char c = buf[i];
-        if (is_printable(c))
-        {
-            printf("%d (%c)", c, c);
+            // Latin-1 keysyms are the characters themselves
+            xlib_send_key(terminal->x_connection, CAST(KeySym, key));
         }
         else
         {
-            printf("%d", c);
+            if (pty_write(terminal->writer, &key, 1))
+            {
+                latency_key_written(probe, 1);
+            }
         }
     }
-    fputs("\n", stdout);
-#endif
-    write(pty_fd, buf, CAST(size_t, bytes));
 }
 
 
+// Called when the render thread put another frame on screen
 static void
-draw_buffer(XlibConnection *x_connection, Terminal *terminal)
+terminal_presented(Terminal *terminal)
 {
-    printf("%s: width = %u, height = %u\n", __func__, x_connection->width, x_connection->height);
-    XClearWindow(x_connection->display, x_connection->window);
+    uint64_t presented = render_thread_presented(terminal->render);
+    if (terminal->probe_frame && (presented >= terminal->probe_frame))
+    {
+        latency_drawn(terminal->probe, 1);
+        terminal->probe_frame = 0;
+    }
+}
 
-    TerminalLineBuffer *lines = terminal->buffer;
-    RawDataBuffer *data = lines->data;
 
-    // @todo Handle jumps in the cursor position
-    unsigned cursor_x = 0;
-    unsigned cursor_y = 0;
-    if (terminal->rows > lines->total_line_count)
+#ifdef STATS_ENABLED
+static void
+terminal_report_signal(Terminal *terminal)
+{
+    struct signalfd_siginfo info;
+    if (read(terminal->signal_fd, &info, sizeof(info)) != sizeof(info))
     {
-        cursor_y = CAST(unsigned, lines->total_line_count);
+        errno_exit("read signalfd");
     }
-    else
+    stats_dump(stdout);
+    terminal_report_memory(terminal, stdout);
+    fflush(stdout);
+}
+#endif
+
+
+static void
+run_epoll(Terminal *terminal, TerminalOptions *options)
+{
+    XlibConnection *x_connection = terminal->x_connection;
+    FrameClock *frame_clock = terminal->frame_clock;
+    LatencyProbe *probe = terminal->probe;
+    PtyReader *reader = terminal->reader;
+    int pty_fd = terminal->pty_fd;
+
+    // With a reader thread, the main thread waits for it to publish data
+    // rather than for the pty itself. Otherwise the pty is edge-triggered and
+    // drained on every wakeup, so a burst of output is parsed and drawn once
+    // however many reads it takes.
+    int input_fd = pty_fd;
+    uint32_t pty_events = EPOLLIN | EPOLLET;
+
+    // Frames going on screen only matter to the probe
+    int presented_fd = (terminal->render && probe) ? terminal->render->presented_fd : -1;
+    if (reader)
     {
-        cursor_y = terminal->rows;
+        input_fd = reader->event_fd;
+        pty_events = EPOLLIN;
     }
 
-    size_t current_line = lines->current_line;
-    int x_pos = 0;
-    int y_pos = CAST(int, cursor_y) * x_connection->font->height - x_connection->font->descent;
-    for (size_t lines_to_draw = 0; lines_to_draw < cursor_y; ++lines_to_draw)
+    enum ClientFds {
+        X_FD,
+        PTY_FD,
+        FRAME_FD,
+        LATENCY_FD,
+        SIGNAL_FD,
+        PRESENTED_FD,
+
+        FD_COUNT,
+    };
+    struct epoll_event epoll_events[] = {
+        [X_FD] = { .events = EPOLLIN, .data = {.fd = x_connection ? x_connection->fd : -1} },
+        [PTY_FD] = { .events = pty_events, .data = {.fd = input_fd} },
+        [FRAME_FD] = { .events = EPOLLIN, .data = {.fd = frame_clock->fd} },
+        [LATENCY_FD] = { .events = EPOLLIN, .data = {.fd = probe ? probe->fd : -1} },
+        [SIGNAL_FD] = { .events = EPOLLIN, .data = {.fd = terminal->signal_fd} },
+        [PRESENTED_FD] = { .events = EPOLLIN, .data = {.fd = presented_fd} },
+    };
+
+    int epollfd = epoll_create(FD_COUNT);
+    if (epollfd == -1)
     {
-        TerminalLine *line = lines->lines + current_line;
+        errno_exit("epoll_create");
+    }
 
-        // @todo Handle long lines whose start may no longer be in the buffer
-        // In this case we probably want to display the portion of the line
-        // which may still be in the buffer
-        if (data->bytes_read - line->one_past_last_byte >= data->size)
+    // The ones that aren't there are left out
+    for (unsigned i = 0; i < FD_COUNT; ++i)
+    {
+        if ((epoll_events[i].data.fd != -1)
+            && (epoll_ctl(epollfd, EPOLL_CTL_ADD, epoll_events[i].data.fd, epoll_events + i) == -1))
         {
-            printf("skipping line %zu: last_byte = %zu but first available is %zu\n",
-                current_line, line->one_past_last_byte, data->bytes_read - data->size);
-            break;
+            errno_exit("epoll_ctl");
         }
+    }
 
-        size_t first_byte = line->first_byte;
-        size_t offset = data->bytes_read - first_byte;
+    PtyWriter *writer = terminal->writer;
+    pty_writer_create(writer, pty_fd, epollfd, reader ? 0 : pty_events);
 
-        if (offset > data->size)
+    int running = x_connection ? xlib_process_events(x_connection, pty_fd, terminal) : 1;
+    while (running)
+    {
+        int nfds = epoll_wait(epollfd, epoll_events, ARRAY_COUNT(epoll_events), -1);
+        if (nfds == -1)
         {
-            offset = data->size;
-            first_byte = data->bytes_read - offset;
+            errno_exit("epoll_wait");
         }
+        STATS_WAKEUP();
 
-        char *byte_to_read = data->write - offset;
-        while ((first_byte++ < line->one_past_last_byte) && (x_pos < x_connection->width))
+        for (int i = 0; i < nfds; ++i)
         {
-            char c = *byte_to_read++;
-            if (is_printable(c))
+            struct epoll_event *epoll_event = epoll_events + i;
+
+            // Input and output are served a chunk each per wakeup, so neither
+            // can starve the other
+            if ((pty_fd == epoll_event->data.fd) && (epoll_event->events & EPOLLOUT))
             {
-                XftDrawStringUtf8(
-                    x_connection->draw, &x_connection->color, x_connection->font,
-                    x_pos, y_pos, CAST(FcChar8 *, &c), 1);
-                x_pos += x_connection->font->max_advance_width;
+                pty_writer_flush(writer);
             }
-            else
+
+            if ((input_fd == epoll_event->data.fd) && (epoll_event->events & ~CAST(uint32_t, EPOLLOUT)))
             {
-                switch (c)
+                int open;
+                int drained = 1;
+                if (reader)
                 {
-                    case '\r':
-                    {
-                        x_pos = 0;
-                    } break;
-
-                    case '\n':
-                    {
-                        // Don't have to do anything, because this triggers an end-of-line
-                    } break;
+                    open = pty_reader_wait(reader);
+                }
+                else
+                {
+                    PtyDrain drain = pty_drain(pty_fd, terminal->data);
+                    open = !drain.closed;
+                    drained = drain.drained;
+                }
+                terminal_output(terminal, options);
 
-                    default:
-                    {
-                        printf("unrecognized control character: %d\n", c);
-                    }
+                if (!open)
+                {
+                    puts("pty closed, quitting...");
+                    running = 0;
+                }
+                else if (!drained)
+                {
+                    // The buffer filled up or the batch hit its limit, so the
+                    // rest is read after whatever else is waiting has had its
+                    // turn
+                    pty_writer_rearm(writer);
                 }
             }
+            else if (frame_clock->fd == epoll_event->data.fd)
+            {
+                terminal_frame_due(terminal);
+            }
+            else if (probe && (probe->fd == epoll_event->data.fd))
+            {
+                terminal_probe_key(terminal);
+            }
+            else if ((presented_fd != -1) && (presented_fd == epoll_event->data.fd))
+            {
+                terminal_presented(terminal);
+            }
+#ifdef STATS_ENABLED
+            else if (terminal->signal_fd == epoll_event->data.fd)
+            {
+                terminal_report_signal(terminal);
+            }
+#endif
+            else
+            {
+                ASSERT((x_connection && (x_connection->fd == epoll_event->data.fd)) || (pty_fd == epoll_event->data.fd));
+            }
         }
-
-        if (current_line)
+        if (running && x_connection)
         {
-            --current_line;
+            running = xlib_process_events(x_connection, pty_fd, terminal);
         }
-        else
+        if (probe && latency_done(probe))
         {
-            current_line = ARRAY_COUNT(lines->lines) - 1;
+            running = 0;
         }
-        x_pos = 0;
-        y_pos -= x_connection->font->height;
     }
+}
+
 
-    cursor_x = CAST(unsigned, x_pos / x_connection->font->max_advance_width);
-    cursor_y = CAST(unsigned, y_pos / x_connection->font->height);
+// What each completion of the ring is for
+enum RingTag
+{
+    RING_PTY_READ,
+    RING_PTY_READABLE,
+    RING_PTY_WRITABLE,
+    RING_X,
+    RING_FRAME,
+    RING_LATENCY,
+    RING_SIGNAL,
+    RING_PRESENTED,
+};
+
+
+// The data buffer is read into without the kernel looking up its pages every
+// time, as long as they could be locked in memory. It's registered at twice
+// its size, since a read that wraps around the end runs into the next copy.
+static int
+ring_register_buffer(IoRing *ring, RawDataBuffer *buffer)
+{
+    struct iovec iovec = { .iov_base = buffer->base, .iov_len = 2 * buffer->size };
 
-    terminal->cursor_x = cursor_x;
-    terminal->cursor_y = cursor_y;
+    int result = io_ring_register_buffers(ring, &iovec, 1);
+    return result;
 }
 
 
 static void
-terminal_resize(Terminal *terminal, XlibConnection *x_connection, int pty_fd)
+ring_read_pty(IoRing *ring, Terminal *terminal)
 {
-    terminal->cols = CAST(unsigned, x_connection->width / x_connection->font->max_advance_width);
-    terminal->rows = CAST(unsigned, x_connection->height / x_connection->font->height);
-    struct winsize terminal_size = {
-        .ws_row = CAST(unsigned short, terminal->rows),
-        .ws_col = CAST(unsigned short, terminal->cols),
-    };
-
-    if (ioctl(pty_fd, TIOCSWINSZ, &terminal_size) == -1)
-        errno_exit("terminal_resize: ioctl");
+    size_t space;
+    char *write = data_buffer_reserve(terminal->data, &space);
+    ASSERT(space);
+    io_ring_read(ring, terminal->pty_fd, write, CAST(unsigned, minull(space, TYPE_MAX(unsigned))),
+        ring->buffers_registered ? 0 : -1, RING_PTY_READ);
 }
 
 
-static int
-xlib_process_events(XlibConnection *x_connection, int pty_fd, Terminal *terminal)
+// The same as run_epoll, except everything goes through an io_uring: one read
+// is always in flight on the pty, straight into the data buffer, and every
+// other fd is polled. The next read is submitted with the same io_uring_enter
+// that waits for the next completion, so output that keeps coming costs one
+// system call per read rather than a wait and a read, and X is only asked for
+// events when it sent some.
+//
+// Reads aren't multishot or linked, since each one has to start where the last
+// one ended in the ring and a pty never says how much that will be. Writes are
+// still made right away and only wait for the pty through the ring, since a
+// key written through the ring took several times as long to come back.
+static void
+run_ring(IoRing *ring, Terminal *terminal, TerminalOptions *options)
 {
-    int running = 1;
+    XlibConnection *x_connection = terminal->x_connection;
+    RawDataBuffer *data_buffer = terminal->data;
+    LatencyProbe *probe = terminal->probe;
+    int pty_fd = terminal->pty_fd;
+
+    PtyWriter *writer = terminal->writer;
+    pty_writer_create(writer, pty_fd, -1, 0);
+    pty_writer_use_ring(writer, ring, RING_PTY_WRITABLE);
+
+    int registered = ring_register_buffer(ring, data_buffer);
+    char *registered_base = data_buffer->base;
+
+    struct
+    {
+        int fd;
+        uint64_t tag;
+    } polls[] = {
+        { x_connection ? x_connection->fd : -1, RING_X },
+        { terminal->frame_clock->fd, RING_FRAME },
+        { probe ? probe->fd : -1, RING_LATENCY },
+        { terminal->signal_fd, RING_SIGNAL },
+        { (terminal->render && probe) ? terminal->render->presented_fd : -1, RING_PRESENTED },
+    };
+    for (unsigned i = 0; i < ARRAY_COUNT(polls); ++i)
+    {
+        if (polls[i].fd != -1)
+        {
+            io_ring_poll(ring, polls[i].fd, POLLIN, 1, polls[i].tag);
+        }
+    }
+    ring_read_pty(ring, terminal);
 
-    int event_count = XPending(x_connection->display);
-    while (event_count)
+    int running = x_connection ? xlib_process_events(x_connection, pty_fd, terminal) : 1;
+    while (running)
     {
-        for (int i = 0; i < event_count; ++i)
+        io_ring_enter(ring, 1);
+        STATS_WAKEUP();
+
+        int x_ready = 0;
+        struct io_uring_cqe *cqe;
+        while (running && (cqe = io_ring_cqe(ring)))
         {
-            XEvent event;
-            XNextEvent(x_connection->display, &event);
-            switch (event.type)
+            uint64_t tag = cqe->user_data;
+            int result = cqe->res;
+            unsigned flags = cqe->flags;
+            io_ring_seen(ring);
+
+            switch (tag)
             {
-                case ConfigureNotify:
+                case RING_PTY_READ:
                 {
-                    if ((event.xconfigure.width != x_connection->width)
-                        || (event.xconfigure.height != x_connection->height))
+                    if (result == -EINTR)
                     {
-                        puts("Window resized");
-                        x_connection->width = CAST(unsigned short, event.xconfigure.width);
-                        x_connection->height = CAST(unsigned short, event.xconfigure.height);
-                        terminal_resize(terminal, x_connection, pty_fd);
+                        ring_read_pty(ring, terminal);
+                    }
+                    else if (result == -EAGAIN)
+                    {
+                        io_ring_poll(ring, pty_fd, POLLIN, 0, RING_PTY_READABLE);
+                    }
+                    else if (result <= 0)
+                    {
+                        // EIO is how the pty reports that the child side was
+                        // closed
+                        if (result && (result != -EIO))
+                        {
+                            errno = -result;
+                            perror("pty read");
+                        }
+                        puts("pty closed, quitting...");
+                        running = 0;
+                    }
+                    else
+                    {
+                        STATS_RECORD(STATS_BYTES_PER_READ, CAST(uint64_t, result));
+                        data_buffer_commit(data_buffer, CAST(size_t, result));
+                        data_buffer_filled(data_buffer);
+                        if (registered && (data_buffer->base != registered_base))
+                        {
+                            // The buffer grew into a new ring, and nothing is
+                            // in flight on the old one
+                            registered = ring_register_buffer(ring, data_buffer);
+                            registered_base = data_buffer->base;
+                        }
+
+                        terminal_output(terminal, options);
+                        ring_read_pty(ring, terminal);
                     }
                 } break;
 
-                case Expose:
+                case RING_PTY_READABLE:
                 {
-                    puts("Expose");
-                    draw_buffer(x_connection, terminal);
+                    ring_read_pty(ring, terminal);
                 } break;
 
-                case KeyPress:
+                case RING_PTY_WRITABLE:
                 {
-                    xlib_process_key_press(&event.xkey, pty_fd);
+                    pty_writer_polled(writer);
                 } break;
 
-                case ClientMessage:
+                case RING_X:
                 {
-                    if ((event.xclient.message_type == WM_PROTOCOLS)
-                        && (CAST(Atom, event.xclient.data.l[0]) == WM_DELETE_WINDOW))
-                    {
-                        running = 0;
-                    }
+                    x_ready = 1;
                 } break;
-            }
-        }
-        event_count = XPending(x_connection->display);
-    }
-
-    return running;
-}
 
+                case RING_FRAME:
+                {
+                    terminal_frame_due(terminal);
+                } break;
 
-#if 0
-static XRenderColor
-xlib_rgba_bytes(unsigned char r, unsigned char g, unsigned char b, unsigned char a)
-{
-    XRenderColor result = {
-        .red = r * EXPR_MAX(result.red) / EXPR_MAX(r),
-        .green = g * EXPR_MAX(result.green) / EXPR_MAX(g),
-        .blue = b * EXPR_MAX(result.blue) / EXPR_MAX(b),
-        .alpha = a * EXPR_MAX(result.alpha) / EXPR_MAX(a),
-    };
+                case RING_LATENCY:
+                {
+                    terminal_probe_key(terminal);
+                } break;
 
-    _Static_assert(EXPR_MAX(result.red) <= (INT_MAX / EXPR_MAX(r)), "Integer overflow");
-    _Static_assert(EXPR_MAX(result.blue) <= (INT_MAX / EXPR_MAX(g)), "Integer overflow");
-    _Static_assert(EXPR_MAX(result.green) <= (INT_MAX / EXPR_MAX(b)), "Integer overflow");
-    _Static_assert(EXPR_MAX(result.alpha) <= (INT_MAX / EXPR_MAX(a)), "Integer overflow");
+                case RING_PRESENTED:
+                {
+                    terminal_presented(terminal);
+                } break;
 
-    return result;
-}
+#ifdef STATS_ENABLED
+                case RING_SIGNAL:
+                {
+                    terminal_report_signal(terminal);
+                } break;
 #endif
 
+                default:
+                {
+                    ASSERT(!"unknown ring tag");
+                } break;
+            }
 
-static XRenderColor
-xlib_rgba_floats(float r, float g, float b, float a)
-{
-    ASSERT(r >= 0 && r <= 1);
-    ASSERT(g >= 0 && g <= 1);
-    ASSERT(b >= 0 && b <= 1);
-    ASSERT(a >= 0 && a <= 1);
+            // A multishot poll that won't complete again is queued again
+            for (unsigned i = 0; i < ARRAY_COUNT(polls); ++i)
+            {
+                if ((polls[i].tag == tag) && !(flags & IORING_CQE_F_MORE))
+                {
+                    io_ring_poll(ring, polls[i].fd, POLLIN, 1, tag);
+                }
+            }
+        }
 
-    XRenderColor result = {
-        .red = CAST(unsigned short, (r * EXPR_MAX(result.red)) + .5),
-        .green = CAST(unsigned short, (g * EXPR_MAX(result.blue)) + .5),
-        .blue = CAST(unsigned short, (b * EXPR_MAX(result.green)) + .5),
-        .alpha = CAST(unsigned short, (a * EXPR_MAX(result.alpha)) + .5),
-    };
+        // Xlib may also have read events off the connection while it waited
+        // for a reply, which the poll never sees. Looking at its queue costs
+        // nothing, unlike XPending, which asks the kernel every time.
+        if (running && x_connection)
+        {
+            if (x_ready || XEventsQueued(x_connection->display, QueuedAlready))
+            {
+                running = xlib_process_events(x_connection, pty_fd, terminal);
+            }
+            else
+            {
+                XFlush(x_connection->display);
+            }
+        }
+        if (probe && latency_done(probe))
+        {
+            running = 0;
+        }
+    }
 
-    return result;
+    if (terminal->headless)
+    {
+        printf("%zu io_uring_enter calls for %zu bytes, %.1f per MB\n", ring->enters, data_buffer->written,
+            data_buffer->written ? CAST(double, ring->enters) * 1024 * 1024 / CAST(double, data_buffer->written) : 0);
+    }
 }
 
 
 static void
-xlib_window_create(XlibConnection *connection)
+run_terminal(int pty_fd, TerminalOptions *options)
 {
-    Display *display = XOpenDisplay(0);
-    if (!display)
+    // Writes are queued rather than waited on, so a child that isn't reading
+    // can't stop the terminal from reading its output
+    int flags = fcntl(pty_fd, F_GETFL);
+    if ((flags == -1) || (fcntl(pty_fd, F_SETFL, flags | O_NONBLOCK) == -1))
     {
-        error_exit("xlib_window_create:XOpenDisplay");
+        errno_exit("fcntl pty");
     }
 
-    int screen = DefaultScreen(display);
-    unsigned screen_width = CAST(unsigned, DisplayWidth(display, screen));
-    unsigned screen_height = CAST(unsigned, DisplayHeight(display, screen));
-
-    XftFont *font = XftFontOpen(
-        display, screen,
-        XFT_FAMILY, XftTypeString, "mono",
-        nullptr);
-    if (!font)
+    static IoRing ring;
+    int use_ring = options->io_ring && io_ring_create(&ring, IO_RING_ENTRIES);
+    if (options->io_ring && !use_ring)
     {
-        error_exit("XftFontOpen");
+        perror("io_uring, using epoll instead");
     }
-    printf("Font: width: %d, height: %d, ascent: %d, descent: %d\n",
-        font->max_advance_width, font->height, font->ascent, font->descent);
 
-    unsigned font_width = CAST(unsigned, font->max_advance_width);
-    unsigned font_height = CAST(unsigned, font->height);
-
-    unsigned cols = 80;
-    unsigned rows = 25;
-
-    unsigned window_width = font_width * cols;
-    if (window_width > screen_width)
+    RawDataBuffer data_buffer;
+    size_t buffer_size = options->reader_thread ? PTY_READER_BUFFER_SIZE : DEFAULT_DATA_BUFFER_SIZE;
+    if (options->buffer_kilobytes)
     {
-        window_width = alignu_down(screen_width, font_width);
-        cols = window_width / font_width;
+        buffer_size = options->buffer_kilobytes * 1024;
     }
+    data_buffer_create(&data_buffer, buffer_size);
 
-    unsigned window_height = font_height * rows;
-    if (window_height > screen_height)
+    // Without a reader thread the buffer is only ever touched here, so it can
+    // grow whenever output keeps filling it
+    if (!options->reader_thread && (data_buffer.max_size < DATA_BUFFER_GROW_LIMIT))
     {
-        window_height = alignu_down(screen_height, font_height);
-        rows = window_height / font_height;
+        data_buffer.max_size = DATA_BUFFER_GROW_LIMIT;
     }
 
-    Window parent = RootWindow(display, screen);
-    int window_x = CAST(int, (screen_width - window_width) / 2);
-    int window_y = CAST(int, (screen_height - window_height) / 2);
-    unsigned border_width = 0;
-
-    int color_depth = CopyFromParent;
-    unsigned int window_class = InputOutput;
-    Visual *visual = DefaultVisual(display, screen);
+    Parser parser;
+    parser_create(&parser);
 
-    unsigned long attribute_mask = CWBackPixel | CWEventMask;
-    XSetWindowAttributes attributes = {
-        .background_pixel = BlackPixel(display, screen),
-        .event_mask = ExposureMask | KeyPressMask | StructureNotifyMask,
-    };
-
-    Window window = XCreateWindow(
-            display, parent,
-            window_x, window_y, window_width, window_height, border_width,
-            color_depth, window_class, visual,
-            attribute_mask, &attributes);
+    MemoryArena memory;
+    arena_create(&memory, TERMINAL_ARENA_RESERVE);
 
-    char *window_name = "Terminal";
-    XTextProperty wm_name;
-    Xutf8TextListToTextProperty(display, &window_name, 1, XUTF8StringStyle, &wm_name);
-    XSetWMName(display, window, &wm_name);
-    XFree(wm_name.value);
-
-    XWMHints *wm_hints = XAllocWMHints();
-    if (wm_hints)
+    TerminalScreen *screen = arena_push(&memory, sizeof(*screen));
+    if (options->headless)
     {
-        wm_hints->flags = InputHint | StateHint;
-        wm_hints->input = True;
-        wm_hints->initial_state = NormalState;
-        XSetWMHints(display, window, wm_hints);
-        XFree(wm_hints);
+        screen_create(screen, options->headless_cols, options->headless_rows, nullptr);
     }
     else
     {
-        error_exit("xlib_window_create:XAllocWMHints");
+        screen_create(screen, SCREEN_DEFAULT_COLS, SCREEN_DEFAULT_ROWS, nullptr);
     }
 
-    XSizeHints *wm_normal_hints = XAllocSizeHints();
-    if (wm_normal_hints)
-    {
-        wm_normal_hints->flags = PPosition | PSize;
-        XSetWMNormalHints(display, window, wm_normal_hints);
-        XFree(wm_normal_hints);
-    }
-    else
-    {
-        error_exit("xlib_window_create:XAllocSizeHints");
-    }
+    Scrollback *scrollback = arena_push(&memory, sizeof(*scrollback));
+    scrollback_create(scrollback, options->scrollback_megabytes * 1024 * 1024);
+    screen->scrollback = scrollback;
 
-    XClassHint *wm_class = XAllocClassHint();
-    if (wm_class)
+    Terminal terminal = {
+        .memory = &memory,
+        .data = &data_buffer,
+        .parser = &parser,
+        .screen = screen,
+        .signal_fd = -1,
+    };
+
+    static XlibConnection x_connection;
+    static HeadlessRenderer headless;
+    if (options->headless)
     {
-        wm_class->res_name = "terminal";
-        wm_class->res_class = "Terminal Emulator";
-        XSetClassHint(display, window, wm_class);
-        XFree(wm_class);
+        headless_create(&headless, "mono", screen->cols, screen->rows);
+        terminal.headless = &headless;
     }
     else
     {
-        error_exit("xlib_window_create:XAllocClassHint");
+        // One connection is used by each thread
+        if (options->render_thread && !XInitThreads())
+        {
+            error_exit("XInitThreads");
+        }
+        xlib_window_create(&x_connection, options->renderer);
+        terminal.x_connection = &x_connection;
     }
 
-    WM_PROTOCOLS = XInternAtom(display, "WM_PROTOCOLS", False);
-    if (!WM_PROTOCOLS)
+#ifdef STATS_ENABLED
+    static char overlay[STATS_OVERLAY_SIZE];
+    if (options->stats_overlay)
     {
-        error_exit("xlib_window_create:XInternAtom WM_PROTOCOLS");
+        terminal.overlay = overlay;
+        x_connection.overlay = overlay;
+        headless.overlay = overlay;
     }
-    WM_DELETE_WINDOW = XInternAtom(display, "WM_DELETE_WINDOW", False);
-    if (!WM_DELETE_WINDOW)
+
+    // SIGUSR1 dumps the stats. It's taken through a signalfd in the main loop
+    // rather than a handler, so it's blocked before any thread is started.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    if (sigprocmask(SIG_BLOCK, &signals, nullptr) == -1)
     {
-        error_exit("xlib_window_create:XInternAtom WM_DELETE_WINDOW");
+        errno_exit("sigprocmask");
     }
-    if (!XSetWMProtocols(display, window, &WM_DELETE_WINDOW, 1))
+    terminal.signal_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+    if (terminal.signal_fd == -1)
     {
-        error_exit("xlib_window_create:XSetWmProtocols");
+        errno_exit("signalfd");
     }
+#endif
 
-    XMapWindow(display, window);
-
-    Colormap colormap = DefaultColormap(display, screen);
-    //XRenderColor value = xlib_rgba_bytes(255, 255 / 2, 0, 255);
-    XRenderColor value = xlib_rgba_floats(1, 1, 1, 1);
-    XftColor color;
-    XftColorAllocValue(display, visual, colormap, &value, &color);
-
-    XftDraw *draw = XftDrawCreate(display, window, visual, DefaultColormap(display, screen));
-
-    connection->display = display;
-    connection->window = window;
-    connection->fd = ConnectionNumber(display);
-    connection->draw = draw;
-    connection->font = font;
-    connection->color = color;
-    connection->width = 0;
-    connection->height = 0;
-}
-
-
-static void
-parse_lines(TerminalLineBuffer *buffer)
-{
-    // @todo Handle jumps in the cursor position
-
-    // IMPORTANT! This function needs to see all data in order to properly
-    // parse whatever the end state of the terminal is, even if the terminal
-    // ends up not displaying it all (e.g., a block of data is received that
-    // exceeds a full screen of data)
-    RawDataBuffer *data = buffer->data;
-    size_t bytes_to_read = CAST(size_t, data->write - data->read);
-    size_t current_byte = data->bytes_read - bytes_to_read;
+    FrameClock frame_clock;
+    frame_clock_create(&frame_clock, options->frame_rate);
 
-    TerminalLine *line = buffer->lines + buffer->current_line;
-    while (data->read < data->write)
+    LatencyProbe probe = { .fd = -1 };
+    if (options->latency_keys)
     {
-        line->one_past_last_byte = ++current_byte;
+        latency_create(&probe, options->latency_keys);
+        terminal.probe = &probe;
+    }
 
-        if ('\n' == *data->read++)
-        {
-            ++buffer->total_line_count;
-            if (++buffer->current_line == ARRAY_COUNT(buffer->lines))
-            {
-                buffer->current_line = 0;
-            }
+    terminal.pty_fd = pty_fd;
+    terminal.frame_clock = &frame_clock;
 
-            line = buffer->lines + buffer->current_line;
-            line->first_byte = line->one_past_last_byte = current_byte;
-        }
+    // The probe waits for its frames to be on screen
+    static RenderThread render;
+    if (options->render_thread)
+    {
+        render_thread_start(&render, screen, terminal.x_connection, terminal.headless, terminal.overlay,
+            terminal.probe != nullptr);
+        terminal.render = &render;
     }
-}
 
+    PtyReader reader;
+    if (options->reader_thread)
+    {
+        pty_reader_start(&reader, pty_fd, &data_buffer);
+        terminal.reader = &reader;
+    }
 
-static void
-data_buffer_create(RawDataBuffer *buffer, size_t size)
-{
-    long page_size = sysconf(_SC_PAGESIZE);
+    PtyWriter writer;
+    terminal.writer = &writer;
 
-    size_t aligned_size = alignull_up2(size, CAST(size_t, page_size));
-    if ((aligned_size < size) || (aligned_size > EXPR_MAX(aligned_size) / 3))
+    if (use_ring)
     {
-        errno = EOVERFLOW;
-        errno_exit("data_buffer_create: buffer size");
+        run_ring(&ring, &terminal, options);
     }
-
-    int fd = memfd_create("data buffer", 0);
-    if (fd == -1)
+    else
     {
-        errno_exit("data_buffer_create: memfd_create");
+        run_epoll(&terminal, options);
     }
 
-    ASSERT(aligned_size < TYPE_MAX(off_t));
-    if (ftruncate(fd, CAST(off_t, aligned_size)) == -1)
+    // The window can be closed while the child is still writing, so the
+    // reader is stopped rather than waited on
+    if (terminal.reader)
     {
-        errno_exit("data_buffer_create: ftruncate");
+        pty_reader_stop(&reader);
+        terminal.reader = nullptr;
     }
 
-    char *start = mmap(nullptr, 3 * aligned_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (MAP_FAILED == start)
+    if (terminal.probe)
     {
-        errno_exit("data_buffer_create: mmap");
+        latency_report(&probe, stdout);
     }
 
-    int prot = PROT_READ | PROT_WRITE;
-    int flags = MAP_SHARED | MAP_FIXED;
-    if (mmap(start, aligned_size, prot, flags, fd, 0) == MAP_FAILED)
+    if (terminal.headless && options->dump_path && !terminal.dumped)
     {
-        errno_exit("map first buffer");
+        terminal_dump(&terminal, options->dump_path);
     }
-    if (mmap(start + aligned_size, aligned_size, prot, flags, fd, 0) == MAP_FAILED)
+    if (terminal.render)
     {
-        errno_exit("map second buffer");
+        render_thread_stop(&render);
     }
-    if (mmap(start + 2 * aligned_size, aligned_size, prot, flags, fd, 0) == MAP_FAILED)
+
+    if (terminal.headless)
     {
-        errno_exit("map third buffer");
+        double seconds = CAST(double, headless.draw_ns) / 1e9;
+        printf("Drew %zu frames in %.3f s, %.0f frames/s, %zu changes held back by synchronized updates\n",
+            headless.frames, seconds, seconds ? CAST(double, headless.frames) / seconds : 0,
+            terminal.frames_held);
+        terminal_report_memory(&terminal, stdout);
     }
-    close(fd);
 
-    buffer->size = aligned_size;
-    buffer->bytes_read = 0;
-    buffer->base = start;
-    buffer->wrap = start + 2 * aligned_size;
-    buffer->read = start;
-    buffer->write = start;
+    close(pty_fd);
 }
 
 
+// Shows a session's screen in a window. Nothing is read from the pty here; the
+// session says when the screen changed and it's drawn straight from the shared
+// memory.
 static void
-run_terminal(int pty_fd)
+run_viewer(SessionView *view, TerminalOptions *options)
 {
-    RawDataBuffer data_buffer;
-    data_buffer_create(&data_buffer, 4000);
+    // The session going away shows up as the socket closing, which is noticed
+    // when it's next read rather than by a signal in the middle of a write
+    signal(SIGPIPE, SIG_IGN);
 
-    TerminalLineBuffer *line_buffer = mmap(nullptr, sizeof(*line_buffer),
-            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (MAP_FAILED == line_buffer)
-    {
-        errno_exit("mmap line_buffer");
-    }
-    line_buffer->data = &data_buffer;
-    line_buffer->total_line_count = 1;
+    Terminal terminal = { .screen = view->shared->screen, .view = view };
 
-    XlibConnection x_connection;
-    xlib_window_create(&x_connection);
+    static XlibConnection x_connection;
+    xlib_window_create(&x_connection, options->renderer);
+    terminal.x_connection = &x_connection;
 
-    Terminal terminal = { .buffer = line_buffer };
+    FrameClock frame_clock;
+    frame_clock_create(&frame_clock, options->frame_rate);
+    terminal.frame_clock = &frame_clock;
 
-    enum ClientFds {
+    enum ViewerFds {
         X_FD,
-        PTY_FD,
+        UPDATE_FD,
+        SOCKET_FD,
+        FRAME_FD,
 
         FD_COUNT,
     };
     struct epoll_event epoll_events[] = {
         [X_FD] = { .events = EPOLLIN, .data = {.fd = x_connection.fd} },
-        [PTY_FD] = { .events = EPOLLIN, .data = {.fd = pty_fd} },
+        [UPDATE_FD] = { .events = EPOLLIN, .data = {.fd = view->update_fd} },
+        [SOCKET_FD] = { .events = EPOLLIN, .data = {.fd = view->socket_fd} },
+        [FRAME_FD] = { .events = EPOLLIN, .data = {.fd = frame_clock.fd} },
     };
 
     int epollfd = epoll_create(FD_COUNT);
@@ -878,60 +1385,115 @@ run_terminal(int pty_fd)
     {
         errno_exit("epoll_create");
     }
-
-    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, x_connection.fd, epoll_events + X_FD) == -1)
-    {
-        errno_exit("epoll_ctl X window");
-    }
-    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, pty_fd, epoll_events + PTY_FD) == -1)
+    for (int i = 0; i < FD_COUNT; ++i)
     {
-        errno_exit("epoll_ctl pty");
+        if (epoll_ctl(epollfd, EPOLL_CTL_ADD, epoll_events[i].data.fd, epoll_events + i) == -1)
+        {
+            errno_exit("epoll_ctl");
+        }
     }
 
-    int running = xlib_process_events(&x_connection, pty_fd, &terminal);
+    // Keys go to the session, which passes them on to the shell
+    PtyWriter writer;
+    pty_writer_create(&writer, view->socket_fd, epollfd, EPOLLIN);
+    terminal.writer = &writer;
+
+    int running = xlib_process_events(&x_connection, -1, &terminal);
     while (running)
     {
-        int xevents = XPending(x_connection.display);
-        printf("Getting ready to epoll. %d xevents in queue\n", xevents);
         int nfds = epoll_wait(epollfd, epoll_events, ARRAY_COUNT(epoll_events), -1);
         if (nfds == -1)
         {
             errno_exit("epoll_wait");
         }
+        STATS_WAKEUP();
 
         for (int i = 0; i < nfds; ++i)
         {
             struct epoll_event *epoll_event = epoll_events + i;
-            if (pty_fd == epoll_event->data.fd)
+            if ((view->socket_fd == epoll_event->data.fd) && (epoll_event->events & EPOLLOUT))
             {
-                ssize_t result = pty_read(pty_fd, &data_buffer);
-                if (result > 0)
+                pty_writer_flush(&writer);
+            }
+
+            if (view->update_fd == epoll_event->data.fd)
+            {
+                char *title = session_updated(view);
+                if (title)
                 {
-                    printf("Read %ld from pty\n", result);
-                    parse_lines(line_buffer);
-                    draw_buffer(&x_connection, &terminal);
+                    xlib_set_title(x_connection.display, x_connection.window, title);
                 }
-                else
+                terminal_changed(&terminal);
+            }
+            else if ((view->socket_fd == epoll_event->data.fd) && (epoll_event->events & ~CAST(uint32_t, EPOLLOUT)))
+            {
+                // The session never sends anything after the hello, so this is
+                // it closing, because the shell exited or another window
+                // attached
+                char data;
+                if (read(view->socket_fd, &data, 1) <= 0)
                 {
-                    printf("pty returned %ld, quitting...\n", result);
+                    puts("session closed, quitting...");
                     running = 0;
                 }
             }
+            else if (frame_clock.fd == epoll_event->data.fd)
+            {
+                terminal_frame_due(&terminal);
+            }
             else
             {
-                ASSERT(x_connection.fd == epoll_event->data.fd);
+                ASSERT((x_connection.fd == epoll_event->data.fd) || (view->socket_fd == epoll_event->data.fd));
             }
         }
-        running = xlib_process_events(&x_connection, pty_fd, &terminal);
+        if (running)
+        {
+            running = xlib_process_events(&x_connection, -1, &terminal);
+        }
+    }
+}
+
+
+// The terminfo entry is compiled into a directory next to the executable. An
+// empty entry in TERMINFO_DIRS stands for the system's own directories.
+static void
+add_terminfo_dir(void)
+{
+    char path[PATH_MAX];
+    ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - sizeof("terminfo"));
+    char *slash = (length > 0) ? memrchr(path, '/', CAST(size_t, length)) : nullptr;
+    if (!slash)
+    {
+        return;
+    }
+    strcpy(slash + 1, "terminfo");
+    if (access(path, R_OK | X_OK))
+    {
+        return;
+    }
+
+    char dirs[2 * PATH_MAX];
+    char *old_dirs = getenv("TERMINFO_DIRS");
+    int size = snprintf(dirs, sizeof(dirs), "%s:%s", path, old_dirs ? old_dirs : "");
+    if ((size > 0) && (CAST(size_t, size) < sizeof(dirs)))
+    {
+        setenv("TERMINFO_DIRS", dirs, 1);
     }
 }
 
 
 static void
-execute_shell(void)
+execute_shell(char **command)
 {
     // Update the environment with our terminal information
     setenv("TERM", "nullrefterm", 1);
+    add_terminfo_dir();
+
+    if (command)
+    {
+        execvp(command[0], command);
+        errno_exit(command[0]);
+    }
 
     char *shell = getenv("SHELL");
     if (!shell || !*shell)
@@ -945,19 +1507,272 @@ execute_shell(void)
 }
 
 
+// Forks off a session running the shell, detached from us so it outlives the
+// window, and waits until it can be attached to
+static void
+start_session(TerminalOptions *options)
+{
+    int ready[2];
+    if (pipe2(ready, O_CLOEXEC) == -1)
+    {
+        errno_exit("pipe2");
+    }
+
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        errno_exit("fork");
+    }
+    if (!pid)
+    {
+        // Forked once more so the session isn't our child, and in a session
+        // of its own so it doesn't get the hangup when our terminal closes
+        close(ready[0]);
+        if (fork())
+        {
+            _exit(EXIT_SUCCESS);
+        }
+        setsid();
+
+        int null_fd = open("/dev/null", O_RDWR);
+        if (null_fd != -1)
+        {
+            dup2(null_fd, STDIN_FILENO);
+            dup2(null_fd, STDOUT_FILENO);
+            close(null_fd);
+        }
+
+        int listen_fd = session_listen(options->session_name);
+        struct winsize size = {
+            .ws_row = SCREEN_DEFAULT_ROWS,
+            .ws_col = SCREEN_DEFAULT_COLS,
+        };
+        int pty_fd;
+        if (pty_spawn(&pty_fd, &size))
+        {
+            int flags = fcntl(pty_fd, F_GETFL);
+            if ((flags == -1) || (fcntl(pty_fd, F_SETFL, flags | O_NONBLOCK) == -1))
+            {
+                errno_exit("fcntl pty");
+            }
+            size_t scrollback_bytes = options->scrollback_megabytes * 1024 * 1024;
+            session_hold(options->session_name, listen_fd, pty_fd, scrollback_bytes, ready[1]);
+            exit(EXIT_SUCCESS);
+        }
+        execute_shell(options->command);
+    }
+
+    close(ready[1]);
+    waitpid(pid, nullptr, 0);
+
+    char ready_byte;
+    if (read(ready[0], &ready_byte, 1) != 1)
+    {
+        error_exit("couldn't start the session");
+    }
+    close(ready[0]);
+}
+
+
+static _Noreturn void
+usage(const char *program)
+{
+    fprintf(stderr, "usage: %s [-t | -u] [-d] [-r frame-rate] [-s megabytes] [-b kilobytes] [-R xft|shm]"
+        " [-H colsxrows [-p file] [-o bytes]]"
+#ifdef STATS_ENABLED
+        " [-S]"
+#endif
+        " [-L keys] [-D name | -A name] [-e command...]\n", program);
+    fprintf(stderr, "  -t  read the pty on a separate thread\n");
+    fprintf(stderr, "  -u  wait for the pty and everything else with io_uring instead of epoll, if the kernel has it\n");
+    fprintf(stderr, "  -d  draw on a separate thread, from copies of the screen\n");
+    fprintf(stderr, "  -r  frames per second to draw at most while output keeps arriving (default %u)\n",
+        DEFAULT_FRAME_RATE);
+    fprintf(stderr, "  -s  memory to keep scrollback in, spilling to disk past %u MB (default %u)\n",
+        SCROLLBACK_RAM_BUDGET / (1024 * 1024), SCROLLBACK_DEFAULT_MEGABYTES);
+    fprintf(stderr, "  -b  size the pty is read into at first, growing up to %u MB while output keeps filling it "
+        "unless -t is given; from %u MB on it's backed by huge pages if any are set aside\n",
+        DATA_BUFFER_GROW_LIMIT / (1024 * 1024), DATA_BUFFER_HUGE_PAGE_SIZE / (1024 * 1024));
+    fprintf(stderr, "  -R  draw glyphs with Xft on the server, or into shared memory on the CPU (default xft)\n");
+    fprintf(stderr, "  -H  draw into memory instead of a window, without connecting to X\n");
+    fprintf(stderr, "  -p  write the headless frame to a PPM file on exit\n");
+    fprintf(stderr, "  -o  write it after this many bytes of output instead\n");
+#ifdef STATS_ENABLED
+    fprintf(stderr, "  -S  show read, parse and draw times over the top right corner (SIGUSR1 prints them all)\n");
+#endif
+    fprintf(stderr, "  -L  time this many keys from being handled to being on screen, echoed by a child instead of the shell\n");
+    fprintf(stderr, "  -D  run the shell in a session by this name that keeps running when the window closes\n");
+    fprintf(stderr, "  -A  show the session by this name, taking it over from any window showing it\n");
+    fprintf(stderr, "  -e  run the rest of the arguments instead of the shell\n");
+    exit(EXIT_FAILURE);
+}
+
+
 int
-main(void)
+main(int argc, char **argv)
 {
+    TerminalOptions options = {
+        .frame_rate = DEFAULT_FRAME_RATE,
+        .scrollback_megabytes = SCROLLBACK_DEFAULT_MEGABYTES,
+    };
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "-t"))
+        {
+            options.reader_thread = 1;
+        }
+        else if (!strcmp(argv[i], "-u"))
+        {
+            options.io_ring = 1;
+        }
+        else if (!strcmp(argv[i], "-d"))
+        {
+            options.render_thread = 1;
+        }
+        else if (!strcmp(argv[i], "-r") && (i + 1 < argc))
+        {
+            unsigned long rate = strtoul(argv[++i], nullptr, 10);
+            if (!rate || (rate > 1000))
+            {
+                usage(argv[0]);
+            }
+            options.frame_rate = CAST(unsigned, rate);
+        }
+        else if (!strcmp(argv[i], "-s") && (i + 1 < argc))
+        {
+            options.scrollback_megabytes = strtoul(argv[++i], nullptr, 10);
+            if (!options.scrollback_megabytes || (options.scrollback_megabytes > TYPE_MAX(size_t) / (1024 * 1024)))
+            {
+                usage(argv[0]);
+            }
+        }
+        else if (!strcmp(argv[i], "-b") && (i + 1 < argc))
+        {
+            options.buffer_kilobytes = strtoul(argv[++i], nullptr, 10);
+            if (!options.buffer_kilobytes || (options.buffer_kilobytes > 1024 * 1024))
+            {
+                usage(argv[0]);
+            }
+        }
+        else if (!strcmp(argv[i], "-H") && (i + 1 < argc))
+        {
+            if ((sscanf(argv[++i], "%ux%u", &options.headless_cols, &options.headless_rows) != 2)
+                || !options.headless_cols || !options.headless_rows
+                || (options.headless_cols > 4096) || (options.headless_rows > 4096))
+            {
+                usage(argv[0]);
+            }
+            options.headless = 1;
+        }
+        else if (!strcmp(argv[i], "-p") && (i + 1 < argc))
+        {
+            options.dump_path = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-o") && (i + 1 < argc))
+        {
+            options.dump_offset = strtoul(argv[++i], nullptr, 10);
+        }
+#ifdef STATS_ENABLED
+        else if (!strcmp(argv[i], "-S"))
+        {
+            options.stats_overlay = 1;
+        }
+#endif
+        else if (!strcmp(argv[i], "-L") && (i + 1 < argc))
+        {
+            options.latency_keys = strtoul(argv[++i], nullptr, 10);
+            if (!options.latency_keys)
+            {
+                usage(argv[0]);
+            }
+        }
+        else if ((!strcmp(argv[i], "-D") || !strcmp(argv[i], "-A")) && (i + 1 < argc))
+        {
+            options.attach_only = (argv[i][1] == 'A');
+            options.session_name = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-e") && (i + 1 < argc))
+        {
+            options.command = argv + i + 1;
+            break;
+        }
+        else if (!strcmp(argv[i], "-R") && (i + 1 < argc))
+        {
+            ++i;
+            if (!strcmp(argv[i], "xft"))
+            {
+                options.renderer = XLIB_RENDER_XFT;
+            }
+            else if (!strcmp(argv[i], "shm"))
+            {
+                options.renderer = XLIB_RENDER_SHM;
+            }
+            else
+            {
+                usage(argv[0]);
+            }
+        }
+        else
+        {
+            usage(argv[0]);
+        }
+    }
+
+    scan_init(SCAN_CONTROL_LEVEL);
+    utf8_init(SCAN_LEVEL_COUNT - 1);
+    raster_init(SCAN_LEVEL_COUNT - 1);
+    parser_init();
+
+    if ((options.dump_path && !options.headless) || (options.io_ring && options.reader_thread))
+    {
+        usage(argv[0]);
+    }
+
+    // A session is only ever shown in a window
+    if (options.session_name)
+    {
+        if (options.headless || options.latency_keys || options.reader_thread || options.io_ring
+            || options.render_thread)
+        {
+            usage(argv[0]);
+        }
+        if (!options.attach_only)
+        {
+            start_session(&options);
+        }
+
+        SessionView view;
+        if (!session_attach(&view, options.session_name))
+        {
+            fprintf(stderr, "no session named %s\n", options.session_name);
+            return EXIT_FAILURE;
+        }
+        run_viewer(&view, &options);
+        return EXIT_SUCCESS;
+    }
+
+    // A window sets the size once it knows how big it is, but without one the
+    // program should start out at the right size
+    struct winsize headless_size = {
+        .ws_row = CAST(unsigned short, options.headless_rows),
+        .ws_col = CAST(unsigned short, options.headless_cols),
+    };
+
     int pty_fd;
-    if (pty_spawn(&pty_fd, 0))
+    if (pty_spawn(&pty_fd, options.headless ? &headless_size : nullptr))
     {
         // we're the parent process
-        run_terminal(pty_fd);
+        run_terminal(pty_fd, &options);
     }
     else
     {
         // we're the child process
-        execute_shell();
+        if (options.latency_keys)
+        {
+            latency_echo();
+        }
+        execute_shell(options.command);
     }
 
     return EXIT_SUCCESS;
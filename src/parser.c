@@ -0,0 +1,1019 @@
+#include "parser.h"
+
+#include "assert.h"
+#include "scan.h"
+#include "types.h"
+#include "utf8.h"
+#include "util.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+
+// The state machine follows Paul Williams' DEC-compatible parser
+// (https://vt100.net/emu/dec_ansi_parser), with two changes for a UTF-8
+// terminal: bytes from 0x80 up are never C1 controls, and ':' separates
+// parameters the same way ';' does.
+
+typedef enum ParserAction
+{
+    ACTION_NONE,
+    ACTION_IGNORE,
+    ACTION_PRINT,
+    ACTION_EXECUTE,
+    ACTION_CLEAR,
+    ACTION_COLLECT,
+    ACTION_PARAM,
+    ACTION_ESC_DISPATCH,
+    ACTION_CSI_DISPATCH,
+    ACTION_HOOK,
+    ACTION_PUT,
+    ACTION_UNHOOK,
+    ACTION_OSC_START,
+    ACTION_OSC_PUT,
+    ACTION_OSC_END,
+
+    ACTION_COUNT,
+} ParserAction;
+
+
+// Each transition packs the action into the high nibble and the next state
+// into the low one. PARSER_STAY means the byte doesn't leave the current
+// state, so no exit or entry actions run.
+#define PARSER_STAY 0xf
+
+_Static_assert(PARSER_STATE_COUNT <= PARSER_STAY, "Too many parser states");
+_Static_assert(ACTION_COUNT <= 16, "Too many parser actions");
+
+static byte transitions[PARSER_STATE_COUNT][256];
+
+static const ParserAction entry_actions[PARSER_STATE_COUNT] = {
+    [PARSER_ESCAPE] = ACTION_CLEAR,
+    [PARSER_CSI_ENTRY] = ACTION_CLEAR,
+    [PARSER_DCS_ENTRY] = ACTION_CLEAR,
+    [PARSER_DCS_PASSTHROUGH] = ACTION_HOOK,
+    [PARSER_OSC_STRING] = ACTION_OSC_START,
+};
+
+static const ParserAction exit_actions[PARSER_STATE_COUNT] = {
+    [PARSER_DCS_PASSTHROUGH] = ACTION_UNHOOK,
+    [PARSER_OSC_STRING] = ACTION_OSC_END,
+};
+
+
+static void
+set_range(ParserState state, unsigned first, unsigned last, ParserAction action, unsigned next)
+{
+    for (unsigned b = first; b <= last; ++b)
+    {
+        transitions[state][b] = CAST(byte, (action << 4) | next);
+    }
+}
+
+
+// Sets the C0 controls, other than the ones handled in every state
+static void
+set_c0(ParserState state, ParserAction action)
+{
+    set_range(state, 0x00, 0x17, action, PARSER_STAY);
+    set_range(state, 0x19, 0x19, action, PARSER_STAY);
+    set_range(state, 0x1c, 0x1f, action, PARSER_STAY);
+}
+
+
+void
+parser_init(void)
+{
+    for (ParserState state = 0; state < PARSER_STATE_COUNT; ++state)
+    {
+        set_range(state, 0x00, 0xff, ACTION_IGNORE, PARSER_STAY);
+    }
+
+    set_c0(PARSER_GROUND, ACTION_EXECUTE);
+    set_range(PARSER_GROUND, 0x20, 0x7e, ACTION_PRINT, PARSER_STAY);
+    set_range(PARSER_GROUND, 0x80, 0xff, ACTION_PRINT, PARSER_STAY);
+
+    set_c0(PARSER_ESCAPE, ACTION_EXECUTE);
+    set_range(PARSER_ESCAPE, 0x20, 0x2f, ACTION_COLLECT, PARSER_ESCAPE_INTERMEDIATE);
+    set_range(PARSER_ESCAPE, 0x30, 0x7e, ACTION_ESC_DISPATCH, PARSER_GROUND);
+    set_range(PARSER_ESCAPE, 'P', 'P', ACTION_NONE, PARSER_DCS_ENTRY);
+    set_range(PARSER_ESCAPE, 'X', 'X', ACTION_NONE, PARSER_SOS_PM_APC_STRING);
+    set_range(PARSER_ESCAPE, '[', '[', ACTION_NONE, PARSER_CSI_ENTRY);
+    set_range(PARSER_ESCAPE, ']', ']', ACTION_NONE, PARSER_OSC_STRING);
+    set_range(PARSER_ESCAPE, '^', '_', ACTION_NONE, PARSER_SOS_PM_APC_STRING);
+
+    set_c0(PARSER_ESCAPE_INTERMEDIATE, ACTION_EXECUTE);
+    set_range(PARSER_ESCAPE_INTERMEDIATE, 0x20, 0x2f, ACTION_COLLECT, PARSER_STAY);
+    set_range(PARSER_ESCAPE_INTERMEDIATE, 0x30, 0x7e, ACTION_ESC_DISPATCH, PARSER_GROUND);
+
+    set_c0(PARSER_CSI_ENTRY, ACTION_EXECUTE);
+    set_range(PARSER_CSI_ENTRY, 0x20, 0x2f, ACTION_COLLECT, PARSER_CSI_INTERMEDIATE);
+    set_range(PARSER_CSI_ENTRY, 0x30, 0x3b, ACTION_PARAM, PARSER_CSI_PARAM);
+    set_range(PARSER_CSI_ENTRY, 0x3c, 0x3f, ACTION_COLLECT, PARSER_CSI_PARAM);
+    set_range(PARSER_CSI_ENTRY, 0x40, 0x7e, ACTION_CSI_DISPATCH, PARSER_GROUND);
+
+    set_c0(PARSER_CSI_PARAM, ACTION_EXECUTE);
+    set_range(PARSER_CSI_PARAM, 0x20, 0x2f, ACTION_COLLECT, PARSER_CSI_INTERMEDIATE);
+    set_range(PARSER_CSI_PARAM, 0x30, 0x3b, ACTION_PARAM, PARSER_STAY);
+    set_range(PARSER_CSI_PARAM, 0x3c, 0x3f, ACTION_NONE, PARSER_CSI_IGNORE);
+    set_range(PARSER_CSI_PARAM, 0x40, 0x7e, ACTION_CSI_DISPATCH, PARSER_GROUND);
+
+    set_c0(PARSER_CSI_INTERMEDIATE, ACTION_EXECUTE);
+    set_range(PARSER_CSI_INTERMEDIATE, 0x20, 0x2f, ACTION_COLLECT, PARSER_STAY);
+    set_range(PARSER_CSI_INTERMEDIATE, 0x30, 0x3f, ACTION_NONE, PARSER_CSI_IGNORE);
+    set_range(PARSER_CSI_INTERMEDIATE, 0x40, 0x7e, ACTION_CSI_DISPATCH, PARSER_GROUND);
+
+    set_c0(PARSER_CSI_IGNORE, ACTION_EXECUTE);
+    set_range(PARSER_CSI_IGNORE, 0x40, 0x7e, ACTION_NONE, PARSER_GROUND);
+
+    set_range(PARSER_DCS_ENTRY, 0x20, 0x2f, ACTION_COLLECT, PARSER_DCS_INTERMEDIATE);
+    set_range(PARSER_DCS_ENTRY, 0x30, 0x3b, ACTION_PARAM, PARSER_DCS_PARAM);
+    set_range(PARSER_DCS_ENTRY, 0x3c, 0x3f, ACTION_COLLECT, PARSER_DCS_PARAM);
+    set_range(PARSER_DCS_ENTRY, 0x40, 0x7e, ACTION_NONE, PARSER_DCS_PASSTHROUGH);
+
+    set_range(PARSER_DCS_PARAM, 0x20, 0x2f, ACTION_COLLECT, PARSER_DCS_INTERMEDIATE);
+    set_range(PARSER_DCS_PARAM, 0x30, 0x3b, ACTION_PARAM, PARSER_STAY);
+    set_range(PARSER_DCS_PARAM, 0x3c, 0x3f, ACTION_NONE, PARSER_DCS_IGNORE);
+    set_range(PARSER_DCS_PARAM, 0x40, 0x7e, ACTION_NONE, PARSER_DCS_PASSTHROUGH);
+
+    set_range(PARSER_DCS_INTERMEDIATE, 0x20, 0x2f, ACTION_COLLECT, PARSER_STAY);
+    set_range(PARSER_DCS_INTERMEDIATE, 0x30, 0x3f, ACTION_NONE, PARSER_DCS_IGNORE);
+    set_range(PARSER_DCS_INTERMEDIATE, 0x40, 0x7e, ACTION_NONE, PARSER_DCS_PASSTHROUGH);
+
+    set_c0(PARSER_DCS_PASSTHROUGH, ACTION_PUT);
+    set_range(PARSER_DCS_PASSTHROUGH, 0x20, 0x7e, ACTION_PUT, PARSER_STAY);
+    set_range(PARSER_DCS_PASSTHROUGH, 0x80, 0xff, ACTION_PUT, PARSER_STAY);
+
+    // BEL ending an OSC string is an xterm extension that everything uses
+    set_range(PARSER_OSC_STRING, 0x07, 0x07, ACTION_NONE, PARSER_GROUND);
+    set_range(PARSER_OSC_STRING, 0x20, 0x7f, ACTION_OSC_PUT, PARSER_STAY);
+    set_range(PARSER_OSC_STRING, 0x80, 0xff, ACTION_OSC_PUT, PARSER_STAY);
+
+    // These apply in every state. ESC \ (ST) ends the string states by way of
+    // the ESC transition, which runs their exit action.
+    for (ParserState state = 0; state < PARSER_STATE_COUNT; ++state)
+    {
+        set_range(state, 0x18, 0x18, ACTION_EXECUTE, PARSER_GROUND);
+        set_range(state, 0x1a, 0x1a, ACTION_EXECUTE, PARSER_GROUND);
+        set_range(state, 0x1b, 0x1b, ACTION_NONE, PARSER_ESCAPE);
+    }
+}
+
+
+void
+parser_create(Parser *parser)
+{
+    memset(parser, 0, sizeof(*parser));
+    parser->state = PARSER_GROUND;
+}
+
+
+static unsigned
+param(Parser *parser, unsigned index, unsigned default_value)
+{
+    unsigned result = default_value;
+    if ((index < parser->param_count) && parser->params[index])
+    {
+        result = parser->params[index];
+    }
+
+    return result;
+}
+
+
+__attribute__((format(printf, 2, 3)))
+static void
+reply(Parser *parser, const char *format, ...)
+{
+    size_t avail = sizeof(parser->reply) - parser->reply_size;
+
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(parser->reply + parser->reply_size, avail, format, args);
+    va_end(args);
+
+    if ((length > 0) && (CAST(size_t, length) < avail))
+    {
+        parser->reply_size += CAST(size_t, length);
+    }
+}
+
+
+static void
+execute(TerminalScreen *screen, byte b)
+{
+    switch (b)
+    {
+        case '\b':
+        {
+            screen_backspace(screen);
+        } break;
+
+        case '\t':
+        {
+            screen_tab(screen);
+        } break;
+
+        case '\n':
+        case '\v':
+        case '\f':
+        {
+            screen_line_feed(screen);
+        } break;
+
+        case '\r':
+        {
+            screen_carriage_return(screen);
+        } break;
+
+        default:
+        {
+            // BEL, SO, SI and the rest are ignored
+        } break;
+    }
+}
+
+
+static void
+esc_dispatch(Parser *parser, TerminalScreen *screen, byte final)
+{
+    if (parser->intermediate_count)
+    {
+        // Character set designations and the like, none of which we support
+        return;
+    }
+
+    switch (final)
+    {
+        case '7':
+        {
+            screen_save_cursor(screen);
+        } break;
+
+        case '8':
+        {
+            screen_restore_cursor(screen);
+        } break;
+
+        case 'D':
+        {
+            screen_line_feed(screen);
+        } break;
+
+        case 'E':
+        {
+            screen_carriage_return(screen);
+            screen_line_feed(screen);
+        } break;
+
+        case 'M':
+        {
+            screen_reverse_index(screen);
+        } break;
+
+        case 'c':
+        {
+            screen_reset(screen);
+        } break;
+    }
+}
+
+
+static uint32_t
+indexed_color(unsigned index)
+{
+    uint32_t result = CAST(uint32_t, index & 0xff);
+    return result;
+}
+
+
+// Handles the extended color forms 38;5;n and 38;2;r;g;b (and likewise for 48),
+// returning the index of the last parameter that was consumed
+static unsigned
+extended_color(Parser *parser, unsigned index, uint32_t *color)
+{
+    unsigned kind = param(parser, index + 1, 0);
+    if ((kind == 5) && (index + 2 < parser->param_count))
+    {
+        *color = indexed_color(parser->params[index + 2]);
+        index += 2;
+    }
+    else if ((kind == 2) && (index + 4 < parser->param_count))
+    {
+        *color = COLOR_RGB(parser->params[index + 2] & 0xff,
+            parser->params[index + 3] & 0xff,
+            parser->params[index + 4] & 0xff);
+        index += 4;
+    }
+    else
+    {
+        index = parser->param_count;
+    }
+
+    return index;
+}
+
+
+// The styles set by SGR 1-9. SGR 22-29 turn off the style at 20 less.
+static const uint32_t sgr_styles[10] = {
+    [1] = STYLE_BOLD,
+    [2] = STYLE_FAINT,
+    [3] = STYLE_ITALIC,
+    [4] = STYLE_UNDERLINE,
+    [5] = STYLE_BLINK,
+    [7] = STYLE_INVERSE,
+    [8] = STYLE_INVISIBLE,
+    [9] = STYLE_STRIKETHROUGH,
+};
+
+
+static void
+select_graphic_rendition(Parser *parser, TerminalScreen *screen)
+{
+    ScreenAttribute attribute = screen->attributes[screen->current_attribute];
+
+    unsigned count = parser->param_count ? parser->param_count : 1;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        unsigned value = param(parser, i, 0);
+        switch (value)
+        {
+            case 0:
+            {
+                attribute = screen->attributes[SCREEN_DEFAULT_ATTRIBUTE];
+            } break;
+
+            case 38:
+            {
+                i = extended_color(parser, i, &attribute.foreground);
+            } break;
+
+            case 39:
+            {
+                attribute.foreground = COLOR_DEFAULT;
+            } break;
+
+            case 48:
+            {
+                i = extended_color(parser, i, &attribute.background);
+            } break;
+
+            case 49:
+            {
+                attribute.background = COLOR_DEFAULT;
+            } break;
+
+            default:
+            {
+                if ((value >= 1) && (value <= 9))
+                {
+                    attribute.style |= sgr_styles[value];
+                }
+                else if ((value >= 22) && (value <= 29))
+                {
+                    // 22 turns off both bold and faint
+                    attribute.style &= ~sgr_styles[value - 20];
+                    if (value == 22)
+                    {
+                        attribute.style &= ~CAST(uint32_t, STYLE_BOLD);
+                    }
+                }
+                else if ((value >= 30) && (value <= 37))
+                {
+                    attribute.foreground = indexed_color(value - 30);
+                }
+                else if ((value >= 40) && (value <= 47))
+                {
+                    attribute.background = indexed_color(value - 40);
+                }
+                else if ((value >= 90) && (value <= 97))
+                {
+                    attribute.foreground = indexed_color(value - 90 + 8);
+                }
+                else if ((value >= 100) && (value <= 107))
+                {
+                    attribute.background = indexed_color(value - 100 + 8);
+                }
+            } break;
+        }
+    }
+
+    screen_set_attribute(screen, &attribute);
+}
+
+
+static void
+set_private_mode(Parser *parser, TerminalScreen *screen, int enable)
+{
+    for (unsigned i = 0; i < parser->param_count; ++i)
+    {
+        switch (parser->params[i])
+        {
+            case 7:
+            {
+                screen->autowrap = enable;
+            } break;
+
+            case 25:
+            {
+                screen->cursor_hidden = !enable;
+            } break;
+
+            case 2004:
+            {
+                screen->bracketed_paste = enable;
+            } break;
+
+            case 2026:
+            {
+                screen->synchronized = enable;
+            } break;
+        }
+    }
+}
+
+
+// DECRQM's answer for a private mode: 1 if it's set, 2 if it's reset and 0 if
+// it isn't one we know. Applications ask before they use synchronized updates.
+static unsigned
+private_mode_state(TerminalScreen *screen, unsigned mode)
+{
+    int enabled;
+    switch (mode)
+    {
+        case 7:
+        {
+            enabled = screen->autowrap;
+        } break;
+
+        case 25:
+        {
+            enabled = !screen->cursor_hidden;
+        } break;
+
+        case 2004:
+        {
+            enabled = screen->bracketed_paste;
+        } break;
+
+        case 2026:
+        {
+            enabled = screen->synchronized;
+        } break;
+
+        default:
+        {
+            return 0;
+        } break;
+    }
+
+    unsigned result = enabled ? 1 : 2;
+    return result;
+}
+
+
+static void
+erase_in_display(TerminalScreen *screen, unsigned mode)
+{
+    switch (mode)
+    {
+        case 0:
+        {
+            screen_erase(screen, screen->cursor_x, screen->cursor_y, screen->cols);
+            screen_erase_rows(screen, screen->cursor_y + 1, screen->rows);
+        } break;
+
+        case 1:
+        {
+            screen_erase_rows(screen, 0, screen->cursor_y);
+            screen_erase(screen, 0, screen->cursor_y, screen->cursor_x + 1);
+        } break;
+
+        case 2:
+        {
+            screen_erase_rows(screen, 0, screen->rows);
+        } break;
+
+        // xterm's extension for erasing the scrollback
+        case 3:
+        {
+            screen_clear_scrollback(screen);
+        } break;
+    }
+}
+
+
+static void
+erase_in_line(TerminalScreen *screen, unsigned mode)
+{
+    switch (mode)
+    {
+        case 0:
+        {
+            screen_erase(screen, screen->cursor_x, screen->cursor_y, screen->cols);
+        } break;
+
+        case 1:
+        {
+            screen_erase(screen, 0, screen->cursor_y, screen->cursor_x + 1);
+        } break;
+
+        case 2:
+        {
+            screen_erase(screen, 0, screen->cursor_y, screen->cols);
+        } break;
+    }
+}
+
+
+static void
+csi_dispatch(Parser *parser, TerminalScreen *screen, byte final)
+{
+    char marker = parser->intermediate_count ? parser->intermediates[0] : 0;
+    if ((marker == '?') && (parser->intermediate_count == 1))
+    {
+        if ((final == 'h') || (final == 'l'))
+        {
+            set_private_mode(parser, screen, final == 'h');
+        }
+        return;
+    }
+    else if ((marker == '?') && (parser->intermediate_count == 2) && (parser->intermediates[1] == '$'))
+    {
+        if (final == 'p')
+        {
+            unsigned mode = param(parser, 0, 0);
+            reply(parser, "\x1b[?%u;%u$y", mode, private_mode_state(screen, mode));
+        }
+        return;
+    }
+    else if (marker == '>')
+    {
+        if ((final == 'c') && !param(parser, 0, 0))
+        {
+            // Secondary device attributes: a VT220 with no particular version
+            reply(parser, "\x1b[>1;0;0c");
+        }
+        return;
+    }
+    else if (marker)
+    {
+        return;
+    }
+
+    unsigned x = screen->cursor_x;
+    unsigned y = screen->cursor_y;
+    switch (final)
+    {
+        case 'A':
+        {
+            unsigned count = param(parser, 0, 1);
+            screen_move_cursor(screen, x, count > y ? 0 : y - count);
+        } break;
+
+        case 'B':
+        case 'e':
+        {
+            screen_move_cursor(screen, x, y + minu(param(parser, 0, 1), screen->rows));
+        } break;
+
+        case 'C':
+        case 'a':
+        {
+            screen_move_cursor(screen, x + minu(param(parser, 0, 1), screen->cols), y);
+        } break;
+
+        case 'D':
+        {
+            unsigned count = param(parser, 0, 1);
+            screen_move_cursor(screen, count > x ? 0 : x - count, y);
+        } break;
+
+        case 'E':
+        {
+            screen_move_cursor(screen, 0, y + minu(param(parser, 0, 1), screen->rows));
+        } break;
+
+        case 'F':
+        {
+            unsigned count = param(parser, 0, 1);
+            screen_move_cursor(screen, 0, count > y ? 0 : y - count);
+        } break;
+
+        case 'G':
+        case '`':
+        {
+            screen_move_cursor(screen, param(parser, 0, 1) - 1, y);
+        } break;
+
+        case 'H':
+        case 'f':
+        {
+            screen_move_cursor(screen, param(parser, 1, 1) - 1, param(parser, 0, 1) - 1);
+        } break;
+
+        case 'd':
+        {
+            screen_move_cursor(screen, x, param(parser, 0, 1) - 1);
+        } break;
+
+        case 'J':
+        {
+            erase_in_display(screen, param(parser, 0, 0));
+        } break;
+
+        case 'K':
+        {
+            erase_in_line(screen, param(parser, 0, 0));
+        } break;
+
+        case 'X':
+        {
+            screen_erase(screen, x, y, param(parser, 0, 1));
+        } break;
+
+        case '@':
+        {
+            screen_insert_chars(screen, param(parser, 0, 1));
+        } break;
+
+        case 'P':
+        {
+            screen_delete_chars(screen, param(parser, 0, 1));
+        } break;
+
+        case 'L':
+        {
+            screen_insert_lines(screen, param(parser, 0, 1));
+        } break;
+
+        case 'M':
+        {
+            screen_delete_lines(screen, param(parser, 0, 1));
+        } break;
+
+        case 'b':
+        {
+            screen_repeat(screen, param(parser, 0, 1));
+        } break;
+
+        case 'r':
+        {
+            screen_set_scroll_region(screen, param(parser, 0, 1) - 1, param(parser, 1, screen->rows));
+        } break;
+
+        case 'S':
+        {
+            screen_scroll_up(screen, param(parser, 0, 1));
+        } break;
+
+        case 'T':
+        {
+            screen_scroll_down(screen, param(parser, 0, 1));
+        } break;
+
+        case 'm':
+        {
+            select_graphic_rendition(parser, screen);
+        } break;
+
+        case 'c':
+        {
+            if (!param(parser, 0, 0))
+            {
+                // Primary device attributes: a VT102
+                reply(parser, "\x1b[?6c");
+            }
+        } break;
+
+        case 'n':
+        {
+            unsigned report = param(parser, 0, 0);
+            if (report == 5)
+            {
+                reply(parser, "\x1b[0n");
+            }
+            else if (report == 6)
+            {
+                reply(parser, "\x1b[%u;%uR", y + 1, x + 1);
+            }
+        } break;
+
+        case 's':
+        {
+            screen_save_cursor(screen);
+        } break;
+
+        case 'u':
+        {
+            screen_restore_cursor(screen);
+        } break;
+    }
+}
+
+
+static void
+osc_dispatch(Parser *parser)
+{
+    // Only window titles (OSC 0 and 2) are understood
+    size_t size = parser->osc_size;
+    const char *osc = parser->osc;
+    if ((size >= 2) && ((osc[0] == '0') || (osc[0] == '2')) && (osc[1] == ';'))
+    {
+        size_t title_size = size - 2;
+        if (title_size >= sizeof(parser->title))
+        {
+            title_size = sizeof(parser->title) - 1;
+        }
+        memcpy(parser->title, osc + 2, title_size);
+        parser->title[title_size] = 0;
+        parser->title_changed = 1;
+    }
+}
+
+
+static void
+osc_put(Parser *parser, const char *bytes, size_t count)
+{
+    size_t avail = sizeof(parser->osc) - parser->osc_size;
+    if (count > avail)
+    {
+        count = avail;
+    }
+    memcpy(parser->osc + parser->osc_size, bytes, count);
+    parser->osc_size += count;
+}
+
+
+// A character that is still cut off when the text ends is either finished by
+// the next lot of data or, if something else comes first, invalid
+static void
+end_text(Parser *parser, TerminalScreen *screen, const char *text, size_t count, int at_end)
+{
+    ASSERT(count < UTF8_MAX_SEQUENCE);
+
+    if (!count)
+    {
+        return;
+    }
+
+    if (at_end)
+    {
+        memcpy(parser->partial, text, count);
+        parser->partial_size = CAST(unsigned, count);
+    }
+    else
+    {
+        uint32_t replacement = UTF8_REPLACEMENT_CHARACTER;
+        screen_write_codepoints(screen, &replacement, 1);
+    }
+}
+
+
+// Writes a run of text without any control bytes in it. at_end says whether
+// it ran up to the end of the data rather than to a control byte.
+static void
+print_text(Parser *parser, TerminalScreen *screen, const char *text, size_t count, int at_end)
+{
+    if (parser->partial_size)
+    {
+        // Whatever follows the rest of the cut off character is decoded along
+        // with it, which makes no difference
+        char sequence[2 * UTF8_MAX_SEQUENCE];
+        size_t size = parser->partial_size;
+        size_t taken = minull(count, UTF8_MAX_SEQUENCE);
+        memcpy(sequence, parser->partial, size);
+        memcpy(sequence + size, text, taken);
+        parser->partial_size = 0;
+
+        size_t consumed;
+        size_t decoded = utf8_decode(sequence, size + taken, parser->decoded, &consumed);
+        screen_write_codepoints(screen, parser->decoded, decoded);
+        if (consumed < size)
+        {
+            ASSERT(taken == count);
+            end_text(parser, screen, sequence + consumed, size + taken - consumed, at_end);
+            return;
+        }
+
+        text += consumed - size;
+        count -= consumed - size;
+    }
+
+    while (count)
+    {
+        size_t ascii = utf8_ascii_length(text, count);
+        if (ascii)
+        {
+            screen_write_ascii(screen, text, ascii);
+            text += ascii;
+            count -= ascii;
+            continue;
+        }
+
+        size_t chunk = minull(count, PARSER_DECODE_CHUNK);
+        size_t consumed;
+        size_t decoded = utf8_decode(text, chunk, parser->decoded, &consumed);
+        screen_write_codepoints(screen, parser->decoded, decoded);
+        text += consumed;
+        count -= consumed;
+
+        if (chunk == consumed + count)
+        {
+            // Only a cut off character is left
+            end_text(parser, screen, text, count, at_end);
+            break;
+        }
+    }
+}
+
+
+static void
+perform(Parser *parser, TerminalScreen *screen, ParserAction action, byte b)
+{
+    switch (action)
+    {
+        case ACTION_NONE:
+        case ACTION_IGNORE:
+        case ACTION_HOOK:
+        case ACTION_PUT:
+        case ACTION_UNHOOK:
+        {
+            // DCS strings are recognized so they can be skipped, but none of
+            // them are supported
+        } break;
+
+        case ACTION_PRINT:
+        {
+            // Printable bytes are normally consumed as runs before they get
+            // to the table, so this is only a fallback
+            char c = CAST(char, b);
+            screen_write_ascii(screen, &c, 1);
+        } break;
+
+        case ACTION_EXECUTE:
+        {
+            execute(screen, b);
+        } break;
+
+        case ACTION_CLEAR:
+        {
+            parser->overflowed = 0;
+            parser->intermediate_count = 0;
+            parser->param_count = 0;
+        } break;
+
+        case ACTION_COLLECT:
+        {
+            if (parser->intermediate_count < ARRAY_COUNT(parser->intermediates))
+            {
+                parser->intermediates[parser->intermediate_count++] = CAST(char, b);
+            }
+            else
+            {
+                parser->overflowed = 1;
+            }
+        } break;
+
+        case ACTION_PARAM:
+        {
+            if (!parser->param_count)
+            {
+                parser->params[parser->param_count++] = 0;
+            }
+
+            if ((b == ';') || (b == ':'))
+            {
+                if (parser->param_count < ARRAY_COUNT(parser->params))
+                {
+                    parser->params[parser->param_count++] = 0;
+                }
+            }
+            else
+            {
+                unsigned *value = parser->params + parser->param_count - 1;
+                *value = *value * 10 + (b - '0');
+                if (*value > PARSER_MAX_PARAM_VALUE)
+                {
+                    *value = PARSER_MAX_PARAM_VALUE;
+                }
+            }
+        } break;
+
+        case ACTION_ESC_DISPATCH:
+        {
+            if (!parser->overflowed)
+            {
+                esc_dispatch(parser, screen, b);
+            }
+        } break;
+
+        case ACTION_CSI_DISPATCH:
+        {
+            if (!parser->overflowed)
+            {
+                csi_dispatch(parser, screen, b);
+            }
+        } break;
+
+        case ACTION_OSC_START:
+        {
+            parser->osc_size = 0;
+        } break;
+
+        case ACTION_OSC_PUT:
+        {
+            char c = CAST(char, b);
+            osc_put(parser, &c, 1);
+        } break;
+
+        case ACTION_OSC_END:
+        {
+            osc_dispatch(parser);
+        } break;
+
+        case ACTION_COUNT:
+        {
+            ASSERT(!"Invalid parser action");
+        } break;
+    }
+}
+
+
+void
+parser_process(Parser *parser, TerminalScreen *screen, RawDataBuffer *data)
+{
+    parser_process_until(parser, screen, data, TYPE_MAX(size_t));
+}
+
+
+void
+parser_process_until(Parser *parser, TerminalScreen *screen, RawDataBuffer *data, size_t position)
+{
+    // IMPORTANT! This function needs to see all data in order to properly
+    // parse whatever the end state of the terminal is, even if the terminal
+    // ends up not displaying it all (e.g., a block of data is received that
+    // exceeds a full screen of data)
+    size_t bytes_to_read;
+    const char *bytes = data_buffer_peek(data, &bytes_to_read);
+    size_t consumed = data->consumed;
+    if (position <= consumed)
+    {
+        return;
+    }
+    if (bytes_to_read > position - consumed)
+    {
+        bytes_to_read = position - consumed;
+    }
+
+    size_t offset = 0;
+    while (offset < bytes_to_read)
+    {
+        // The two states that consume arbitrary text only need to look at
+        // control bytes, so everything up to the next one is handled at once
+        if (parser->state == PARSER_GROUND)
+        {
+            size_t run = scan_control(bytes + offset, bytes_to_read - offset);
+            if (run)
+            {
+                print_text(parser, screen, bytes + offset, run, offset + run == bytes_to_read);
+                offset += run;
+                continue;
+            }
+
+            // The control byte cut off a character that was never finished
+            end_text(parser, screen, parser->partial, parser->partial_size, 0);
+            parser->partial_size = 0;
+        }
+        else if (parser->state == PARSER_OSC_STRING)
+        {
+            size_t run = scan_control(bytes + offset, bytes_to_read - offset);
+            if (run)
+            {
+                osc_put(parser, bytes + offset, run);
+                offset += run;
+                continue;
+            }
+        }
+
+        byte b = CAST(byte, bytes[offset++]);
+        byte transition = transitions[parser->state][b];
+        ParserAction action = transition >> 4;
+        unsigned next = transition & 0xf;
+
+        if (next == PARSER_STAY)
+        {
+            perform(parser, screen, action, b);
+        }
+        else
+        {
+            perform(parser, screen, exit_actions[parser->state], b);
+            perform(parser, screen, action, b);
+            parser->state = CAST(ParserState, next);
+            perform(parser, screen, entry_actions[next], b);
+        }
+    }
+
+    data_buffer_consume(data, bytes_to_read);
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "data_buffer.h"
+#include "screen.h"
+#include "utf8.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+// Anything past these limits is dropped so hostile input can't make the parser
+// do more than a constant amount of work per byte
+#define PARSER_MAX_PARAMS 16
+#define PARSER_MAX_PARAM_VALUE 65535
+#define PARSER_MAX_INTERMEDIATES 2
+#define PARSER_MAX_OSC 512
+
+// Text that isn't ASCII is decoded this many bytes at a time, which keeps any
+// ASCII that follows it from having to be decoded too
+#define PARSER_DECODE_CHUNK 64
+
+#define PARSER_MAX_TITLE 256
+#define PARSER_MAX_REPLY 64
+
+
+typedef enum ParserState
+{
+    PARSER_GROUND,
+    PARSER_ESCAPE,
+    PARSER_ESCAPE_INTERMEDIATE,
+    PARSER_CSI_ENTRY,
+    PARSER_CSI_PARAM,
+    PARSER_CSI_INTERMEDIATE,
+    PARSER_CSI_IGNORE,
+    PARSER_DCS_ENTRY,
+    PARSER_DCS_PARAM,
+    PARSER_DCS_INTERMEDIATE,
+    PARSER_DCS_PASSTHROUGH,
+    PARSER_DCS_IGNORE,
+    PARSER_OSC_STRING,
+    PARSER_SOS_PM_APC_STRING,
+
+    PARSER_STATE_COUNT,
+} ParserState;
+
+
+typedef struct Parser
+{
+    ParserState state;
+
+    // Set when a sequence had more intermediates than we keep, in which case
+    // it is ignored instead of being dispatched as something it isn't
+    int overflowed;
+
+    unsigned intermediate_count;
+    char intermediates[PARSER_MAX_INTERMEDIATES];
+
+    unsigned param_count;
+    unsigned params[PARSER_MAX_PARAMS];
+
+    // The start of a character that was cut off by the end of the data, to be
+    // finished by whatever comes next
+    unsigned partial_size;
+    char partial[UTF8_MAX_SEQUENCE];
+    uint32_t decoded[PARSER_DECODE_CHUNK];
+
+    size_t osc_size;
+    char osc[PARSER_MAX_OSC];
+
+    // The window title requested with OSC 0 or 2, if it changed
+    int title_changed;
+    char title[PARSER_MAX_TITLE];
+
+    // Responses to queries, waiting to be written back to the pty
+    size_t reply_size;
+    char reply[PARSER_MAX_REPLY];
+} Parser;
+
+
+// Builds the transition table. Must be called once before parsing anything.
+void parser_init(void);
+
+void parser_create(Parser *parser);
+
+// Interprets everything waiting in the data buffer, updating the screen, and
+// consumes it
+void parser_process(Parser *parser, TerminalScreen *screen, RawDataBuffer *data);
+
+// The same, but stops once the buffer's running total of consumed bytes
+// reaches position, so the screen can be looked at after an exact byte
+void parser_process_until(Parser *parser, TerminalScreen *screen, RawDataBuffer *data, size_t position);
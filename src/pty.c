@@ -0,0 +1,242 @@
+#define _GNU_SOURCE // for ptsname, posix_openpt
+
+#include "pty.h"
+
+#include "stats.h"
+#include "types.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h> // struct winsize, TIOCSWINSZ, ioctl,
+#include <unistd.h>
+
+
+ssize_t
+pty_read(int pty_fd, RawDataBuffer *buffer)
+{
+    size_t avail;
+    char *write = data_buffer_reserve(buffer, &avail);
+
+    STATS_START(read_start);
+    ssize_t bytes_read = read(pty_fd, write, minull(avail, EXPR_MAX(bytes_read)));
+    STATS_STOP(STATS_READ_NS, read_start);
+    if (bytes_read < 0)
+    {
+        // EIO is how the pty reports that the child side was closed. The pty is
+        // non-blocking, so there may also just be nothing to read yet.
+        if ((errno != EIO) && (errno != EAGAIN))
+        {
+            perror("pty_read");
+        }
+    }
+    else
+    {
+#if 0
+        printf("Read %ld bytes\n", bytes_read);
+        for (ssize_t i = 0; i < bytes_read; ++i)
+        {
+            if (i)
+            {
+                printf(", ");
+            }
+            char c = write[i];
+            if (isprint(c))
+            {
+                printf("'%c'", c);
+            }
+            else
+            {
+                printf("<%d>", c);
+            }
+        }
+        fputs("\n", stdout);
+#endif
+        STATS_RECORD(STATS_BYTES_PER_READ, CAST(uint64_t, bytes_read));
+        data_buffer_commit(buffer, CAST(size_t, bytes_read));
+        data_buffer_filled(buffer);
+    }
+    return bytes_read;
+}
+
+
+PtyDrain
+pty_drain(int pty_fd, RawDataBuffer *buffer)
+{
+    PtyDrain result = { 0 };
+
+    // Whatever is waiting already is read in this batch, so a buffer that may
+    // grow grows once to hold it rather than over several batches
+    int pending = 0;
+    ++result.syscalls;
+    size_t space;
+    data_buffer_reserve(buffer, &space);
+    if ((ioctl(pty_fd, FIONREAD, &pending) == 0) && (CAST(size_t, pending) > space)
+        && (buffer->size < buffer->max_size))
+    {
+        size_t needed = buffer->size - space + CAST(size_t, pending);
+        size_t size = buffer->size;
+        while ((size < needed) && (size < buffer->max_size))
+        {
+            size *= 2;
+        }
+        data_buffer_grow(buffer, minull(size, buffer->max_size));
+    }
+
+    // The ring is mapped twice in a row, so the space left is one block even
+    // when it wraps around the end and a plain read can fill all of it
+    while (result.bytes < PTY_DRAIN_LIMIT)
+    {
+        char *write = data_buffer_reserve(buffer, &space);
+        if (!space)
+        {
+            break;
+        }
+
+        ++result.syscalls;
+        STATS_START(read_start);
+        ssize_t bytes_read = read(pty_fd, write, minull(space, EXPR_MAX(bytes_read)));
+        STATS_STOP(STATS_READ_NS, read_start);
+        if (bytes_read > 0)
+        {
+            STATS_RECORD(STATS_BYTES_PER_READ, CAST(uint64_t, bytes_read));
+            data_buffer_commit(buffer, CAST(size_t, bytes_read));
+            result.bytes += CAST(size_t, bytes_read);
+            ++result.reads;
+        }
+        else if ((bytes_read == -1) && (errno == EINTR))
+        {
+            continue;
+        }
+        else
+        {
+            if ((bytes_read == -1) && (errno == EAGAIN))
+            {
+                result.drained = 1;
+            }
+            else
+            {
+                // EIO is how the pty reports that the child side was closed
+                if ((bytes_read == -1) && (errno != EIO))
+                {
+                    perror("pty_drain");
+                }
+                result.closed = 1;
+            }
+            break;
+        }
+    }
+    data_buffer_filled(buffer);
+
+    return result;
+}
+
+
+int
+pty_open(char *name, size_t len)
+{
+    int pty_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (pty_fd == -1)
+    {
+        errno_exit("pty_open:posix_openpt");
+    }
+
+    if(grantpt(pty_fd) == -1)
+    {
+        errno_exit("pty_open:grantpt");
+    }
+
+    if (unlockpt(pty_fd) == -1)
+    {
+        errno_exit("pty_open:unlockpt");
+    }
+
+    char *pty_name = ptsname(pty_fd);
+    if (!pty_name)
+    {
+        errno_exit("pty_open:ptsname");
+    }
+
+    size_t copied = copy_string(name, pty_name, len);
+    if (copied == len)
+    {
+        errno = EOVERFLOW;
+        errno_exit("pty_open:copy_string");
+    }
+
+    return pty_fd;
+}
+
+
+pid_t
+pty_spawn(int *fd, struct winsize *winsize)
+{
+    pid_t pid = -1;
+
+    char pty_name[PATH_MAX];
+    int parent_fd = pty_open(pty_name, sizeof(pty_name));
+    if (parent_fd >= 0)
+    {
+        pid = fork();
+        switch (pid)
+        {
+            // fork failed
+            case -1:
+            {
+                errno_exit("pty_spawn:fork");
+            } break;
+
+            // we're the child process
+            case 0:
+            {
+                if (setsid() == -1)
+                {
+                    errno_exit("pty_spawn:setsid");
+                }
+
+                close(parent_fd);
+                int child_fd = open(pty_name, O_RDWR);
+                if (child_fd == -1)
+                {
+                    errno_exit("pty_spawn:open");
+                }
+
+                if (winsize)
+                {
+                    if (ioctl(child_fd, TIOCSWINSZ, winsize) == -1)
+                    {
+                        errno_exit("pty_spawn:ioctl TIOCSWINSZ");
+                    }
+                }
+
+                if (dup2(child_fd, STDIN_FILENO) != STDIN_FILENO)
+                {
+                    errno_exit("pty_spawn:dup2 stdin");
+                }
+                if (dup2(child_fd, STDOUT_FILENO) != STDOUT_FILENO)
+                {
+                    errno_exit("pty_spawn:dup2 stdout");
+                }
+                if (dup2(child_fd, STDERR_FILENO) != STDERR_FILENO)
+                {
+                    errno_exit("pty_spawn:dup2 stderr");
+                }
+
+                if (child_fd > STDERR_FILENO)
+                {
+                    close(child_fd);
+                }
+            } break;
+
+            // we're the parent process. pid = the process id of the child
+            default:
+            {
+                *fd = parent_fd;
+            } break;
+        }
+    }
+
+    return pid;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "data_buffer.h"
+
+#include <stddef.h>
+#include <sys/ioctl.h> // struct winsize
+#include <sys/types.h> // pid_t, ssize_t
+
+
+// The most read in one batch, so a flood of output still leaves room for a
+// frame and whatever else is waiting every so often
+#define PTY_DRAIN_LIMIT (1024 * 1024)
+
+
+typedef struct PtyDrain
+{
+    size_t bytes;
+    unsigned reads;
+
+    // Reads plus the one FIONREAD
+    unsigned syscalls;
+
+    // Set if the pty ran out of data, which means an edge-triggered epoll will
+    // report it again once there's more. Otherwise the buffer filled up or the
+    // batch hit its limit first.
+    int drained;
+
+    // Set once the child side was closed
+    int closed;
+} PtyDrain;
+
+
+ssize_t pty_read(int pty_fd, RawDataBuffer *buffer);
+
+// Reads a non-blocking pty until it has nothing more to give, the buffer is
+// full or PTY_DRAIN_LIMIT was read. The buffer is grown first if it may grow
+// and what's waiting doesn't fit.
+PtyDrain pty_drain(int pty_fd, RawDataBuffer *buffer);
+
+int pty_open(char *name, size_t len);
+
+pid_t pty_spawn(int *fd, struct winsize *winsize);
@@ -0,0 +1,181 @@
+#include "pty_reader.h"
+
+#include "pty.h"
+#include "types.h"
+#include "util.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+
+static void
+post(int fd)
+{
+    uint64_t one = 1;
+    if (write(fd, &one, sizeof(one)) != sizeof(one))
+    {
+        errno_exit("pty_reader:write eventfd");
+    }
+}
+
+
+static void
+wait_for_space(PtyReader *reader)
+{
+    // Announce that we're about to sleep before looking at the buffer one last
+    // time. The consumer releases space before checking the flag, so one of
+    // the two is guaranteed to see the other.
+    atomic_store(&reader->waiting_for_space, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    size_t space;
+    data_buffer_reserve(reader->buffer, &space);
+    if (!space)
+    {
+        uint64_t count;
+        if ((read(reader->space_fd, &count, sizeof(count)) == -1) && (errno != EINTR))
+        {
+            errno_exit("pty_reader:read eventfd");
+        }
+    }
+
+    atomic_store(&reader->waiting_for_space, 0);
+}
+
+
+static void *
+read_pty(void *arg)
+{
+    PtyReader *reader = arg;
+    while (!atomic_load(&reader->stopping))
+    {
+        size_t space;
+        data_buffer_reserve(reader->buffer, &space);
+        if (!space)
+        {
+            wait_for_space(reader);
+            continue;
+        }
+
+        ssize_t result = pty_read(reader->pty_fd, reader->buffer);
+        if (result <= 0)
+        {
+            if ((result == -1) && (errno == EINTR))
+            {
+                continue;
+            }
+
+            // The pty is non-blocking for the main thread's writes, so this
+            // thread waits for output itself. A wakeup meant for a wait for
+            // space that found space anyway is cleared here, so it doesn't
+            // keep the poll from sleeping.
+            if ((result == -1) && (errno == EAGAIN))
+            {
+                struct pollfd pollfds[] = {
+                    { .fd = reader->pty_fd, .events = POLLIN },
+                    { .fd = reader->space_fd, .events = POLLIN },
+                };
+                if ((poll(pollfds, ARRAY_COUNT(pollfds), -1) > 0) && (pollfds[1].revents & POLLIN))
+                {
+                    uint64_t count;
+                    if ((read(reader->space_fd, &count, sizeof(count)) == -1) && (errno != EINTR))
+                    {
+                        errno_exit("pty_reader:read eventfd");
+                    }
+                }
+                continue;
+            }
+            break;
+        }
+
+        post(reader->event_fd);
+    }
+
+    atomic_store(&reader->closed, 1);
+    post(reader->event_fd);
+
+    return nullptr;
+}
+
+
+void
+pty_reader_start(PtyReader *reader, int pty_fd, RawDataBuffer *buffer)
+{
+    reader->pty_fd = pty_fd;
+    reader->buffer = buffer;
+    atomic_init(&reader->waiting_for_space, 0);
+    atomic_init(&reader->stopping, 0);
+    atomic_init(&reader->closed, 0);
+
+    reader->event_fd = eventfd(0, EFD_CLOEXEC);
+    if (reader->event_fd == -1)
+    {
+        errno_exit("pty_reader_start:eventfd");
+    }
+    reader->space_fd = eventfd(0, EFD_CLOEXEC);
+    if (reader->space_fd == -1)
+    {
+        errno_exit("pty_reader_start:eventfd");
+    }
+
+    int error = pthread_create(&reader->thread, nullptr, read_pty, reader);
+    if (error)
+    {
+        errno = error;
+        errno_exit("pty_reader_start:pthread_create");
+    }
+}
+
+
+int
+pty_reader_wait(PtyReader *reader)
+{
+    uint64_t count;
+    if ((read(reader->event_fd, &count, sizeof(count)) == -1) && (errno != EINTR))
+    {
+        errno_exit("pty_reader_wait:read eventfd");
+    }
+
+    int result = !atomic_load(&reader->closed);
+    return result;
+}
+
+
+void
+pty_reader_consumed(PtyReader *reader)
+{
+    // Only wakes the reader when it actually went to sleep, so the common case
+    // costs no system call
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_exchange(&reader->waiting_for_space, 0))
+    {
+        post(reader->space_fd);
+    }
+}
+
+
+void
+pty_reader_join(PtyReader *reader)
+{
+    int error = pthread_join(reader->thread, nullptr);
+    if (error)
+    {
+        errno = error;
+        errno_exit("pty_reader_join:pthread_join");
+    }
+
+    close(reader->event_fd);
+    close(reader->space_fd);
+}
+
+
+void
+pty_reader_stop(PtyReader *reader)
+{
+    atomic_store(&reader->stopping, 1);
+    post(reader->space_fd);
+    pty_reader_join(reader);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "data_buffer.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+
+// The data buffer size used with a reader thread. It has to hold everything
+// the child writes while a frame is being drawn for the child to never block.
+#define PTY_READER_BUFFER_SIZE (1024 * 1024)
+
+
+// A thread that does nothing but read the pty into a data buffer, so the
+// child never waits on the kernel's pty buffer while the terminal is busy
+// drawing. The thread is the buffer's only producer.
+typedef struct PtyReader
+{
+    int pty_fd;
+    RawDataBuffer *buffer;
+
+    // Readable whenever new data was published or the pty was closed. Meant
+    // to go into the consumer's epoll set.
+    int event_fd;
+
+    // Posted by the consumer when it frees up space the reader is waiting on,
+    // or when it wants the reader to stop
+    int space_fd;
+    _Atomic int waiting_for_space;
+    _Atomic int stopping;
+
+    // Set once the pty returned end of file or an error. Nothing more will be
+    // published after that.
+    _Atomic int closed;
+
+    pthread_t thread;
+} PtyReader;
+
+
+void pty_reader_start(PtyReader *reader, int pty_fd, RawDataBuffer *buffer);
+
+// Clears the event fd. Returns whether the pty is still open, meaning there
+// may be more data to come after what is in the buffer now.
+int pty_reader_wait(PtyReader *reader);
+
+// Must be called after the consumer consumed data from the buffer
+void pty_reader_consumed(PtyReader *reader);
+
+// Waits for the thread to see the pty close and frees everything but the pty
+void pty_reader_join(PtyReader *reader);
+
+// The same, but for when the pty may still be open. The thread stops reading
+// wherever it is, so nothing is written to the buffer once this returns.
+void pty_reader_stop(PtyReader *reader);
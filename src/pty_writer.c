@@ -0,0 +1,319 @@
+#include "pty_writer.h"
+
+#include "types.h"
+#include "util.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+
+#define PASTE_START "\033[200~"
+#define PASTE_END "\033[201~"
+
+
+void
+pty_writer_create(PtyWriter *writer, int pty_fd, int epoll_fd, uint32_t read_events)
+{
+    writer->pty_fd = pty_fd;
+    writer->epoll_fd = epoll_fd;
+    writer->read_events = read_events;
+    writer->polling_out = 0;
+    writer->ring = nullptr;
+    writer->ring_tag = 0;
+
+    data_buffer_create(&writer->queue, PTY_WRITER_BUFFER_SIZE);
+
+    writer->pasting = 0;
+    writer->paste_open = 0;
+    writer->paste_bracketed = 0;
+    writer->paste_start_owed = 0;
+    writer->paste_end_owed = 0;
+    writer->paste_capacity = 0;
+    writer->paste_size = 0;
+    writer->paste_offset = 0;
+    writer->paste = nullptr;
+}
+
+
+// Returns 0 if there's no room for it yet
+static int
+queue_bracket(PtyWriter *writer, const char *bracket, size_t size)
+{
+    size_t space;
+    char *dst = data_buffer_reserve(&writer->queue, &space);
+    if (space < size)
+    {
+        return 0;
+    }
+
+    memcpy(dst, bracket, size);
+    data_buffer_commit(&writer->queue, size);
+    return 1;
+}
+
+
+static void
+queue_paste_end(PtyWriter *writer)
+{
+    if (writer->paste_end_owed && queue_bracket(writer, PASTE_END, sizeof(PASTE_END) - 1))
+    {
+        writer->paste_end_owed = 0;
+    }
+}
+
+
+// Moves as much of the paste into the queue as fits in its first half, leaving
+// the rest of the queue for keys and replies
+static void
+queue_paste(PtyWriter *writer)
+{
+    // The last paste is closed before anything of the next one goes out
+    queue_paste_end(writer);
+    if (!writer->pasting || writer->paste_end_owed)
+    {
+        return;
+    }
+    if (writer->paste_start_owed)
+    {
+        if (!queue_bracket(writer, PASTE_START, sizeof(PASTE_START) - 1))
+        {
+            return;
+        }
+        writer->paste_start_owed = 0;
+    }
+
+    size_t space;
+    char *dst = data_buffer_reserve(&writer->queue, &space);
+    size_t reserved = writer->queue.size / 2;
+    size_t count = minull(space > reserved ? space - reserved : 0, writer->paste_size - writer->paste_offset);
+
+    // Lines are ended with a carriage return, the same as the Enter key. An
+    // ESC could end a bracketed paste early and have the rest of it taken
+    // for keys, so it's dropped.
+    const char *src = writer->paste + writer->paste_offset;
+    int bracketed = writer->paste_bracketed;
+    size_t queued = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        char c = src[i];
+        dst[queued] = (c == '\n') ? '\r' : c;
+        queued += !bracketed || (c != '\033');
+    }
+    data_buffer_commit(&writer->queue, queued);
+    writer->paste_offset += count;
+
+    if ((writer->paste_offset == writer->paste_size) && !writer->paste_open)
+    {
+        writer->paste_offset = writer->paste_size = 0;
+        writer->paste_end_owed = bracketed;
+        writer->pasting = 0;
+
+        free(writer->paste);
+        writer->paste = nullptr;
+        writer->paste_capacity = 0;
+
+        queue_paste_end(writer);
+    }
+    else if (writer->paste_offset == writer->paste_size)
+    {
+        writer->paste_offset = writer->paste_size = 0;
+    }
+}
+
+
+static void
+poll_out(PtyWriter *writer, int enable)
+{
+    // A poll on the ring completes once and can't be taken back, so one that
+    // isn't needed anymore just finds nothing to write
+    if (writer->ring)
+    {
+        if (enable && !writer->polling_out)
+        {
+            io_ring_poll(writer->ring, writer->pty_fd, POLLOUT, 0, writer->ring_tag);
+            writer->polling_out = 1;
+        }
+        return;
+    }
+
+    // Edge-triggered, a pty that stays writable isn't reported again unless
+    // it's asked about again
+    int edge_triggered = (writer->read_events & EPOLLET) != 0;
+    if ((enable == writer->polling_out) && !(enable && edge_triggered))
+    {
+        return;
+    }
+
+    struct epoll_event event = {
+        .events = writer->read_events | (enable ? EPOLLOUT : 0),
+        .data = {.fd = writer->pty_fd},
+    };
+    int op = writer->read_events ? EPOLL_CTL_MOD : (enable ? EPOLL_CTL_ADD : EPOLL_CTL_DEL);
+    if (epoll_ctl(writer->epoll_fd, op, writer->pty_fd, &event) == -1)
+    {
+        errno_exit("pty_writer:epoll_ctl");
+    }
+    writer->polling_out = enable;
+}
+
+
+void
+pty_writer_flush(PtyWriter *writer)
+{
+    queue_paste(writer);
+
+    size_t count;
+    char *data = data_buffer_peek(&writer->queue, &count);
+    if (count)
+    {
+        ssize_t result = write(writer->pty_fd, data, minull(count, PTY_WRITE_CHUNK));
+        if (result > 0)
+        {
+            data_buffer_consume(&writer->queue, CAST(size_t, result));
+            queue_paste(writer);
+        }
+        else if ((result == -1) && (errno != EAGAIN) && (errno != EINTR))
+        {
+            // EIO means the child is gone and nothing will ever be read again,
+            // as does EPIPE when writing to a session. The terminal notices
+            // when it next reads.
+            if ((errno != EIO) && (errno != EPIPE))
+            {
+                perror("pty_writer_flush");
+            }
+            data_buffer_consume(&writer->queue, count);
+            writer->pasting = 0;
+            writer->paste_start_owed = writer->paste_end_owed = 0;
+            writer->paste_offset = writer->paste_size = 0;
+        }
+        data_buffer_peek(&writer->queue, &count);
+    }
+
+    // Whatever is left of a paste is only held back by the queue being full,
+    // so it's enough to wait for the queue to drain
+    poll_out(writer, count != 0);
+}
+
+
+int
+pty_write(PtyWriter *writer, const void *data, size_t size)
+{
+    size_t space;
+    char *dst = data_buffer_reserve(&writer->queue, &space);
+    if (size > space)
+    {
+        return 0;
+    }
+
+    memcpy(dst, data, size);
+    data_buffer_commit(&writer->queue, size);
+    pty_writer_flush(writer);
+
+    return 1;
+}
+
+
+void
+pty_writer_use_ring(PtyWriter *writer, IoRing *ring, uint64_t user_data)
+{
+    writer->ring = ring;
+    writer->ring_tag = user_data;
+}
+
+
+void
+pty_writer_polled(PtyWriter *writer)
+{
+    writer->polling_out = 0;
+    pty_writer_flush(writer);
+}
+
+
+void
+pty_writer_rearm(PtyWriter *writer)
+{
+    struct epoll_event event = {
+        .events = writer->read_events | (writer->polling_out ? EPOLLOUT : 0),
+        .data = {.fd = writer->pty_fd},
+    };
+    if (epoll_ctl(writer->epoll_fd, EPOLL_CTL_MOD, writer->pty_fd, &event) == -1)
+    {
+        errno_exit("pty_writer_rearm:epoll_ctl");
+    }
+}
+
+
+size_t
+pty_writer_space(PtyWriter *writer)
+{
+    size_t result;
+    data_buffer_reserve(&writer->queue, &result);
+    return result;
+}
+
+
+void
+pty_paste_begin(PtyWriter *writer, int bracketed)
+{
+    if (writer->pasting)
+    {
+        // Only what was queued of the last paste goes out, which has to be
+        // closed if it was opened
+        writer->paste_offset = writer->paste_size = 0;
+        writer->pasting = 0;
+        writer->paste_end_owed |= writer->paste_bracketed && !writer->paste_start_owed;
+    }
+
+    writer->paste_bracketed = bracketed;
+    writer->paste_start_owed = bracketed;
+    writer->pasting = 1;
+    writer->paste_open = 1;
+    pty_writer_flush(writer);
+}
+
+
+void
+pty_paste_append(PtyWriter *writer, const char *text, size_t size)
+{
+    // The child may have gone away while the paste was on its way
+    if (!writer->pasting)
+    {
+        return;
+    }
+
+    if (writer->paste_size + size > writer->paste_capacity)
+    {
+        size_t capacity = 2 * writer->paste_capacity;
+        if (capacity < writer->paste_size + size)
+        {
+            capacity = writer->paste_size + size;
+        }
+        char *paste = realloc(writer->paste, capacity);
+        if (!paste)
+        {
+            errno_exit("pty_paste_append:realloc");
+        }
+        writer->paste = paste;
+        writer->paste_capacity = capacity;
+    }
+
+    memcpy(writer->paste + writer->paste_size, text, size);
+    writer->paste_size += size;
+    pty_writer_flush(writer);
+}
+
+
+void
+pty_paste_end(PtyWriter *writer)
+{
+    if (writer->pasting)
+    {
+        writer->paste_open = 0;
+        pty_writer_flush(writer);
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "data_buffer.h"
+#include "io_ring.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+#define PTY_WRITER_BUFFER_SIZE (64 * 1024)
+
+// The most written in one go, so a long queue is sent a piece per wakeup in
+// between reads of the child's output instead of all at once
+#define PTY_WRITE_CHUNK 4096
+
+
+// Everything sent to the child goes through a queue on a non-blocking pty, so
+// a child that stops reading its input can't freeze the terminal. Whatever
+// doesn't fit into the kernel's buffer right away is written once epoll says
+// the pty is writable again, or the ring if the terminal waits on an io_uring.
+typedef struct PtyWriter
+{
+    int pty_fd;
+    int epoll_fd;
+
+    // Polled for writability instead of epoll if set, with the completion
+    // tagged with ring_tag
+    IoRing *ring;
+    uint64_t ring_tag;
+
+    // EPOLLIN when the pty is read on the main thread, in which case it's in
+    // the epoll set already, possibly with EPOLLET. With a reader thread it's
+    // only added while there's something to write.
+    uint32_t read_events;
+    int polling_out;
+
+    RawDataBuffer queue;
+
+    // Pasted text is held here and queued a piece at a time as the child takes
+    // it, so a paste of any size never fills the queue and anything typed
+    // meanwhile still gets through. A paste stays open while more of it may
+    // arrive, and the closing bracket goes out after its last piece.
+    int pasting;
+    int paste_open;
+    int paste_bracketed;
+
+    // Brackets wait in line for room in the queue like the rest of the paste,
+    // since a paste that's never closed leaves the child expecting more of it
+    int paste_start_owed;
+    int paste_end_owed;
+    size_t paste_capacity;
+    size_t paste_size;
+    size_t paste_offset;
+    char *paste;
+} PtyWriter;
+
+
+void pty_writer_create(PtyWriter *writer, int pty_fd, int epoll_fd, uint32_t read_events);
+
+// Queues bytes and writes what it can right away. Returns 0 if they didn't
+// fit in the queue and were dropped.
+int pty_write(PtyWriter *writer, const void *data, size_t size);
+
+// Called when the pty is writable
+void pty_writer_flush(PtyWriter *writer);
+
+// Waits for writability through the ring from now on
+void pty_writer_use_ring(PtyWriter *writer, IoRing *ring, uint64_t user_data);
+
+// Called when the writer's poll on the ring completed
+void pty_writer_polled(PtyWriter *writer);
+
+// Asks epoll about an edge-triggered pty again, so whatever it's ready for
+// now is reported on the next wait even though no new edge came
+void pty_writer_rearm(PtyWriter *writer);
+
+// How many bytes pty_write would take right now
+size_t pty_writer_space(PtyWriter *writer);
+
+// Pastes are wrapped in ESC [ 200 ~ and ESC [ 201 ~ if bracketed, with any ESC
+// in them dropped so they can't close the bracket themselves. Any paste still
+// going is ended first.
+void pty_paste_begin(PtyWriter *writer, int bracketed);
+void pty_paste_append(PtyWriter *writer, const char *text, size_t size);
+void pty_paste_end(PtyWriter *writer);
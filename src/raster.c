@@ -0,0 +1,763 @@
+#include "raster.h"
+
+#include "assert.h"
+#include "types.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+
+// Writes count pixels of a glyph row, mixing the two colors by coverage. Each
+// channel becomes (foreground * a + background * (255 - a)) / 255, rounded.
+// Cells have solid backgrounds, so nothing under them has to be read back.
+typedef void BlendFunction(
+    uint32_t *dst, const unsigned char *coverage, unsigned count, uint32_t foreground, uint32_t background);
+
+
+static uint32_t
+blend_pixel(unsigned alpha, uint32_t foreground, uint32_t background)
+{
+    uint32_t result = 0;
+    for (unsigned shift = 0; shift < 24; shift += 8)
+    {
+        unsigned value = ((foreground >> shift) & 0xff) * alpha + ((background >> shift) & 0xff) * (255 - alpha) + 128;
+        value = (value + (value >> 8)) >> 8;
+        result |= value << shift;
+    }
+
+    return result;
+}
+
+
+static void
+blend_scalar(uint32_t *dst, const unsigned char *coverage, unsigned count, uint32_t foreground, uint32_t background)
+{
+    for (unsigned i = 0; i < count; ++i)
+    {
+        dst[i] = blend_pixel(coverage[i], foreground, background);
+    }
+}
+
+
+#if defined(__x86_64__)
+// Both take alphas spread across the channels of their pixel and colors
+// widened to 16 bits a channel. Nothing overflows, since 255 * 255 + 128 still
+// fits.
+static __m128i
+blend_lanes_sse2(__m128i alpha, __m128i foreground, __m128i background)
+{
+    __m128i inverse = _mm_sub_epi16(_mm_set1_epi16(255), alpha);
+    __m128i value = _mm_add_epi16(_mm_mullo_epi16(foreground, alpha), _mm_mullo_epi16(background, inverse));
+    value = _mm_add_epi16(value, _mm_set1_epi16(128));
+    value = _mm_srli_epi16(_mm_add_epi16(value, _mm_srli_epi16(value, 8)), 8);
+
+    return value;
+}
+
+
+static void
+blend_sse2(uint32_t *dst, const unsigned char *coverage, unsigned count, uint32_t foreground, uint32_t background)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i foreground16 = _mm_unpacklo_epi8(_mm_set1_epi32(CAST(int, foreground)), zero);
+    __m128i background16 = _mm_unpacklo_epi8(_mm_set1_epi32(CAST(int, background)), zero);
+    __m128i background32 = _mm_set1_epi32(CAST(int, background));
+
+    unsigned i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        uint32_t alphas;
+        memcpy(&alphas, coverage + i, sizeof(alphas));
+
+        // Blank parts of a glyph are common enough to be worth skipping
+        __m128i pixels = background32;
+        if (alphas)
+        {
+            // a0 a1 a2 a3 -> a0 a0 a0 a0 a1 a1 a1 a1 and a2 a2 a2 a2 a3 a3 a3 a3
+            __m128i alpha16 = _mm_unpacklo_epi8(_mm_cvtsi32_si128(CAST(int, alphas)), zero);
+            alpha16 = _mm_unpacklo_epi16(alpha16, alpha16);
+
+            __m128i low = blend_lanes_sse2(_mm_unpacklo_epi32(alpha16, alpha16), foreground16, background16);
+            __m128i high = blend_lanes_sse2(_mm_unpackhi_epi32(alpha16, alpha16), foreground16, background16);
+            pixels = _mm_packus_epi16(low, high);
+        }
+        _mm_storeu_si128(CAST(__m128i *, dst + i), pixels);
+    }
+
+    blend_scalar(dst + i, coverage + i, count - i, foreground, background);
+}
+
+
+__attribute__((target("avx2")))
+static __m256i
+blend_lanes_avx2(__m256i alpha, __m256i foreground, __m256i background)
+{
+    __m256i inverse = _mm256_sub_epi16(_mm256_set1_epi16(255), alpha);
+    __m256i value = _mm256_add_epi16(_mm256_mullo_epi16(foreground, alpha), _mm256_mullo_epi16(background, inverse));
+    value = _mm256_add_epi16(value, _mm256_set1_epi16(128));
+    value = _mm256_srli_epi16(_mm256_add_epi16(value, _mm256_srli_epi16(value, 8)), 8);
+
+    return value;
+}
+
+
+__attribute__((target("avx2")))
+static __m256i
+blend8_avx2(uint64_t alphas, __m256i foreground16, __m256i background16)
+{
+    // Each alpha in both halves of its pixel's 32 bits, then in all four
+    // channels once interleaved the way unpacking pixels would interleave them
+    __m256i alpha32 = _mm256_cvtepu8_epi32(_mm_cvtsi64_si128(CAST(long long, alphas)));
+    __m256i alpha16 = _mm256_or_si256(alpha32, _mm256_slli_epi32(alpha32, 16));
+
+    __m256i low = blend_lanes_avx2(_mm256_unpacklo_epi32(alpha16, alpha16), foreground16, background16);
+    __m256i high = blend_lanes_avx2(_mm256_unpackhi_epi32(alpha16, alpha16), foreground16, background16);
+
+    return _mm256_packus_epi16(low, high);
+}
+
+
+__attribute__((target("avx2")))
+static void
+blend_avx2(uint32_t *dst, const unsigned char *coverage, unsigned count, uint32_t foreground, uint32_t background)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i foreground16 = _mm256_unpacklo_epi8(_mm256_set1_epi32(CAST(int, foreground)), zero);
+    __m256i background16 = _mm256_unpacklo_epi8(_mm256_set1_epi32(CAST(int, background)), zero);
+    __m256i background32 = _mm256_set1_epi32(CAST(int, background));
+
+    unsigned i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        uint64_t alphas;
+        memcpy(&alphas, coverage + i, sizeof(alphas));
+        __m256i pixels = alphas ? blend8_avx2(alphas, foreground16, background16) : background32;
+        _mm256_storeu_si256(CAST(__m256i *, dst + i), pixels);
+    }
+
+    // Cells are rarely a multiple of 8 pixels wide, so the rest of the row is
+    // done the same way with the pixels past its end masked off
+    if (i < count)
+    {
+        unsigned remaining = count - i;
+        uint64_t alphas = 0;
+        memcpy(&alphas, coverage + i, remaining);
+        __m256i pixels = alphas ? blend8_avx2(alphas, foreground16, background16) : background32;
+        __m256i mask = _mm256_cmpgt_epi32(
+            _mm256_set1_epi32(CAST(int, remaining)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        _mm256_maskstore_epi32(CAST(int *, dst + i), mask, pixels);
+    }
+}
+#endif
+
+
+static BlendFunction *blend = blend_scalar;
+
+
+ScanLevel
+raster_init(ScanLevel max_level)
+{
+    ScanLevel level = SCAN_SCALAR;
+    blend = blend_scalar;
+
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+
+    if (max_level >= SCAN_SSE2)
+    {
+        level = SCAN_SSE2;
+        blend = blend_sse2;
+    }
+    if ((max_level >= SCAN_AVX2) && __builtin_cpu_supports("avx2"))
+    {
+        level = SCAN_AVX2;
+        blend = blend_avx2;
+    }
+    // A glyph row is rarely wider than 16 pixels, so there's nothing for
+    // AVX-512 to add
+#else
+    (void)max_level;
+#endif
+
+    return level;
+}
+
+
+// Opens the font file fontconfig matched at the size it was matched at
+static FT_Face
+open_pattern(GlyphAtlas *atlas, FcPattern *pattern)
+{
+    FcChar8 *file;
+    int index;
+    if ((FcPatternGetString(pattern, FC_FILE, 0, &file) != FcResultMatch)
+        || (FcPatternGetInteger(pattern, FC_INDEX, 0, &index) != FcResultMatch))
+    {
+        return nullptr;
+    }
+
+    FT_Face result;
+    if (FT_New_Face(atlas->library, CAST(const char *, file), index, &result))
+    {
+        return nullptr;
+    }
+
+    // Bitmap fonts only come in the sizes they have
+    if (FT_Set_Pixel_Sizes(result, 0, atlas->pixel_size) && result->num_fixed_sizes)
+    {
+        FT_Select_Size(result, 0);
+    }
+
+    return result;
+}
+
+
+static FcPattern *
+match_face(const char *family, GlyphFace face, double dpi)
+{
+    FcPattern *pattern = FcNameParse(CAST(const FcChar8 *, family));
+    if (!pattern)
+    {
+        return nullptr;
+    }
+
+    FcPatternAddInteger(pattern, FC_WEIGHT, (face & GLYPH_BOLD) ? FC_WEIGHT_BOLD : FC_WEIGHT_MEDIUM);
+    FcPatternAddInteger(pattern, FC_SLANT, (face & GLYPH_ITALIC) ? FC_SLANT_ITALIC : FC_SLANT_ROMAN);
+    if (dpi > 0)
+    {
+        FcPatternAddDouble(pattern, FC_DPI, dpi);
+    }
+    FcConfigSubstitute(nullptr, pattern, FcMatchPattern);
+    FcDefaultSubstitute(pattern);
+
+    FcResult match_result;
+    FcPattern *result = FcFontMatch(nullptr, pattern, &match_result);
+    FcPatternDestroy(pattern);
+
+    return result;
+}
+
+
+// Asks fontconfig for the font closest to the given one that has the codepoint
+static FT_Face
+find_fallback(GlyphAtlas *atlas, FcPattern *font, uint32_t codepoint)
+{
+    FT_Face result = nullptr;
+
+    FcPattern *pattern = FcPatternDuplicate(font);
+    FcCharSet *charset = FcCharSetCreate();
+    if (pattern && charset)
+    {
+        FcCharSetAddChar(charset, codepoint);
+        FcPatternDel(pattern, FC_CHARSET);
+        FcPatternAddCharSet(pattern, FC_CHARSET, charset);
+        FcPatternAddBool(pattern, FC_SCALABLE, FcTrue);
+        FcConfigSubstitute(nullptr, pattern, FcMatchPattern);
+        FcDefaultSubstitute(pattern);
+
+        FcResult match_result;
+        FcPattern *match = FcFontMatch(nullptr, pattern, &match_result);
+        if (match)
+        {
+            result = open_pattern(atlas, match);
+            if (result && !FT_Get_Char_Index(result, codepoint))
+            {
+                FT_Done_Face(result);
+                result = nullptr;
+            }
+            FcPatternDestroy(match);
+        }
+    }
+
+    if (charset)
+    {
+        FcCharSetDestroy(charset);
+    }
+    if (pattern)
+    {
+        FcPatternDestroy(pattern);
+    }
+
+    return result;
+}
+
+
+static FT_Face
+font_for(GlyphAtlas *atlas, uint32_t codepoint, GlyphFace face)
+{
+    FT_Face result = atlas->faces[face];
+    if (!FT_Get_Char_Index(result, codepoint))
+    {
+        FT_Face fallback = nullptr;
+        for (unsigned i = 0; i < atlas->fallback_count; ++i)
+        {
+            if (FT_Get_Char_Index(atlas->fallbacks[i], codepoint))
+            {
+                fallback = atlas->fallbacks[i];
+                break;
+            }
+        }
+
+        if (!fallback && (atlas->fallback_count < ARRAY_COUNT(atlas->fallbacks)))
+        {
+            fallback = find_fallback(atlas, atlas->patterns[face], codepoint);
+            if (fallback)
+            {
+                atlas->fallbacks[atlas->fallback_count++] = fallback;
+            }
+        }
+
+        // Otherwise fall through and draw whatever the font has for missing
+        // characters
+        if (fallback)
+        {
+            result = fallback;
+        }
+    }
+
+    return result;
+}
+
+
+// Renders a glyph into its slot with its origin on the baseline at the left
+// edge, cutting off anything that spills out of the slot
+static void
+rasterize_glyph(GlyphAtlas *atlas, uint32_t codepoint, GlyphFace face, unsigned char *slot)
+{
+    memset(slot, 0, atlas->slot_size);
+
+    FT_Face font = font_for(atlas, codepoint, face);
+    FT_UInt glyph = FT_Get_Char_Index(font, codepoint);
+    if (FT_Load_Glyph(font, glyph, FT_LOAD_RENDER | FT_LOAD_TARGET_LIGHT))
+    {
+        return;
+    }
+
+    FT_GlyphSlot rendered = font->glyph;
+    FT_Bitmap *bitmap = &rendered->bitmap;
+    int left = rendered->bitmap_left;
+    int top = CAST(int, atlas->ascent) - rendered->bitmap_top;
+    for (unsigned row = 0; row < bitmap->rows; ++row)
+    {
+        int y = top + CAST(int, row);
+        if ((y < 0) || (y >= CAST(int, atlas->cell_height)))
+        {
+            continue;
+        }
+
+        unsigned char *source = bitmap->buffer + CAST(ptrdiff_t, row) * bitmap->pitch;
+        unsigned char *target = slot + CAST(unsigned, y) * atlas->slot_width;
+        for (unsigned col = 0; col < bitmap->width; ++col)
+        {
+            int x = left + CAST(int, col);
+            if ((x < 0) || (x >= CAST(int, atlas->slot_width)))
+            {
+                continue;
+            }
+
+            unsigned char alpha;
+            if (bitmap->pixel_mode == FT_PIXEL_MODE_MONO)
+            {
+                alpha = (source[col / 8] & (0x80 >> (col % 8))) ? 255 : 0;
+            }
+            else if (bitmap->pixel_mode == FT_PIXEL_MODE_GRAY)
+            {
+                alpha = source[col];
+            }
+            else
+            {
+                // Color and subpixel glyphs aren't supported
+                return;
+            }
+            target[x] = alpha;
+        }
+    }
+}
+
+
+void
+glyph_atlas_create(GlyphAtlas *atlas, const char *family, double dpi)
+{
+    if (!FcInit())
+    {
+        error_exit("glyph_atlas_create:FcInit");
+    }
+    if (FT_Init_FreeType(&atlas->library))
+    {
+        error_exit("glyph_atlas_create:FT_Init_FreeType");
+    }
+
+    for (GlyphFace face = 0; face < GLYPH_FACE_COUNT; ++face)
+    {
+        atlas->patterns[face] = match_face(family, face, dpi);
+        atlas->faces[face] = nullptr;
+        if (face == GLYPH_REGULAR)
+        {
+            double pixel_size = 0;
+            if (!atlas->patterns[face]
+                || (FcPatternGetDouble(atlas->patterns[face], FC_PIXEL_SIZE, 0, &pixel_size) != FcResultMatch))
+            {
+                error_exit("glyph_atlas_create:FcFontMatch");
+            }
+            atlas->pixel_size = CAST(unsigned, pixel_size + .5);
+        }
+        if (atlas->patterns[face])
+        {
+            atlas->faces[face] = open_pattern(atlas, atlas->patterns[face]);
+        }
+
+        if (!atlas->faces[face])
+        {
+            // Still draw something if the family has no bold or italic variant
+            if (face == GLYPH_REGULAR)
+            {
+                error_exit("glyph_atlas_create:FT_New_Face");
+            }
+            atlas->faces[face] = atlas->faces[GLYPH_REGULAR];
+            atlas->patterns[face] = atlas->patterns[GLYPH_REGULAR];
+        }
+    }
+
+    // Every cell is as wide as the widest character of a font that should be
+    // monospaced anyway, but a stray wide glyph shouldn't widen all of them
+    FT_Face regular = atlas->faces[GLYPH_REGULAR];
+    FT_Size_Metrics *metrics = &regular->size->metrics;
+    FT_Pos advance = metrics->max_advance;
+    if (!FT_Load_Char(regular, 'M', FT_LOAD_DEFAULT))
+    {
+        advance = regular->glyph->advance.x;
+    }
+    atlas->cell_width = CAST(unsigned, (advance + 63) >> 6);
+    atlas->ascent = CAST(unsigned, (metrics->ascender + 63) >> 6);
+    atlas->cell_height = atlas->ascent + CAST(unsigned, (-metrics->descender + 63) >> 6);
+    if (!atlas->cell_width || !atlas->cell_height)
+    {
+        error_exit("glyph_atlas_create: font has no size");
+    }
+
+    atlas->slot_width = 2 * atlas->cell_width;
+    atlas->slot_size = CAST(size_t, atlas->slot_width) * atlas->cell_height;
+
+    atlas->fallback_count = 0;
+    atlas->hits = atlas->misses = 0;
+
+    atlas->entries = calloc(GLYPH_ATLAS_SIZE, sizeof(*atlas->entries));
+    atlas->coverage = malloc(GLYPH_ATLAS_SIZE * atlas->slot_size);
+    if (!atlas->entries || !atlas->coverage)
+    {
+        errno_exit("glyph_atlas_create:malloc");
+    }
+
+    for (GlyphFace face = 0; face < GLYPH_FACE_COUNT; ++face)
+    {
+        for (uint32_t codepoint = '!'; codepoint <= '~'; ++codepoint)
+        {
+            glyph_atlas_lookup(atlas, codepoint, face);
+        }
+    }
+}
+
+
+const unsigned char *
+glyph_atlas_lookup(GlyphAtlas *atlas, uint32_t codepoint, GlyphFace face)
+{
+    ASSERT(face < GLYPH_FACE_COUNT);
+    _Static_assert((GLYPH_ATLAS_SIZE & (GLYPH_ATLAS_SIZE - 1)) == 0, "Atlas size must be a power of 2");
+
+    uint32_t key = ((codepoint << 2) | face) + 1;
+
+    // Fibonacci hashing so runs of neighbouring codepoints spread out
+    uint32_t slot = (key * 2654435769u) >> 20;
+    _Static_assert(GLYPH_ATLAS_SIZE == (1 << (32 - 20)), "Hash shift doesn't match the atlas size");
+
+    AtlasEntry *entry = atlas->entries + slot;
+    unsigned char *result = atlas->coverage + slot * atlas->slot_size;
+    if (entry->key == key)
+    {
+        ++atlas->hits;
+    }
+    else
+    {
+        ++atlas->misses;
+        rasterize_glyph(atlas, codepoint, face, result);
+        entry->key = key;
+    }
+
+    return result;
+}
+
+
+void
+framebuffer_clear(Framebuffer *framebuffer)
+{
+    for (unsigned y = 0; y < framebuffer->height; ++y)
+    {
+        uint32_t *row = framebuffer->pixels + y * framebuffer->stride;
+        for (unsigned x = 0; x < framebuffer->width; ++x)
+        {
+            row[x] = DEFAULT_BACKGROUND_RGB;
+        }
+    }
+}
+
+
+static void
+fill_rect(Framebuffer *framebuffer, unsigned x, unsigned y, unsigned width, unsigned height, uint32_t rgb)
+{
+    for (unsigned row = 0; row < height; ++row)
+    {
+        uint32_t *pixels = framebuffer->pixels + (y + row) * framebuffer->stride + x;
+        for (unsigned i = 0; i < width; ++i)
+        {
+            pixels[i] = rgb;
+        }
+    }
+}
+
+
+// Draws a run of cells that all share the same colors and style, clipped to
+// the framebuffer. Every pixel of a cell is written once, either with the
+// background or by blending its glyph over it.
+static void
+draw_cells(
+    Framebuffer *framebuffer, GlyphAtlas *atlas, unsigned x, unsigned y, ScreenCell *cells, unsigned count,
+    uint32_t foreground, uint32_t background, uint32_t style)
+{
+    unsigned x_pos = x * atlas->cell_width;
+    unsigned y_pos = y * atlas->cell_height;
+    if ((x_pos >= framebuffer->width) || (y_pos >= framebuffer->height))
+    {
+        return;
+    }
+    unsigned right = minu(x_pos + count * atlas->cell_width, framebuffer->width);
+    unsigned height = minu(atlas->cell_height, framebuffer->height - y_pos);
+
+    if (foreground == background)
+    {
+        fill_rect(framebuffer, x_pos, y_pos, right - x_pos, height, background);
+        return;
+    }
+
+    GlyphFace face = glyph_face(style);
+    for (unsigned i = 0; i < count; ++i)
+    {
+        unsigned cell_x = x_pos + i * atlas->cell_width;
+        if (cell_x >= right)
+        {
+            break;
+        }
+
+        // Drawn with the character it belongs to
+        if (cells[i].flags & CELL_WIDE_SPACER)
+        {
+            continue;
+        }
+
+        // The second half of a wide character may belong to the next run, but
+        // it can only differ in the color of the empty space around the glyph
+        unsigned width = (cells[i].flags & CELL_WIDE) ? atlas->slot_width : atlas->cell_width;
+        width = minu(width, framebuffer->width - cell_x);
+        if (cells[i].codepoint == ' ')
+        {
+            fill_rect(framebuffer, cell_x, y_pos, width, height, background);
+            continue;
+        }
+
+        const unsigned char *coverage = glyph_atlas_lookup(atlas, cells[i].codepoint, face);
+        uint32_t *pixels = framebuffer->pixels + y_pos * framebuffer->stride + cell_x;
+        for (unsigned row = 0; row < height; ++row)
+        {
+            blend(pixels, coverage, width, foreground, background);
+            pixels += framebuffer->stride;
+            coverage += atlas->slot_width;
+        }
+    }
+
+    unsigned baseline = atlas->ascent;
+    if ((style & STYLE_UNDERLINE) && (baseline + 1 < height))
+    {
+        fill_rect(framebuffer, x_pos, y_pos + baseline + 1, right - x_pos, 1, foreground);
+    }
+    if ((style & STYLE_STRIKETHROUGH) && (baseline - baseline / 3 < height))
+    {
+        fill_rect(framebuffer, x_pos, y_pos + baseline - baseline / 3, right - x_pos, 1, foreground);
+    }
+}
+
+
+void
+raster_add_rect(RasterRect *rect, unsigned x, unsigned y, unsigned width, unsigned height)
+{
+    if (!width || !height)
+    {
+        return;
+    }
+
+    if (!rect->width)
+    {
+        *rect = (RasterRect){ x, y, width, height };
+        return;
+    }
+
+    unsigned right = rect->x + rect->width;
+    unsigned bottom = rect->y + rect->height;
+    if (x + width > right)
+    {
+        right = x + width;
+    }
+    if (y + height > bottom)
+    {
+        bottom = y + height;
+    }
+    rect->x = minu(rect->x, x);
+    rect->y = minu(rect->y, y);
+    rect->width = right - rect->x;
+    rect->height = bottom - rect->y;
+}
+
+
+void
+raster_draw_text(
+    Framebuffer *framebuffer, GlyphAtlas *atlas, unsigned col, unsigned row, const char *text, unsigned count,
+    RasterRect *changed)
+{
+    ScreenCell cells[256];
+    count = minu(count, ARRAY_COUNT(cells));
+    for (unsigned i = 0; i < count; ++i)
+    {
+        cells[i] = (ScreenCell){ .codepoint = CAST(byte, text[i]) };
+    }
+
+    draw_cells(framebuffer, atlas, col, row, cells, count, DEFAULT_BACKGROUND_RGB, DEFAULT_FOREGROUND_RGB, 0);
+    if ((col * atlas->cell_width < framebuffer->width) && (row * atlas->cell_height < framebuffer->height))
+    {
+        unsigned x = col * atlas->cell_width;
+        unsigned y = row * atlas->cell_height;
+        raster_add_rect(changed, x, y,
+            minu(count * atlas->cell_width, framebuffer->width - x), minu(atlas->cell_height, framebuffer->height - y));
+    }
+}
+
+
+void
+raster_scroll(
+    Framebuffer *framebuffer, GlyphAtlas *atlas, TerminalScreen *screen, DrawnCursor *cursor, unsigned overlay_cols,
+    RasterRect *moved)
+{
+    *moved = (RasterRect){ 0 };
+    int scroll = screen_take_scroll(screen, cursor, overlay_cols);
+    if (!scroll)
+    {
+        return;
+    }
+
+    // Only the rows of cells move. Rows that were cut off by the bottom of
+    // the framebuffer have nothing to move up, so any that come into full
+    // view are drawn again.
+    unsigned cell_height = atlas->cell_height;
+    unsigned height = minu(screen->rows * cell_height, framebuffer->height);
+    unsigned shift = CAST(unsigned, abs(scroll)) * cell_height;
+    if (shift >= height)
+    {
+        screen_damage_all(screen);
+        return;
+    }
+
+    uint32_t *pixels = framebuffer->pixels;
+    size_t stride = framebuffer->stride;
+    size_t size = (height - shift) * stride * sizeof(*pixels);
+    if (scroll > 0)
+    {
+        memmove(pixels, pixels + shift * stride, size);
+
+        unsigned full_rows = framebuffer->height / cell_height;
+        unsigned first_cut = (full_rows > CAST(unsigned, scroll)) ? full_rows - CAST(unsigned, scroll) : 0;
+        for (unsigned y = first_cut; y < screen->rows; ++y)
+        {
+            screen_damage(screen, 0, y, screen->cols);
+        }
+        *moved = (RasterRect){ 0, 0, framebuffer->width, height - shift };
+    }
+    else
+    {
+        memmove(pixels + shift * stride, pixels, size);
+        *moved = (RasterRect){ 0, shift, framebuffer->width, height - shift };
+    }
+}
+
+
+void
+raster_draw_buffer(
+    Framebuffer *framebuffer, GlyphAtlas *atlas, TerminalScreen *screen, DrawnCursor *cursor,
+    RasterRect *changed)
+{
+    unsigned cell_width = atlas->cell_width;
+    unsigned cell_height = atlas->cell_height;
+    unsigned visible_cols = framebuffer->width / cell_width;
+    unsigned cols = minu(screen->cols, visible_cols + 1);
+    int cursor_visible = screen_damage_cursor(screen, cursor, cols);
+
+    *changed = (RasterRect){ 0 };
+    int cursor_damaged = 0;
+    for (unsigned y = 0; y < screen->rows; ++y)
+    {
+        ScreenSpan span;
+        if (!screen_damaged_span(screen, y, cols, &span) || (y * cell_height >= framebuffer->height))
+        {
+            continue;
+        }
+
+        if ((y == screen->cursor_y) && (screen->cursor_x >= span.first) && (screen->cursor_x < span.end))
+        {
+            cursor_damaged = 1;
+        }
+
+        // Cells paint their own background, so only what's past the end of a
+        // short row is cleared. A span that reaches the last column also
+        // clears whatever partial cell is left past it.
+        unsigned left = span.first * cell_width;
+        unsigned right = (span.end == screen->cols) ? framebuffer->width : minu(span.end * cell_width, framebuffer->width);
+        unsigned top = y * cell_height;
+        unsigned height = minu(cell_height, framebuffer->height - top);
+        unsigned blank = (span.row_end > span.first) ? span.row_end * cell_width : left;
+        if (blank < right)
+        {
+            fill_rect(framebuffer, blank, top, right - blank, height, DEFAULT_BACKGROUND_RGB);
+        }
+        raster_add_rect(changed, left, top, right - left, height);
+
+        for (unsigned x = span.first; x < span.row_end; )
+        {
+            unsigned count = CAST(unsigned, screen_run_length(span.row + x, span.row_end - x));
+
+            ScreenAttribute *attribute = span.attributes + span.row[x].attribute;
+            uint32_t foreground, background;
+            screen_resolve_colors(attribute, &foreground, &background);
+            draw_cells(framebuffer, atlas, x, y, span.row + x, count, foreground, background, attribute->style);
+
+            x += count;
+        }
+    }
+    screen_clear_damage(screen);
+
+    if (cursor_visible && cursor_damaged)
+    {
+        ScreenCell *cell = screen_row(screen, screen->cursor_y) + screen->cursor_x;
+        ScreenAttribute *attribute = screen->attributes + cell->attribute;
+        uint32_t foreground, background;
+        screen_resolve_colors(attribute, &foreground, &background);
+        if (foreground == background)
+        {
+            foreground = DEFAULT_FOREGROUND_RGB;
+            background = DEFAULT_BACKGROUND_RGB;
+        }
+        draw_cells(framebuffer, atlas, screen->cursor_x, screen->cursor_y, cell, 1,
+            background, foreground, attribute->style & ~CAST(uint32_t, STYLE_INVISIBLE));
+    }
+
+    screen_cursor_drawn(screen, cursor, cursor_visible);
+}
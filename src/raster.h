@@ -0,0 +1,115 @@
+#pragma once
+
+#include "scan.h"
+#include "screen.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fontconfig/fontconfig.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+
+// Must be a power of 2
+#define GLYPH_ATLAS_SIZE 4096
+
+#define GLYPH_ATLAS_MAX_FALLBACKS 16
+
+
+// Pixels are 0x00RRGGBB, which is how 24-bit TrueColor visuals lay them out
+typedef struct Framebuffer
+{
+    unsigned width;
+    unsigned height;
+
+    // In pixels
+    size_t stride;
+    uint32_t *pixels;
+} Framebuffer;
+
+
+// The smallest rectangle of pixels a draw changed, empty if width is 0
+typedef struct RasterRect
+{
+    unsigned x;
+    unsigned y;
+    unsigned width;
+    unsigned height;
+} RasterRect;
+
+
+typedef struct AtlasEntry
+{
+    // (codepoint << 2) | face, plus one so zero means empty
+    uint32_t key;
+} AtlasEntry;
+
+
+// Glyphs rendered to 8-bit coverage once and kept, so drawing a cell is just
+// blending a slot of the atlas into the framebuffer. Each slot is two cells
+// wide so wide characters fit, and slot i belongs to entry i, so a glyph that
+// hashes to a slot in use simply replaces what was there.
+typedef struct GlyphAtlas
+{
+    FT_Library library;
+    FT_Face faces[GLYPH_FACE_COUNT];
+
+    // What fontconfig matched each face to, to look for fallbacks close to it
+    FcPattern *patterns[GLYPH_FACE_COUNT];
+    unsigned pixel_size;
+
+    // Fonts found for characters the faces don't have, shared by every face
+    unsigned fallback_count;
+    FT_Face fallbacks[GLYPH_ATLAS_MAX_FALLBACKS];
+
+    unsigned cell_width;
+    unsigned cell_height;
+    unsigned ascent;
+
+    unsigned slot_width;
+    size_t slot_size;
+
+    size_t hits;
+    size_t misses;
+
+    AtlasEntry *entries;
+    unsigned char *coverage;
+} GlyphAtlas;
+
+
+// Selects the blending routine the same way scan_init does
+ScanLevel raster_init(ScanLevel max_level);
+
+// Finds the font with fontconfig and rasterizes printable ASCII in every face
+// up front. A dpi of 0 leaves the size to fontconfig's defaults.
+void glyph_atlas_create(GlyphAtlas *atlas, const char *family, double dpi);
+
+// Returns the coverage of a glyph, slot_width by cell_height bytes
+const unsigned char *glyph_atlas_lookup(GlyphAtlas *atlas, uint32_t codepoint, GlyphFace face);
+
+
+// Draws ASCII text in cells starting at col, row, in the default colors swapped
+void raster_draw_text(
+    Framebuffer *framebuffer, GlyphAtlas *atlas, unsigned col, unsigned row, const char *text, unsigned count,
+    RasterRect *changed);
+
+// Grows rect to cover another one
+void raster_add_rect(RasterRect *rect, unsigned x, unsigned y, unsigned width, unsigned height);
+
+// Fills the whole framebuffer with the default background
+void framebuffer_clear(Framebuffer *framebuffer);
+
+// Moves the pixels of the rows that scrolled since the last draw along with
+// them, so only the rows that came in are drawn again, and returns the pixels
+// that moved. overlay_cols is how much of the top row the overlay was last
+// drawn over.
+void raster_scroll(
+    Framebuffer *framebuffer, GlyphAtlas *atlas, TerminalScreen *screen, DrawnCursor *cursor, unsigned overlay_cols,
+    RasterRect *moved);
+
+// Repaints only the cells damaged since the last call, the same way
+// draw_buffer does, and returns the pixels that changed
+void raster_draw_buffer(
+    Framebuffer *framebuffer, GlyphAtlas *atlas, TerminalScreen *screen, DrawnCursor *cursor,
+    RasterRect *changed);
@@ -0,0 +1,332 @@
+#include "render_thread.h"
+
+#include "assert.h"
+#include "stats.h"
+#include "types.h"
+#include "util.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+
+static void
+post(int fd)
+{
+    uint64_t one = 1;
+    if (write(fd, &one, sizeof(one)) != sizeof(one))
+    {
+        errno_exit("render_thread:write eventfd");
+    }
+}
+
+
+static void
+set_presented(RenderThread *render, uint64_t sequence)
+{
+    atomic_store_explicit(&render->presented, sequence, memory_order_release);
+    post(render->presented_fd);
+}
+
+
+// Swaps the front frame for the one published last, if it wasn't taken yet.
+// Whatever wasn't drawn of the old front frame, because the server was still
+// busy with the image, is drawn with the new one.
+static void
+take_frame(RenderThread *render)
+{
+    if (!(atomic_load_explicit(&render->shared, memory_order_relaxed) & RENDER_FRAME_FRESH))
+    {
+        return;
+    }
+
+    TerminalScreen *old = &render->frames[render->front].screen;
+    unsigned shared = atomic_exchange_explicit(&render->shared, render->front, memory_order_acq_rel);
+    render->front = shared & ~CAST(unsigned, RENDER_FRAME_FRESH);
+
+    screen_merge_damage(&render->frames[render->front].screen, old->damage, old->scroll, old->cols, old->rows);
+}
+
+
+static void
+draw_frame(RenderThread *render)
+{
+    take_frame(render);
+    RenderFrame *frame = render->frames + render->front;
+    if (!frame->sequence)
+    {
+        return;
+    }
+
+#ifdef STATS_ENABLED
+    if (render->overlay)
+    {
+        stats_format_overlay(render->overlay, STATS_OVERLAY_SIZE);
+    }
+#endif
+
+    STATS_START(draw_start);
+    XlibConnection *x_connection = &render->x_connection;
+    if (render->headless)
+    {
+        headless_draw(render->headless, &frame->screen);
+        set_presented(render, frame->sequence);
+    }
+    else
+    {
+        if ((frame->width != x_connection->width) || (frame->height != x_connection->height))
+        {
+            xlib_resize(x_connection, frame->width, frame->height);
+        }
+
+        draw_buffer(x_connection, &frame->screen);
+        if (x_connection->renderer == XLIB_RENDER_SHM)
+        {
+            // Either the image was just put, or there was nothing to put, or
+            // the frame has to wait until the server is done with the last one
+            if (x_connection->put_pending && !x_connection->draw_deferred)
+            {
+                render->put_sequence = frame->sequence;
+            }
+            else if (!x_connection->put_pending)
+            {
+                set_presented(render, frame->sequence);
+            }
+        }
+        else
+        {
+            if (render->sync)
+            {
+                XSync(x_connection->display, False);
+            }
+            set_presented(render, frame->sequence);
+        }
+    }
+    STATS_STOP(STATS_DRAW_NS, draw_start);
+    STATS_COUNT(frames_drawn);
+}
+
+
+// The only events that come to this connection are MIT-SHM completions and
+// the answers to copies of the window onto itself, since the window's events
+// go to the main thread's
+static void
+process_events(RenderThread *render)
+{
+    XlibConnection *x_connection = &render->x_connection;
+    while (XPending(x_connection->display))
+    {
+        XEvent event;
+        XNextEvent(x_connection->display, &event);
+        if ((x_connection->renderer == XLIB_RENDER_SHM) && (event.type == x_connection->shm_completion))
+        {
+            x_connection->put_pending = 0;
+            set_presented(render, render->put_sequence);
+            if (x_connection->draw_deferred)
+            {
+                draw_frame(render);
+            }
+        }
+        else if ((event.type == GraphicsExpose) || (event.type == NoExpose))
+        {
+            if (xlib_copy_exposed(x_connection, &render->frames[render->front].screen, &event))
+            {
+                draw_frame(render);
+            }
+        }
+    }
+}
+
+
+static void *
+draw_frames(void *arg)
+{
+    RenderThread *render = arg;
+    struct pollfd fds[] = {
+        { .fd = render->wake_fd, .events = POLLIN },
+        { .fd = render->headless ? -1 : render->x_connection.fd, .events = POLLIN },
+    };
+
+    while (!atomic_load(&render->stopping))
+    {
+        if (poll(fds, ARRAY_COUNT(fds), -1) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            errno_exit("render_thread:poll");
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            uint64_t count;
+            if (read(render->wake_fd, &count, sizeof(count)) == -1)
+            {
+                errno_exit("render_thread:read eventfd");
+            }
+            draw_frame(render);
+        }
+
+        // Also sends off whatever was just drawn
+        if (!render->headless)
+        {
+            process_events(render);
+        }
+    }
+
+    return nullptr;
+}
+
+
+void
+render_thread_start(RenderThread *render, TerminalScreen *screen, XlibConnection *x_connection,
+    HeadlessRenderer *headless, char *overlay, int sync)
+{
+    for (unsigned i = 0; i < ARRAY_COUNT(render->frames); ++i)
+    {
+        RenderFrame *frame = render->frames + i;
+        screen_create(&frame->screen, screen->cols, screen->rows, nullptr);
+        frame->sequence = 0;
+        frame->width = 0;
+        frame->height = 0;
+    }
+    render->back = 0;
+    render->published = 0;
+    atomic_init(&render->shared, 1);
+    render->front = 2;
+
+    arena_create(&render->memory, RENDER_DAMAGE_RESERVE);
+    render->published_damage = nullptr;
+    render->published_scroll = 0;
+    render->published_cols = 0;
+    render->published_rows = 0;
+
+    render->headless = headless;
+    if (headless)
+    {
+        headless->overlay = overlay;
+    }
+    else
+    {
+        xlib_renderer_create(&render->x_connection, x_connection);
+        render->x_connection.overlay = overlay;
+    }
+    render->overlay = overlay;
+    render->sync = sync;
+    render->put_sequence = 0;
+
+    atomic_init(&render->stopping, 0);
+    atomic_init(&render->presented, 0);
+    render->wake_fd = eventfd(0, EFD_CLOEXEC);
+    render->presented_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if ((render->wake_fd == -1) || (render->presented_fd == -1))
+    {
+        errno_exit("render_thread_start:eventfd");
+    }
+
+    int error = pthread_create(&render->thread, nullptr, draw_frames, render);
+    if (error)
+    {
+        errno = error;
+        errno_exit("render_thread_start:pthread_create");
+    }
+}
+
+
+void
+render_thread_publish(RenderThread *render, TerminalScreen *screen, unsigned width, unsigned height)
+{
+    RenderFrame *frame = render->frames + render->back;
+    screen_snapshot(&frame->screen, screen);
+    frame->sequence = ++render->published;
+    frame->width = CAST(unsigned short, width);
+    frame->height = CAST(unsigned short, height);
+
+    // The damage of the last frame published has to be drawn with this one if
+    // the render thread never takes it. Only this thread marks the shared
+    // frame fresh, so if it isn't, the last frame was taken.
+    unsigned fresh = render->back | RENDER_FRAME_FRESH;
+    unsigned shared = atomic_load_explicit(&render->shared, memory_order_relaxed);
+    int merged = (shared & RENDER_FRAME_FRESH) != 0;
+    if (merged)
+    {
+        screen_merge_damage(&frame->screen, render->published_damage, render->published_scroll,
+            render->published_cols, render->published_rows);
+    }
+
+    if (render->published_rows != screen->rows)
+    {
+        arena_reset(&render->memory);
+        render->published_damage = arena_push(&render->memory, screen->rows * sizeof(*render->published_damage));
+    }
+    size_t damage_size = screen->rows * sizeof(*render->published_damage);
+    memcpy(render->published_damage, frame->screen.damage, damage_size);
+    render->published_scroll = frame->screen.scroll;
+    render->published_cols = screen->cols;
+    render->published_rows = screen->rows;
+
+    // If it was taken after all, it was drawn along with its scroll, which
+    // mustn't be moved by twice, so the frame only keeps its own damage
+    if (!merged || !atomic_compare_exchange_strong_explicit(&render->shared, &shared, fresh,
+            memory_order_acq_rel, memory_order_relaxed))
+    {
+        if (merged)
+        {
+            memcpy(frame->screen.damage, screen->damage, damage_size);
+            memcpy(render->published_damage, screen->damage, damage_size);
+            frame->screen.scroll = screen->scroll;
+            render->published_scroll = screen->scroll;
+        }
+        shared = atomic_exchange_explicit(&render->shared, fresh, memory_order_acq_rel);
+    }
+    screen_clear_damage(screen);
+
+    render->back = shared & ~CAST(unsigned, RENDER_FRAME_FRESH);
+    post(render->wake_fd);
+}
+
+
+uint64_t
+render_thread_presented(RenderThread *render)
+{
+    uint64_t count;
+    if ((read(render->presented_fd, &count, sizeof(count)) == -1) && (errno != EAGAIN))
+    {
+        errno_exit("render_thread_presented:read eventfd");
+    }
+
+    uint64_t result = atomic_load_explicit(&render->presented, memory_order_acquire);
+    return result;
+}
+
+
+void
+render_thread_flush(RenderThread *render)
+{
+    while (render_thread_presented(render) < render->published)
+    {
+        struct pollfd pollfd = { .fd = render->presented_fd, .events = POLLIN };
+        poll(&pollfd, 1, -1);
+    }
+}
+
+
+void
+render_thread_stop(RenderThread *render)
+{
+    atomic_store(&render->stopping, 1);
+    post(render->wake_fd);
+
+    int error = pthread_join(render->thread, nullptr);
+    if (error)
+    {
+        errno = error;
+        errno_exit("render_thread_stop:pthread_join");
+    }
+
+    close(render->wake_fd);
+    close(render->presented_fd);
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "arena.h"
+#include "headless.h"
+#include "screen.h"
+#include "xlib.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+
+// Enough for the damage of as many rows as a window can have
+#define RENDER_DAMAGE_RESERVE (1024 * 1024)
+
+// Set in RenderThread.shared along with the index of the frame there while
+// that frame hasn't been taken yet
+#define RENDER_FRAME_FRESH 4
+
+
+// A copy of the screen as it was when it was published, which nothing
+// changes while it's drawn
+typedef struct RenderFrame
+{
+    TerminalScreen screen;
+
+    // Counts up from 1 with every frame published, so 0 is none yet
+    uint64_t sequence;
+
+    // How big the window was, as far as the main thread knew
+    unsigned short width;
+    unsigned short height;
+} RenderFrame;
+
+
+// A thread that does nothing but draw, so a slow frame never holds up parsing
+// and a flood of output never holds up drawing.
+//
+// Frames are triple buffered. The main thread copies the screen into the back
+// frame and swaps it with the shared one, and the render thread swaps its front
+// frame with the shared one whenever that holds a frame it hasn't taken yet.
+// Neither ever waits for the other: a frame published before the last one was
+// taken simply replaces it, with its damage carried over.
+typedef struct RenderThread
+{
+    RenderFrame frames[3];
+
+    // Only ever touched by the main thread
+    unsigned back;
+    uint64_t published;
+
+    // The damage of the last frame published, which has to be drawn with the
+    // next one if the render thread never takes it
+    MemoryArena memory;
+    ScreenDamage *published_damage;
+    int published_scroll;
+    unsigned published_cols;
+    unsigned published_rows;
+
+    _Atomic unsigned shared;
+
+    // Only ever touched by the render thread once it's started
+    unsigned front;
+
+    // Exactly one of these is drawn into. The connection is the thread's
+    // own, but the headless renderer is handed over by the main thread.
+    XlibConnection x_connection;
+    HeadlessRenderer *headless;
+
+    // Rewritten before every frame if the stats are shown
+    char *overlay;
+
+    // Xft frames are only on screen once the server has answered a round trip
+    // after them, which is only waited for if someone wants to know
+    int sync;
+
+    // The last frame put through MIT-SHM, which is on screen once the server
+    // is done with the image
+    uint64_t put_sequence;
+
+    // Posted by the main thread for every frame and to stop the thread
+    int wake_fd;
+    _Atomic int stopping;
+
+    // The last frame that is on screen. presented_fd is readable whenever it
+    // changed.
+    _Atomic uint64_t presented;
+    int presented_fd;
+
+    pthread_t thread;
+} RenderThread;
+
+
+// Starts drawing copies of screen, into the window of x_connection through a
+// connection of the thread's own if it's set and with headless otherwise
+void render_thread_start(RenderThread *render, TerminalScreen *screen, XlibConnection *x_connection,
+    HeadlessRenderer *headless, char *overlay, int sync);
+
+// Copies the screen into a new frame for the thread to draw and clears its
+// damage. width and height are the size of the window.
+void render_thread_publish(RenderThread *render, TerminalScreen *screen, unsigned width, unsigned height);
+
+// Clears presented_fd and returns the sequence of the last frame on screen
+uint64_t render_thread_presented(RenderThread *render);
+
+// Waits until the last frame published is on screen
+void render_thread_flush(RenderThread *render);
+
+void render_thread_stop(RenderThread *render);
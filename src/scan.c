@@ -0,0 +1,253 @@
+#include "scan.h"
+
+#include "types.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+
+const char *scan_level_names[SCAN_LEVEL_COUNT] = {
+    [SCAN_SCALAR] = "scalar",
+    [SCAN_SSE2] = "sse2",
+    [SCAN_AVX2] = "avx2",
+    [SCAN_AVX512] = "avx512",
+};
+
+
+#define SWAR_ONES 0x0101010101010101ull
+#define SWAR_HIGHS 0x8080808080808080ull
+
+
+static int
+is_control(char c)
+{
+    byte b = CAST(byte, c);
+    int result = (b < 0x20) || (b == 0x7f);
+    return result;
+}
+
+
+static uint64_t
+load_word(const char *data)
+{
+    uint64_t result;
+    memcpy(&result, data, sizeof(result));
+    return result;
+}
+
+
+// Sets the high bit of every byte of word that is a C0 control or DEL, looking
+// for bytes below 0x20 and bytes that are zero after xoring with 0x7f. Borrows
+// can set it in bytes after the first such byte too, but never before, so only
+// the lowest set bit is exact.
+static uint64_t
+control_bits(uint64_t word)
+{
+    uint64_t c0 = (word - 0x20 * SWAR_ONES) & ~word;
+    uint64_t del = word ^ (0x7f * SWAR_ONES);
+    del = (del - SWAR_ONES) & ~del;
+
+    uint64_t result = (c0 | del) & SWAR_HIGHS;
+    return result;
+}
+
+
+// Eight bytes at a time in a general purpose register. The bytes after the
+// last full word are checked with one more word that overlaps the one before,
+// which is fine since the bytes they share are known not to match.
+static size_t
+scan_control_scalar(const char *data, size_t count)
+{
+    size_t offset = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; count - offset >= 8; offset += 8)
+    {
+        uint64_t bits = control_bits(load_word(data + offset));
+        if (bits)
+        {
+            return offset + CAST(size_t, __builtin_ctzll(bits)) / 8;
+        }
+    }
+    if ((offset != count) && (count >= 8))
+    {
+        uint64_t bits = control_bits(load_word(data + count - 8));
+        return count - (bits ? 8 - CAST(size_t, __builtin_ctzll(bits)) / 8 : 0);
+    }
+#endif
+
+    while ((offset < count) && !is_control(data[offset]))
+    {
+        ++offset;
+    }
+
+    return offset;
+}
+
+
+#if defined(__x86_64__)
+
+// A byte is a C0 control if min(byte, 0x1f) == byte using an unsigned
+// comparison. There is no unsigned less-than for bytes before AVX-512, which is
+// why this is done with min.
+//
+// Like the scalar scan, the last bytes are checked with a block that overlaps
+// the one before, so a scan costs one call whatever its length. Only scans
+// shorter than a block drop down a level.
+
+static unsigned
+control_mask_sse2(const char *data)
+{
+    const __m128i c0_max = _mm_set1_epi8(0x1f);
+    const __m128i del = _mm_set1_epi8(0x7f);
+
+    __m128i block = _mm_loadu_si128(CAST(const __m128i *, data));
+    __m128i c0 = _mm_cmpeq_epi8(_mm_min_epu8(block, c0_max), block);
+    __m128i is_del = _mm_cmpeq_epi8(block, del);
+
+    unsigned result = CAST(unsigned, _mm_movemask_epi8(_mm_or_si128(c0, is_del)));
+    return result;
+}
+
+
+static size_t
+scan_control_sse2(const char *data, size_t count)
+{
+    size_t offset = 0;
+    for (; count - offset >= 16; offset += 16)
+    {
+        unsigned mask = control_mask_sse2(data + offset);
+        if (mask)
+        {
+            return offset + CAST(size_t, __builtin_ctz(mask));
+        }
+    }
+    if (offset == count)
+    {
+        return count;
+    }
+    if (count < 16)
+    {
+        return scan_control_scalar(data, count);
+    }
+
+    unsigned mask = control_mask_sse2(data + count - 16);
+    return count - (mask ? 16 - CAST(size_t, __builtin_ctz(mask)) : 0);
+}
+
+
+__attribute__((target("avx2")))
+static unsigned
+control_mask_avx2(const char *data)
+{
+    const __m256i c0_max = _mm256_set1_epi8(0x1f);
+    const __m256i del = _mm256_set1_epi8(0x7f);
+
+    __m256i block = _mm256_loadu_si256(CAST(const __m256i *, data));
+    __m256i c0 = _mm256_cmpeq_epi8(_mm256_min_epu8(block, c0_max), block);
+    __m256i is_del = _mm256_cmpeq_epi8(block, del);
+
+    unsigned result = CAST(unsigned, _mm256_movemask_epi8(_mm256_or_si256(c0, is_del)));
+    return result;
+}
+
+
+__attribute__((target("avx2")))
+static size_t
+scan_control_avx2(const char *data, size_t count)
+{
+    size_t offset = 0;
+    for (; count - offset >= 32; offset += 32)
+    {
+        unsigned mask = control_mask_avx2(data + offset);
+        if (mask)
+        {
+            return offset + CAST(size_t, __builtin_ctz(mask));
+        }
+    }
+    if (offset == count)
+    {
+        return count;
+    }
+    if (count < 32)
+    {
+        return scan_control_sse2(data, count);
+    }
+
+    unsigned mask = control_mask_avx2(data + count - 32);
+    return count - (mask ? 32 - CAST(size_t, __builtin_ctz(mask)) : 0);
+}
+
+
+// Masked loads don't fault on the bytes they leave out, so the last bytes are
+// one more block instead of a drop down a level
+__attribute__((target("avx512f,avx512bw")))
+static size_t
+scan_control_avx512(const char *data, size_t count)
+{
+    const __m512i c0_max = _mm512_set1_epi8(0x1f);
+    const __m512i del = _mm512_set1_epi8(0x7f);
+
+    size_t offset = 0;
+    for (; count - offset >= 64; offset += 64)
+    {
+        __m512i block = _mm512_loadu_si512(data + offset);
+        __mmask64 mask = _mm512_cmple_epu8_mask(block, c0_max)
+            | _mm512_cmpeq_epi8_mask(block, del);
+        if (mask)
+        {
+            return offset + CAST(size_t, __builtin_ctzll(mask));
+        }
+    }
+    if (offset == count)
+    {
+        return count;
+    }
+
+    __mmask64 valid = (CAST(__mmask64, 1) << (count - offset)) - 1;
+    __m512i block = _mm512_maskz_loadu_epi8(valid, data + offset);
+    __mmask64 mask = _mm512_mask_cmple_epu8_mask(valid, block, c0_max)
+        | _mm512_mask_cmpeq_epi8_mask(valid, block, del);
+    return mask ? offset + CAST(size_t, __builtin_ctzll(mask)) : count;
+}
+
+#endif
+
+
+ScanFunction *scan_control = scan_control_scalar;
+
+
+ScanLevel
+scan_init(ScanLevel max_level)
+{
+    ScanLevel level = SCAN_SCALAR;
+    scan_control = scan_control_scalar;
+
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+
+    // SSE2 is part of the x86-64 baseline, so it is always available
+    if (max_level >= SCAN_SSE2)
+    {
+        level = SCAN_SSE2;
+        scan_control = scan_control_sse2;
+    }
+    if ((max_level >= SCAN_AVX2) && __builtin_cpu_supports("avx2"))
+    {
+        level = SCAN_AVX2;
+        scan_control = scan_control_avx2;
+    }
+    if ((max_level >= SCAN_AVX512) && __builtin_cpu_supports("avx512bw"))
+    {
+        level = SCAN_AVX512;
+        scan_control = scan_control_avx512;
+    }
+#else
+    (void)max_level;
+#endif
+
+    return level;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+
+
+// Implementations of the control-byte scanner, from least to most capable. The
+// level to use is selected by scan_init.
+typedef enum ScanLevel
+{
+    SCAN_SCALAR,
+    SCAN_SSE2,
+    SCAN_AVX2,
+    SCAN_AVX512,
+
+    SCAN_LEVEL_COUNT,
+} ScanLevel;
+
+
+extern const char *scan_level_names[SCAN_LEVEL_COUNT];
+
+
+// Returns the offset of the first C0 control byte (0x00-0x1f) or DEL (0x7f) in
+// the first count bytes of data, or count if there is no such byte.
+typedef size_t ScanFunction(const char *data, size_t count);
+
+extern ScanFunction *scan_control;
+
+
+// Selects the most capable implementation that is supported by the CPU but not
+// above max_level, and returns the level that was actually selected.
+ScanLevel scan_init(ScanLevel max_level);
+
+// Scans of terminal output end at the next control byte, usually a few dozen
+// bytes in, where blocks wider than SSE2's cost more than they skip. The wider
+// levels are kept for scan_bench to compare.
+#define SCAN_CONTROL_LEVEL SCAN_SSE2
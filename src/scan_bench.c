@@ -0,0 +1,235 @@
+#define _GNU_SOURCE
+
+#include "scan.h"
+#include "streams.h"
+#include "types.h"
+#include "utf8.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+#define DEFAULT_MEGABYTES 256
+#define PASS_COUNT 5
+
+
+// The line index the terminal used to build over the raw pty data. It is kept
+// here because it is the simplest consumer of the scanner that isn't dominated
+// by other work.
+#define LINE_INDEX_COUNT 80
+
+typedef struct IndexedLine
+{
+    size_t first_byte;
+    size_t one_past_last_byte;
+} IndexedLine;
+
+
+typedef struct LineIndex
+{
+    size_t total_line_count;
+
+    size_t current_line;
+    IndexedLine lines[LINE_INDEX_COUNT];
+} LineIndex;
+
+
+// The original loop, which touches the line index on every byte. This is the
+// baseline to measure the scanner against.
+static void
+index_lines_bytewise(LineIndex *index, const char *data, size_t size)
+{
+    IndexedLine *line = index->lines + index->current_line;
+    for (size_t current_byte = 0; current_byte < size;)
+    {
+        line->one_past_last_byte = ++current_byte;
+
+        if ('\n' == data[current_byte - 1])
+        {
+            ++index->total_line_count;
+            if (++index->current_line == ARRAY_COUNT(index->lines))
+            {
+                index->current_line = 0;
+            }
+
+            line = index->lines + index->current_line;
+            line->first_byte = line->one_past_last_byte = current_byte;
+        }
+    }
+}
+
+
+// Only control bytes can end a line, so this skips over everything else in
+// bulk and only touches the line index once per line
+static void
+index_lines_scan(LineIndex *index, const char *data, size_t size)
+{
+    IndexedLine *line = index->lines + index->current_line;
+    size_t offset = 0;
+    while (offset < size)
+    {
+        offset += scan_control(data + offset, size - offset);
+        if (offset == size)
+        {
+            break;
+        }
+
+        if ('\n' == data[offset++])
+        {
+            line->one_past_last_byte = offset;
+
+            ++index->total_line_count;
+            if (++index->current_line == ARRAY_COUNT(index->lines))
+            {
+                index->current_line = 0;
+            }
+
+            line = index->lines + index->current_line;
+            line->first_byte = line->one_past_last_byte = offset;
+        }
+    }
+
+    line->one_past_last_byte = size;
+}
+
+
+static double
+now_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    double result = CAST(double, now.tv_sec) + CAST(double, now.tv_nsec) / 1e9;
+    return result;
+}
+
+
+typedef void IndexFunction(LineIndex *index, const char *data, size_t size);
+
+
+static double
+measure(IndexFunction *index_lines, const char *data, size_t size, LineIndex *index)
+{
+    double best = 0;
+    for (int pass = 0; pass < PASS_COUNT; ++pass)
+    {
+        memset(index, 0, sizeof(*index));
+        index->total_line_count = 1;
+
+        double start = now_seconds();
+        index_lines(index, data, size);
+        double elapsed = now_seconds() - start;
+
+        if (!pass || (elapsed < best))
+        {
+            best = elapsed;
+        }
+    }
+
+    double result = CAST(double, size) / best / 1e9;
+    return result;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    size_t megabytes = DEFAULT_MEGABYTES;
+    if (argc > 1)
+    {
+        megabytes = strtoul(argv[1], nullptr, 10);
+        if (!megabytes)
+        {
+            fprintf(stderr, "usage: %s [megabytes]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    size_t size = megabytes * 1024 * 1024;
+    char *data = malloc(size);
+    if (!data)
+    {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+    stream_generate(STREAM_ASCII, data, size);
+
+    printf("indexing %zu MB of synthetic build output, best of %d passes\n", megabytes, PASS_COUNT);
+
+    static LineIndex expected;
+    double baseline = measure(index_lines_bytewise, data, size, &expected);
+    printf("%-10s %7.2f GB/s\n", "bytewise", baseline);
+
+    for (ScanLevel level = SCAN_SCALAR; level < SCAN_LEVEL_COUNT; ++level)
+    {
+        if (scan_init(level) != level)
+        {
+            printf("%-10s unsupported\n", scan_level_names[level]);
+            continue;
+        }
+
+        static LineIndex index;
+        double rate = measure(index_lines_scan, data, size, &index);
+        printf("%-10s %7.2f GB/s (%.1fx)%s\n", scan_level_names[level], rate, rate / baseline,
+            memcmp(&index, &expected, sizeof(index)) ? " MISMATCH" : "");
+    }
+
+    // Decoding is measured on text that is half multibyte characters and on
+    // random bytes, which are mostly invalid
+    uint32_t *codepoints = malloc(size * sizeof(*codepoints));
+    uint32_t *expected_codepoints = malloc(size * sizeof(*codepoints));
+    if (!codepoints || !expected_codepoints)
+    {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+
+    StreamKind decode_streams[] = { STREAM_ASCII, STREAM_UTF8, STREAM_BINARY };
+    for (size_t i = 0; i < ARRAY_COUNT(decode_streams); ++i)
+    {
+        stream_generate(decode_streams[i], data, size);
+        printf("\ndecoding %s\n", stream_names[decode_streams[i]]);
+
+        size_t expected_count = 0;
+        for (ScanLevel level = SCAN_SCALAR; level < SCAN_LEVEL_COUNT; ++level)
+        {
+            if (utf8_init(level) != level)
+            {
+                printf("%-10s unsupported\n", scan_level_names[level]);
+                continue;
+            }
+
+            double best = 0;
+            size_t count = 0;
+            for (int pass = 0; pass < PASS_COUNT; ++pass)
+            {
+                double start = now_seconds();
+                size_t consumed;
+                count = utf8_decode(data, size, codepoints, &consumed);
+                double elapsed = now_seconds() - start;
+
+                if (!pass || (elapsed < best))
+                {
+                    best = elapsed;
+                }
+            }
+
+            if (level == SCAN_SCALAR)
+            {
+                expected_count = count;
+                memcpy(expected_codepoints, codepoints, count * sizeof(*codepoints));
+            }
+            int mismatch = (count != expected_count)
+                || memcmp(codepoints, expected_codepoints, count * sizeof(*codepoints));
+            printf("%-10s %7.2f GB/s%s\n", scan_level_names[level], CAST(double, size) / best / 1e9,
+                mismatch ? " MISMATCH" : "");
+        }
+    }
+
+    free(expected_codepoints);
+    free(codepoints);
+    free(data);
+    return EXIT_SUCCESS;
+}
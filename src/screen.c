@@ -0,0 +1,1660 @@
+#include "screen.h"
+
+#include "arena.h"
+#include "assert.h"
+#include "scrollback.h"
+#include "shared_heap.h"
+#include "types.h"
+#include "utf8.h"
+#include "util.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// The xterm defaults
+static const uint32_t base_colors[16] = {
+    0x000000, 0xcd0000, 0x00cd00, 0xcdcd00, 0x0000ee, 0xcd00cd, 0x00cdcd, 0xe5e5e5,
+    0x7f7f7f, 0xff0000, 0x00ff00, 0xffff00, 0x5c5cff, 0xff00ff, 0x00ffff, 0xffffff,
+};
+
+
+static uint32_t
+color_rgb(uint32_t color, uint32_t default_rgb)
+{
+    // COLOR_DEFAULT has the direct bit set too, and is above every index
+    uint32_t result = default_rgb;
+    if ((color & COLOR_DIRECT) && (color != COLOR_DEFAULT))
+    {
+        result = color & 0xffffff;
+    }
+    else if (color < 16)
+    {
+        result = base_colors[color];
+    }
+    else if (color < 232)
+    {
+        // 6x6x6 color cube
+        static const uint32_t levels[6] = { 0, 95, 135, 175, 215, 255 };
+        uint32_t index = color - 16;
+        result = (levels[index / 36] << 16) | (levels[index / 6 % 6] << 8) | levels[index % 6];
+    }
+    else if (color < 256)
+    {
+        // Grayscale ramp
+        uint32_t level = 8 + 10 * (color - 232);
+        result = (level << 16) | (level << 8) | level;
+    }
+
+    return result;
+}
+
+
+size_t
+screen_run_length(ScreenCell *cells, size_t count)
+{
+    size_t result = 1;
+    while ((result < count) && (cells[result].attribute == cells[0].attribute))
+    {
+        ++result;
+    }
+
+    return result;
+}
+
+
+void
+screen_resolve_colors(ScreenAttribute *attribute, uint32_t *foreground, uint32_t *background)
+{
+    uint32_t fg = color_rgb(attribute->foreground, DEFAULT_FOREGROUND_RGB);
+    uint32_t bg = color_rgb(attribute->background, DEFAULT_BACKGROUND_RGB);
+
+    if (attribute->style & STYLE_FAINT)
+    {
+        fg = (fg >> 1) & 0x7f7f7f;
+    }
+    if (attribute->style & STYLE_INVERSE)
+    {
+        uint32_t swap = fg;
+        fg = bg;
+        bg = swap;
+    }
+    if (attribute->style & STYLE_INVISIBLE)
+    {
+        fg = bg;
+    }
+
+    *foreground = fg;
+    *background = bg;
+}
+
+
+GlyphFace
+glyph_face(uint32_t style)
+{
+    GlyphFace result = GLYPH_REGULAR;
+    if (style & STYLE_BOLD)
+    {
+        result |= GLYPH_BOLD;
+    }
+    if (style & STYLE_ITALIC)
+    {
+        result |= GLYPH_ITALIC;
+    }
+
+    return result;
+}
+
+
+// Stores the first few cells one at a time and then doubles them with memcpy,
+// which is several times faster than storing every cell past a short run
+static void
+fill_cells(ScreenCell *cells, size_t count, ScreenCell cell)
+{
+    size_t filled = minull(count, 16);
+    for (size_t i = 0; i < filled; ++i)
+    {
+        cells[i] = cell;
+    }
+
+    while (filled < count)
+    {
+        size_t copied = minull(filled, count - filled);
+        memcpy(cells + filled, cells, copied * sizeof(*cells));
+        filled += copied;
+    }
+}
+
+
+static void
+clear_cells(ScreenCell *cells, size_t count, uint16_t attribute)
+{
+    fill_cells(cells, count, (ScreenCell){ .codepoint = ' ', .attribute = attribute });
+}
+
+
+// Erased cells take on the current background color, but nothing else
+static uint16_t
+blank_attribute(TerminalScreen *screen)
+{
+    ScreenAttribute *current = screen->attributes + screen->current_attribute;
+
+    ScreenAttribute blank = {
+        .foreground = COLOR_DEFAULT,
+        .background = current->background,
+    };
+
+    uint16_t result = screen_intern_attribute(screen, &blank);
+    return result;
+}
+
+
+static void *
+screen_alloc(TerminalScreen *screen, size_t size)
+{
+    void *result;
+    if (screen->heap)
+    {
+        result = shared_heap_alloc(screen->heap, size);
+    }
+    else
+    {
+        result = arena_push(screen->grid_arenas + screen->grid_arena, size);
+    }
+
+    return result;
+}
+
+
+// What's in the grid arenas goes when the arena is next reset instead
+static void
+screen_free(TerminalScreen *screen, void *memory)
+{
+    if (screen->heap)
+    {
+        shared_heap_free(screen->heap, memory);
+    }
+}
+
+
+static ScreenCell *
+allocate_cells(TerminalScreen *screen, unsigned cols, unsigned rows)
+{
+    size_t count = CAST(size_t, cols) * rows;
+
+    ScreenCell *result = screen_alloc(screen, count * sizeof(*result));
+    clear_cells(result, count, SCREEN_DEFAULT_ATTRIBUTE);
+
+    return result;
+}
+
+
+// Keeps a row that is about to disappear off the top
+static void
+push_scrollback(TerminalScreen *screen, ScreenCell *row, unsigned cols)
+{
+    Scrollback *scrollback = screen->scrollback;
+    if (scrollback)
+    {
+        unsigned flags = (row[cols - 1].flags & CELL_WRAPPED) ? LINE_WRAPPED : 0;
+        scrollback_push(scrollback, screen, row, cols, flags);
+    }
+}
+
+
+static ScreenDamage *
+allocate_damage(TerminalScreen *screen, unsigned rows)
+{
+    ScreenDamage *result = screen_alloc(screen, rows * sizeof(*result));
+
+    return result;
+}
+
+
+void
+screen_damage(TerminalScreen *screen, unsigned x, unsigned y, unsigned count)
+{
+    ASSERT(y < screen->rows);
+    ASSERT(x + count <= screen->cols);
+
+    ScreenDamage *damage = screen->damage + y;
+    if (damage->first >= damage->end)
+    {
+        damage->first = x;
+        damage->end = x + count;
+    }
+    else
+    {
+        if (x < damage->first)
+        {
+            damage->first = x;
+        }
+        if (x + count > damage->end)
+        {
+            damage->end = x + count;
+        }
+    }
+}
+
+
+// Nothing that was drawn is kept, so there's nothing to move either
+void
+screen_damage_all(TerminalScreen *screen)
+{
+    for (unsigned y = 0; y < screen->rows; ++y)
+    {
+        screen->damage[y] = (ScreenDamage){ .first = 0, .end = screen->cols };
+    }
+    screen->scroll = 0;
+}
+
+
+void
+screen_clear_damage(TerminalScreen *screen)
+{
+    memset(screen->damage, 0, screen->rows * sizeof(*screen->damage));
+    screen->scroll = 0;
+}
+
+
+// Moves the damage along with rows that scrolled up by count, or down if it's
+// negative, and damages the rows that came in
+static void
+scroll_damage(TerminalScreen *screen, int count)
+{
+    // With the view in the scrollback the rows that scrolled don't move in it
+    unsigned rows = screen->rows;
+    unsigned shift = CAST(unsigned, abs(count));
+    int scroll = screen->scroll + count;
+    if (screen->scrolled_back || (shift >= rows) || (CAST(unsigned, abs(scroll)) >= rows))
+    {
+        screen_damage_all(screen);
+        return;
+    }
+
+    ScreenDamage *damage = screen->damage;
+    ScreenDamage all = { .first = 0, .end = screen->cols };
+    if (count > 0)
+    {
+        memmove(damage, damage + shift, (rows - shift) * sizeof(*damage));
+        for (unsigned y = rows - shift; y < rows; ++y)
+        {
+            damage[y] = all;
+        }
+    }
+    else
+    {
+        memmove(damage + shift, damage, (rows - shift) * sizeof(*damage));
+        for (unsigned y = 0; y < shift; ++y)
+        {
+            damage[y] = all;
+        }
+    }
+    screen->scroll = scroll;
+}
+
+
+void
+screen_merge_damage(TerminalScreen *screen, ScreenDamage *damage, int scroll, unsigned cols, unsigned rows)
+{
+    int total = scroll + screen->scroll;
+    if ((cols != screen->cols) || (rows != screen->rows) || (CAST(unsigned, abs(total)) >= rows))
+    {
+        screen_damage_all(screen);
+        return;
+    }
+
+    // The older damage is where its rows were before the screen scrolled
+    // since, and any of them that scrolled off are damaged already
+    for (unsigned y = 0; y < rows; ++y)
+    {
+        int to = CAST(int, y) - screen->scroll;
+        if ((damage[y].first < damage[y].end) && (to >= 0) && (to < CAST(int, rows)))
+        {
+            screen_damage(screen, damage[y].first, CAST(unsigned, to), damage[y].end - damage[y].first);
+        }
+    }
+    screen->scroll = total;
+}
+
+
+int
+screen_damage_cursor(TerminalScreen *screen, DrawnCursor *cursor, unsigned cols)
+{
+    int visible = !screen->cursor_hidden && !screen->scrolled_back && (screen->cursor_x < cols);
+    int moved = (cursor->x != screen->cursor_x) || (cursor->y != screen->cursor_y);
+    if (cursor->drawn && (moved || !visible) && (cursor->x < screen->cols) && (cursor->y < screen->rows))
+    {
+        screen_damage(screen, cursor->x, cursor->y, 1);
+    }
+    if (visible && (moved || !cursor->drawn))
+    {
+        screen_damage(screen, screen->cursor_x, screen->cursor_y, 1);
+    }
+
+    return visible;
+}
+
+
+void
+screen_cursor_drawn(TerminalScreen *screen, DrawnCursor *cursor, int visible)
+{
+    if (visible)
+    {
+        cursor->x = CAST(unsigned short, screen->cursor_x);
+        cursor->y = CAST(unsigned short, screen->cursor_y);
+    }
+    cursor->drawn = visible;
+}
+
+
+int
+screen_take_scroll(TerminalScreen *screen, DrawnCursor *cursor, unsigned overlay_cols)
+{
+    int result = screen->scroll;
+    screen->scroll = 0;
+
+    if (result && cursor->drawn)
+    {
+        int y = cursor->y - result;
+        if ((y >= 0) && (y < CAST(int, screen->rows)))
+        {
+            cursor->y = CAST(unsigned short, y);
+        }
+        else
+        {
+            cursor->drawn = 0;
+        }
+    }
+
+    // The overlay is drawn over the top row, so it only stays in view when the
+    // screen scrolls down
+    unsigned cols = minu(overlay_cols, screen->cols);
+    if ((result < 0) && cols)
+    {
+        screen_damage(screen, screen->cols - cols, CAST(unsigned, -result), cols);
+    }
+
+    return result;
+}
+
+
+int
+screen_damaged_span(TerminalScreen *screen, unsigned y, unsigned cols, ScreenSpan *span)
+{
+    ScreenDamage *damage = screen->damage + y;
+    unsigned first = damage->first;
+    unsigned end = minu(damage->end, cols);
+    if (first >= end)
+    {
+        return 0;
+    }
+
+    unsigned row_count;
+    ScreenAttribute *attributes;
+    ScreenCell *row = screen_view_row(screen, y, &row_count, &attributes);
+
+    // Wide characters are drawn whole, since clearing either half of one
+    // wipes out part of its glyph
+    if (first && (first < row_count) && (row[first].flags & CELL_WIDE_SPACER))
+    {
+        --first;
+    }
+    if ((end < cols) && (end <= row_count) && (row[end - 1].flags & CELL_WIDE))
+    {
+        ++end;
+    }
+
+    span->first = first;
+    span->end = end;
+    span->row = row;
+    span->row_end = minu(end, row_count);
+    span->attributes = attributes;
+
+    return 1;
+}
+
+
+unsigned
+screen_damage_overlay(TerminalScreen *screen, unsigned *overlay_cols, size_t length)
+{
+    unsigned cols = minu(*overlay_cols, screen->cols);
+    if (cols)
+    {
+        screen_damage(screen, screen->cols - cols, 0, cols);
+    }
+
+    *overlay_cols = CAST(unsigned, minull(length, screen->cols));
+    unsigned result = screen->cols - *overlay_cols;
+
+    return result;
+}
+
+
+void
+screen_create(TerminalScreen *screen, unsigned cols, unsigned rows, struct SharedHeap *heap)
+{
+    ASSERT(cols && rows);
+
+    memset(screen, 0, sizeof(*screen));
+    screen->heap = heap;
+    if (!heap)
+    {
+        arena_create(screen->grid_arenas + 0, SCREEN_GRID_RESERVE);
+        arena_create(screen->grid_arenas + 1, SCREEN_GRID_RESERVE);
+    }
+    screen->cols = cols;
+    screen->rows = rows;
+    screen->cells = allocate_cells(screen, cols, rows);
+    screen->damage = allocate_damage(screen, rows);
+    screen_damage_all(screen);
+
+    ScreenAttribute default_attribute = {
+        .foreground = COLOR_DEFAULT,
+        .background = COLOR_DEFAULT,
+    };
+    screen->current_attribute = screen_intern_attribute(screen, &default_attribute);
+    ASSERT(screen->current_attribute == SCREEN_DEFAULT_ATTRIBUTE);
+
+    screen->autowrap = 1;
+    screen->scroll_bottom = rows;
+}
+
+
+// The number of cells in a row up to its last non-blank one
+static unsigned
+row_length(ScreenCell *row, unsigned cols)
+{
+    unsigned result = cols;
+    while (result && (row[result - 1].codepoint == ' ') && (row[result - 1].attribute == SCREEN_DEFAULT_ATTRIBUTE))
+    {
+        --result;
+    }
+
+    return result;
+}
+
+
+// Finds the line that starts at row y, which goes on for as long as rows are
+// wrapped. Returns the row after it and sets length to its cells minus any
+// trailing blanks.
+static unsigned
+find_line(TerminalScreen *screen, unsigned y, size_t *length)
+{
+    unsigned first = y;
+    while ((y + 1 < screen->rows) && (screen_row(screen, y)[screen->cols - 1].flags & CELL_WRAPPED))
+    {
+        ++y;
+    }
+
+    *length = CAST(size_t, y - first) * screen->cols + row_length(screen_row(screen, y), screen->cols);
+    return y + 1;
+}
+
+
+// Lays out the line that starts at row y at a new width, into out if it's set.
+// Returns the row after the line and sets rows to how many rows it takes up at
+// the new width, which for the line with the cursor on it is enough to hold the
+// cursor. cursor is set to where the cursor ends up in the line, if it's on it.
+//
+// A wide character isn't split by the new right margin, but moved to the next
+// row with a padding blank left in front of it. Padding left by the old right
+// margin is dropped.
+static unsigned
+reflow_line(TerminalScreen *screen, unsigned y, unsigned cols, ScreenCell *out, size_t *rows, size_t *cursor)
+{
+    size_t length;
+    unsigned next = find_line(screen, y, &length);
+
+    size_t cursor_offset = SIZE_MAX;
+    if ((screen->cursor_y >= y) && (screen->cursor_y < next))
+    {
+        cursor_offset = CAST(size_t, screen->cursor_y - y) * screen->cols + screen->cursor_x;
+    }
+
+    size_t at = 0;
+    for (size_t i = 0; i < length; ++i)
+    {
+        ScreenCell cell = screen_row(screen, y + CAST(unsigned, i / screen->cols))[i % screen->cols];
+        if (cell.flags & CELL_WIDE_PADDING)
+        {
+            if (i == cursor_offset)
+            {
+                *cursor = at;
+            }
+            continue;
+        }
+
+        if ((cell.flags & CELL_WIDE) && (cols > 1) && (at % cols == cols - 1))
+        {
+            if (out)
+            {
+                out[at] = (ScreenCell){ .codepoint = ' ', .flags = CELL_WIDE_PADDING };
+            }
+            ++at;
+        }
+        if (i == cursor_offset)
+        {
+            *cursor = at;
+        }
+
+        if (out)
+        {
+            cell.flags &= CAST(uint16_t, ~CELL_WRAPPED);
+            out[at] = cell;
+        }
+        ++at;
+    }
+
+    if ((cursor_offset != SIZE_MAX) && (cursor_offset >= length))
+    {
+        *cursor = at + (cursor_offset - length);
+    }
+    if ((cursor_offset != SIZE_MAX) && (at <= *cursor))
+    {
+        at = *cursor + 1;
+    }
+    *rows = at ? (at + cols - 1) / cols : 1;
+
+    return next;
+}
+
+
+// Rewraps the lines on the screen to the new width. Only the screen is
+// rewrapped here; the scrollback is wrapped whenever it is shown, so the cost
+// of a resize doesn't depend on how much history there is.
+void
+screen_resize(TerminalScreen *screen, unsigned cols, unsigned rows)
+{
+    if (!cols || !rows || ((cols == screen->cols) && (rows == screen->rows)))
+    {
+        return;
+    }
+
+    // Work out how many rows the lines take up at the new width and where the
+    // cursor ends up
+    size_t new_rows = 0;
+    size_t cursor_row = 0;
+    unsigned cursor_col = 0;
+    for (unsigned y = 0; y < screen->rows; )
+    {
+        size_t count;
+        size_t cursor = SIZE_MAX;
+        y = reflow_line(screen, y, cols, nullptr, &count, &cursor);
+        if (cursor != SIZE_MAX)
+        {
+            cursor_row = new_rows + cursor / cols;
+            cursor_col = CAST(unsigned, cursor % cols);
+        }
+        new_rows += count;
+    }
+
+    // The new grid is laid out in the arena the current one isn't in, which
+    // was last used by the resize before this one
+    if (!screen->heap)
+    {
+        screen->grid_arena ^= 1;
+        arena_reset(screen->grid_arenas + screen->grid_arena);
+    }
+
+    // Lay the lines out at the new width, marking every row but the last of
+    // each line as wrapped
+    ScreenCell *wrapped = allocate_cells(screen, cols, CAST(unsigned, new_rows));
+    size_t row = 0;
+    for (unsigned y = 0; y < screen->rows; )
+    {
+        size_t count;
+        size_t cursor = SIZE_MAX;
+        y = reflow_line(screen, y, cols, wrapped + row * cols, &count, &cursor);
+        for (size_t i = 0; i + 1 < count; ++i)
+        {
+            wrapped[(row + i) * cols + cols - 1].flags |= CELL_WRAPPED;
+        }
+        row += count;
+    }
+    ASSERT(row == new_rows);
+
+    // Keep the cursor on screen by dropping rows off the top
+    size_t first_kept = 0;
+    if (cursor_row >= rows)
+    {
+        first_kept = cursor_row - rows + 1;
+    }
+    for (size_t y = 0; y < first_kept; ++y)
+    {
+        push_scrollback(screen, wrapped + y * cols, cols);
+    }
+
+    ScreenCell *cells = allocate_cells(screen, cols, rows);
+    size_t copy_rows = new_rows - first_kept;
+    if (copy_rows > rows)
+    {
+        copy_rows = rows;
+    }
+    memcpy(cells, wrapped + first_kept * cols, copy_rows * cols * sizeof(*cells));
+    screen_free(screen, wrapped);
+
+    screen_free(screen, screen->cells);
+    screen_free(screen, screen->damage);
+    screen->cells = cells;
+    screen->damage = allocate_damage(screen, rows);
+    screen->cols = cols;
+    screen->rows = rows;
+    screen->first_row = 0;
+    screen->view_segment = 0;
+    screen->scroll_top = 0;
+    screen->scroll_bottom = rows;
+    screen_damage_all(screen);
+
+    screen->cursor_x = cursor_col;
+    screen->cursor_y = CAST(unsigned, cursor_row - first_kept);
+    screen->wrap_pending = 0;
+}
+
+
+void
+screen_destroy(TerminalScreen *screen)
+{
+    ASSERT(!screen->heap);
+
+    arena_destroy(screen->grid_arenas + 0);
+    arena_destroy(screen->grid_arenas + 1);
+    screen->cells = nullptr;
+    screen->damage = nullptr;
+}
+
+
+void
+screen_snapshot(TerminalScreen *copy, TerminalScreen *screen)
+{
+    ASSERT(!copy->heap);
+
+    unsigned cols = screen->cols;
+    unsigned rows = screen->rows;
+    if ((copy->cols != cols) || (copy->rows != rows))
+    {
+        // Nothing in the old grid is kept, so the new one can go in either arena
+        copy->grid_arena ^= 1;
+        arena_reset(copy->grid_arenas + copy->grid_arena);
+        copy->cells = screen_alloc(copy, CAST(size_t, cols) * rows * sizeof(*copy->cells));
+        copy->damage = allocate_damage(copy, rows);
+        copy->cols = cols;
+        copy->rows = rows;
+    }
+
+    // Until the table is renumbered attributes are only ever added to the
+    // end of it, so only the ones added since the last copy are copied
+    if (copy->attribute_generation != screen->attribute_generation)
+    {
+        copy->attribute_count = 0;
+    }
+    if (copy->attribute_count != screen->attribute_count)
+    {
+        ASSERT(copy->attribute_count < screen->attribute_count);
+        memcpy(copy->attributes + copy->attribute_count, screen->attributes + copy->attribute_count,
+            (screen->attribute_count - copy->attribute_count) * sizeof(*copy->attributes));
+        memcpy(copy->attribute_index, screen->attribute_index, sizeof(copy->attribute_index));
+        copy->attribute_count = screen->attribute_count;
+        copy->attribute_generation = screen->attribute_generation;
+    }
+
+    for (unsigned y = 0; y < rows; ++y)
+    {
+        unsigned count;
+        ScreenAttribute *attributes;
+        ScreenCell *row = screen_view_row(screen, y, &count, &attributes);
+        ScreenCell *copied = copy->cells + CAST(size_t, y) * cols;
+        memcpy(copied, row, count * sizeof(*copied));
+        clear_cells(copied + count, cols - count, SCREEN_DEFAULT_ATTRIBUTE);
+
+        // Until they're interned below, rows from the scrollback hold indices
+        // into its table, which the copy's would choke on if it's renumbered
+        if (attributes != screen->attributes)
+        {
+            for (unsigned x = 0; x < count; ++x)
+            {
+                copied[x].attribute = SCREEN_DEFAULT_ATTRIBUTE;
+            }
+        }
+    }
+
+    // Rows from the scrollback index its own table, so their attributes are
+    // added to the copy's. Interning may renumber the copy's table, which
+    // renumbers every row copied so far, so they're looked up from the
+    // scrollback again instead of from the copy.
+    if (screen->scrolled_back)
+    {
+        for (unsigned y = 0; y < rows; ++y)
+        {
+            unsigned count;
+            ScreenAttribute *attributes;
+            ScreenCell *row = screen_view_row(screen, y, &count, &attributes);
+            if (attributes != screen->attributes)
+            {
+                ScreenCell *copied = copy->cells + CAST(size_t, y) * cols;
+                for (unsigned x = 0; x < count; ++x)
+                {
+                    copied[x].attribute = screen_intern_attribute(copy, attributes + row[x].attribute);
+                }
+            }
+        }
+
+        // The table isn't a copy of the screen's any more, so the next copy
+        // starts over
+        copy->attribute_generation = screen->attribute_generation - 1;
+    }
+
+    copy->first_row = 0;
+    copy->cursor_x = screen->cursor_x;
+    copy->cursor_y = screen->cursor_y;
+    copy->cursor_hidden = screen->cursor_hidden || screen->scrolled_back;
+    memcpy(copy->damage, screen->damage, rows * sizeof(*copy->damage));
+    copy->scroll = screen->scroll;
+}
+
+
+ScreenCell *
+screen_row(TerminalScreen *screen, unsigned y)
+{
+    ASSERT(y < screen->rows);
+
+    unsigned row = screen->first_row + y;
+    if (row >= screen->rows)
+    {
+        row -= screen->rows;
+    }
+
+    ScreenCell *result = screen->cells + CAST(size_t, row) * screen->cols;
+    return result;
+}
+
+
+uint32_t
+screen_hash_attribute(ScreenAttribute *attribute)
+{
+    uint32_t hash = attribute->foreground * 0x9e3779b1u;
+    hash = (hash ^ attribute->background) * 0x85ebca6bu;
+    hash = (hash ^ attribute->style) * 0xc2b2ae35u;
+
+    uint32_t result = hash >> 16;
+    return result;
+}
+
+
+// How many rows a scrollback line takes up at the current width
+static unsigned
+line_segments(TerminalScreen *screen, uint64_t line)
+{
+    unsigned count;
+    unsigned flags;
+    scrollback_line(screen->scrollback, line, &count, &flags);
+
+    unsigned result = count ? (count + screen->cols - 1) / screen->cols : 1;
+    return result;
+}
+
+
+// Where the view starts. The line it was on may have been dropped since.
+static uint64_t
+view_top(TerminalScreen *screen, unsigned *segment)
+{
+    Scrollback *scrollback = screen->scrollback;
+
+    uint64_t result = scrollback->end_line;
+    *segment = 0;
+    if (screen->scrolled_back && (screen->view_line >= scrollback->first_line))
+    {
+        result = screen->view_line;
+        *segment = screen->view_segment;
+    }
+    else if (screen->scrolled_back)
+    {
+        result = scrollback->first_line;
+    }
+
+    return result;
+}
+
+
+static void
+set_view_top(TerminalScreen *screen, uint64_t line, unsigned segment)
+{
+    int scrolled_back = line < screen->scrollback->end_line;
+    if ((scrolled_back != screen->scrolled_back)
+        || (scrolled_back && ((line != screen->view_line) || (segment != screen->view_segment))))
+    {
+        screen->scrolled_back = scrolled_back;
+        screen->view_line = line;
+        screen->view_segment = segment;
+        screen_damage_all(screen);
+    }
+}
+
+
+ScreenCell *
+screen_view_row(TerminalScreen *screen, unsigned y, unsigned *count, ScreenAttribute **attributes)
+{
+    ASSERT(y < screen->rows);
+
+    Scrollback *scrollback = screen->scrollback;
+    if (!screen->scrolled_back)
+    {
+        *count = screen->cols;
+        *attributes = screen->attributes;
+        return screen_row(screen, y);
+    }
+
+    // Walk down from the top of the view, or from the last row looked up if
+    // it's above this one. Whatever is left once the scrollback runs out comes
+    // from the top of the screen.
+    unsigned top_segment;
+    uint64_t top_line = view_top(screen, &top_segment);
+    uint64_t line = top_line;
+    unsigned segment = top_segment;
+    unsigned walked = 0;
+
+    ViewRow *last = &screen->last_view_row;
+    if ((last->top_line == top_line) && (last->top_segment == top_segment) && (last->cols == screen->cols)
+        && (last->end_line == scrollback->end_line) && (last->end_cell == scrollback->end_cell) && (last->y <= y))
+    {
+        line = last->line;
+        segment = last->segment;
+        walked = last->rows_walked;
+    }
+
+    while ((walked < y) && (line < scrollback->end_line))
+    {
+        if (++segment == line_segments(screen, line))
+        {
+            ++line;
+            segment = 0;
+        }
+        ++walked;
+    }
+
+    *last = (ViewRow){
+        .top_line = top_line,
+        .top_segment = top_segment,
+        .cols = screen->cols,
+        .end_line = scrollback->end_line,
+        .end_cell = scrollback->end_cell,
+        .y = y,
+        .rows_walked = walked,
+        .line = line,
+        .segment = segment,
+    };
+    y -= walked;
+
+    ScreenCell *result;
+    if (line < scrollback->end_line)
+    {
+        unsigned flags;
+        result = scrollback_line(scrollback, line, count, &flags);
+
+        unsigned skipped = minu(segment * screen->cols, *count);
+        result += skipped;
+        *count = minu(*count - skipped, screen->cols);
+        *attributes = scrollback->attributes;
+    }
+    else
+    {
+        result = screen_row(screen, y);
+        *count = screen->cols;
+        *attributes = screen->attributes;
+    }
+
+    return result;
+}
+
+
+void
+screen_scroll_view_up(TerminalScreen *screen, size_t rows)
+{
+    Scrollback *scrollback = screen->scrollback;
+    if (!scrollback)
+    {
+        return;
+    }
+
+    unsigned segment;
+    uint64_t line = view_top(screen, &segment);
+    for (size_t i = 0; i < rows; ++i)
+    {
+        if (segment)
+        {
+            --segment;
+        }
+        else if (line > scrollback->first_line)
+        {
+            --line;
+            segment = line_segments(screen, line) - 1;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    set_view_top(screen, line, segment);
+}
+
+
+void
+screen_scroll_view_down(TerminalScreen *screen, size_t rows)
+{
+    Scrollback *scrollback = screen->scrollback;
+    if (!scrollback || !screen->scrolled_back)
+    {
+        return;
+    }
+
+    unsigned segment;
+    uint64_t line = view_top(screen, &segment);
+    for (size_t i = 0; (i < rows) && (line < scrollback->end_line); ++i)
+    {
+        if (++segment == line_segments(screen, line))
+        {
+            ++line;
+            segment = 0;
+        }
+    }
+
+    set_view_top(screen, line, segment);
+}
+
+
+void
+screen_view_line(TerminalScreen *screen, size_t line)
+{
+    Scrollback *scrollback = screen->scrollback;
+    if (scrollback)
+    {
+        uint64_t top = scrollback->first_line + line;
+        if (top > scrollback->end_line)
+        {
+            top = scrollback->end_line;
+        }
+        set_view_top(screen, top, 0);
+    }
+}
+
+
+void
+screen_view_bottom(TerminalScreen *screen)
+{
+    if (screen->scrollback)
+    {
+        set_view_top(screen, screen->scrollback->end_line, 0);
+    }
+}
+
+
+void
+screen_clear_scrollback(TerminalScreen *screen)
+{
+    if (screen->scrollback)
+    {
+        screen_view_bottom(screen);
+        scrollback_clear(screen->scrollback);
+    }
+}
+
+
+static unsigned
+find_attribute_slot(TerminalScreen *screen, ScreenAttribute *attribute)
+{
+    unsigned slot = screen_hash_attribute(attribute) % SCREEN_ATTRIBUTE_INDEX_COUNT;
+    for (;;)
+    {
+        uint16_t entry = screen->attribute_index[slot];
+        if (!entry)
+        {
+            break;
+        }
+
+        ScreenAttribute *existing = screen->attributes + entry - 1;
+        if ((existing->foreground == attribute->foreground)
+            && (existing->background == attribute->background)
+            && (existing->style == attribute->style))
+        {
+            break;
+        }
+
+        if (++slot == ARRAY_COUNT(screen->attribute_index))
+        {
+            slot = 0;
+        }
+    }
+
+    // The index has twice as many slots as there are attributes, so there is
+    // always an empty slot to end the probe
+    return slot;
+}
+
+
+// Drops every attribute that is no longer used by any cell and renumbers the
+// rest. This costs a pass over the screen, but only happens once the table is
+// full, so output that cycles through many colors stays bounded.
+static void
+compact_attributes(TerminalScreen *screen)
+{
+    static uint16_t remap[SCREEN_ATTRIBUTE_COUNT];
+    memset(remap, 0, sizeof(remap));
+
+    size_t cell_count = CAST(size_t, screen->cols) * screen->rows;
+    remap[SCREEN_DEFAULT_ATTRIBUTE] = 1;
+    remap[screen->current_attribute] = 1;
+    remap[screen->saved_attribute] = 1;
+    for (size_t i = 0; i < cell_count; ++i)
+    {
+        ASSERT(screen->cells[i].attribute < screen->attribute_count);
+        remap[screen->cells[i].attribute] = 1;
+    }
+
+    unsigned count = 0;
+    memset(screen->attribute_index, 0, sizeof(screen->attribute_index));
+    for (unsigned i = 0; i < screen->attribute_count; ++i)
+    {
+        if (remap[i])
+        {
+            ScreenAttribute *attribute = screen->attributes + i;
+            screen->attributes[count] = *attribute;
+            unsigned slot = find_attribute_slot(screen, screen->attributes + count);
+            screen->attribute_index[slot] = CAST(uint16_t, count + 1);
+            remap[i] = CAST(uint16_t, count++);
+        }
+    }
+    screen->attribute_count = count;
+
+    for (size_t i = 0; i < cell_count; ++i)
+    {
+        screen->cells[i].attribute = remap[screen->cells[i].attribute];
+    }
+    screen->current_attribute = remap[screen->current_attribute];
+    screen->saved_attribute = remap[screen->saved_attribute];
+    ++screen->attribute_generation;
+}
+
+
+uint16_t
+screen_intern_attribute(TerminalScreen *screen, ScreenAttribute *attribute)
+{
+    unsigned slot = find_attribute_slot(screen, attribute);
+    uint16_t entry = screen->attribute_index[slot];
+    if (entry)
+    {
+        return CAST(uint16_t, entry - 1);
+    }
+
+    if (screen->attribute_count == ARRAY_COUNT(screen->attributes))
+    {
+        compact_attributes(screen);
+        if (screen->attribute_count == ARRAY_COUNT(screen->attributes))
+        {
+            return SCREEN_DEFAULT_ATTRIBUTE;
+        }
+        slot = find_attribute_slot(screen, attribute);
+    }
+
+    uint16_t result = CAST(uint16_t, screen->attribute_count++);
+    screen->attributes[result] = *attribute;
+    screen->attribute_index[slot] = CAST(uint16_t, result + 1);
+
+    return result;
+}
+
+
+// Blanks the half of any wide character that is left behind when the cells
+// [x, x + count) of row y are overwritten
+static void
+split_wide(TerminalScreen *screen, unsigned x, unsigned y, unsigned count)
+{
+    ASSERT(count && (x + count <= screen->cols));
+
+    ScreenCell *row = screen_row(screen, y);
+    if (x && (row[x].flags & CELL_WIDE_SPACER))
+    {
+        row[x - 1].codepoint = ' ';
+        row[x - 1].flags &= CELL_WRAPPED;
+        screen_damage(screen, x - 1, y, 1);
+    }
+
+    unsigned last = x + count - 1;
+    if ((last + 1 < screen->cols) && (row[last].flags & CELL_WIDE))
+    {
+        row[last + 1].codepoint = ' ';
+        row[last + 1].flags &= CELL_WRAPPED;
+        screen_damage(screen, last + 1, y, 1);
+    }
+}
+
+
+static void
+wrap_if_pending(TerminalScreen *screen)
+{
+    if (screen->wrap_pending)
+    {
+        screen_row(screen, screen->cursor_y)[screen->cols - 1].flags |= CELL_WRAPPED;
+        screen->wrap_pending = 0;
+        screen->cursor_x = 0;
+        screen_line_feed(screen);
+    }
+}
+
+
+// Writes count characters one cell wide, taken from text if it's set and all
+// codepoint otherwise, a row at a time
+static void
+write_cells(TerminalScreen *screen, const char *text, uint32_t codepoint, size_t count)
+{
+    while (count)
+    {
+        wrap_if_pending(screen);
+
+        ScreenCell *cell = screen_row(screen, screen->cursor_y) + screen->cursor_x;
+        size_t run = screen->cols - screen->cursor_x;
+        if (run > count)
+        {
+            run = count;
+        }
+        split_wide(screen, screen->cursor_x, screen->cursor_y, CAST(unsigned, run));
+        screen_damage(screen, screen->cursor_x, screen->cursor_y, CAST(unsigned, run));
+        if (text)
+        {
+            for (size_t i = 0; i < run; ++i)
+            {
+                cell[i] = (ScreenCell){
+                    .codepoint = CAST(byte, text[i]),
+                    .attribute = screen->current_attribute,
+                };
+            }
+            text += run;
+        }
+        else
+        {
+            fill_cells(cell, run, (ScreenCell){ .codepoint = codepoint, .attribute = screen->current_attribute });
+        }
+
+        count -= run;
+        screen->cursor_x += CAST(unsigned, run);
+        if (screen->cursor_x == screen->cols)
+        {
+            screen->cursor_x = screen->cols - 1;
+            screen->wrap_pending = screen->autowrap;
+        }
+    }
+}
+
+
+void
+screen_write_ascii(TerminalScreen *screen, const char *text, size_t count)
+{
+    if (!count)
+    {
+        return;
+    }
+    screen->last_codepoint = CAST(byte, text[count - 1]);
+
+    if (!screen->autowrap && (count > screen->cols - screen->cursor_x))
+    {
+        // Everything that doesn't fit lands on the last column, so only the
+        // last character of the overflow survives
+        size_t fits = screen->cols - screen->cursor_x;
+        write_cells(screen, text, 0, fits - 1);
+        screen->wrap_pending = 0;
+        text += count - 1;
+        count = 1;
+    }
+
+    write_cells(screen, text, 0, count);
+}
+
+
+static void
+write_codepoint(TerminalScreen *screen, uint32_t codepoint, unsigned width)
+{
+    wrap_if_pending(screen);
+
+    if (screen->cursor_x + width > screen->cols)
+    {
+        // A wide character isn't split between rows. Without autowrap it goes
+        // over the end of the row like everything else.
+        if (screen->autowrap)
+        {
+            screen_erase(screen, screen->cursor_x, screen->cursor_y, screen->cols);
+            ScreenCell *row = screen_row(screen, screen->cursor_y);
+            for (unsigned x = screen->cursor_x; x < screen->cols; ++x)
+            {
+                row[x].flags |= CELL_WIDE_PADDING;
+            }
+            screen->wrap_pending = 1;
+            wrap_if_pending(screen);
+        }
+        else
+        {
+            screen->cursor_x = screen->cols - width;
+        }
+    }
+
+    screen->last_codepoint = codepoint;
+
+    ScreenCell *cell = screen_row(screen, screen->cursor_y) + screen->cursor_x;
+    split_wide(screen, screen->cursor_x, screen->cursor_y, width);
+    screen_damage(screen, screen->cursor_x, screen->cursor_y, width);
+    if (width == 2)
+    {
+        cell[0] = (ScreenCell){ .codepoint = codepoint, .attribute = screen->current_attribute, .flags = CELL_WIDE };
+        cell[1] = (ScreenCell){ .codepoint = ' ', .attribute = screen->current_attribute, .flags = CELL_WIDE_SPACER };
+    }
+    else
+    {
+        cell[0] = (ScreenCell){ .codepoint = codepoint, .attribute = screen->current_attribute };
+    }
+
+    if (screen->cursor_x + width == screen->cols)
+    {
+        screen->cursor_x = screen->cols - 1;
+        screen->wrap_pending = screen->autowrap;
+    }
+    else
+    {
+        screen->cursor_x += width;
+    }
+}
+
+
+static unsigned
+codepoint_width(TerminalScreen *screen, uint32_t codepoint)
+{
+    unsigned result = utf8_width(codepoint);
+    if (result > screen->cols)
+    {
+        result = 1;
+    }
+
+    return result;
+}
+
+
+void
+screen_write_codepoints(TerminalScreen *screen, const uint32_t *codepoints, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        unsigned width = codepoint_width(screen, codepoints[i]);
+        if (width)
+        {
+            write_codepoint(screen, codepoints[i], width);
+        }
+    }
+}
+
+
+void
+screen_repeat(TerminalScreen *screen, size_t count)
+{
+    uint32_t codepoint = screen->last_codepoint;
+    if (!codepoint)
+    {
+        return;
+    }
+
+    unsigned width = codepoint_width(screen, codepoint);
+    if (width == 1)
+    {
+        // Without autowrap whatever doesn't fit lands on the last column,
+        // which ends up the same either way
+        if (!screen->autowrap && (count > screen->cols - screen->cursor_x))
+        {
+            count = screen->cols - screen->cursor_x;
+        }
+        write_cells(screen, nullptr, codepoint, count);
+    }
+    else if (width)
+    {
+        // Without autowrap the writes past the end of the row all land on the
+        // same last cells
+        if (!screen->autowrap)
+        {
+            count = minull(count, (screen->cols - screen->cursor_x) / width + 1);
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            write_codepoint(screen, codepoint, width);
+        }
+    }
+}
+
+
+void
+screen_line_feed(TerminalScreen *screen)
+{
+    if (screen->cursor_y + 1 == screen->scroll_bottom)
+    {
+        screen_scroll_up(screen, 1);
+    }
+    else if (screen->cursor_y + 1 < screen->rows)
+    {
+        ++screen->cursor_y;
+    }
+}
+
+
+void
+screen_carriage_return(TerminalScreen *screen)
+{
+    screen->cursor_x = 0;
+    screen->wrap_pending = 0;
+}
+
+
+void
+screen_backspace(TerminalScreen *screen)
+{
+    if (screen->cursor_x)
+    {
+        --screen->cursor_x;
+    }
+    screen->wrap_pending = 0;
+}
+
+
+void
+screen_tab(TerminalScreen *screen)
+{
+    unsigned x = (screen->cursor_x / SCREEN_TAB_WIDTH + 1) * SCREEN_TAB_WIDTH;
+    screen->cursor_x = x < screen->cols ? x : screen->cols - 1;
+}
+
+
+// Copies the rows [top, bottom) count rows up, and blanks the count rows at the
+// bottom. Rows that are copied over at the top of the screen go to the
+// scrollback if keep is set.
+static void
+move_rows_up(TerminalScreen *screen, unsigned top, unsigned bottom, unsigned count, int keep)
+{
+    count = minu(count, bottom - top);
+
+    if (keep && !top)
+    {
+        for (unsigned y = 0; y < count; ++y)
+        {
+            push_scrollback(screen, screen_row(screen, y), screen->cols);
+        }
+    }
+
+    size_t row_size = screen->cols * sizeof(ScreenCell);
+    for (unsigned y = top; y + count < bottom; ++y)
+    {
+        memcpy(screen_row(screen, y), screen_row(screen, y + count), row_size);
+        screen_damage(screen, 0, y, screen->cols);
+    }
+    screen_erase_rows(screen, bottom - count, count);
+}
+
+
+// The same the other way
+static void
+move_rows_down(TerminalScreen *screen, unsigned top, unsigned bottom, unsigned count)
+{
+    count = minu(count, bottom - top);
+
+    size_t row_size = screen->cols * sizeof(ScreenCell);
+    for (unsigned y = bottom; y-- > top + count; )
+    {
+        memcpy(screen_row(screen, y), screen_row(screen, y - count), row_size);
+        screen_damage(screen, 0, y, screen->cols);
+    }
+    screen_erase_rows(screen, top, count);
+}
+
+
+// Only a region that covers the whole screen is scrolled by moving where the
+// ring starts, and only that moves the damage along with it. Anything smaller
+// copies its rows and damages them all.
+void
+screen_scroll_up(TerminalScreen *screen, unsigned count)
+{
+    if ((screen->scroll_top != 0) || (screen->scroll_bottom != screen->rows))
+    {
+        move_rows_up(screen, screen->scroll_top, screen->scroll_bottom, count, 1);
+        return;
+    }
+
+    if (count > screen->rows)
+    {
+        count = screen->rows;
+    }
+
+    uint16_t attribute = blank_attribute(screen);
+    for (unsigned i = 0; i < count; ++i)
+    {
+        push_scrollback(screen, screen_row(screen, 0), screen->cols);
+        clear_cells(screen_row(screen, 0), screen->cols, attribute);
+        if (++screen->first_row == screen->rows)
+        {
+            screen->first_row = 0;
+        }
+    }
+    scroll_damage(screen, CAST(int, count));
+}
+
+
+void
+screen_scroll_down(TerminalScreen *screen, unsigned count)
+{
+    if ((screen->scroll_top != 0) || (screen->scroll_bottom != screen->rows))
+    {
+        move_rows_down(screen, screen->scroll_top, screen->scroll_bottom, count);
+        return;
+    }
+
+    if (count > screen->rows)
+    {
+        count = screen->rows;
+    }
+
+    uint16_t attribute = blank_attribute(screen);
+    for (unsigned i = 0; i < count; ++i)
+    {
+        screen->first_row = (screen->first_row ? screen->first_row : screen->rows) - 1;
+        clear_cells(screen_row(screen, 0), screen->cols, attribute);
+    }
+    scroll_damage(screen, -CAST(int, count));
+}
+
+
+void
+screen_reverse_index(TerminalScreen *screen)
+{
+    if (screen->cursor_y == screen->scroll_top)
+    {
+        screen_scroll_down(screen, 1);
+    }
+    else if (screen->cursor_y)
+    {
+        --screen->cursor_y;
+    }
+}
+
+
+void
+screen_set_scroll_region(TerminalScreen *screen, unsigned top, unsigned bottom)
+{
+    bottom = minu(bottom, screen->rows);
+    if (top + 1 < bottom)
+    {
+        screen->scroll_top = top;
+        screen->scroll_bottom = bottom;
+        screen_move_cursor(screen, 0, 0);
+    }
+}
+
+
+void
+screen_insert_lines(TerminalScreen *screen, unsigned count)
+{
+    unsigned y = screen->cursor_y;
+    if (y == screen->scroll_top)
+    {
+        // Which is all a scroll down is, and that can be cheaper
+        screen_scroll_down(screen, count);
+        screen_carriage_return(screen);
+    }
+    else if ((y > screen->scroll_top) && (y < screen->scroll_bottom))
+    {
+        move_rows_down(screen, y, screen->scroll_bottom, count);
+        screen_carriage_return(screen);
+    }
+}
+
+
+void
+screen_delete_lines(TerminalScreen *screen, unsigned count)
+{
+    unsigned y = screen->cursor_y;
+    if ((y >= screen->scroll_top) && (y < screen->scroll_bottom))
+    {
+        move_rows_up(screen, y, screen->scroll_bottom, count, 0);
+        screen_carriage_return(screen);
+    }
+}
+
+
+void
+screen_insert_chars(TerminalScreen *screen, unsigned count)
+{
+    unsigned x = screen->cursor_x;
+    unsigned y = screen->cursor_y;
+    unsigned cols = screen->cols;
+    count = minu(count, cols - x);
+    unsigned kept = cols - x - count;
+
+    // Wide characters cut in two by the cursor or by the right margin are
+    // blanked
+    ScreenCell *row = screen_row(screen, y);
+    if (row[x].flags & CELL_WIDE_SPACER)
+    {
+        split_wide(screen, x, y, 1);
+        row[x].flags &= CELL_WRAPPED;
+    }
+    if (kept && (row[x + kept - 1].flags & CELL_WIDE))
+    {
+        row[x + kept - 1].codepoint = ' ';
+        row[x + kept - 1].flags &= CELL_WRAPPED;
+    }
+
+    // The row no longer runs on into the next one as it did
+    row[cols - 1].flags &= CAST(uint16_t, ~CELL_WRAPPED);
+    memmove(row + x + count, row + x, kept * sizeof(*row));
+    clear_cells(row + x, count, blank_attribute(screen));
+    screen_damage(screen, x, y, cols - x);
+    screen->wrap_pending = 0;
+}
+
+
+void
+screen_delete_chars(TerminalScreen *screen, unsigned count)
+{
+    unsigned x = screen->cursor_x;
+    unsigned y = screen->cursor_y;
+    unsigned cols = screen->cols;
+    count = minu(count, cols - x);
+    unsigned kept = cols - x - count;
+
+    ScreenCell *row = screen_row(screen, y);
+    split_wide(screen, x, y, count);
+
+    row[cols - 1].flags &= CAST(uint16_t, ~CELL_WRAPPED);
+    memmove(row + x, row + x + count, kept * sizeof(*row));
+    clear_cells(row + x + kept, count, blank_attribute(screen));
+    screen_damage(screen, x, y, cols - x);
+    screen->wrap_pending = 0;
+}
+
+
+void
+screen_save_cursor(TerminalScreen *screen)
+{
+    screen->saved_cursor_x = screen->cursor_x;
+    screen->saved_cursor_y = screen->cursor_y;
+    screen->saved_attribute = screen->current_attribute;
+}
+
+
+void
+screen_restore_cursor(TerminalScreen *screen)
+{
+    screen_move_cursor(screen, screen->saved_cursor_x, screen->saved_cursor_y);
+    screen->current_attribute = screen->saved_attribute;
+}
+
+
+void
+screen_set_attribute(TerminalScreen *screen, ScreenAttribute *attribute)
+{
+    screen->current_attribute = screen_intern_attribute(screen, attribute);
+}
+
+
+void
+screen_move_cursor(TerminalScreen *screen, unsigned x, unsigned y)
+{
+    screen->cursor_x = x < screen->cols ? x : screen->cols - 1;
+    screen->cursor_y = y < screen->rows ? y : screen->rows - 1;
+    screen->wrap_pending = 0;
+}
+
+
+void
+screen_erase(TerminalScreen *screen, unsigned x, unsigned y, unsigned count)
+{
+    ASSERT(x < screen->cols);
+
+    if (count > screen->cols - x)
+    {
+        count = screen->cols - x;
+    }
+    split_wide(screen, x, y, count);
+    clear_cells(screen_row(screen, y) + x, count, blank_attribute(screen));
+    screen_damage(screen, x, y, count);
+}
+
+
+void
+screen_erase_rows(TerminalScreen *screen, unsigned first_row, unsigned row_count)
+{
+    ASSERT(first_row <= screen->rows);
+
+    if (row_count > screen->rows - first_row)
+    {
+        row_count = screen->rows - first_row;
+    }
+
+    uint16_t attribute = blank_attribute(screen);
+    for (unsigned y = first_row; y < first_row + row_count; ++y)
+    {
+        clear_cells(screen_row(screen, y), screen->cols, attribute);
+        screen_damage(screen, 0, y, screen->cols);
+    }
+}
+
+
+void
+screen_reset(TerminalScreen *screen)
+{
+    screen->current_attribute = SCREEN_DEFAULT_ATTRIBUTE;
+    screen->saved_attribute = SCREEN_DEFAULT_ATTRIBUTE;
+    screen->saved_cursor_x = screen->saved_cursor_y = 0;
+    screen->autowrap = 1;
+    screen->cursor_hidden = 0;
+    screen->bracketed_paste = 0;
+    screen->synchronized = 0;
+    screen->scroll_top = 0;
+    screen->scroll_bottom = screen->rows;
+    screen->last_codepoint = 0;
+
+    screen_erase_rows(screen, 0, screen->rows);
+    screen_move_cursor(screen, 0, 0);
+}
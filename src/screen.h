@@ -0,0 +1,374 @@
+#pragma once
+
+#include "arena.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+#define SCREEN_DEFAULT_COLS 80
+#define SCREEN_DEFAULT_ROWS 25
+
+#define SCREEN_TAB_WIDTH 8
+
+// Maximum number of distinct attribute combinations that can be on the screen
+// at once. Anything past this is drawn with the default attributes.
+#define SCREEN_ATTRIBUTE_COUNT 1024
+
+#define SCREEN_ATTRIBUTE_INDEX_COUNT (2 * SCREEN_ATTRIBUTE_COUNT)
+
+#define SCREEN_DEFAULT_ATTRIBUTE 0
+
+// Address space for each of the two grids, enough for a grid and the rewrapped
+// copy it's resized from at any size a window can be
+#define SCREEN_GRID_RESERVE (512ull * 1024 * 1024)
+
+
+enum ScreenStyle
+{
+    STYLE_BOLD = 1 << 0,
+    STYLE_FAINT = 1 << 1,
+    STYLE_ITALIC = 1 << 2,
+    STYLE_UNDERLINE = 1 << 3,
+    STYLE_BLINK = 1 << 4,
+    STYLE_INVERSE = 1 << 5,
+    STYLE_INVISIBLE = 1 << 6,
+    STYLE_STRIKETHROUGH = 1 << 7,
+};
+
+
+// The font faces a cell can be drawn with. The bits line up so a face can be
+// built by or-ing bold and italic together.
+typedef enum GlyphFace
+{
+    GLYPH_REGULAR = 0,
+    GLYPH_BOLD = 1 << 0,
+    GLYPH_ITALIC = 1 << 1,
+
+    GLYPH_FACE_COUNT = 4,
+} GlyphFace;
+
+
+// Colors are either one of the 256 indexed colors or a direct 24-bit color
+#define COLOR_DEFAULT 0xffffffff
+#define COLOR_DIRECT 0x01000000
+#define COLOR_RGB(r, g, b) (COLOR_DIRECT | ((uint32_t)(r) << 16) | ((uint32_t)(g) << 8) | (uint32_t)(b))
+
+
+#define DEFAULT_FOREGROUND_RGB 0xffffff
+#define DEFAULT_BACKGROUND_RGB 0x000000
+
+
+typedef struct ScreenAttribute
+{
+    uint32_t foreground;
+    uint32_t background;
+    uint32_t style;
+} ScreenAttribute;
+
+
+enum ScreenCellFlags
+{
+    // Set on the last cell of a row that was cut off by the right margin and
+    // continues on the next row
+    CELL_WRAPPED = 1 << 0,
+
+    // A character two cells wide is stored in the first of them. The second
+    // holds a blank marked as a spacer, so neither half is ever overwritten
+    // without the other being cleared too.
+    CELL_WIDE = 1 << 1,
+    CELL_WIDE_SPACER = 1 << 2,
+
+    // The blank left at the end of a row by a wide character that didn't fit
+    // there, which isn't part of the line when it's rewrapped
+    CELL_WIDE_PADDING = 1 << 3,
+};
+
+
+typedef struct ScreenCell
+{
+    uint32_t codepoint;
+    uint16_t attribute;
+    uint16_t flags;
+} ScreenCell;
+
+
+// Row y of a scrolled back view is row segment of scrollback line line, or if
+// that's past the end of the scrollback, row y - rows_walked of the screen
+typedef struct ViewRow
+{
+    // What it was worked out from
+    uint64_t top_line;
+    unsigned top_segment;
+    unsigned cols;
+    uint64_t end_line;
+    uint64_t end_cell;
+
+    unsigned y;
+    unsigned rows_walked;
+    uint64_t line;
+    unsigned segment;
+} ViewRow;
+
+
+// The columns [first, end) of a row that changed since it was last drawn
+typedef struct ScreenDamage
+{
+    unsigned first;
+    unsigned end;
+} ScreenDamage;
+
+
+struct Scrollback;
+struct SharedHeap;
+
+
+typedef struct TerminalScreen
+{
+    unsigned cols;
+    unsigned rows;
+
+    unsigned cursor_x;
+    unsigned cursor_y;
+
+    // Set when a character was written into the last column. The cursor stays
+    // put until the next character, which wraps to the next line first.
+    int wrap_pending;
+
+    // DECAWM. When off, characters past the last column overwrite it.
+    int autowrap;
+    int cursor_hidden;
+
+    // Pasted text is wrapped in ESC [ 200 ~ and ESC [ 201 ~
+    int bracketed_paste;
+
+    // Mode 2026. Set while the application is in the middle of redrawing the
+    // screen, which shouldn't be shown until it's done.
+    int synchronized;
+
+    // DECSTBM. Only the rows [scroll_top, scroll_bottom) move when the screen
+    // scrolls, and they only go to the scrollback if the region starts at the
+    // top.
+    unsigned scroll_top;
+    unsigned scroll_bottom;
+
+    // The last character written, which REP repeats, or 0 if there's none
+    uint32_t last_codepoint;
+
+    unsigned saved_cursor_x;
+    unsigned saved_cursor_y;
+    uint16_t saved_attribute;
+
+    // The cells are stored as a ring of rows so scrolling doesn't have to move
+    // any of them. Screen row y is stored at row (first_row + y) % rows.
+    unsigned first_row;
+    ScreenCell *cells;
+
+    // Indexed by screen row rather than by stored row
+    ScreenDamage *damage;
+
+    // How many rows the screen scrolled up since it was last drawn, or down if
+    // negative. The damage moves along with the rows, so a renderer can move
+    // whatever it drew by as much and only draw the rows that came in. Always
+    // less than rows, and only ever set by scrolls of the whole screen.
+    int scroll;
+
+    // Where rows go when they scroll off the top, if anywhere
+    struct Scrollback *scrollback;
+
+    // Where the cells are allocated if they're shared with another process
+    struct SharedHeap *heap;
+
+    // Where they're allocated otherwise. Each resize lays the new grid out in
+    // the arena the current one isn't in and then switches to it, so resizing
+    // never allocates once both have grown to the largest size seen.
+    unsigned grid_arena;
+    MemoryArena grid_arenas[2];
+
+    // When the view is scrolled back, its top row is row view_segment of
+    // scrollback line view_line. Lines are wrapped at the current width only
+    // when they are shown, so resizing never touches the scrollback, and they
+    // are counted as running totals, so the view stays on the same text while
+    // more lines are added below it.
+    int scrolled_back;
+    uint64_t view_line;
+    unsigned view_segment;
+
+    // Where the last row looked up in the scrolled back view came from, so the
+    // rows of a frame are found by stepping down from the one before rather
+    // than from the top each time. Only good while nothing it was worked out
+    // from has changed.
+    ViewRow last_view_row;
+
+    uint16_t current_attribute;
+
+    // Changes whenever existing attributes are renumbered
+    unsigned attribute_generation;
+
+    unsigned attribute_count;
+    ScreenAttribute attributes[SCREEN_ATTRIBUTE_COUNT];
+    uint16_t attribute_index[SCREEN_ATTRIBUTE_INDEX_COUNT];
+} TerminalScreen;
+
+
+// Returns the number of cells at the start of cells that share an attribute
+size_t screen_run_length(ScreenCell *cells, size_t count);
+
+// Resolves an attribute into the 0xRRGGBB colors the cells should be drawn in,
+// taking inverse video and faint text into account
+void screen_resolve_colors(ScreenAttribute *attribute, uint32_t *foreground, uint32_t *background);
+
+
+GlyphFace glyph_face(uint32_t style);
+
+
+// Marks cells as needing to be drawn again
+void screen_damage(TerminalScreen *screen, unsigned x, unsigned y, unsigned count);
+
+void screen_damage_all(TerminalScreen *screen);
+
+// Called by the renderer once everything damaged has been drawn
+void screen_clear_damage(TerminalScreen *screen);
+
+// Adds the damage and scroll of an older copy of the screen that was never
+// drawn, or damages everything if that copy was another size
+void screen_merge_damage(TerminalScreen *screen, ScreenDamage *damage, int scroll, unsigned cols, unsigned rows);
+
+
+// Where a renderer last drew the cursor, so the cell under it can be put back
+// once it moves
+typedef struct DrawnCursor
+{
+    unsigned short x;
+    unsigned short y;
+    int drawn;
+} DrawnCursor;
+
+// Damages the cell the cursor has to be erased from and the one it has to be
+// drawn over, given how many columns are visible. Returns whether the cursor
+// is to be drawn at all.
+int screen_damage_cursor(TerminalScreen *screen, DrawnCursor *cursor, unsigned cols);
+
+void screen_cursor_drawn(TerminalScreen *screen, DrawnCursor *cursor, int visible);
+
+// Returns how far the screen scrolled since it was last drawn and clears it.
+// Moves where the cursor was drawn along with it, and damages the cells the
+// overlay moves onto, for renderers that move whatever they drew by as much.
+int screen_take_scroll(TerminalScreen *screen, DrawnCursor *cursor, unsigned overlay_cols);
+
+
+// The damaged columns [first, end) of a row of the view. Lines from the
+// scrollback can be shorter than the screen is wide, so only [first, row_end)
+// has cells; the rest is blank.
+typedef struct ScreenSpan
+{
+    unsigned first;
+    unsigned end;
+    unsigned row_end;
+    ScreenCell *row;
+    ScreenAttribute *attributes;
+} ScreenSpan;
+
+// Returns whether any of the first cols columns of view row y are damaged, and
+// if so which ones, widened to cover whole wide characters
+int screen_damaged_span(TerminalScreen *screen, unsigned y, unsigned cols, ScreenSpan *span);
+
+
+// Text can be drawn over the right end of the top row, like the stats
+// overlay. This damages the cells the last text covered so they show through
+// again wherever the new text is shorter, and returns the column the new text
+// starts at.
+unsigned screen_damage_overlay(TerminalScreen *screen, unsigned *overlay_cols, size_t length);
+
+
+// Allocates the cells from heap if it's set and with malloc otherwise
+void screen_create(TerminalScreen *screen, unsigned cols, unsigned rows, struct SharedHeap *heap);
+
+void screen_resize(TerminalScreen *screen, unsigned cols, unsigned rows);
+
+// Gives back the grids of a screen that isn't shared
+void screen_destroy(TerminalScreen *screen);
+
+// Makes copy, a screen that was created the same way but is only ever drawn,
+// show what screen shows: the rows in view, the cursor and the damage. Rows
+// from the scrollback are padded out to the width of the screen and the copy
+// is never scrolled back, so drawing it never looks at anything that goes on
+// changing while it's drawn.
+void screen_snapshot(TerminalScreen *copy, TerminalScreen *screen);
+
+ScreenCell *screen_row(TerminalScreen *screen, unsigned y);
+
+// Returns the row shown at y, which comes from the scrollback if the view is
+// scrolled back. Sets count to how many cells the row has, which can be less
+// than the number of columns, and attributes to the table its cells index.
+ScreenCell *screen_view_row(TerminalScreen *screen, unsigned y, unsigned *count, ScreenAttribute **attributes);
+
+// Moves the view back into the scrollback or forward towards the screen
+void screen_scroll_view_up(TerminalScreen *screen, size_t rows);
+void screen_scroll_view_down(TerminalScreen *screen, size_t rows);
+
+// Puts a scrollback line at the top of the view, counting from the oldest one
+void screen_view_line(TerminalScreen *screen, size_t line);
+
+void screen_view_bottom(TerminalScreen *screen);
+
+void screen_clear_scrollback(TerminalScreen *screen);
+
+uint32_t screen_hash_attribute(ScreenAttribute *attribute);
+
+uint16_t screen_intern_attribute(TerminalScreen *screen, ScreenAttribute *attribute);
+
+void screen_write_ascii(TerminalScreen *screen, const char *text, size_t count);
+
+// Writes decoded characters, each taking up as many cells as utf8_width says.
+// Characters with no width are dropped, since cells only hold one codepoint.
+void screen_write_codepoints(TerminalScreen *screen, const uint32_t *codepoints, size_t count);
+
+// REP: writes the last character written count more times
+void screen_repeat(TerminalScreen *screen, size_t count);
+
+void screen_line_feed(TerminalScreen *screen);
+
+void screen_carriage_return(TerminalScreen *screen);
+
+void screen_backspace(TerminalScreen *screen);
+
+void screen_tab(TerminalScreen *screen);
+
+// Both only move the rows of the scroll region
+void screen_scroll_up(TerminalScreen *screen, unsigned count);
+
+void screen_scroll_down(TerminalScreen *screen, unsigned count);
+
+// DECSTBM: [top, bottom) becomes the scroll region if it's at least two rows,
+// and the cursor moves home
+void screen_set_scroll_region(TerminalScreen *screen, unsigned top, unsigned bottom);
+
+// IL and DL: move the rows of the scroll region from the cursor's down by
+// count, or up over the count rows from the cursor's. Nothing happens if the
+// cursor is outside the region.
+void screen_insert_lines(TerminalScreen *screen, unsigned count);
+
+void screen_delete_lines(TerminalScreen *screen, unsigned count);
+
+// ICH and DCH: move the rest of the cursor's row right by count blanks, or left
+// over the count cells from the cursor's
+void screen_insert_chars(TerminalScreen *screen, unsigned count);
+
+void screen_delete_chars(TerminalScreen *screen, unsigned count);
+
+void screen_reverse_index(TerminalScreen *screen);
+
+void screen_save_cursor(TerminalScreen *screen);
+
+void screen_restore_cursor(TerminalScreen *screen);
+
+void screen_set_attribute(TerminalScreen *screen, ScreenAttribute *attribute);
+
+void screen_move_cursor(TerminalScreen *screen, unsigned x, unsigned y);
+
+void screen_erase(TerminalScreen *screen, unsigned x, unsigned y, unsigned count);
+
+void screen_erase_rows(TerminalScreen *screen, unsigned first_row, unsigned row_count);
+
+void screen_reset(TerminalScreen *screen);
@@ -0,0 +1,161 @@
+#include "screen.h"
+#include "scrollback.h"
+#include "types.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+#define WIDE_CHARACTER 0x4e2d
+
+
+static int failure_count;
+
+
+static void
+check(int passed, const char *test, const char *what)
+{
+    if (!passed)
+    {
+        fprintf(stderr, "%s: %s\n", test, what);
+        ++failure_count;
+    }
+}
+
+
+// Every wide character has its spacer right after it on the same row, and
+// nothing left over by a wrap is in the middle of a line
+static void
+check_wide_pairs(TerminalScreen *screen, const char *test)
+{
+    for (unsigned y = 0; y < screen->rows; ++y)
+    {
+        ScreenCell *row = screen_row(screen, y);
+        for (unsigned x = 0; x < screen->cols; ++x)
+        {
+            if (row[x].flags & CELL_WIDE)
+            {
+                check((x + 1 < screen->cols) && (row[x + 1].flags & CELL_WIDE_SPACER), test, "wide character cut in two");
+            }
+            if (row[x].flags & CELL_WIDE_SPACER)
+            {
+                check(x && (row[x - 1].flags & CELL_WIDE), test, "spacer without its wide character");
+            }
+            if (row[x].flags & CELL_WIDE_PADDING)
+            {
+                check((x + 1 == screen->cols) && (y + 1 < screen->rows)
+                    && (screen_row(screen, y + 1)[0].flags & CELL_WIDE), test, "padding not before a wide character");
+            }
+        }
+    }
+}
+
+
+static void
+write_line(TerminalScreen *screen, const char *text, size_t count)
+{
+    screen_write_ascii(screen, text, count);
+    uint32_t wide = WIDE_CHARACTER;
+    screen_write_codepoints(screen, &wide, 1);
+    screen_write_ascii(screen, "z", 1);
+}
+
+
+// A wide character that would end up in the last column is moved to the next
+// row whole, with padding in front of it
+static void
+test_resize_narrower(Scrollback *scrollback)
+{
+    const char *test = "resize narrower";
+
+    TerminalScreen screen;
+    screen_create(&screen, 8, 4, nullptr);
+    screen.scrollback = scrollback;
+    write_line(&screen, "abcd", 4);
+    screen_resize(&screen, 5, 4);
+
+    check_wide_pairs(&screen, test);
+    ScreenCell *first = screen_row(&screen, 0);
+    ScreenCell *second = screen_row(&screen, 1);
+    check(first[3].codepoint == 'd', test, "text before the wide character moved");
+    check((first[4].flags & CELL_WIDE_PADDING) && (first[4].flags & CELL_WRAPPED), test, "last column not padded");
+    check((second[0].codepoint == WIDE_CHARACTER) && (second[2].codepoint == 'z'), test, "wide character not on the next row");
+    check((screen.cursor_y == 1) && (screen.cursor_x == 3), test, "cursor not after the line");
+
+    screen_destroy(&screen);
+}
+
+
+// Padding left by the old right margin isn't part of the line
+static void
+test_resize_wider(Scrollback *scrollback)
+{
+    const char *test = "resize wider";
+
+    TerminalScreen screen;
+    screen_create(&screen, 5, 4, nullptr);
+    screen.scrollback = scrollback;
+    write_line(&screen, "abcd", 4);
+    screen_resize(&screen, 8, 4);
+
+    check_wide_pairs(&screen, test);
+    ScreenCell *first = screen_row(&screen, 0);
+    check((first[4].codepoint == WIDE_CHARACTER) && (first[6].codepoint == 'z'), test, "padding kept in the line");
+    check(screen_row(&screen, 1)[0].codepoint == ' ', test, "line still takes two rows");
+    check((screen.cursor_y == 0) && (screen.cursor_x == 7), test, "cursor not after the line");
+
+    screen_destroy(&screen);
+}
+
+
+// Resizing back and forth across rows of wide characters never cuts one in two
+static void
+test_resize_back_and_forth(Scrollback *scrollback)
+{
+    const char *test = "resize back and forth";
+
+    TerminalScreen screen;
+    screen_create(&screen, 11, 6, nullptr);
+    screen.scrollback = scrollback;
+    uint32_t line[] = { 'a', WIDE_CHARACTER, WIDE_CHARACTER, 'b', WIDE_CHARACTER, WIDE_CHARACTER, WIDE_CHARACTER, 'c' };
+    screen_write_codepoints(&screen, line, ARRAY_COUNT(line));
+
+    for (unsigned cols = 11; cols > 2; --cols)
+    {
+        screen_resize(&screen, cols, 6);
+        check_wide_pairs(&screen, test);
+    }
+    screen_resize(&screen, 20, 6);
+    check_wide_pairs(&screen, test);
+
+    // Back on one row, with only the spacers in between
+    ScreenCell *row = screen_row(&screen, 0);
+    unsigned x = 0;
+    for (size_t i = 0; i < ARRAY_COUNT(line); ++i)
+    {
+        check(row[x].codepoint == line[i], test, "line changed");
+        x += (row[x].flags & CELL_WIDE) ? 2 : 1;
+    }
+
+    screen_destroy(&screen);
+}
+
+
+int
+main(void)
+{
+    static Scrollback scrollback;
+    scrollback_create(&scrollback, 1024 * 1024);
+
+    test_resize_narrower(&scrollback);
+    test_resize_wider(&scrollback);
+    test_resize_back_and_forth(&scrollback);
+
+    if (failure_count)
+    {
+        fprintf(stderr, "%d checks failed\n", failure_count);
+        return EXIT_FAILURE;
+    }
+    printf("screen tests passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,405 @@
+#define _GNU_SOURCE // for memfd_create, O_TMPFILE, MAP_FIXED_NOREPLACE
+
+#include "scrollback.h"
+
+#include "assert.h"
+#include "types.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+#define LINE_OFFSET_BITS 48
+#define LINE_OFFSET_MASK ((CAST(uint64_t, 1) << LINE_OFFSET_BITS) - 1)
+
+
+// An unlinked file in the temporary directory, so it goes away with us
+static int
+open_spill_file(void)
+{
+    const char *directory = getenv("TMPDIR");
+    if (!directory || !*directory)
+    {
+        directory = "/tmp";
+    }
+
+    int result = open(directory, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    return result;
+}
+
+
+// Maps the file twice in a row so anything that runs off the end of the first
+// copy continues into the second. If address is set the copies go there, and
+// nullptr is returned if anything else is in the way.
+static ScreenCell *
+map_cells(int fd, size_t size, void *address)
+{
+    int reserve_flags = MAP_PRIVATE | MAP_ANONYMOUS | (address ? MAP_FIXED_NOREPLACE : 0);
+    char *start = mmap(address, 2 * size, PROT_NONE, reserve_flags, -1, 0);
+    if (address && (start != address))
+    {
+        if (MAP_FAILED != start)
+        {
+            munmap(start, 2 * size);
+        }
+        return nullptr;
+    }
+    if (MAP_FAILED == start)
+    {
+        errno_exit("scrollback: mmap");
+    }
+
+    int prot = PROT_READ | PROT_WRITE;
+    int flags = MAP_SHARED | MAP_FIXED;
+    if (mmap(start, size, prot, flags, fd, 0) == MAP_FAILED)
+    {
+        errno_exit("scrollback: map first copy");
+    }
+    if (mmap(start + size, size, prot, flags, fd, 0) == MAP_FAILED)
+    {
+        errno_exit("scrollback: map second copy");
+    }
+
+    ScreenCell *result = CAST(ScreenCell *, CAST(void *, start));
+    return result;
+}
+
+
+void
+scrollback_create(Scrollback *scrollback, size_t max_bytes)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    // An eighth of the memory goes to the line index, which is enough for
+    // lines that average 7 cells after trailing blanks are dropped
+    size_t line_capacity = 1024;
+    while (line_capacity * sizeof(*scrollback->lines) * 2 <= max_bytes / 8)
+    {
+        line_capacity *= 2;
+    }
+
+    size_t cells_size = alignull_up2(max_bytes - line_capacity * sizeof(*scrollback->lines), CAST(size_t, page_size));
+    // Room for a few of the longest lines keeps the line being added to from
+    // having to be dropped to make room for itself
+    if ((cells_size > EXPR_MAX(cells_size) / 2) || (cells_size < 4 * SCROLLBACK_MAX_LINE * sizeof(ScreenCell)))
+    {
+        errno = EOVERFLOW;
+        errno_exit("scrollback_create: size");
+    }
+
+    int spilled = 0;
+    int fd = -1;
+    if (cells_size > SCROLLBACK_RAM_BUDGET)
+    {
+        fd = open_spill_file();
+        spilled = (fd != -1);
+    }
+    if (fd == -1)
+    {
+        fd = memfd_create("scrollback", MFD_CLOEXEC);
+        if (fd == -1)
+        {
+            errno_exit("scrollback_create: memfd_create");
+        }
+    }
+
+    // The file stays sparse, so memory or disk is only used as lines come in
+    ASSERT(cells_size < TYPE_MAX(off_t));
+    if (ftruncate(fd, CAST(off_t, cells_size)) == -1)
+    {
+        errno_exit("scrollback_create: ftruncate");
+    }
+    ScreenCell *cells = map_cells(fd, cells_size, nullptr);
+
+    // The index is in a file of its own too, so it can be shared like the cells
+    size_t lines_size = line_capacity * sizeof(*scrollback->lines);
+    int lines_fd = memfd_create("scrollback lines", MFD_CLOEXEC);
+    if ((lines_fd == -1) || (ftruncate(lines_fd, CAST(off_t, lines_size)) == -1))
+    {
+        errno_exit("scrollback_create: lines");
+    }
+    uint64_t *lines = mmap(nullptr, lines_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, lines_fd, 0);
+    if (MAP_FAILED == lines)
+    {
+        errno_exit("scrollback_create: mmap lines");
+    }
+
+    memset(scrollback, 0, sizeof(*scrollback));
+    scrollback->spilled = spilled;
+    scrollback->cells_fd = fd;
+    scrollback->lines_fd = lines_fd;
+    scrollback->cell_capacity = cells_size / sizeof(*cells);
+    scrollback->cells = cells;
+    scrollback->line_capacity = line_capacity;
+    scrollback->lines = lines;
+
+    // Attribute 0 is always the default so blank lines need nothing
+    scrollback->attributes[0] = (ScreenAttribute){
+        .foreground = COLOR_DEFAULT,
+        .background = COLOR_DEFAULT,
+    };
+    scrollback->attribute_count = 1;
+    unsigned slot = screen_hash_attribute(scrollback->attributes) % SCROLLBACK_ATTRIBUTE_INDEX_COUNT;
+    scrollback->attribute_index[slot] = 1;
+}
+
+
+int
+scrollback_attach(Scrollback *scrollback, int cells_fd, int lines_fd)
+{
+    size_t cells_size = scrollback->cell_capacity * sizeof(*scrollback->cells);
+    if (!map_cells(cells_fd, cells_size, scrollback->cells))
+    {
+        return 0;
+    }
+
+    size_t lines_size = scrollback->line_capacity * sizeof(*scrollback->lines);
+    void *lines = mmap(scrollback->lines, lines_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_NORESERVE | MAP_FIXED_NOREPLACE, lines_fd, 0);
+    int result = (lines == scrollback->lines);
+    return result;
+}
+
+
+// Attributes are kept, since the screen is still mapped to them
+void
+scrollback_clear(Scrollback *scrollback)
+{
+    scrollback->first_line = scrollback->end_line;
+    scrollback->first_cell = scrollback->end_cell;
+}
+
+
+// Returns the slot of the index that holds the attribute, or the empty slot it
+// would go in
+static unsigned
+find_attribute_slot(Scrollback *scrollback, ScreenAttribute *attribute)
+{
+    unsigned slot = screen_hash_attribute(attribute) % SCROLLBACK_ATTRIBUTE_INDEX_COUNT;
+    for (;;)
+    {
+        uint16_t entry = scrollback->attribute_index[slot];
+        if (!entry)
+        {
+            break;
+        }
+
+        ScreenAttribute *existing = scrollback->attributes + entry - 1;
+        if ((existing->foreground == attribute->foreground)
+            && (existing->background == attribute->background)
+            && (existing->style == attribute->style))
+        {
+            break;
+        }
+
+        if (++slot == ARRAY_COUNT(scrollback->attribute_index))
+        {
+            slot = 0;
+        }
+    }
+
+    return slot;
+}
+
+
+// Drops the attributes no stored line uses any more and renumbers the rest
+static void
+compact_attributes(Scrollback *scrollback)
+{
+    static uint16_t remap[SCROLLBACK_ATTRIBUTE_COUNT];
+    memset(remap, 0, sizeof(remap));
+
+    ScreenCell *cells = scrollback->cells + scrollback->first_cell % scrollback->cell_capacity;
+    size_t cell_count = CAST(size_t, scrollback->end_cell - scrollback->first_cell);
+    remap[0] = 1;
+    for (size_t i = 0; i < cell_count; ++i)
+    {
+        ASSERT(cells[i].attribute < scrollback->attribute_count);
+        remap[cells[i].attribute] = 1;
+    }
+
+    unsigned count = 0;
+    memset(scrollback->attribute_index, 0, sizeof(scrollback->attribute_index));
+    for (unsigned i = 0; i < scrollback->attribute_count; ++i)
+    {
+        if (remap[i])
+        {
+            scrollback->attributes[count] = scrollback->attributes[i];
+            unsigned slot = find_attribute_slot(scrollback, scrollback->attributes + count);
+            scrollback->attribute_index[slot] = CAST(uint16_t, count + 1);
+            remap[i] = CAST(uint16_t, count++);
+        }
+    }
+    scrollback->attribute_count = count;
+
+    for (size_t i = 0; i < cell_count; ++i)
+    {
+        cells[i].attribute = remap[cells[i].attribute];
+    }
+
+    // What the screen's attributes map to has moved too
+    memset(scrollback->screen_attributes, 0, sizeof(scrollback->screen_attributes));
+    scrollback->compacted_cell = scrollback->first_cell;
+}
+
+
+static uint16_t
+intern_attribute(Scrollback *scrollback, ScreenAttribute *attribute)
+{
+    unsigned slot = find_attribute_slot(scrollback, attribute);
+    uint16_t entry = scrollback->attribute_index[slot];
+    if (entry)
+    {
+        return CAST(uint16_t, entry - 1);
+    }
+
+    // Past the limit lines lose their colors until the next compaction
+    if (scrollback->attribute_count == ARRAY_COUNT(scrollback->attributes))
+    {
+        return 0;
+    }
+
+    uint16_t result = CAST(uint16_t, scrollback->attribute_count++);
+    scrollback->attributes[result] = *attribute;
+    scrollback->attribute_index[slot] = CAST(uint16_t, result + 1);
+
+    return result;
+}
+
+
+static uint16_t
+map_attribute(Scrollback *scrollback, TerminalScreen *screen, uint16_t attribute)
+{
+    if (scrollback->screen_generation != screen->attribute_generation)
+    {
+        memset(scrollback->screen_attributes, 0, sizeof(scrollback->screen_attributes));
+        scrollback->screen_generation = screen->attribute_generation;
+    }
+
+    uint16_t entry = scrollback->screen_attributes[attribute];
+    if (!entry)
+    {
+        entry = CAST(uint16_t, intern_attribute(scrollback, screen->attributes + attribute) + 1);
+        scrollback->screen_attributes[attribute] = entry;
+    }
+
+    uint16_t result = CAST(uint16_t, entry - 1);
+    return result;
+}
+
+
+static uint64_t
+line_start(Scrollback *scrollback, uint64_t line)
+{
+    uint64_t result = scrollback->end_cell;
+    if (line < scrollback->end_line)
+    {
+        result = scrollback->lines[line & (scrollback->line_capacity - 1)] & LINE_OFFSET_MASK;
+    }
+
+    return result;
+}
+
+
+static void
+drop_first_line(Scrollback *scrollback)
+{
+    ASSERT(scrollback->first_line < scrollback->end_line);
+
+    ++scrollback->first_line;
+    scrollback->first_cell = line_start(scrollback, scrollback->first_line);
+}
+
+
+void
+scrollback_push(Scrollback *scrollback, TerminalScreen *screen, ScreenCell *row, unsigned count, unsigned flags)
+{
+    if (!(flags & LINE_WRAPPED))
+    {
+        while (count && (row[count - 1].codepoint == ' ') && (row[count - 1].attribute == SCREEN_DEFAULT_ATTRIBUTE))
+        {
+            --count;
+        }
+    }
+
+    uint64_t last_line = scrollback->end_line - 1;
+    int continues = (scrollback->end_line > scrollback->first_line)
+        && ((scrollback->lines[last_line & (scrollback->line_capacity - 1)] >> LINE_OFFSET_BITS) & LINE_WRAPPED)
+        && (scrollback->end_cell + count - line_start(scrollback, last_line) <= SCROLLBACK_MAX_LINE);
+
+    while ((scrollback->end_cell + count - scrollback->first_cell > scrollback->cell_capacity)
+        || (!continues && (scrollback->end_line - scrollback->first_line == scrollback->line_capacity)))
+    {
+        drop_first_line(scrollback);
+    }
+    ASSERT(!continues || (scrollback->first_line <= last_line));
+
+    // Done before the row is copied, since compacting renumbers only the cells
+    // already pushed. Compacting again before much has been dropped would
+    // mostly find the same attributes in use.
+    if ((scrollback->attribute_count + count > ARRAY_COUNT(scrollback->attributes))
+        && (scrollback->first_cell - scrollback->compacted_cell >= scrollback->cell_capacity / 4))
+    {
+        compact_attributes(scrollback);
+    }
+
+    // Rows are mostly long runs of one attribute
+    ScreenCell *cells = scrollback->cells + scrollback->end_cell % scrollback->cell_capacity;
+    uint16_t screen_attribute = SCREEN_DEFAULT_ATTRIBUTE;
+    uint16_t attribute = map_attribute(scrollback, screen, screen_attribute);
+    for (unsigned i = 0; i < count; ++i)
+    {
+        if (row[i].attribute != screen_attribute)
+        {
+            screen_attribute = row[i].attribute;
+            attribute = map_attribute(scrollback, screen, screen_attribute);
+        }
+        cells[i] = (ScreenCell){
+            .codepoint = row[i].codepoint,
+            .attribute = attribute,
+            .flags = CAST(uint16_t, row[i].flags & ~CELL_WRAPPED),
+        };
+    }
+
+    uint64_t start = scrollback->end_cell;
+    if (continues)
+    {
+        start = line_start(scrollback, last_line);
+    }
+    else
+    {
+        ++scrollback->end_line;
+    }
+    scrollback->lines[(scrollback->end_line - 1) & (scrollback->line_capacity - 1)] =
+        start | (CAST(uint64_t, flags) << LINE_OFFSET_BITS);
+    scrollback->end_cell += count;
+}
+
+
+size_t
+scrollback_line_count(Scrollback *scrollback)
+{
+    size_t result = CAST(size_t, scrollback->end_line - scrollback->first_line);
+    return result;
+}
+
+
+ScreenCell *
+scrollback_line(Scrollback *scrollback, uint64_t line, unsigned *count, unsigned *flags)
+{
+    ASSERT((line >= scrollback->first_line) && (line < scrollback->end_line));
+
+    uint64_t entry = scrollback->lines[line & (scrollback->line_capacity - 1)];
+    uint64_t start = entry & LINE_OFFSET_MASK;
+
+    *count = CAST(unsigned, line_start(scrollback, line + 1) - start);
+    *flags = CAST(unsigned, entry >> LINE_OFFSET_BITS);
+
+    ScreenCell *result = scrollback->cells + start % scrollback->cell_capacity;
+    return result;
+}
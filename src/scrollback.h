@@ -0,0 +1,101 @@
+#pragma once
+
+#include "screen.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+#define SCROLLBACK_DEFAULT_MEGABYTES 64
+
+// Scrollback bigger than this is kept in an unlinked file on disk instead of
+// in memory, so the kernel can write it out rather than it counting against RAM
+#define SCROLLBACK_RAM_BUDGET (256 * 1024 * 1024)
+
+// Lines keep their own copy of every attribute they use, since the screen
+// renumbers its attributes whenever its table fills up. Must fit in a uint16_t.
+#define SCROLLBACK_ATTRIBUTE_COUNT 32768
+#define SCROLLBACK_ATTRIBUTE_INDEX_COUNT (2 * SCROLLBACK_ATTRIBUTE_COUNT)
+
+
+// Rows that continue on the next row are joined back into one line, up to this
+// many cells. Past that a line is split as if it had ended there.
+#define SCROLLBACK_MAX_LINE (16 * 1024)
+
+
+// Stored with each line
+enum ScrollbackLineFlags
+{
+    // The last row pushed was cut off by the right margin, so the next row
+    // pushed is more of the same line
+    LINE_WRAPPED = 1 << 0,
+};
+
+
+// Lines that scrolled off the top of the screen, oldest first, stored until
+// they take up more than a fixed amount of memory. After that the oldest lines
+// are dropped to make room.
+//
+// Lines are stored the way they were written rather than the way they were
+// wrapped, so they can be shown at any width without being rewritten.
+//
+// The cells of all lines are stored back to back in a ring mapped twice in a
+// row, so a line that wraps around the end of the ring is still contiguous. A
+// ring of offsets into it makes looking up any line a single index.
+typedef struct Scrollback
+{
+    // Set if the cells live in a file on disk
+    int spilled;
+
+    // Kept open so another process can map the scrollback too
+    int cells_fd;
+    int lines_fd;
+
+    size_t cell_capacity;
+    ScreenCell *cells;
+
+    // Entry i % line_capacity holds where line i starts, as a running total of
+    // cells pushed, with the line's flags in the top bits
+    size_t line_capacity;
+    uint64_t *lines;
+
+    // Running totals. The lines still stored are [first_line, end_line) and
+    // their cells are [first_cell, end_cell).
+    uint64_t first_line;
+    uint64_t end_line;
+    uint64_t first_cell;
+    uint64_t end_cell;
+
+    // Which of our attributes each screen attribute maps to, plus one. Only
+    // valid while the screen's attribute generation hasn't changed.
+    unsigned screen_generation;
+    uint16_t screen_attributes[SCREEN_ATTRIBUTE_COUNT];
+
+    // Attributes no line uses any more are dropped when the table is about to
+    // fill up, and not again until a good part of the lines have gone since
+    uint64_t compacted_cell;
+    unsigned attribute_count;
+    ScreenAttribute attributes[SCROLLBACK_ATTRIBUTE_COUNT];
+    uint16_t attribute_index[SCROLLBACK_ATTRIBUTE_INDEX_COUNT];
+} Scrollback;
+
+
+void scrollback_create(Scrollback *scrollback, size_t max_bytes);
+
+// Maps the cells and line index of a scrollback another process created, whose
+// struct is already visible here, at the same addresses they have there.
+// Returns 0 if something else is mapped there already.
+int scrollback_attach(Scrollback *scrollback, int cells_fd, int lines_fd);
+
+void scrollback_clear(Scrollback *scrollback);
+
+// Copies a row of the screen into the scrollback, either as a new line or as
+// the continuation of the last one. Trailing blanks are dropped from rows that
+// end their line.
+void scrollback_push(Scrollback *scrollback, TerminalScreen *screen, ScreenCell *row, unsigned count, unsigned flags);
+
+size_t scrollback_line_count(Scrollback *scrollback);
+
+// Returns the cells of a line, where line is a running total in the range
+// [first_line, end_line). Lines can be any length; what isn't there is blank.
+ScreenCell *scrollback_line(Scrollback *scrollback, uint64_t line, unsigned *count, unsigned *flags);
@@ -0,0 +1,538 @@
+#define _GNU_SOURCE // for accept4, struct ucred
+
+#include "session.h"
+
+#include "assert.h"
+#include "data_buffer.h"
+#include "pty.h"
+#include "pty_writer.h"
+#include "scrollback.h"
+#include "shared_heap.h"
+#include "stats.h"
+#include "types.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h> // struct winsize, TIOCSWINSZ, ioctl
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+// Sent along with the hello when a window attaches
+enum SessionFds
+{
+    SESSION_HEAP_FD,
+    SESSION_CELLS_FD,
+    SESSION_LINES_FD,
+    SESSION_UPDATE_FD,
+    SESSION_RESIZE_FD,
+
+    SESSION_FD_COUNT,
+};
+
+
+typedef struct SessionHello
+{
+    void *heap;
+    size_t heap_size;
+} SessionHello;
+
+
+typedef union SessionControl
+{
+    char buffer[CMSG_SPACE(SESSION_FD_COUNT * sizeof(int))];
+    struct cmsghdr align;
+} SessionControl;
+
+
+// Without a runtime directory the socket goes in a directory of our own in
+// /tmp. Anyone could have made it first, so it's only used if it's ours, is
+// really a directory and nobody else can get into it.
+static void
+make_private_directory(const char *path)
+{
+    if ((mkdir(path, 0700) == -1) && (errno != EEXIST))
+    {
+        errno_exit(path);
+    }
+
+    struct stat status;
+    if (lstat(path, &status) == -1)
+    {
+        errno_exit(path);
+    }
+    if (!S_ISDIR(status.st_mode) || (status.st_uid != getuid()) || (status.st_mode & 077))
+    {
+        error_exit("session: the socket directory in /tmp isn't ours alone");
+    }
+}
+
+
+// In the runtime directory if there is one, so only we can get at it
+static void
+session_address(struct sockaddr_un *address, const char *name)
+{
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+
+    const char *directory = getenv("XDG_RUNTIME_DIR");
+    int length;
+    if (directory && *directory)
+    {
+        length = snprintf(address->sun_path, sizeof(address->sun_path), "%s/nullrefterm-%s", directory, name);
+    }
+    else
+    {
+        char private_directory[64];
+        snprintf(private_directory, sizeof(private_directory), "/tmp/nullrefterm-%u", getuid());
+        make_private_directory(private_directory);
+        length = snprintf(address->sun_path, sizeof(address->sun_path), "%s/%s", private_directory, name);
+    }
+
+    if ((length < 0) || (CAST(size_t, length) >= sizeof(address->sun_path)))
+    {
+        error_exit("session: name too long");
+    }
+}
+
+
+// Whatever is on the other end of the socket gets at all of our memory, or we
+// at all of its, so it has to be us
+static int
+peer_is_us(int socket_fd)
+{
+    struct ucred credentials;
+    socklen_t size = sizeof(credentials);
+    int result = (getsockopt(socket_fd, SOL_SOCKET, SO_PEERCRED, &credentials, &size) == 0)
+        && (credentials.uid == getuid());
+    return result;
+}
+
+
+static void
+post(int fd)
+{
+    uint64_t one = 1;
+    if (write(fd, &one, sizeof(one)) != sizeof(one))
+    {
+        errno_exit("session:write eventfd");
+    }
+}
+
+
+void
+session_lock(SessionShared *shared)
+{
+    int error = pthread_mutex_lock(&shared->lock);
+
+    // Whoever held it died. Windows only ever draw while holding it, and the
+    // screen is only half changed if the session itself died, so it's fine as
+    // it is.
+    if (error == EOWNERDEAD)
+    {
+        error = pthread_mutex_consistent(&shared->lock);
+    }
+    if (error)
+    {
+        errno = error;
+        errno_exit("session_lock");
+    }
+}
+
+
+void
+session_unlock(SessionShared *shared)
+{
+    pthread_mutex_unlock(&shared->lock);
+}
+
+
+static int
+send_hello(int socket_fd, SharedHeap *heap, int fds[SESSION_FD_COUNT])
+{
+    SessionHello hello = {
+        .heap = heap,
+        .heap_size = heap->size,
+    };
+    struct iovec iov = { .iov_base = &hello, .iov_len = sizeof(hello) };
+
+    SessionControl control;
+    struct msghdr message = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buffer,
+        .msg_controllen = sizeof(control.buffer),
+    };
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(SESSION_FD_COUNT * sizeof(int));
+    memcpy(CMSG_DATA(header), fds, SESSION_FD_COUNT * sizeof(int));
+
+    int result = (sendmsg(socket_fd, &message, MSG_NOSIGNAL) == sizeof(hello));
+    return result;
+}
+
+
+// Only reads from the window while the shell's queue has room for what's read,
+// so a window pasting faster than the shell reads waits on the socket instead
+static void
+poll_client(int epoll_fd, int client_fd, PtyWriter *writer, int *polling)
+{
+    int enable = (pty_writer_space(writer) >= PTY_WRITE_CHUNK);
+    if (enable != *polling)
+    {
+        struct epoll_event event = { .events = enable ? EPOLLIN : 0, .data = {.fd = client_fd} };
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client_fd, &event) == -1)
+        {
+            errno_exit("session:epoll_ctl client");
+        }
+        *polling = enable;
+    }
+}
+
+
+int
+session_listen(const char *name)
+{
+    struct sockaddr_un address;
+    session_address(&address, name);
+
+    // A socket nobody answers on is left over from a session that died
+    int result = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (result == -1)
+    {
+        errno_exit("session_listen:socket");
+    }
+    if (connect(result, CAST(struct sockaddr *, CAST(void *, &address)), sizeof(address)) == 0)
+    {
+        error_exit("session_listen: a session by that name is running already");
+    }
+    unlink(address.sun_path);
+    if ((bind(result, CAST(struct sockaddr *, CAST(void *, &address)), sizeof(address)) == -1)
+        || (listen(result, 4) == -1))
+    {
+        errno_exit(address.sun_path);
+    }
+
+    return result;
+}
+
+
+void
+session_hold(const char *name, int listen_fd, int pty_fd, size_t scrollback_bytes, int ready_fd)
+{
+    SharedHeap *heap = shared_heap_create(SHARED_HEAP_SIZE);
+    SessionShared *shared = shared_heap_alloc(heap, sizeof(*shared));
+    heap->root = shared;
+
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&shared->lock, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+
+    TerminalScreen *screen = shared_heap_alloc(heap, sizeof(*screen));
+    screen_create(screen, SCREEN_DEFAULT_COLS, SCREEN_DEFAULT_ROWS, heap);
+    Scrollback *scrollback = shared_heap_alloc(heap, sizeof(*scrollback));
+    scrollback_create(scrollback, scrollback_bytes);
+    screen->scrollback = scrollback;
+    shared->screen = screen;
+
+    RawDataBuffer data_buffer;
+    data_buffer_create(&data_buffer, DEFAULT_DATA_BUFFER_SIZE);
+    data_buffer.max_size = DATA_BUFFER_GROW_LIMIT;
+
+    static Parser parser;
+    parser_create(&parser);
+
+    int update_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    int resize_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if ((update_fd == -1) || (resize_fd == -1))
+    {
+        errno_exit("session_hold:eventfd");
+    }
+    int fds[SESSION_FD_COUNT] = {
+        [SESSION_HEAP_FD] = heap->fd,
+        [SESSION_CELLS_FD] = scrollback->cells_fd,
+        [SESSION_LINES_FD] = scrollback->lines_fd,
+        [SESSION_UPDATE_FD] = update_fd,
+        [SESSION_RESIZE_FD] = resize_fd,
+    };
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1)
+    {
+        errno_exit("session_hold:epoll_create1");
+    }
+    int watched[] = { pty_fd, listen_fd, resize_fd };
+    for (size_t i = 0; i < ARRAY_COUNT(watched); ++i)
+    {
+        struct epoll_event event = { .events = EPOLLIN, .data = {.fd = watched[i]} };
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, watched[i], &event) == -1)
+        {
+            errno_exit("session_hold:epoll_ctl");
+        }
+    }
+
+    PtyWriter writer;
+    pty_writer_create(&writer, pty_fd, epoll_fd, EPOLLIN);
+
+    char ready = 1;
+    if (write(ready_fd, &ready, 1) != 1)
+    {
+        errno_exit("session_hold:write ready");
+    }
+    close(ready_fd);
+
+    int client_fd = -1;
+    int polling_client = 0;
+    int running = 1;
+    while (running)
+    {
+        struct epoll_event events[4];
+        int count = epoll_wait(epoll_fd, events, ARRAY_COUNT(events), -1);
+        if (count == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            errno_exit("session_hold:epoll_wait");
+        }
+        STATS_WAKEUP();
+
+        for (int i = 0; i < count; ++i)
+        {
+            struct epoll_event *event = events + i;
+            if ((pty_fd == event->data.fd) && (event->events & EPOLLOUT))
+            {
+                pty_writer_flush(&writer);
+            }
+
+            if ((pty_fd == event->data.fd) && (event->events & ~CAST(uint32_t, EPOLLOUT)))
+            {
+                ssize_t result = pty_read(pty_fd, &data_buffer);
+                running = (result > 0) || ((result == -1) && ((errno == EAGAIN) || (errno == EINTR)));
+
+                session_lock(shared);
+                parser_process(&parser, screen, &data_buffer);
+                if (parser.title_changed)
+                {
+                    copy_string(shared->title, parser.title, sizeof(shared->title));
+                    ++shared->title_generation;
+                    parser.title_changed = 0;
+                }
+                session_unlock(shared);
+
+                if (parser.reply_size)
+                {
+                    pty_write(&writer, parser.reply, parser.reply_size);
+                    parser.reply_size = 0;
+                }
+                post(update_fd);
+            }
+            else if (listen_fd == event->data.fd)
+            {
+                int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+                if ((fd != -1) && (!peer_is_us(fd) || !send_hello(fd, heap, fds)))
+                {
+                    close(fd);
+                    fd = -1;
+                }
+                if (fd != -1)
+                {
+                    // The window attached before is told by its socket closing
+                    if (client_fd != -1)
+                    {
+                        close(client_fd);
+                    }
+                    client_fd = fd;
+                    polling_client = 1;
+
+                    struct epoll_event client_event = { .events = EPOLLIN, .data = {.fd = client_fd} };
+                    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &client_event) == -1)
+                    {
+                        errno_exit("session_hold:epoll_ctl client");
+                    }
+                }
+            }
+            else if (resize_fd == event->data.fd)
+            {
+                uint64_t posted;
+                if (read(resize_fd, &posted, sizeof(posted)) != sizeof(posted))
+                {
+                    continue;
+                }
+
+                uint32_t size = atomic_load(&shared->requested_size);
+                unsigned cols = size >> 16;
+                unsigned rows = size & 0xffff;
+                if (cols && rows)
+                {
+                    session_lock(shared);
+                    screen_resize(screen, cols, rows);
+                    session_unlock(shared);
+
+                    struct winsize winsize = {
+                        .ws_row = CAST(unsigned short, rows),
+                        .ws_col = CAST(unsigned short, cols),
+                    };
+                    ioctl(pty_fd, TIOCSWINSZ, &winsize);
+                    post(update_fd);
+                }
+            }
+            else if ((client_fd == event->data.fd) && (client_fd != -1))
+            {
+                char input[PTY_WRITE_CHUNK];
+                int detached = 0;
+                if (pty_writer_space(&writer) >= sizeof(input))
+                {
+                    ssize_t result = read(client_fd, input, sizeof(input));
+                    if (result > 0)
+                    {
+                        pty_write(&writer, input, CAST(size_t, result));
+                    }
+                    detached = !result || ((result == -1) && (errno != EAGAIN) && (errno != EINTR));
+                }
+                else
+                {
+                    detached = (event->events & (EPOLLHUP | EPOLLERR)) != 0;
+                }
+
+                if (detached)
+                {
+                    // Detached. The shell carries on until a window attaches
+                    // again.
+                    close(client_fd);
+                    client_fd = -1;
+                }
+            }
+        }
+
+        if (client_fd != -1)
+        {
+            poll_client(epoll_fd, client_fd, &writer, &polling_client);
+        }
+    }
+
+    struct sockaddr_un address;
+    session_address(&address, name);
+    unlink(address.sun_path);
+}
+
+
+int
+session_attach(SessionView *view, const char *name)
+{
+    struct sockaddr_un address;
+    session_address(&address, name);
+
+    int socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (socket_fd == -1)
+    {
+        errno_exit("session_attach:socket");
+    }
+    if (connect(socket_fd, CAST(struct sockaddr *, CAST(void *, &address)), sizeof(address)) == -1)
+    {
+        close(socket_fd);
+        return 0;
+    }
+    if (!peer_is_us(socket_fd))
+    {
+        error_exit("session_attach: the session belongs to someone else");
+    }
+
+    SessionHello hello;
+    struct iovec iov = { .iov_base = &hello, .iov_len = sizeof(hello) };
+    SessionControl control;
+    struct msghdr message = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buffer,
+        .msg_controllen = sizeof(control.buffer),
+    };
+    struct cmsghdr *header;
+    if ((recvmsg(socket_fd, &message, MSG_CMSG_CLOEXEC) != sizeof(hello))
+        || !(header = CMSG_FIRSTHDR(&message))
+        || (header->cmsg_type != SCM_RIGHTS)
+        || (header->cmsg_len != CMSG_LEN(SESSION_FD_COUNT * sizeof(int))))
+    {
+        error_exit("session_attach: the session didn't say hello");
+    }
+    int fds[SESSION_FD_COUNT];
+    memcpy(fds, CMSG_DATA(header), sizeof(fds));
+
+    // The heap is mapped where it is in the session, so every pointer in it
+    // can be followed as it is. With address space layout randomization
+    // something else being there already is unlikely but possible.
+    SharedHeap *heap = shared_heap_attach(fds[SESSION_HEAP_FD], hello.heap, hello.heap_size);
+    SessionShared *shared = heap ? heap->root : nullptr;
+    if (!heap || !scrollback_attach(shared->screen->scrollback, fds[SESSION_CELLS_FD], fds[SESSION_LINES_FD]))
+    {
+        error_exit("session_attach: the session's memory can't be mapped where it is in the session");
+    }
+    close(fds[SESSION_HEAP_FD]);
+    close(fds[SESSION_CELLS_FD]);
+    close(fds[SESSION_LINES_FD]);
+
+    int flags = fcntl(socket_fd, F_GETFL);
+    if ((flags == -1) || (fcntl(socket_fd, F_SETFL, flags | O_NONBLOCK) == -1))
+    {
+        errno_exit("session_attach:fcntl");
+    }
+
+    view->socket_fd = socket_fd;
+    view->update_fd = fds[SESSION_UPDATE_FD];
+    view->resize_fd = fds[SESSION_RESIZE_FD];
+    view->shared = shared;
+    view->title_generation = 0;
+    view->title[0] = 0;
+
+    // Whatever was drawn last was drawn by another window
+    session_lock(shared);
+    screen_damage_all(shared->screen);
+    session_unlock(shared);
+
+    return 1;
+}
+
+
+void
+session_request_resize(SessionView *view, unsigned cols, unsigned rows)
+{
+    ASSERT((cols <= 0xffff) && (rows <= 0xffff));
+
+    atomic_store(&view->shared->requested_size, (cols << 16) | rows);
+    post(view->resize_fd);
+}
+
+
+char *
+session_updated(SessionView *view)
+{
+    uint64_t posted;
+    read(view->update_fd, &posted, sizeof(posted));
+
+    char *result = nullptr;
+    SessionShared *shared = view->shared;
+    session_lock(shared);
+    if (shared->title_generation != view->title_generation)
+    {
+        copy_string(view->title, shared->title, sizeof(view->title));
+        view->title_generation = shared->title_generation;
+        result = view->title;
+    }
+    session_unlock(shared);
+
+    return result;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "parser.h"
+#include "screen.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+// Everything a window needs to draw a session. It lives in the session's
+// shared heap, along with the screen and the scrollback index, which a window
+// maps at the same addresses so it can draw them as they are without any
+// output being replayed.
+typedef struct SessionShared
+{
+    // Held by the session while it changes the screen and by the window while
+    // it draws it. Robust, so a window that dies holding it doesn't take the
+    // session down with it.
+    pthread_mutex_t lock;
+
+    TerminalScreen *screen;
+
+    // The size the window would like the screen to be, cols << 16 | rows
+    _Atomic uint32_t requested_size;
+
+    unsigned title_generation;
+    char title[PARSER_MAX_TITLE];
+} SessionShared;
+
+
+// A window's connection to a session
+typedef struct SessionView
+{
+    // Whatever is written here goes to the shell as it is. The session closes
+    // it when the shell exits or another window attaches.
+    int socket_fd;
+
+    // Readable whenever the screen changed
+    int update_fd;
+
+    // Posted after setting requested_size
+    int resize_fd;
+
+    SessionShared *shared;
+
+    unsigned title_generation;
+    char title[PARSER_MAX_TITLE];
+} SessionView;
+
+
+// Claims the name for a new session before its shell is started. Exits if a
+// session by that name is running already.
+int session_listen(const char *name);
+
+// Runs a session: owns the pty and the parser, parses what the shell writes
+// into the shared screen and sends the shell whatever the attached window
+// sends. Writes a byte to ready_fd once windows can attach. Returns when the
+// shell exits.
+void session_hold(const char *name, int listen_fd, int pty_fd, size_t scrollback_bytes, int ready_fd);
+
+// Maps the screen of a running session. Returns 0 if there is no such session.
+int session_attach(SessionView *view, const char *name);
+
+void session_lock(SessionShared *shared);
+void session_unlock(SessionShared *shared);
+
+// Asks the session to resize the screen and the pty
+void session_request_resize(SessionView *view, unsigned cols, unsigned rows);
+
+// Clears update_fd. Returns the title if it changed since the last call.
+char *session_updated(SessionView *view);
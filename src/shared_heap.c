@@ -0,0 +1,189 @@
+#define _GNU_SOURCE // for memfd_create, MAP_FIXED_NOREPLACE
+
+#include "shared_heap.h"
+
+#include "assert.h"
+#include "types.h"
+#include "util.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+#define BLOCK_ALIGN 64
+
+// Freed blocks at least this big give their pages back
+#define RELEASE_SIZE (64 * 1024)
+
+
+// Every block starts with its size, header included. Free blocks also link to
+// the next free one; in used blocks that's where the memory handed out starts.
+typedef struct HeapBlock
+{
+    size_t size;
+    size_t next;
+} HeapBlock;
+
+
+static size_t
+align_up(size_t value, size_t align)
+{
+    size_t result = (value + align - 1) & ~(align - 1);
+    return result;
+}
+
+
+static HeapBlock *
+block_at(SharedHeap *heap, size_t offset)
+{
+    HeapBlock *result = CAST(HeapBlock *, CAST(void *, CAST(char *, heap) + offset));
+    return result;
+}
+
+
+SharedHeap *
+shared_heap_create(size_t size)
+{
+    int fd = memfd_create("shared heap", MFD_CLOEXEC);
+    if (fd == -1)
+    {
+        errno_exit("shared_heap_create:memfd_create");
+    }
+
+    ASSERT(size < TYPE_MAX(off_t));
+    if (ftruncate(fd, CAST(off_t, size)) == -1)
+    {
+        errno_exit("shared_heap_create:ftruncate");
+    }
+
+    SharedHeap *heap = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd, 0);
+    if (MAP_FAILED == heap)
+    {
+        errno_exit("shared_heap_create:mmap");
+    }
+
+    // Everything past the header starts out as one free block
+    size_t first = align_up(sizeof(*heap), BLOCK_ALIGN);
+    heap->fd = fd;
+    heap->size = size;
+    heap->free_list = first;
+    heap->root = nullptr;
+    *block_at(heap, first) = (HeapBlock){ .size = size - first };
+
+    return heap;
+}
+
+
+SharedHeap *
+shared_heap_attach(int fd, void *base, size_t size)
+{
+    SharedHeap *result = mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE | MAP_FIXED_NOREPLACE,
+        fd, 0);
+    if (MAP_FAILED == result)
+    {
+        return nullptr;
+    }
+    if (result != base)
+    {
+        // Kernels before MAP_FIXED_NOREPLACE treat it as a hint
+        munmap(result, size);
+        return nullptr;
+    }
+
+    return result;
+}
+
+
+void *
+shared_heap_alloc(SharedHeap *heap, size_t size)
+{
+    size_t needed = align_up(size + sizeof(HeapBlock), BLOCK_ALIGN);
+
+    size_t *link = &heap->free_list;
+    while (*link)
+    {
+        HeapBlock *block = block_at(heap, *link);
+        if (block->size >= needed)
+        {
+            // Whatever is left over stays free where the block was
+            if (block->size - needed >= BLOCK_ALIGN)
+            {
+                HeapBlock *rest = block_at(heap, *link + needed);
+                *rest = (HeapBlock){ .size = block->size - needed, .next = block->next };
+                *link += needed;
+                block->size = needed;
+            }
+            else
+            {
+                *link = block->next;
+            }
+
+            void *result = block + 1;
+            memset(result, 0, block->size - sizeof(*block));
+            return result;
+        }
+        link = &block->next;
+    }
+
+    error_exit("shared_heap_alloc: out of memory");
+}
+
+
+void
+shared_heap_free(SharedHeap *heap, void *memory)
+{
+    if (!memory)
+    {
+        return;
+    }
+
+    HeapBlock *block = CAST(HeapBlock *, memory) - 1;
+    size_t offset = CAST(size_t, CAST(char *, block) - CAST(char *, heap));
+
+    size_t previous = 0;
+    size_t next = heap->free_list;
+    while (next && (next < offset))
+    {
+        previous = next;
+        next = block_at(heap, next)->next;
+    }
+
+    block->next = next;
+    if (next && (offset + block->size == next))
+    {
+        block->size += block_at(heap, next)->size;
+        block->next = block_at(heap, next)->next;
+    }
+
+    if (previous && (previous + block_at(heap, previous)->size == offset))
+    {
+        HeapBlock *merged = block_at(heap, previous);
+        merged->size += block->size;
+        merged->next = block->next;
+        block = merged;
+        offset = previous;
+    }
+    else if (previous)
+    {
+        block_at(heap, previous)->next = offset;
+    }
+    else
+    {
+        heap->free_list = offset;
+    }
+
+    // Hands whole pages in the middle of a big free block back to the kernel.
+    // They read back as zeroes if they're used again.
+    if (block->size >= RELEASE_SIZE)
+    {
+        long page_size = sysconf(_SC_PAGESIZE);
+        size_t start = align_up(offset + sizeof(*block), CAST(size_t, page_size));
+        size_t end = (offset + block->size) & ~(CAST(size_t, page_size) - 1);
+        if (end > start)
+        {
+            madvise(CAST(char *, heap) + start, end - start, MADV_REMOVE);
+        }
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+
+
+// Reserved up front and only backed as it's used
+#define SHARED_HEAP_SIZE (1024ull * 1024 * 1024)
+
+
+// Memory in a memfd that another process can map at the same address, so the
+// pointers stored in it mean the same thing in both. Blocks are handed out
+// first fit from a free list kept in the memory itself, sorted by address so
+// neighbours merge back together when freed.
+//
+// The heap lives at the start of its own memory, so a process that maps it
+// finds everything else through root.
+typedef struct SharedHeap
+{
+    int fd;
+    size_t size;
+
+    // Offset of the first free block, or 0 if there is none
+    size_t free_list;
+
+    void *root;
+} SharedHeap;
+
+
+SharedHeap *shared_heap_create(size_t size);
+
+// Maps a heap another process created at the address it has there. Returns
+// nullptr if something else is already mapped there.
+SharedHeap *shared_heap_attach(int fd, void *base, size_t size);
+
+// Zeroed
+void *shared_heap_alloc(SharedHeap *heap, size_t size);
+
+void shared_heap_free(SharedHeap *heap, void *memory);
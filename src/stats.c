@@ -0,0 +1,131 @@
+#include "stats.h"
+
+#include "types.h"
+
+#include <stdatomic.h>
+
+
+#ifdef STATS_ENABLED
+
+#define HISTOGRAM_BUCKETS 33
+
+
+Stats stats;
+
+
+static const char *series_names[STATS_SERIES_COUNT] = {
+    [STATS_READ_NS] = "read ns",
+    [STATS_PARSE_NS] = "parse ns",
+    [STATS_DRAW_NS] = "draw ns",
+    [STATS_BYTES_PER_READ] = "bytes/read",
+    [STATS_READS_PER_WAKEUP] = "reads/wakeup",
+};
+
+
+static uint64_t
+load(_Atomic uint64_t *value)
+{
+    uint64_t result = atomic_load_explicit(value, memory_order_relaxed);
+    return result;
+}
+
+
+void
+stats_record(StatsSeries series, uint64_t value)
+{
+    StatsRing *ring = stats.series + series;
+
+    uint64_t count = load(&ring->count);
+    uint32_t sample = (value > UINT32_MAX) ? UINT32_MAX : CAST(uint32_t, value);
+    atomic_store_explicit(ring->samples + count % STATS_RING_SIZE, sample, memory_order_relaxed);
+    atomic_store_explicit(&ring->total, load(&ring->total) + value, memory_order_relaxed);
+    if (value > load(&ring->max))
+    {
+        atomic_store_explicit(&ring->max, value, memory_order_relaxed);
+    }
+    atomic_store_explicit(&ring->count, count + 1, memory_order_relaxed);
+}
+
+
+void
+stats_wakeup(void)
+{
+    static uint64_t last_reads;
+
+    uint64_t reads = load(&stats.series[STATS_BYTES_PER_READ].count);
+    atomic_fetch_add_explicit(&stats.wakeups, 1, memory_order_relaxed);
+    stats_record(STATS_READS_PER_WAKEUP, reads - last_reads);
+    last_reads = reads;
+}
+
+
+// Returns the mean of the samples still in the ring
+static double
+recent_mean(StatsRing *ring)
+{
+    uint64_t count = minull(load(&ring->count), STATS_RING_SIZE);
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        sum += atomic_load_explicit(ring->samples + i, memory_order_relaxed);
+    }
+
+    double result = count ? CAST(double, sum) / CAST(double, count) : 0;
+    return result;
+}
+
+
+void
+stats_dump(FILE *file)
+{
+    fprintf(file, "wakeups %llu, frames drawn %llu, skipped %llu, published %llu, held %llu\n",
+        CAST(unsigned long long, load(&stats.wakeups)),
+        CAST(unsigned long long, load(&stats.frames_drawn)),
+        CAST(unsigned long long, load(&stats.frames_skipped)),
+        CAST(unsigned long long, load(&stats.frames_published)),
+        CAST(unsigned long long, load(&stats.frames_held)));
+
+    for (StatsSeries series = 0; series < STATS_SERIES_COUNT; ++series)
+    {
+        StatsRing *ring = stats.series + series;
+        uint64_t count = load(&ring->count);
+        fprintf(file, "%-13s count %llu, mean %.1f, max %llu\n", series_names[series],
+            CAST(unsigned long long, count),
+            count ? CAST(double, load(&ring->total)) / CAST(double, count) : 0,
+            CAST(unsigned long long, load(&ring->max)));
+
+        // Bucket i holds the samples below 2^i that aren't in an earlier one
+        uint64_t buckets[HISTOGRAM_BUCKETS] = { 0 };
+        uint64_t recent = minull(count, STATS_RING_SIZE);
+        for (uint64_t i = 0; i < recent; ++i)
+        {
+            uint32_t sample = atomic_load_explicit(ring->samples + i, memory_order_relaxed);
+            unsigned bucket = sample ? 32 - CAST(unsigned, __builtin_clz(sample)) : 0;
+            ++buckets[bucket];
+        }
+        for (unsigned bucket = 0; bucket < HISTOGRAM_BUCKETS; ++bucket)
+        {
+            if (buckets[bucket])
+            {
+                fprintf(file, "    < %-11llu %llu\n",
+                    1ull << bucket, CAST(unsigned long long, buckets[bucket]));
+            }
+        }
+    }
+    fflush(file);
+}
+
+
+void
+stats_format_overlay(char *text, size_t size)
+{
+    snprintf(text, size, " read %.0fus parse %.0fus draw %.0fus %.0fB/read %llu/%llu frames ",
+        recent_mean(stats.series + STATS_READ_NS) / 1000,
+        recent_mean(stats.series + STATS_PARSE_NS) / 1000,
+        recent_mean(stats.series + STATS_DRAW_NS) / 1000,
+        recent_mean(stats.series + STATS_BYTES_PER_READ),
+        CAST(unsigned long long, load(&stats.frames_drawn)),
+        CAST(unsigned long long, load(&stats.frames_drawn) + load(&stats.frames_skipped)));
+}
+
+#endif
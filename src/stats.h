@@ -0,0 +1,100 @@
+#pragma once
+
+#include "util.h"
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+
+// Counters for the hot path. They only exist in debug builds; in release
+// builds every STATS_ macro expands to nothing.
+#ifdef DEBUG
+#define STATS_ENABLED
+#endif
+
+
+// How many of the most recent samples of each series are kept for histograms
+#define STATS_RING_SIZE 1024
+
+#define STATS_OVERLAY_SIZE 96
+
+
+typedef enum StatsSeries
+{
+    STATS_READ_NS,
+    STATS_PARSE_NS,
+    STATS_DRAW_NS,
+    STATS_BYTES_PER_READ,
+    STATS_READS_PER_WAKEUP,
+
+    STATS_SERIES_COUNT,
+} StatsSeries;
+
+
+// Totals since startup plus the last STATS_RING_SIZE samples. Each series only
+// has one writer, which may be the reader thread, so everything is atomic but
+// only ever accessed with relaxed ordering.
+typedef struct StatsRing
+{
+    _Atomic uint64_t count;
+    _Atomic uint64_t total;
+    _Atomic uint64_t max;
+    _Atomic uint32_t samples[STATS_RING_SIZE];
+} StatsRing;
+
+
+typedef struct Stats
+{
+    StatsRing series[STATS_SERIES_COUNT];
+
+    _Atomic uint64_t wakeups;
+
+    // Frames drawn, and times the screen changed but drawing was left to a
+    // later frame
+    _Atomic uint64_t frames_drawn;
+    _Atomic uint64_t frames_skipped;
+
+    // Frames copied for a render thread, which draws fewer of them if another
+    // one is copied before it gets to the last
+    _Atomic uint64_t frames_published;
+
+    // Times the screen changed in the middle of a synchronized update, none of
+    // which were drawn
+    _Atomic uint64_t frames_held;
+} Stats;
+
+
+#ifdef STATS_ENABLED
+
+extern Stats stats;
+
+#define STATS_START(name) uint64_t name = now_ns()
+#define STATS_STOP(series, name) stats_record(series, now_ns() - (name))
+#define STATS_RECORD(series, value) stats_record(series, value)
+#define STATS_COUNT(counter) atomic_fetch_add_explicit(&stats.counter, 1, memory_order_relaxed)
+#define STATS_WAKEUP() stats_wakeup()
+
+#else
+
+#define STATS_START(name)
+#define STATS_STOP(series, name)
+#define STATS_RECORD(series, value)
+#define STATS_COUNT(counter)
+#define STATS_WAKEUP()
+
+#endif
+
+
+void stats_record(StatsSeries series, uint64_t value);
+
+// Called whenever the main loop wakes up. Records how many reads there were
+// since the last time.
+void stats_wakeup(void);
+
+// Writes the totals and a log2 histogram of the recent samples of each series
+void stats_dump(FILE *file);
+
+// Formats one short line of the recent averages, to be drawn over the screen
+void stats_format_overlay(char *text, size_t size);
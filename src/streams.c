@@ -0,0 +1,175 @@
+#include "streams.h"
+
+#include "assert.h"
+#include "types.h"
+
+#include <string.h>
+
+
+const char *stream_names[STREAM_KIND_COUNT] = {
+    [STREAM_ASCII] = "ascii",
+    [STREAM_LONG_LINES] = "long-lines",
+    [STREAM_NO_NEWLINES] = "no-newlines",
+    [STREAM_BINARY] = "binary",
+    [STREAM_ESCAPES] = "escapes",
+    [STREAM_UTF8] = "utf8",
+};
+
+
+typedef struct StreamWriter
+{
+    char *data;
+    size_t size;
+    size_t offset;
+
+    unsigned seed;
+} StreamWriter;
+
+
+static unsigned
+random_below(StreamWriter *writer, unsigned limit)
+{
+    writer->seed = writer->seed * 1103515245 + 12345;
+
+    unsigned result = (writer->seed >> 16) % limit;
+    return result;
+}
+
+
+static void
+put_bytes(StreamWriter *writer, const char *bytes, size_t count)
+{
+    size_t avail = writer->size - writer->offset;
+    if (count > avail)
+    {
+        count = avail;
+    }
+
+    memcpy(writer->data + writer->offset, bytes, count);
+    writer->offset += count;
+}
+
+
+static void
+put_printable(StreamWriter *writer, unsigned count)
+{
+    for (unsigned i = 0; (i < count) && (writer->offset < writer->size); ++i)
+    {
+        writer->data[writer->offset++] = CAST(char, ' ' + random_below(writer, 95));
+    }
+}
+
+
+// Lines are terminated the way the pty delivers them
+static void
+put_newline(StreamWriter *writer)
+{
+    put_bytes(writer, "\r\n", 2);
+}
+
+
+static void
+put_utf8_character(StreamWriter *writer)
+{
+    static const char *characters[] = {
+        "\xc3\xa9",         // é
+        "\xce\xbb",         // λ
+        "\xd0\x96",         // Ж
+        "\xe2\x94\x80",     // ─
+        "\xe2\x82\xac",     // €
+        "\xe3\x81\x82",     // あ
+        "\xe4\xb8\xad",     // 中
+        "\xf0\x9f\x98\x80", // 😀
+    };
+
+    const char *character = characters[random_below(writer, ARRAY_COUNT(characters))];
+    put_bytes(writer, character, strlen(character));
+}
+
+
+static void
+put_escape(StreamWriter *writer)
+{
+    static const char *sequences[] = {
+        "\x1b[0m",
+        "\x1b[1m",
+        "\x1b[1;31m",
+        "\x1b[32m",
+        "\x1b[38;5;208m",
+        "\x1b[38;2;255;128;0m",
+        "\x1b[K",
+        "\x1b[2;10H",
+        "\x1b[A",
+        "\x1b]0;title\x07",
+    };
+
+    const char *sequence = sequences[random_below(writer, ARRAY_COUNT(sequences))];
+    put_bytes(writer, sequence, strlen(sequence));
+}
+
+
+void
+stream_generate(StreamKind kind, char *data, size_t size)
+{
+    StreamWriter writer = { .data = data, .size = size, .seed = 1 };
+
+    while (writer.offset < writer.size)
+    {
+        switch (kind)
+        {
+            case STREAM_ASCII:
+            {
+                put_printable(&writer, 20 + random_below(&writer, 140));
+                put_newline(&writer);
+            } break;
+
+            case STREAM_LONG_LINES:
+            {
+                put_printable(&writer, 2000 + random_below(&writer, 18000));
+                put_newline(&writer);
+            } break;
+
+            case STREAM_NO_NEWLINES:
+            {
+                put_printable(&writer, 4096);
+            } break;
+
+            case STREAM_BINARY:
+            {
+                writer.data[writer.offset++] = CAST(char, random_below(&writer, 256));
+            } break;
+
+            case STREAM_ESCAPES:
+            {
+                put_escape(&writer);
+                put_printable(&writer, 1 + random_below(&writer, 12));
+                if (!random_below(&writer, 8))
+                {
+                    put_newline(&writer);
+                }
+            } break;
+
+            case STREAM_UTF8:
+            {
+                unsigned count = 10 + random_below(&writer, 60);
+                for (unsigned i = 0; i < count; ++i)
+                {
+                    if (random_below(&writer, 2))
+                    {
+                        put_utf8_character(&writer);
+                    }
+                    else
+                    {
+                        put_printable(&writer, 1);
+                    }
+                }
+                put_newline(&writer);
+            } break;
+
+            case STREAM_KIND_COUNT:
+            {
+                ASSERT(!"Invalid stream kind");
+            } break;
+        }
+    }
+}
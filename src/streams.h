@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+
+
+// Synthetic terminal output used by the benchmarks
+typedef enum StreamKind
+{
+    STREAM_ASCII,
+    STREAM_LONG_LINES,
+    STREAM_NO_NEWLINES,
+    STREAM_BINARY,
+    STREAM_ESCAPES,
+    STREAM_UTF8,
+
+    STREAM_KIND_COUNT,
+} StreamKind;
+
+
+extern const char *stream_names[STREAM_KIND_COUNT];
+
+
+// Fills data with size bytes of the given kind of output. The same kind and
+// size always produce the same bytes.
+void stream_generate(StreamKind kind, char *data, size_t size);
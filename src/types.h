@@ -1,3 +1,5 @@
+#pragma once
+
 #include <limits.h>
 
 #define nullptr ((void *)0)
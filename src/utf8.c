@@ -0,0 +1,527 @@
+#include "utf8.h"
+
+#include "types.h"
+
+#include <string.h>
+
+// Generated into the build directory by width_gen.c
+#include "width_table.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+
+// The range the second byte of a sequence has to be in depends on the lead
+// byte, which is what rules out overlong forms, surrogates and anything past
+// U+10FFFF. Every byte after that is a plain continuation byte.
+typedef struct LeadByte
+{
+    byte length;
+    byte second_min;
+    byte second_max;
+} LeadByte;
+
+
+static LeadByte
+lead_byte(byte b)
+{
+    LeadByte result = { 0 };
+    if ((b >= 0xc2) && (b <= 0xdf))
+    {
+        result = (LeadByte){ 2, 0x80, 0xbf };
+    }
+    else if (b == 0xe0)
+    {
+        result = (LeadByte){ 3, 0xa0, 0xbf };
+    }
+    else if (b == 0xed)
+    {
+        result = (LeadByte){ 3, 0x80, 0x9f };
+    }
+    else if ((b >= 0xe1) && (b <= 0xef))
+    {
+        result = (LeadByte){ 3, 0x80, 0xbf };
+    }
+    else if (b == 0xf0)
+    {
+        result = (LeadByte){ 4, 0x90, 0xbf };
+    }
+    else if ((b >= 0xf1) && (b <= 0xf3))
+    {
+        result = (LeadByte){ 4, 0x80, 0xbf };
+    }
+    else if (b == 0xf4)
+    {
+        result = (LeadByte){ 4, 0x80, 0x8f };
+    }
+
+    return result;
+}
+
+
+// Decodes the sequence at the start of data, which starts with a byte that
+// isn't ASCII. Returns how many bytes it took up, or 0 if it is cut off by
+// the end of data. An invalid sequence ends at the first byte that can't be
+// part of it, which is where the next one starts.
+static size_t
+decode_sequence(const byte *data, size_t count, uint32_t *codepoint)
+{
+    LeadByte lead = lead_byte(data[0]);
+    if (!lead.length)
+    {
+        *codepoint = UTF8_REPLACEMENT_CHARACTER;
+        return 1;
+    }
+
+    uint32_t value = data[0] & (0x7fu >> lead.length);
+    byte min = lead.second_min;
+    byte max = lead.second_max;
+    for (size_t i = 1; i < lead.length; ++i)
+    {
+        if (i == count)
+        {
+            return 0;
+        }
+
+        byte b = data[i];
+        if ((b < min) || (b > max))
+        {
+            *codepoint = UTF8_REPLACEMENT_CHARACTER;
+            return i;
+        }
+        value = (value << 6) | (b & 0x3f);
+
+        min = 0x80;
+        max = 0xbf;
+    }
+
+    *codepoint = value;
+    return lead.length;
+}
+
+
+static size_t
+ascii_length_scalar(const char *data, size_t count)
+{
+    size_t offset = 0;
+    while ((offset < count) && !(CAST(byte, data[offset]) & 0x80))
+    {
+        ++offset;
+    }
+
+    return offset;
+}
+
+
+static size_t
+decode_scalar(const char *data, size_t count, uint32_t *codepoints, size_t *consumed)
+{
+    const byte *bytes = CAST(const byte *, data);
+
+    size_t codepoint_count = 0;
+    size_t offset = 0;
+    while (offset < count)
+    {
+        byte b = bytes[offset];
+        if (b < 0x80)
+        {
+            codepoints[codepoint_count++] = b;
+            ++offset;
+            continue;
+        }
+
+        size_t length = decode_sequence(bytes + offset, count - offset, codepoints + codepoint_count);
+        if (!length)
+        {
+            break;
+        }
+        ++codepoint_count;
+        offset += length;
+    }
+
+    *consumed = offset;
+    return codepoint_count;
+}
+
+
+#if defined(__x86_64__)
+
+// Decodes the characters of a block that is already known to be valid, given
+// a mask of the bytes they start at, so none of the checks are needed. Each
+// character is loaded as a big-endian word, shifted down to its own bytes and
+// has its payload bits gathered with pext. Characters only depend on the mask,
+// not on each other, so they decode in parallel. Reads up to 3 bytes past the
+// last character.
+__attribute__((target("bmi,bmi2")))
+static size_t
+decode_valid(const byte *data, uint32_t starts, uint32_t *codepoints)
+{
+    // By the high nibble of the lead byte
+    static const byte lengths[16] = { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 3, 4 };
+    static const uint32_t payloads[5] = { 0, 0x7f, 0x1f3f, 0x0f3f3f, 0x073f3f3f };
+
+    size_t codepoint_count = 0;
+    while (starts)
+    {
+        unsigned offset = CAST(unsigned, __builtin_ctz(starts));
+        starts = _blsr_u32(starts);
+
+        uint32_t word;
+        memcpy(&word, data + offset, sizeof(word));
+        word = __builtin_bswap32(word);
+
+        unsigned length = lengths[data[offset] >> 4];
+        word >>= 8 * (4 - length);
+        codepoints[codepoint_count++] = _pext_u32(word, payloads[length]);
+    }
+
+    return codepoint_count;
+}
+
+
+// Returns how much of a valid block of the given size is made up of complete
+// characters, by looking back from the end for a lead byte whose sequence
+// doesn't fit
+static size_t
+complete_length(const byte *data, size_t size)
+{
+    for (size_t back = 1; back < UTF8_MAX_SEQUENCE; ++back)
+    {
+        byte b = data[size - back];
+        if (b < 0x80)
+        {
+            break;
+        }
+        if (b >= 0xc0)
+        {
+            size_t length = (b >= 0xf0) ? 4 : (b >= 0xe0) ? 3 : 2;
+            if (length > back)
+            {
+                return size - back;
+            }
+            break;
+        }
+    }
+
+    return size;
+}
+
+
+static size_t
+ascii_length_sse2(const char *data, size_t count)
+{
+    size_t offset = 0;
+    for (; count - offset >= 16; offset += 16)
+    {
+        __m128i block = _mm_loadu_si128(CAST(const __m128i *, data + offset));
+        unsigned mask = CAST(unsigned, _mm_movemask_epi8(block));
+        if (mask)
+        {
+            return offset + CAST(size_t, __builtin_ctz(mask));
+        }
+    }
+
+    offset += ascii_length_scalar(data + offset, count - offset);
+    return offset;
+}
+
+
+__attribute__((target("avx2")))
+static size_t
+ascii_length_avx2(const char *data, size_t count)
+{
+    size_t offset = 0;
+    for (; count - offset >= 32; offset += 32)
+    {
+        __m256i block = _mm256_loadu_si256(CAST(const __m256i *, data + offset));
+        unsigned mask = CAST(unsigned, _mm256_movemask_epi8(block));
+        if (mask)
+        {
+            return offset + CAST(size_t, __builtin_ctz(mask));
+        }
+    }
+
+    offset += ascii_length_sse2(data + offset, count - offset);
+    return offset;
+}
+
+
+// Validation follows Keiser and Lemire, "Validating UTF-8 In Less Than One
+// Instruction Per Byte". Every error shows up in the high nibble of a byte,
+// the low nibble of the byte before it or the high nibble of the byte itself,
+// so three table lookups and'ed together find all of the two byte errors. The
+// only thing they can't see is a sequence with too few or too many
+// continuation bytes, which is checked by comparing where the lookups expect
+// the third and fourth bytes of a sequence against where the lead bytes are.
+
+#define TOO_SHORT (1 << 0)
+#define TOO_LONG (1 << 1)
+#define OVERLONG_3 (1 << 2)
+#define TOO_LARGE (1 << 3)
+#define SURROGATE (1 << 4)
+#define OVERLONG_2 (1 << 5)
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4 (1 << 6)
+#define TWO_CONTINUATIONS (1 << 7)
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTINUATIONS)
+
+
+static const byte byte_1_high_errors[16] = {
+    // 0_______ ________
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+    // 10______ ________
+    TWO_CONTINUATIONS, TWO_CONTINUATIONS, TWO_CONTINUATIONS, TWO_CONTINUATIONS,
+    // 1100____ ________
+    TOO_SHORT | OVERLONG_2,
+    // 1101____ ________
+    TOO_SHORT,
+    // 1110____ ________
+    TOO_SHORT | OVERLONG_3 | SURROGATE,
+    // 1111____ ________
+    TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4,
+};
+
+static const byte byte_1_low_errors[16] = {
+    // ____0000 ________
+    CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+    // ____0001 ________
+    CARRY | OVERLONG_2,
+    // ____001_ ________
+    CARRY,
+    CARRY,
+    // ____0100 ________
+    CARRY | TOO_LARGE,
+    // ____0101 ________ and up
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    // ____1101 ________
+    CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+};
+
+static const byte byte_2_high_errors[16] = {
+    // ________ 0_______
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+    // ________ 1000____
+    TOO_LONG | OVERLONG_2 | TWO_CONTINUATIONS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+    // ________ 1001____
+    TOO_LONG | OVERLONG_2 | TWO_CONTINUATIONS | OVERLONG_3 | TOO_LARGE,
+    // ________ 101_____
+    TOO_LONG | OVERLONG_2 | TWO_CONTINUATIONS | SURROGATE | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTINUATIONS | SURROGATE | TOO_LARGE,
+    // ________ 11______
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+};
+
+
+__attribute__((target("avx2")))
+static __m256i
+lookup_nibbles(__m256i nibbles, const byte *table)
+{
+    __m128i entries = _mm_loadu_si128(CAST(const __m128i *, CAST(const void *, table)));
+    __m256i result = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(entries), nibbles);
+    return result;
+}
+
+
+// The bytes that came count bytes before each byte of block
+__attribute__((target("avx2")))
+static __m256i
+previous_bytes(__m256i block, __m256i previous_block, int count)
+{
+    __m256i straddle = _mm256_permute2x128_si256(previous_block, block, 0x21);
+
+    __m256i result;
+    switch (count)
+    {
+        case 1: result = _mm256_alignr_epi8(block, straddle, 15); break;
+        case 2: result = _mm256_alignr_epi8(block, straddle, 14); break;
+        default: result = _mm256_alignr_epi8(block, straddle, 13); break;
+    }
+
+    return result;
+}
+
+
+// Returns non-zero bytes where a block that starts on a character boundary is
+// invalid. A sequence cut off by the end of the block is not an error here.
+__attribute__((target("avx2")))
+static __m256i
+block_errors_avx2(__m256i block)
+{
+    const __m256i low_nibble = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+
+    __m256i previous1 = previous_bytes(block, zero, 1);
+    __m256i previous1_high = _mm256_and_si256(_mm256_srli_epi16(previous1, 4), low_nibble);
+    __m256i previous1_low = _mm256_and_si256(previous1, low_nibble);
+    __m256i block_high = _mm256_and_si256(_mm256_srli_epi16(block, 4), low_nibble);
+
+    __m256i byte_1_high = lookup_nibbles(previous1_high, byte_1_high_errors);
+    __m256i byte_1_low = lookup_nibbles(previous1_low, byte_1_low_errors);
+    __m256i byte_2_high = lookup_nibbles(block_high, byte_2_high_errors);
+
+    __m256i special_cases = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+
+    // Only a byte two after a lead byte of 1110____ or more, or three after
+    // one of 11110___, has to be the continuation byte the lookups flagged as
+    // two continuations in a row
+    __m256i previous2 = previous_bytes(block, zero, 2);
+    __m256i previous3 = previous_bytes(block, zero, 3);
+    __m256i third_byte = _mm256_subs_epu8(previous2, _mm256_set1_epi8(CAST(char, 0xe0 - 0x80)));
+    __m256i fourth_byte = _mm256_subs_epu8(previous3, _mm256_set1_epi8(CAST(char, 0xf0 - 0x80)));
+    __m256i must_continue = _mm256_and_si256(_mm256_or_si256(third_byte, fourth_byte),
+        _mm256_set1_epi8(CAST(char, 0x80)));
+
+    __m256i result = _mm256_xor_si256(must_continue, special_cases);
+    return result;
+}
+
+
+// Blocks that are all ASCII are widened. Anything else is validated as a
+// whole, and only blocks with an error in them go through the careful decoder.
+__attribute__((target("avx2,bmi,bmi2")))
+static size_t
+decode_avx2(const char *data, size_t count, uint32_t *codepoints, size_t *consumed)
+{
+    const byte *bytes = CAST(const byte *, data);
+
+    // Leaves room for decode_valid to read past the end of a block
+    size_t codepoint_count = 0;
+    size_t offset = 0;
+    while (count - offset >= 32 + UTF8_MAX_SEQUENCE - 1)
+    {
+        __m256i block = _mm256_loadu_si256(CAST(const __m256i *, data + offset));
+        if (!_mm256_movemask_epi8(block))
+        {
+            __m256i *out = CAST(__m256i *, CAST(void *, codepoints + codepoint_count));
+            for (int i = 0; i < 4; ++i)
+            {
+                __m128i eight = _mm_loadl_epi64(CAST(const __m128i *, data + offset + 8 * i));
+                _mm256_storeu_si256(out + i, _mm256_cvtepu8_epi32(eight));
+            }
+
+            codepoint_count += 32;
+            offset += 32;
+            continue;
+        }
+
+        __m256i errors = block_errors_avx2(block);
+        if (!_mm256_testz_si256(errors, errors))
+        {
+            size_t used;
+            codepoint_count += decode_scalar(data + offset, 32, codepoints + codepoint_count, &used);
+            offset += used;
+            continue;
+        }
+
+        // Every byte but a continuation byte starts a character
+        __m256i continuation = _mm256_cmpeq_epi8(_mm256_and_si256(block, _mm256_set1_epi8(CAST(char, 0xc0))),
+            _mm256_set1_epi8(CAST(char, 0x80)));
+        uint32_t starts = ~CAST(uint32_t, _mm256_movemask_epi8(continuation));
+
+        size_t length = complete_length(bytes + offset, 32);
+        if (length < 32)
+        {
+            starts &= (1u << length) - 1;
+        }
+        codepoint_count += decode_valid(bytes + offset, starts, codepoints + codepoint_count);
+        offset += length;
+    }
+
+    size_t used;
+    codepoint_count += decode_scalar(data + offset, count - offset, codepoints + codepoint_count, &used);
+    *consumed = offset + used;
+    return codepoint_count;
+}
+
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t
+ascii_length_avx512(const char *data, size_t count)
+{
+    size_t offset = 0;
+    for (; count - offset >= 64; offset += 64)
+    {
+        __m512i block = _mm512_loadu_si512(data + offset);
+        __mmask64 mask = _mm512_movepi8_mask(block);
+        if (mask)
+        {
+            return offset + CAST(size_t, __builtin_ctzll(mask));
+        }
+    }
+
+    offset += ascii_length_avx2(data + offset, count - offset);
+    return offset;
+}
+
+#endif
+
+
+Utf8AsciiFunction *utf8_ascii_length = ascii_length_scalar;
+Utf8DecodeFunction *utf8_decode = decode_scalar;
+
+
+ScanLevel
+utf8_init(ScanLevel max_level)
+{
+    ScanLevel level = SCAN_SCALAR;
+    utf8_ascii_length = ascii_length_scalar;
+    utf8_decode = decode_scalar;
+
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+
+    // SSE2 only finds runs of ASCII faster. Decoding with it was slower than
+    // the scalar decoder on text that isn't all ASCII, and the parser already
+    // writes runs of ASCII without decoding them.
+    if (max_level >= SCAN_SSE2)
+    {
+        level = SCAN_SSE2;
+        utf8_ascii_length = ascii_length_sse2;
+    }
+    if ((max_level >= SCAN_AVX2) && __builtin_cpu_supports("avx2")
+        && __builtin_cpu_supports("bmi") && __builtin_cpu_supports("bmi2"))
+    {
+        level = SCAN_AVX2;
+        utf8_ascii_length = ascii_length_avx2;
+        utf8_decode = decode_avx2;
+    }
+    // Decoding gains nothing from the wider registers, since validation works
+    // in 16 byte lanes either way
+    if ((max_level >= SCAN_AVX512) && __builtin_cpu_supports("avx512bw"))
+    {
+        level = SCAN_AVX512;
+        utf8_ascii_length = ascii_length_avx512;
+    }
+#else
+    (void)max_level;
+#endif
+
+    return level;
+}
+
+
+unsigned
+utf8_width(uint32_t codepoint)
+{
+    if (codepoint >= (ARRAY_COUNT(width_index) << WIDTH_BLOCK_SHIFT))
+    {
+        return 1;
+    }
+
+    unsigned block = width_index[codepoint >> WIDTH_BLOCK_SHIFT];
+    unsigned i = codepoint & ((1u << WIDTH_BLOCK_SHIFT) - 1);
+    unsigned result = (width_blocks[block][i / 4] >> ((i % 4) * 2)) & 3u;
+    return result;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "scan.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+#define UTF8_REPLACEMENT_CHARACTER 0xfffd
+
+// The longest encoded character
+#define UTF8_MAX_SEQUENCE 4
+
+
+// Returns how many bytes at the start of data are ASCII
+typedef size_t Utf8AsciiFunction(const char *data, size_t count);
+
+extern Utf8AsciiFunction *utf8_ascii_length;
+
+
+// Decodes data into at most count codepoints, returning how many there were.
+// Every invalid sequence becomes one U+FFFD, as Unicode recommends, so nothing
+// is dropped and no amount of garbage costs more than a byte at a time.
+//
+// A sequence that is cut off by the end of data is left alone, since the rest
+// of it could still arrive, and consumed is set to where it starts.
+typedef size_t Utf8DecodeFunction(const char *data, size_t count, uint32_t *codepoints, size_t *consumed);
+
+extern Utf8DecodeFunction *utf8_decode;
+
+
+// Selects the implementations the same way scan_init does
+ScanLevel utf8_init(ScanLevel max_level);
+
+// The number of cells a character takes up: 0, 1 or 2
+unsigned utf8_width(uint32_t codepoint);
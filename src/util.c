@@ -0,0 +1,127 @@
+#define _GNU_SOURCE // for clock_gettime
+
+#include "util.h"
+
+#include "assert.h"
+#include "types.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+size_t
+copy_string(char *dst, const char *src, size_t len)
+{
+    size_t count = 0;
+
+    for (; src[count] && (count < len); ++count)
+    {
+        dst[count] = src[count];
+    }
+    if (count < len)
+    {
+        dst[count] = 0;
+    }
+
+    return count;
+}
+
+
+unsigned
+minu(unsigned a, unsigned b)
+{
+    unsigned result = a < b ? a : b;
+    return result;
+}
+
+
+unsigned long long
+minull(unsigned long long a, unsigned long long b)
+{
+    unsigned long long result = a < b ? a : b;
+    return result;
+}
+
+
+#if 0
+int
+power_of_2s(long long v)
+{
+    int result = (v > 0) && (0 == (v & (v - 1)));
+
+    return result;
+}
+#endif
+
+
+int
+power_of_2u(unsigned long long v)
+{
+    int result = v && (0 == (v & (v - 1)));
+
+    return result;
+}
+
+
+unsigned
+alignu_down(unsigned value, unsigned align)
+{
+    unsigned result = value / align * align;
+
+    return result;
+}
+
+
+unsigned long long
+alignull_up2(unsigned long long value, unsigned long long align)
+{
+    ASSERT(power_of_2u(align));
+
+    unsigned long long mask = align - 1;
+
+    unsigned long long result = (value + mask) & ~mask;
+
+    return result;
+}
+
+
+uint64_t
+now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    uint64_t result = CAST(uint64_t, now.tv_sec) * 1000000000 + CAST(uint64_t, now.tv_nsec);
+    return result;
+}
+
+
+_Noreturn void
+error_exit(const char *message)
+{
+    fputs(message, stderr);
+    exit(EXIT_FAILURE);
+}
+
+
+#if 0
+_Noreturn void
+errorf_exit(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    exit(EXIT_FAILURE);
+}
+#endif
+
+
+_Noreturn void
+errno_exit(const char *msg)
+{
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+size_t copy_string(char *dst, const char *src, size_t len);
+
+unsigned minu(unsigned a, unsigned b);
+
+unsigned long long minull(unsigned long long a, unsigned long long b);
+
+int power_of_2u(unsigned long long v);
+
+unsigned alignu_down(unsigned value, unsigned align);
+
+unsigned long long alignull_up2(unsigned long long value, unsigned long long align);
+
+// CLOCK_MONOTONIC in nanoseconds
+uint64_t now_ns(void);
+
+_Noreturn void error_exit(const char *message);
+
+_Noreturn void errno_exit(const char *msg);
@@ -0,0 +1,113 @@
+// Writes the table of character widths used by utf8_width to stdout. This is
+// run by the build, so the C library's idea of widths is only consulted once,
+// on the build machine, rather than through wcwidth on every character.
+
+#define _XOPEN_SOURCE 700 // for wcwidth
+
+#include "types.h"
+
+#include <locale.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+
+#define CODEPOINT_COUNT 0x110000
+#define BLOCK_SHIFT 8
+#define BLOCK_SIZE (1 << BLOCK_SHIFT)
+#define BLOCK_COUNT (CODEPOINT_COUNT / BLOCK_SIZE)
+
+// Widths take 2 bits each
+#define BLOCK_BYTES (BLOCK_SIZE / 4)
+
+
+static unsigned
+width(uint32_t codepoint)
+{
+    // C1 controls take up no room. Anything else the library doesn't know,
+    // like unassigned characters, still gets a cell to draw a missing glyph in.
+    if ((codepoint >= 0x80) && (codepoint < 0xa0))
+    {
+        return 0;
+    }
+
+    int result = wcwidth(CAST(wchar_t, codepoint));
+    if (result < 0)
+    {
+        result = 1;
+    }
+    else if (result > 2)
+    {
+        result = 2;
+    }
+
+    return CAST(unsigned, result);
+}
+
+
+int
+main(void)
+{
+    if (!setlocale(LC_CTYPE, "C.UTF-8"))
+    {
+        fprintf(stderr, "width_gen: no C.UTF-8 locale\n");
+        return EXIT_FAILURE;
+    }
+
+    // Most blocks are all one width, so identical blocks are stored once
+    static byte blocks[BLOCK_COUNT][BLOCK_BYTES];
+    static unsigned index[BLOCK_COUNT];
+    unsigned block_count = 0;
+    for (unsigned block = 0; block < BLOCK_COUNT; ++block)
+    {
+        byte widths[BLOCK_BYTES] = { 0 };
+        for (unsigned i = 0; i < BLOCK_SIZE; ++i)
+        {
+            uint32_t codepoint = CAST(uint32_t, block * BLOCK_SIZE + i);
+            widths[i / 4] = CAST(byte, widths[i / 4] | (width(codepoint) << ((i % 4) * 2)));
+        }
+
+        unsigned match = 0;
+        while ((match < block_count) && memcmp(blocks[match], widths, sizeof(widths)))
+        {
+            ++match;
+        }
+        if (match == block_count)
+        {
+            memcpy(blocks[block_count++], widths, sizeof(widths));
+        }
+        index[block] = match;
+    }
+
+    if (block_count > 256)
+    {
+        fprintf(stderr, "width_gen: %u distinct blocks don't fit a byte index\n", block_count);
+        return EXIT_FAILURE;
+    }
+
+    printf("// Generated by width_gen.c. Do not edit.\n\n");
+    printf("#define WIDTH_BLOCK_SHIFT %d\n\n", BLOCK_SHIFT);
+
+    printf("static const byte width_index[%d] = {", BLOCK_COUNT);
+    for (unsigned block = 0; block < BLOCK_COUNT; ++block)
+    {
+        printf("%s%u,", (block % 16) ? " " : "\n    ", index[block]);
+    }
+    printf("\n};\n\n");
+
+    printf("static const byte width_blocks[%u][%d] = {\n", block_count, BLOCK_BYTES);
+    for (unsigned block = 0; block < block_count; ++block)
+    {
+        printf("    {");
+        for (unsigned i = 0; i < BLOCK_BYTES; ++i)
+        {
+            printf("%s0x%02x,", (i % 16) ? " " : "\n        ", blocks[block][i]);
+        }
+        printf("\n    },\n");
+    }
+    printf("};\n");
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,824 @@
+#include "xlib.h"
+
+#include "assert.h"
+#include "types.h"
+#include "util.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/shm.h>
+
+
+Atom WM_PROTOCOLS;
+Atom WM_DELETE_WINDOW;
+Atom UTF8_STRING;
+Atom INCR;
+Atom NULLREF_PASTE;
+
+
+static XRenderColor
+xlib_rgba_bytes(unsigned char r, unsigned char g, unsigned char b, unsigned char a)
+{
+    XRenderColor result = {
+        .red = r * EXPR_MAX(result.red) / EXPR_MAX(r),
+        .green = g * EXPR_MAX(result.green) / EXPR_MAX(g),
+        .blue = b * EXPR_MAX(result.blue) / EXPR_MAX(b),
+        .alpha = a * EXPR_MAX(result.alpha) / EXPR_MAX(a),
+    };
+
+    _Static_assert(EXPR_MAX(result.red) <= (INT_MAX / EXPR_MAX(r)), "Integer overflow");
+    _Static_assert(EXPR_MAX(result.blue) <= (INT_MAX / EXPR_MAX(g)), "Integer overflow");
+    _Static_assert(EXPR_MAX(result.green) <= (INT_MAX / EXPR_MAX(b)), "Integer overflow");
+    _Static_assert(EXPR_MAX(result.alpha) <= (INT_MAX / EXPR_MAX(a)), "Integer overflow");
+
+    return result;
+}
+
+
+#if 0
+static XRenderColor
+xlib_rgba_floats(float r, float g, float b, float a)
+{
+    ASSERT(r >= 0 && r <= 1);
+    ASSERT(g >= 0 && g <= 1);
+    ASSERT(b >= 0 && b <= 1);
+    ASSERT(a >= 0 && a <= 1);
+
+    XRenderColor result = {
+        .red = CAST(unsigned short, (r * EXPR_MAX(result.red)) + .5),
+        .green = CAST(unsigned short, (g * EXPR_MAX(result.blue)) + .5),
+        .blue = CAST(unsigned short, (b * EXPR_MAX(result.green)) + .5),
+        .alpha = CAST(unsigned short, (a * EXPR_MAX(result.alpha)) + .5),
+    };
+
+    return result;
+}
+#endif
+
+
+void
+xlib_set_title(Display *display, Window window, char *title)
+{
+    XTextProperty wm_name;
+    if (Xutf8TextListToTextProperty(display, &title, 1, XUTF8StringStyle, &wm_name) == Success)
+    {
+        XSetWMName(display, window, &wm_name);
+        XFree(wm_name.value);
+    }
+}
+
+
+void
+xlib_send_key(XlibConnection *connection, KeySym keysym)
+{
+    Display *display = connection->display;
+    XEvent event = {
+        .xkey = {
+            .type = KeyPress,
+            .display = display,
+            .window = connection->window,
+            .root = DefaultRootWindow(display),
+            .subwindow = None,
+            .time = CurrentTime,
+            .same_screen = True,
+            .keycode = XKeysymToKeycode(display, keysym),
+        },
+    };
+    XSendEvent(display, connection->window, False, KeyPressMask, &event);
+    XFlush(display);
+}
+
+
+void
+xlib_request_paste(Display *display, Window window, Atom selection)
+{
+    XConvertSelection(display, selection, UTF8_STRING, NULLREF_PASTE, window, CurrentTime);
+}
+
+
+// The framebuffer is filled in as 0x00RRGGBB pixels, so the server has to
+// have the extension and a visual that reads them the same way
+static int
+shm_supported(Display *display, int screen)
+{
+    Visual *visual = DefaultVisual(display, screen);
+    int result = XShmQueryExtension(display)
+        && (visual->class == TrueColor)
+        && (DefaultDepth(display, screen) >= 24)
+        && (visual->red_mask == 0xff0000) && (visual->green_mask == 0xff00) && (visual->blue_mask == 0xff);
+
+    return result;
+}
+
+
+// The same resolution Xft sizes its fonts for
+static double
+screen_dpi(Display *display, int screen)
+{
+    char *value = XGetDefault(display, "Xft", "dpi");
+    double result = value ? strtod(value, nullptr) : 0;
+    if ((result <= 0) && DisplayHeightMM(display, screen))
+    {
+        result = DisplayHeight(display, screen) * 25.4 / DisplayHeightMM(display, screen);
+    }
+
+    return result;
+}
+
+
+// Everything needed to draw into the window once the connection, the window
+// and the fonts are there
+static void
+create_drawing(XlibConnection *connection)
+{
+    Display *display = connection->display;
+    Window window = connection->window;
+    int screen = DefaultScreen(display);
+
+    arena_create(&connection->scratch, XLIB_SCRATCH_RESERVE);
+    connection->draw = nullptr;
+    connection->gc = nullptr;
+    connection->image = nullptr;
+    connection->shm_completion = 0;
+    connection->put_pending = 0;
+    connection->draw_deferred = 0;
+    connection->copies_pending = 0;
+    connection->exposed = (RasterRect){ 0 };
+    connection->overlay = nullptr;
+    connection->overlay_cols = 0;
+    connection->width = 0;
+    connection->height = 0;
+    connection->cursor = (DrawnCursor){ 0 };
+
+    // Xft copies the window onto itself with the GC when the screen scrolls,
+    // and MIT-SHM puts the image with it
+    connection->gc = XCreateGC(display, window, 0, nullptr);
+    if (connection->renderer == XLIB_RENDER_SHM)
+    {
+        connection->shm_completion = XShmGetEventBase(display) + ShmCompletion;
+    }
+    else
+    {
+        connection->draw = XftDrawCreate(display, window, DefaultVisual(display, screen),
+            DefaultColormap(display, screen));
+    }
+}
+
+
+void
+xlib_window_create(XlibConnection *connection, XlibRenderer renderer)
+{
+    Display *display = XOpenDisplay(0);
+    if (!display)
+    {
+        error_exit("xlib_window_create:XOpenDisplay");
+    }
+
+    int screen = DefaultScreen(display);
+    unsigned screen_width = CAST(unsigned, DisplayWidth(display, screen));
+    unsigned screen_height = CAST(unsigned, DisplayHeight(display, screen));
+
+    if ((renderer == XLIB_RENDER_SHM) && !shm_supported(display, screen))
+    {
+        fputs("MIT-SHM or a 24-bit TrueColor visual isn't available, drawing with Xft instead\n", stderr);
+        renderer = XLIB_RENDER_XFT;
+    }
+
+    XftFont *font = nullptr;
+    unsigned font_width;
+    unsigned font_height;
+    if (renderer == XLIB_RENDER_SHM)
+    {
+        GlyphAtlas *atlas = &connection->atlas;
+        glyph_atlas_create(atlas, "mono", screen_dpi(display, screen));
+        printf("Font: width: %u, height: %u, ascent: %u\n", atlas->cell_width, atlas->cell_height, atlas->ascent);
+
+        font_width = atlas->cell_width;
+        font_height = atlas->cell_height;
+    }
+    else
+    {
+        glyph_cache_create(&connection->glyphs, display, screen, "mono");
+        font = connection->glyphs.faces[GLYPH_REGULAR];
+        printf("Font: width: %d, height: %d, ascent: %d, descent: %d\n",
+            font->max_advance_width, font->height, font->ascent, font->descent);
+
+        font_width = CAST(unsigned, font->max_advance_width);
+        font_height = CAST(unsigned, font->height);
+    }
+
+    unsigned cols = 80;
+    unsigned rows = 25;
+
+    unsigned window_width = font_width * cols;
+    if (window_width > screen_width)
+    {
+        window_width = alignu_down(screen_width, font_width);
+        cols = window_width / font_width;
+    }
+
+    unsigned window_height = font_height * rows;
+    if (window_height > screen_height)
+    {
+        window_height = alignu_down(screen_height, font_height);
+        rows = window_height / font_height;
+    }
+
+    Window parent = RootWindow(display, screen);
+    int window_x = CAST(int, (screen_width - window_width) / 2);
+    int window_y = CAST(int, (screen_height - window_height) / 2);
+    unsigned border_width = 0;
+
+    int color_depth = CopyFromParent;
+    unsigned int window_class = InputOutput;
+    Visual *visual = DefaultVisual(display, screen);
+
+    unsigned long attribute_mask = CWBackPixel | CWEventMask;
+    XSetWindowAttributes attributes = {
+        .background_pixel = BlackPixel(display, screen),
+        .event_mask = ExposureMask | KeyPressMask | ButtonPressMask | PropertyChangeMask | StructureNotifyMask,
+    };
+
+    Window window = XCreateWindow(
+            display, parent,
+            window_x, window_y, window_width, window_height, border_width,
+            color_depth, window_class, visual,
+            attribute_mask, &attributes);
+
+    xlib_set_title(display, window, "Terminal");
+
+    XWMHints *wm_hints = XAllocWMHints();
+    if (wm_hints)
+    {
+        wm_hints->flags = InputHint | StateHint;
+        wm_hints->input = True;
+        wm_hints->initial_state = NormalState;
+        XSetWMHints(display, window, wm_hints);
+        XFree(wm_hints);
+    }
+    else
+    {
+        error_exit("xlib_window_create:XAllocWMHints");
+    }
+
+    XSizeHints *wm_normal_hints = XAllocSizeHints();
+    if (wm_normal_hints)
+    {
+        wm_normal_hints->flags = PPosition | PSize;
+        XSetWMNormalHints(display, window, wm_normal_hints);
+        XFree(wm_normal_hints);
+    }
+    else
+    {
+        error_exit("xlib_window_create:XAllocSizeHints");
+    }
+
+    XClassHint *wm_class = XAllocClassHint();
+    if (wm_class)
+    {
+        wm_class->res_name = "terminal";
+        wm_class->res_class = "Terminal Emulator";
+        XSetClassHint(display, window, wm_class);
+        XFree(wm_class);
+    }
+    else
+    {
+        error_exit("xlib_window_create:XAllocClassHint");
+    }
+
+    WM_PROTOCOLS = XInternAtom(display, "WM_PROTOCOLS", False);
+    if (!WM_PROTOCOLS)
+    {
+        error_exit("xlib_window_create:XInternAtom WM_PROTOCOLS");
+    }
+    WM_DELETE_WINDOW = XInternAtom(display, "WM_DELETE_WINDOW", False);
+    if (!WM_DELETE_WINDOW)
+    {
+        error_exit("xlib_window_create:XInternAtom WM_DELETE_WINDOW");
+    }
+    if (!XSetWMProtocols(display, window, &WM_DELETE_WINDOW, 1))
+    {
+        error_exit("xlib_window_create:XSetWmProtocols");
+    }
+    UTF8_STRING = XInternAtom(display, "UTF8_STRING", False);
+    INCR = XInternAtom(display, "INCR", False);
+    NULLREF_PASTE = XInternAtom(display, "NULLREF_PASTE", False);
+    if (!UTF8_STRING || !INCR || !NULLREF_PASTE)
+    {
+        error_exit("xlib_window_create:XInternAtom");
+    }
+
+    XMapWindow(display, window);
+
+    connection->display = display;
+    connection->window = window;
+    connection->fd = ConnectionNumber(display);
+    connection->renderer = renderer;
+    connection->cell_width = font_width;
+    connection->cell_height = font_height;
+    connection->font = font;
+    connection->paste_incremental = 0;
+    create_drawing(connection);
+}
+
+
+void
+xlib_renderer_create(XlibConnection *connection, XlibConnection *window_connection)
+{
+    // The window has to be on the server before another connection can draw
+    // into it
+    XSync(window_connection->display, False);
+
+    Display *display = XOpenDisplay(0);
+    if (!display)
+    {
+        error_exit("xlib_renderer_create:XOpenDisplay");
+    }
+
+    // The atlas is only ever touched by whoever draws, so it changes hands.
+    // Xft fonts belong to a connection, so they're opened again.
+    XlibRenderer renderer = window_connection->renderer;
+    XftFont *font = nullptr;
+    if (renderer == XLIB_RENDER_SHM)
+    {
+        connection->atlas = window_connection->atlas;
+    }
+    else
+    {
+        glyph_cache_create(&connection->glyphs, display, DefaultScreen(display), "mono");
+        font = connection->glyphs.faces[GLYPH_REGULAR];
+    }
+
+    connection->display = display;
+    connection->window = window_connection->window;
+    connection->fd = ConnectionNumber(display);
+    connection->renderer = renderer;
+    connection->cell_width = window_connection->cell_width;
+    connection->cell_height = window_connection->cell_height;
+    connection->font = font;
+    connection->paste_incremental = 0;
+    create_drawing(connection);
+
+    if (window_connection->gc)
+    {
+        XFreeGC(window_connection->display, window_connection->gc);
+        window_connection->gc = nullptr;
+    }
+    if (window_connection->draw)
+    {
+        XftDrawDestroy(window_connection->draw);
+        window_connection->draw = nullptr;
+    }
+    window_connection->renderer = XLIB_RENDER_NONE;
+}
+
+
+static void
+destroy_image(XlibConnection *connection)
+{
+    if (connection->image)
+    {
+        XShmDetach(connection->display, &connection->shm);
+
+        // The pixels aren't XDestroyImage's to free
+        connection->image->data = nullptr;
+        XDestroyImage(connection->image);
+        shmdt(connection->shm.shmaddr);
+
+        connection->image = nullptr;
+        connection->framebuffer = (Framebuffer){ 0 };
+    }
+}
+
+
+static void
+create_image(XlibConnection *connection, unsigned width, unsigned height)
+{
+    Display *display = connection->display;
+    int screen = DefaultScreen(display);
+    XShmSegmentInfo *shm = &connection->shm;
+
+    XImage *image = XShmCreateImage(
+        display, DefaultVisual(display, screen), CAST(unsigned, DefaultDepth(display, screen)),
+        ZPixmap, nullptr, shm, width, height);
+    if (!image || (image->bits_per_pixel != 32) || (image->byte_order != LSBFirst))
+    {
+        error_exit("create_image:XShmCreateImage");
+    }
+
+    shm->shmid = shmget(IPC_PRIVATE, CAST(size_t, image->bytes_per_line) * height, IPC_CREAT | 0600);
+    if (shm->shmid == -1)
+    {
+        errno_exit("create_image:shmget");
+    }
+    shm->shmaddr = image->data = shmat(shm->shmid, nullptr, 0);
+    if (shm->shmaddr == CAST(char *, -1))
+    {
+        errno_exit("create_image:shmat");
+    }
+    shm->readOnly = False;
+    if (!XShmAttach(display, shm))
+    {
+        error_exit("create_image:XShmAttach");
+    }
+
+    // Once the server has attached too, the segment can be marked for removal
+    // so it goes away with us however we exit
+    XSync(display, False);
+    shmctl(shm->shmid, IPC_RMID, nullptr);
+
+    connection->image = image;
+    connection->framebuffer = (Framebuffer){
+        .width = width,
+        .height = height,
+        .stride = CAST(size_t, image->bytes_per_line) / sizeof(uint32_t),
+        .pixels = CAST(uint32_t *, CAST(void *, image->data)),
+    };
+    framebuffer_clear(&connection->framebuffer);
+}
+
+
+void
+xlib_resize(XlibConnection *connection, unsigned width, unsigned height)
+{
+    connection->width = CAST(unsigned short, width);
+    connection->height = CAST(unsigned short, height);
+
+    if (connection->renderer == XLIB_RENDER_SHM)
+    {
+        destroy_image(connection);
+        if (width && height)
+        {
+            create_image(connection, width, height);
+        }
+
+        // All of it has to be put, not just the cells, since the image starts
+        // out blank
+        connection->exposed = (RasterRect){ 0, 0, width, height };
+        connection->cursor.drawn = 0;
+    }
+}
+
+
+int
+xlib_shm_completed(XlibConnection *connection, TerminalScreen *screen, XEvent *event)
+{
+    if ((connection->renderer != XLIB_RENDER_SHM) || (event->type != connection->shm_completion))
+    {
+        return 0;
+    }
+
+    connection->put_pending = 0;
+    if (connection->draw_deferred)
+    {
+        draw_buffer(connection, screen);
+    }
+
+    return 1;
+}
+
+
+static XftColor
+xlib_color(XlibConnection *connection, uint32_t rgb)
+{
+    XRenderColor value = xlib_rgba_bytes(
+        CAST(unsigned char, rgb >> 16), CAST(unsigned char, rgb >> 8), CAST(unsigned char, rgb), 255);
+
+    // On the TrueColor visuals we run on this only packs the value into a
+    // pixel, so there's no round trip and nothing to free afterwards
+    int screen = DefaultScreen(connection->display);
+    XftColor result;
+    XftColorAllocValue(
+        connection->display, DefaultVisual(connection->display, screen),
+        DefaultColormap(connection->display, screen), &value, &result);
+
+    return result;
+}
+
+
+// Draws a run of cells that all share the same colors and style with at most
+// one request for the background, one for all the glyphs and one for each
+// line through them
+static void
+draw_cells(
+    XlibConnection *connection, unsigned x, unsigned y, ScreenCell *cells, unsigned count,
+    uint32_t foreground, uint32_t background, uint32_t style)
+{
+    XftFont *font = connection->font;
+    int cell_width = font->max_advance_width;
+    int x_pos = CAST(int, x) * cell_width;
+    int y_pos = CAST(int, y) * font->height;
+    unsigned width = count * CAST(unsigned, cell_width);
+    unsigned height = CAST(unsigned, font->height);
+
+    // The window was just cleared to the default background
+    if (background != DEFAULT_BACKGROUND_RGB)
+    {
+        XftColor color = xlib_color(connection, background);
+        XftDrawRect(connection->draw, &color, x_pos, y_pos, width, height);
+    }
+
+    if (foreground == background)
+    {
+        return;
+    }
+
+    size_t mark = connection->scratch.used;
+    XftGlyphFontSpec *specs = arena_push(&connection->scratch, count * sizeof(*specs));
+
+    GlyphFace face = glyph_face(style);
+    int baseline = y_pos + font->ascent;
+    int spec_count = 0;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        if (cells[i].codepoint != ' ')
+        {
+            CachedGlyph *glyph = glyph_cache_lookup(&connection->glyphs, cells[i].codepoint, face);
+            XftGlyphFontSpec *spec = specs + spec_count++;
+            spec->font = glyph->font;
+            spec->glyph = glyph->glyph;
+            spec->x = CAST(short, x_pos + CAST(int, i) * cell_width);
+            spec->y = CAST(short, baseline);
+        }
+    }
+
+    XftColor color = xlib_color(connection, foreground);
+    if (spec_count)
+    {
+        XftDrawGlyphFontSpec(connection->draw, &color, specs, spec_count);
+    }
+    arena_pop_to(&connection->scratch, mark);
+    if (style & STYLE_UNDERLINE)
+    {
+        XftDrawRect(connection->draw, &color, x_pos, baseline + 1, width, 1);
+    }
+    if (style & STYLE_STRIKETHROUGH)
+    {
+        XftDrawRect(connection->draw, &color, x_pos, baseline - font->ascent / 3, width, 1);
+    }
+}
+
+
+// Marks the cells under a rectangle of the window, so the next draw_buffer
+// repaints them
+void
+xlib_damage_rect(XlibConnection *x_connection, TerminalScreen *screen, int x, int y, int width, int height)
+{
+    // The image still has what was last drawn, which only has to be put again
+    if (x_connection->renderer == XLIB_RENDER_SHM)
+    {
+        Framebuffer *framebuffer = &x_connection->framebuffer;
+        if ((x >= 0) && (y >= 0) && (CAST(unsigned, x) < framebuffer->width) && (CAST(unsigned, y) < framebuffer->height))
+        {
+            raster_add_rect(&x_connection->exposed, CAST(unsigned, x), CAST(unsigned, y),
+                minu(CAST(unsigned, width), framebuffer->width - CAST(unsigned, x)),
+                minu(CAST(unsigned, height), framebuffer->height - CAST(unsigned, y)));
+        }
+        return;
+    }
+
+    // Where the cells under it end up is only known to whoever draws next,
+    // once it moved what's in the window along with the rows that scrolled.
+    // That rarely happens, so everything is drawn again instead.
+    if ((x_connection->renderer == XLIB_RENDER_NONE) || screen->scroll)
+    {
+        screen_damage_all(screen);
+        return;
+    }
+
+    int cell_width = CAST(int, x_connection->cell_width);
+    int cell_height = CAST(int, x_connection->cell_height);
+
+    // The parts of the window past the last cell are only ever background,
+    // which the server already painted
+    int first_col = x / cell_width;
+    int first_row = y / cell_height;
+    int end_col = (x + width + cell_width - 1) / cell_width;
+    int end_row = (y + height + cell_height - 1) / cell_height;
+    if (end_col > CAST(int, screen->cols))
+    {
+        end_col = CAST(int, screen->cols);
+    }
+    if (end_row > CAST(int, screen->rows))
+    {
+        end_row = CAST(int, screen->rows);
+    }
+
+    for (int row = first_row; row < end_row; ++row)
+    {
+        if (first_col < end_col)
+        {
+            screen_damage(screen, CAST(unsigned, first_col), CAST(unsigned, row), CAST(unsigned, end_col - first_col));
+        }
+    }
+}
+
+
+int
+xlib_copy_exposed(XlibConnection *x_connection, TerminalScreen *screen, XEvent *event)
+{
+    if (event->type == NoExpose)
+    {
+        --x_connection->copies_pending;
+        return 0;
+    }
+
+    // Parts of the window that weren't there to be copied, which a later copy
+    // may have moved somewhere else already
+    XGraphicsExposeEvent *expose = &event->xgraphicsexpose;
+    if (x_connection->copies_pending > 1)
+    {
+        screen_damage_all(screen);
+    }
+    else
+    {
+        xlib_damage_rect(x_connection, screen, expose->x, expose->y, expose->width, expose->height);
+    }
+    if (!expose->count)
+    {
+        --x_connection->copies_pending;
+    }
+
+    return 1;
+}
+
+
+// Moves what's in the window along with the rows that scrolled, so only the
+// rows that came in have to be drawn. Whatever wasn't in the window to be
+// copied comes back as GraphicsExpose.
+static void
+copy_scrolled(XlibConnection *x_connection, TerminalScreen *screen, int scroll)
+{
+    unsigned cell_height = x_connection->cell_height;
+    unsigned shift = CAST(unsigned, abs(scroll)) * cell_height;
+    unsigned height = screen->rows * cell_height - shift;
+    if (!x_connection->width)
+    {
+        return;
+    }
+
+    int from = (scroll > 0) ? CAST(int, shift) : 0;
+    int to = (scroll > 0) ? 0 : CAST(int, shift);
+    XCopyArea(x_connection->display, x_connection->window, x_connection->window, x_connection->gc,
+        0, from, x_connection->width, height, 0, to);
+    ++x_connection->copies_pending;
+}
+
+
+static size_t
+overlay_length(XlibConnection *x_connection)
+{
+    size_t result = x_connection->overlay ? strlen(x_connection->overlay) : 0;
+    return result;
+}
+
+
+static void
+xft_draw_buffer(XlibConnection *x_connection, TerminalScreen *screen)
+{
+    unsigned cell_width = x_connection->cell_width;
+    unsigned cell_height = x_connection->cell_height;
+    unsigned visible_cols = x_connection->width / cell_width;
+    unsigned cols = minu(screen->cols, visible_cols + 1);
+
+    int scroll = screen_take_scroll(screen, &x_connection->cursor, x_connection->overlay_cols);
+    if (scroll)
+    {
+        copy_scrolled(x_connection, screen, scroll);
+    }
+
+    // The cell the cursor was drawn over has to be put back if the cursor
+    // moved away from it, and the new one drawn over
+    int cursor_visible = screen_damage_cursor(screen, &x_connection->cursor, cols);
+    unsigned overlay_col = screen_damage_overlay(screen, &x_connection->overlay_cols, overlay_length(x_connection));
+
+    int cursor_damaged = 0;
+    for (unsigned y = 0; y < screen->rows; ++y)
+    {
+        ScreenSpan span;
+        if (!screen_damaged_span(screen, y, cols, &span))
+        {
+            continue;
+        }
+
+        if ((y == screen->cursor_y) && (screen->cursor_x >= span.first) && (screen->cursor_x < span.end))
+        {
+            cursor_damaged = 1;
+        }
+
+        // A span that reaches the last column also clears whatever partial
+        // cell is left past it, which a width of 0 does
+        unsigned clear_width = (span.end == screen->cols) ? 0 : (span.end - span.first) * cell_width;
+        XClearArea(x_connection->display, x_connection->window,
+            CAST(int, span.first * cell_width), CAST(int, y * cell_height),
+            clear_width, cell_height, False);
+
+        for (unsigned x = span.first; x < span.row_end; )
+        {
+            unsigned count = CAST(unsigned, screen_run_length(span.row + x, span.row_end - x));
+
+            ScreenAttribute *attribute = span.attributes + span.row[x].attribute;
+            uint32_t foreground, background;
+            screen_resolve_colors(attribute, &foreground, &background);
+            draw_cells(x_connection, x, y, span.row + x, count, foreground, background, attribute->style);
+
+            x += count;
+        }
+    }
+    screen_clear_damage(screen);
+
+    if (cursor_visible && cursor_damaged)
+    {
+        ScreenCell *cell = screen_row(screen, screen->cursor_y) + screen->cursor_x;
+        ScreenAttribute *attribute = screen->attributes + cell->attribute;
+        uint32_t foreground, background;
+        screen_resolve_colors(attribute, &foreground, &background);
+        if (foreground == background)
+        {
+            foreground = DEFAULT_FOREGROUND_RGB;
+            background = DEFAULT_BACKGROUND_RGB;
+        }
+        draw_cells(x_connection, screen->cursor_x, screen->cursor_y, cell, 1,
+            background, foreground, attribute->style & ~CAST(uint32_t, STYLE_INVISIBLE));
+    }
+
+    if (x_connection->overlay_cols)
+    {
+        ScreenCell cells[256];
+        unsigned count = minu(x_connection->overlay_cols, ARRAY_COUNT(cells));
+        for (unsigned i = 0; i < count; ++i)
+        {
+            cells[i] = (ScreenCell){ .codepoint = CAST(byte, x_connection->overlay[i]) };
+        }
+        draw_cells(x_connection, overlay_col, 0, cells, count, DEFAULT_BACKGROUND_RGB, DEFAULT_FOREGROUND_RGB, 0);
+    }
+
+    screen_cursor_drawn(screen, &x_connection->cursor, cursor_visible);
+}
+
+
+// Draws into the shared image and has the server copy everything that changed
+// to the window with a single request
+static void
+shm_draw_buffer(XlibConnection *x_connection, TerminalScreen *screen)
+{
+    if (!x_connection->image)
+    {
+        return;
+    }
+    if (x_connection->put_pending)
+    {
+        x_connection->draw_deferred = 1;
+        return;
+    }
+    x_connection->draw_deferred = 0;
+
+    // The image is what's in the window, so it's moved instead, and put along
+    // with everything else that changed
+    RasterRect moved;
+    raster_scroll(&x_connection->framebuffer, &x_connection->atlas, screen, &x_connection->cursor,
+        x_connection->overlay_cols, &moved);
+
+    unsigned overlay_col = screen_damage_overlay(screen, &x_connection->overlay_cols, overlay_length(x_connection));
+
+    RasterRect changed;
+    raster_draw_buffer(&x_connection->framebuffer, &x_connection->atlas, screen, &x_connection->cursor, &changed);
+    raster_add_rect(&changed, moved.x, moved.y, moved.width, moved.height);
+    if (x_connection->overlay_cols)
+    {
+        raster_draw_text(&x_connection->framebuffer, &x_connection->atlas, overlay_col, 0,
+            x_connection->overlay, x_connection->overlay_cols, &changed);
+    }
+
+    RasterRect *exposed = &x_connection->exposed;
+    raster_add_rect(&changed, exposed->x, exposed->y, exposed->width, exposed->height);
+    *exposed = (RasterRect){ 0 };
+
+    if (changed.width)
+    {
+        XShmPutImage(x_connection->display, x_connection->window, x_connection->gc, x_connection->image,
+            CAST(int, changed.x), CAST(int, changed.y), CAST(int, changed.x), CAST(int, changed.y),
+            changed.width, changed.height, True);
+        x_connection->put_pending = 1;
+    }
+}
+
+
+// Repaints only the cells damaged since the last call
+void
+draw_buffer(XlibConnection *x_connection, TerminalScreen *screen)
+{
+    ASSERT(x_connection->renderer != XLIB_RENDER_NONE);
+
+    arena_reset(&x_connection->scratch);
+    if (x_connection->renderer == XLIB_RENDER_SHM)
+    {
+        shm_draw_buffer(x_connection, screen);
+    }
+    else
+    {
+        xft_draw_buffer(x_connection, screen);
+    }
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "arena.h"
+#include "glyph_cache.h"
+#include "raster.h"
+#include "screen.h"
+
+#include <X11/Xatom.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/Xft/Xft.h>
+#include <X11/extensions/XShm.h>
+
+
+#define XLIB_SCRATCH_RESERVE (64 * 1024 * 1024)
+
+
+typedef enum XlibRenderer
+{
+    // Glyphs are drawn by the server through Xft
+    XLIB_RENDER_XFT,
+
+    // Cells are drawn into an image shared with the server through MIT-SHM,
+    // which only has to be told which part of it to copy to the window
+    XLIB_RENDER_SHM,
+
+    // Nothing is drawn through this connection. Another one draws into its
+    // window.
+    XLIB_RENDER_NONE,
+} XlibRenderer;
+
+
+typedef struct XlibConnection
+{
+    Display *display;
+    Window window;
+    int fd;
+
+    XlibRenderer renderer;
+    unsigned cell_width;
+    unsigned cell_height;
+
+    XftDraw *draw;
+    XftFont *font;
+    GlyphCache glyphs;
+
+    // Whatever a frame needs only while it's drawn, reset before each one
+    MemoryArena scratch;
+
+    GC gc;
+    XImage *image;
+    XShmSegmentInfo shm;
+    Framebuffer framebuffer;
+    GlyphAtlas atlas;
+
+    // The server reads the image after XShmPutImage returns, so it mustn't be
+    // drawn into again until the server says it's done with it. Frames asked
+    // for until then are drawn once it is.
+    int shm_completion;
+    int put_pending;
+    int draw_deferred;
+
+    // Copies of the window onto itself that the server hasn't answered with
+    // NoExpose or the last GraphicsExpose yet
+    int copies_pending;
+
+    // Drawn over the top right corner if set
+    const char *overlay;
+    unsigned overlay_cols;
+
+    // Parts of the window to copy from the image again on the next draw,
+    // which don't need anything redrawn
+    RasterRect exposed;
+
+    unsigned short width;
+    unsigned short height;
+
+    // Where the cursor was last drawn, so it can be erased when it moves
+    DrawnCursor cursor;
+
+    // Set while a large selection arrives a piece at a time through the INCR
+    // protocol
+    int paste_incremental;
+} XlibConnection;
+
+
+extern Atom WM_PROTOCOLS;
+extern Atom WM_DELETE_WINDOW;
+extern Atom UTF8_STRING;
+extern Atom INCR;
+
+// The property on the window the selection is pasted through
+extern Atom NULLREF_PASTE;
+
+
+void xlib_set_title(Display *display, Window window, char *title);
+
+// Sends a key press to the window through the server, so it arrives the same
+// way one from the keyboard would
+void xlib_send_key(XlibConnection *connection, KeySym keysym);
+
+// Asks the owner of the selection to send it over
+void xlib_request_paste(Display *display, Window window, Atom selection);
+
+void xlib_window_create(XlibConnection *connection, XlibRenderer renderer);
+
+// Opens a connection of its own to draw into the window of another one, for a
+// thread that does nothing but draw. The other connection only handles input
+// from then on.
+void xlib_renderer_create(XlibConnection *connection, XlibConnection *window_connection);
+
+// Called with the new size of the window
+void xlib_resize(XlibConnection *connection, unsigned width, unsigned height);
+
+// Returns whether the event was the server finishing with the shared image,
+// drawing any frame that had to wait for it
+int xlib_shm_completed(XlibConnection *connection, TerminalScreen *screen, XEvent *event);
+
+void xlib_damage_rect(XlibConnection *x_connection, TerminalScreen *screen, int x, int y, int width, int height);
+
+// Handles GraphicsExpose and NoExpose, which the server answers each copy of
+// the window onto itself with. Returns whether anything was damaged.
+int xlib_copy_exposed(XlibConnection *x_connection, TerminalScreen *screen, XEvent *event);
+
+void draw_buffer(XlibConnection *x_connection, TerminalScreen *screen);